@@ -0,0 +1,124 @@
+// Connections/sec of the two accept designs:
+//   pool      - one EventLoop thread accepts and hands every socket to a WorkerPool
+//   reuseport - N pinned EventLoops, each accepting on its own SO_REUSEPORT socket and
+//               handling the connection inline
+// Each client thread repeatedly connects, reads a tiny response and closes, so the
+// server side cost is accept + dispatch + write + close.
+
+#include "bench_util.hpp"
+#include "core/event_loop.hpp"
+#include "core/event_loop_group.hpp"
+#include "core/listener.hpp"
+#include "core/worker_pool.hpp"
+#include <atomic>
+#include <csignal>
+#include <thread>
+
+namespace {
+
+const char kResponse[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+
+void respondAndClose(int client_fd) {
+    ssize_t n = ::write(client_fd, kResponse, sizeof(kResponse) - 1);
+    (void)n;
+    close(client_fd);
+}
+
+// Runs clients against the port for the given duration and returns completed connections.
+uint64_t driveClients(int port, size_t num_clients, double seconds) {
+    std::atomic<uint64_t> completed{0};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < num_clients; ++i) {
+        clients.emplace_back([&] {
+            char buf[256];
+            uint64_t local = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                int fd = bench::connectLoopback(port);
+                if (fd == -1) {
+                    continue;
+                }
+                while (::read(fd, buf, sizeof(buf)) > 0) {}
+                close(fd);
+                ++local;
+            }
+            completed += local;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    done = true;
+    for (auto &t : clients) {
+        t.join();
+    }
+    return completed.load();
+}
+
+double benchPool(int port, size_t workers, size_t clients, double seconds) {
+    EventLoop loop;
+    WorkerPool pool(workers);
+    int listen_fd = createListenSocket(port, false, false);
+    loop.addFd(listen_fd, EPOLLIN, [&](int, uint32_t) {
+        int client_fd = ::accept(listen_fd, nullptr, nullptr);
+        if (client_fd != -1) {
+            pool.submit([client_fd] { respondAndClose(client_fd); });
+        }
+    });
+    std::thread loop_thread([&] { loop.run(); });
+    auto start = bench::Clock::now();
+    uint64_t n = driveClients(port, clients, seconds);
+    double elapsed = bench::secondsSince(start);
+    loop.stop();
+    loop_thread.join();
+    close(listen_fd);
+    return n / elapsed;
+}
+
+double benchReusePort(int port, size_t loops, size_t clients, double seconds) {
+    EventLoopGroup group(loops, port);
+    group.start([](int client_fd, EventLoop &) { respondAndClose(client_fd); });
+    auto start = bench::Clock::now();
+    uint64_t n = driveClients(port, clients, seconds);
+    double elapsed = bench::secondsSince(start);
+    group.stop();
+    group.join();
+    return n / elapsed;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: accept_bench [--mode=both|pool|reuseport] [--port=18080] [--clients=8]\n"
+                    "                    [--seconds=3] [--workers=16] [--loops=<cores>]\n");
+        return 0;
+    }
+    std::string mode = args.get("mode", "both");
+    int port = static_cast<int>(args.getInt("port", 18080));
+    size_t clients = args.getInt("clients", 8);
+    double seconds = args.getDouble("seconds", 3.0);
+    size_t workers = args.getInt("workers", 16);
+    size_t loops = args.getInt("loops", std::max(1u, std::thread::hardware_concurrency()));
+
+    try {
+        bench::QuietLog quiet;
+        double pool_rate = 0, reuse_rate = 0;
+        if (mode == "both" || mode == "pool") {
+            pool_rate = benchPool(port, workers, clients, seconds);
+        }
+        if (mode == "both" || mode == "reuseport") {
+            reuse_rate = benchReusePort(port + 1, loops, clients, seconds);
+        }
+        if (pool_rate > 0) {
+            std::printf("acceptor+pool (%zu workers): %10.0f conn/s\n", workers, pool_rate);
+        }
+        if (reuse_rate > 0) {
+            std::printf("reuseport     (%zu loops):   %10.0f conn/s\n", loops, reuse_rate);
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "accept_bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
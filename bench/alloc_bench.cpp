@@ -0,0 +1,154 @@
+// Heap allocations per request and resident memory under sustained load. Drives
+// --connections HttpSessions on socketpairs round-robin on one thread, each answering
+// keep-alive requests with a small response, and closes and reopens every connection
+// after --requests-per-connection requests so connection setup is part of the mix.
+// Allocations are counted by replacing the global operator new; RSS comes from
+// /proc/self/status.
+
+#include "bench_util.hpp"
+#include "core/event_loop.hpp"
+#include "http/http_session.hpp"
+#include <atomic>
+#include <fstream>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+void *countedAlloc(size_t size, size_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = alignment <= alignof(std::max_align_t) ? std::malloc(size ? size : 1)
+                                                      : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+long statusKb(const char *field) {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    size_t len = std::strlen(field);
+    while (std::getline(in, line)) {
+        if (line.compare(0, len, field) == 0) {
+            return std::strtol(line.c_str() + len + 1, nullptr, 10);
+        }
+    }
+    return -1;
+}
+
+const char kRequest[] = "GET /static/js/app.3f9c1b.js HTTP/1.1\r\n"
+                        "Host: www.example.com\r\n"
+                        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 Chrome/124.0.0.0\r\n"
+                        "Accept: */*\r\n"
+                        "Accept-Encoding: gzip, deflate, br\r\n"
+                        "Accept-Language: en-US,en;q=0.9\r\n"
+                        "Cookie: session=8c1d2e4f5a6b7c8d9e0f; theme=dark\r\n\r\n";
+
+struct Client {
+    int fd = -1; // our end; the session owns the other one
+    std::unique_ptr<HttpSession> session;
+    long served = 0;
+};
+
+} // namespace
+
+void *operator new(size_t size) { return countedAlloc(size, 0); }
+void *operator new[](size_t size) { return countedAlloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return countedAlloc(size, static_cast<size_t>(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return countedAlloc(size, static_cast<size_t>(alignment));
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: alloc_bench [--connections=256] [--requests=1000000] [--requests-per-connection=100]\n"
+                    "                   [--body=512]\n");
+        return 0;
+    }
+    size_t connections = args.getInt("connections", 256);
+    long requests = args.getInt("requests", 1000000);
+    long per_connection = args.getInt("requests-per-connection", 100);
+    size_t body_size = args.getInt("body", 512);
+    bench::QuietLog quiet;
+
+    EventLoop loop;
+    SessionLimits limits;
+    limits.max_requests = per_connection + 1;
+    HttpParser parser;
+    RequestHandler handler = [body_size](const Request &) {
+        return Response{200, "OK", "HTTP/1.1", {{"Content-Type", "application/javascript"}},
+                        std::string(body_size, 'x')};
+    };
+    auto open = [&](Client &client) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+            std::perror("socketpair");
+            std::exit(1);
+        }
+        auto conn = std::make_unique<Connection>(fds[0], nullptr);
+        conn->set_nonblocking(true);
+        client.fd = fds[1];
+        client.session = std::make_unique<HttpSession>(std::move(conn), parser, handler, limits, loop, [] {});
+        client.served = 0;
+    };
+
+    std::vector<Client> clients(connections);
+    for (Client &client : clients) {
+        open(client);
+    }
+    std::vector<char> buffer(256 * 1024);
+    const long warmup = std::min<long>(requests / 10, static_cast<long>(connections) * per_connection);
+    uint64_t start_allocations = 0;
+    long start_rss = 0;
+    auto start = bench::Clock::now();
+    long peak_rss = 0;
+    for (long i = 0; i < requests + warmup; ++i) {
+        if (i == warmup) {
+            start_allocations = allocations.load();
+            start_rss = statusKb("VmRSS:");
+            start = bench::Clock::now();
+        }
+        Client &client = clients[i % connections];
+        if (::write(client.fd, kRequest, sizeof(kRequest) - 1) != static_cast<ssize_t>(sizeof(kRequest) - 1)) {
+            std::perror("write");
+            return 1;
+        }
+        client.session->process();
+        if (::read(client.fd, buffer.data(), buffer.size()) <= 0) {
+            std::perror("read");
+            return 1;
+        }
+        if (++client.served == per_connection) {
+            client.session.reset();
+            close(client.fd);
+            open(client);
+        }
+        if (i % 65536 == 0) {
+            peak_rss = std::max(peak_rss, statusKb("VmRSS:"));
+        }
+    }
+    double seconds = bench::secondsSince(start);
+    uint64_t counted = allocations.load() - start_allocations;
+    long end_rss = statusKb("VmRSS:");
+    peak_rss = std::max(peak_rss, end_rss);
+
+    std::printf("%zu connections, %ld requests, %ld per connection, %zu-byte bodies\n", connections, requests,
+                per_connection, body_size);
+    std::printf("allocations per request  %10.2f\n", static_cast<double>(counted) / requests);
+    std::printf("requests/s               %10.0f\n", requests / seconds);
+    std::printf("RSS after warmup         %10ld KiB\n", start_rss);
+    std::printf("RSS at end               %10ld KiB\n", end_rss);
+    std::printf("RSS peak (sampled)       %10ld KiB\n", peak_rss);
+    return 0;
+}
@@ -0,0 +1,133 @@
+// L7Proxy load balancing against three local stub backends, one of them slow
+// (--delay-us per response) and, in the last run, one of them down:
+//   round robin      - smooth weighted round robin, ejection off
+//   p2c              - power of two choices on requests in flight, ejection off
+//   hash             - consistent hash on the request target (--keys distinct paths)
+//   p2c + ejection   - answers slower than --slow-ms count as failures and eject the slow one
+//   p2c, one down    - the slow backend replaced by a closed port; retries hide it
+// Reports throughput, p50/p99 latency, failed requests, the share of requests each
+// backend served and how often one was ejected.
+
+#include "bench_util.hpp"
+#include "stub_backend.hpp"
+#include "proxy/l7_proxy.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace {
+
+struct Scenario {
+    const char *name;
+    BalancePolicy policy;
+    bool eject;
+    bool one_down;
+};
+
+void run(const Scenario &scenario, std::vector<std::unique_ptr<bench::StubBackend>> &backends, int threads,
+         long requests, long keys, long slow_ms) {
+    std::vector<UpstreamConfig> upstreams;
+    for (size_t i = 0; i < backends.size(); ++i) {
+        bool down = scenario.one_down && i + 1 == backends.size();
+        upstreams.push_back(UpstreamConfig{"127.0.0.1", down ? bench::deadPort() : backends[i]->port(), 1});
+    }
+    LoadBalancerConfig config;
+    config.policy = scenario.policy;
+    config.consecutive_failures = scenario.eject ? 3 : 0;
+    config.slow_response = std::chrono::milliseconds(scenario.eject ? slow_ms : 0);
+    config.max_attempts = 2;
+    L7Proxy proxy(upstreams, config);
+
+    std::vector<long> served_before;
+    for (auto &backend : backends) {
+        served_before.push_back(backend->served());
+    }
+    std::vector<std::vector<double>> per_thread(threads);
+    std::atomic<long> failures{0};
+    auto start = bench::Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            Request request{"GET", "", "HTTP/1.1", {{"Host", "backend"}}, ""};
+            for (long i = 0; i < requests / threads; ++i) {
+                request.path = "/item/" + std::to_string((i * threads + t) % keys);
+                auto begin = bench::Clock::now();
+                try {
+                    if (proxy.forward(request).status_code != 200) {
+                        ++failures;
+                        continue;
+                    }
+                } catch (const std::exception &) {
+                    ++failures;
+                    continue;
+                }
+                per_thread[t].push_back(bench::secondsSince(begin) * 1e6);
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    double seconds = bench::secondsSince(start);
+
+    std::vector<double> latencies;
+    for (auto &samples : per_thread) {
+        latencies.insert(latencies.end(), samples.begin(), samples.end());
+    }
+    std::string shares;
+    long total = 0;
+    for (size_t i = 0; i < backends.size(); ++i) {
+        total += backends[i]->served() - served_before[i];
+    }
+    for (size_t i = 0; i < backends.size(); ++i) {
+        char share[16];
+        std::snprintf(share, sizeof(share), "%3.0f%% ",
+                      total ? 100.0 * (backends[i]->served() - served_before[i]) / total : 0.0);
+        shares += share;
+    }
+    uint64_t ejections = 0;
+    for (const auto &upstream : proxy.upstreamStats()) {
+        ejections += upstream.ejections;
+    }
+    std::printf("%-16s %8.0f %9.1f %9.1f %7ld  %s %9llu\n", scenario.name, latencies.size() / seconds,
+                bench::percentile(latencies, 0.5), bench::percentile(latencies, 0.99), failures.load(),
+                shares.c_str(), static_cast<unsigned long long>(ejections));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: balancer_bench [--requests=4000] [--threads=8] [--delay-us=20000] [--slow-ms=5]\n"
+                    "                      [--keys=1000] [--body=1024]\n");
+        return 0;
+    }
+    long requests = args.getInt("requests", 4000);
+    int threads = static_cast<int>(args.getInt("threads", 8));
+    long delay_us = args.getInt("delay-us", 20000);
+    long slow_ms = args.getInt("slow-ms", 5);
+    long keys = std::max(args.getInt("keys", 1000), 1L);
+    size_t body_size = args.getInt("body", 1024);
+
+    std::vector<std::unique_ptr<bench::StubBackend>> backends;
+    for (int i = 0; i < 3; ++i) {
+        backends.push_back(std::make_unique<bench::StubBackend>(body_size, false));
+    }
+    backends.back()->setDelay(std::chrono::microseconds(delay_us));
+
+    std::printf("%ld requests, %d threads, 3 backends, the last one %ld us slower\n", requests, threads, delay_us);
+    std::printf("%-16s %8s %9s %9s %7s  %-15s %9s\n", "policy", "req/s", "p50 us", "p99 us", "failed",
+                "share b0 b1 b2", "ejections");
+    const Scenario scenarios[] = {
+        {"round robin", BalancePolicy::RoundRobin, false, false},
+        {"p2c", BalancePolicy::LeastOutstanding, false, false},
+        {"hash", BalancePolicy::ConsistentHash, false, false},
+        {"p2c + ejection", BalancePolicy::LeastOutstanding, true, false},
+        {"p2c, one down", BalancePolicy::LeastOutstanding, true, true},
+    };
+    for (const Scenario &scenario : scenarios) {
+        run(scenario, backends, threads, requests, keys, slow_ms);
+    }
+    return 0;
+}
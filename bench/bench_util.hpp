@@ -0,0 +1,191 @@
+#ifndef BENCH_UTIL_HPP
+#define BENCH_UTIL_HPP
+
+// Small helpers shared by the benchmark executables: --key=value argument parsing,
+// timing, loopback client sockets and JSON reports.
+
+#include "core/logger.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+class Args {
+public:
+    Args(int argc, char **argv) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help_ = true;
+                continue;
+            }
+            if (arg.rfind("--", 0) != 0) {
+                continue;
+            }
+            auto eq = arg.find('=');
+            if (eq == std::string::npos) {
+                values_[arg.substr(2)] = "1";
+            } else {
+                values_[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        }
+    }
+
+    bool help() const { return help_; }
+
+    std::string get(const std::string &key, const std::string &def) const {
+        auto it = values_.find(key);
+        return it == values_.end() ? def : it->second;
+    }
+
+    long getInt(const std::string &key, long def) const {
+        auto it = values_.find(key);
+        return it == values_.end() ? def : std::strtol(it->second.c_str(), nullptr, 10);
+    }
+
+    double getDouble(const std::string &key, double def) const {
+        auto it = values_.find(key);
+        return it == values_.end() ? def : std::strtod(it->second.c_str(), nullptr);
+    }
+
+private:
+    std::map<std::string, std::string> values_;
+    bool help_ = false;
+};
+
+inline double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Returns a connected socket to 127.0.0.1:port, or -1.
+inline int connectLoopback(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Value at quantile q (0..1) of an unsorted sample; sorts in place.
+inline double percentile(std::vector<double> &samples, double q) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t idx = static_cast<size_t>(q * (samples.size() - 1) + 0.5);
+    return samples[std::min(idx, samples.size() - 1)];
+}
+
+// One benchmark of a JSON report: time per operation in nanoseconds, plus extra
+// values such as latency percentiles.
+struct JsonResult {
+    std::string name;
+    long iterations;
+    double real_ns;
+    double cpu_ns;
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+// The results in Google Benchmark's JSON layout, one benchmark object per line, so its
+// compare.py and readJsonBaseline() both read them.
+inline std::string jsonReport(const std::string &executable, const std::vector<JsonResult> &results,
+                              int repetitions) {
+    char date[64];
+    time_t now = time(nullptr);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &tm);
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+
+    std::ostringstream out;
+    out << "{\n  \"context\": {\n"
+        << "    \"date\": \"" << date << "\",\n"
+        << "    \"host_name\": \"" << host << "\",\n"
+        << "    \"executable\": \"" << executable << "\",\n"
+        << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+        << "    \"library_build_type\": \"release\"\n"
+#else
+        << "    \"library_build_type\": \"debug\"\n"
+#endif
+        << "  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const JsonResult &r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"run_name\": \"" << r.name
+            << "\", \"run_type\": \"iteration\", \"repetitions\": " << repetitions
+            << ", \"iterations\": " << r.iterations << ", \"real_time\": " << r.real_ns
+            << ", \"cpu_time\": " << r.cpu_ns << ", \"time_unit\": \"ns\", \"items_per_second\": "
+            << (r.real_ns > 0 ? 1e9 / r.real_ns : 0);
+        for (const auto &counter : r.counters) {
+            out << ", \"" << counter.first << "\": " << counter.second;
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+// name -> real_time from a report written by jsonReport() or by Google Benchmark.
+inline std::map<std::string, double> readJsonBaseline(const std::string &path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    std::map<std::string, double> baseline;
+    size_t pos = 0;
+    while ((pos = text.find("\"name\": \"", pos)) != std::string::npos) {
+        pos += 9;
+        size_t end = text.find('"', pos);
+        size_t time = text.find("\"real_time\": ", end);
+        if (end == std::string::npos || time == std::string::npos) {
+            break;
+        }
+        baseline[text.substr(pos, end - pos)] = std::strtod(text.c_str() + time + 13, nullptr);
+        pos = time;
+    }
+    return baseline;
+}
+
+// Mutes the server components' informational logging while measuring, so setup lines
+// such as "Starting worker pool" do not land in the middle of the results.
+class QuietLog {
+public:
+    QuietLog() : saved_(Logger::level()) { Logger::setLevel(LogLevel::Warn); }
+    ~QuietLog() { Logger::setLevel(saved_); }
+
+private:
+    LogLevel saved_;
+};
+
+} // namespace bench
+
+#endif // BENCH_UTIL_HPP
@@ -0,0 +1,183 @@
+// Multi-threaded contention benchmark for the response cache:
+//   legacy  - the previous Cache: one unordered_map behind one mutex, hits copy the value
+//             out under the lock, eviction drops an arbitrary entry once the entry limit is hit
+//   sharded - Cache: per-shard locks, LRU with a byte budget, hits share the buffer
+// Keys follow a zipf distribution and each thread runs a get/put mix; on a miss the
+// thread puts the value, the way the proxy handler fills the cache.
+
+#include "bench_util.hpp"
+#include "http/cache.hpp"
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+// Copied from the previous include/http/cache.hpp and src/http/cache.cpp.
+class LegacyCache {
+public:
+    LegacyCache(size_t max_size) : max_size_(max_size) {}
+
+    bool get(const std::string &key, std::string &value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(key);
+        if (it != cache_.end()) {
+            value = it->second;
+            return true;
+        }
+        return false;
+    }
+
+    void put(const std::string &key, const std::string &value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cache_.size() >= max_size_) {
+            cache_.erase(cache_.begin());
+        }
+        cache_[key] = value;
+    }
+
+private:
+    std::unordered_map<std::string, std::string> cache_;
+    std::mutex mutex_;
+    size_t max_size_;
+};
+
+// Inverse-CDF sampling over a precomputed zipf table.
+class Zipf {
+public:
+    Zipf(size_t n, double s) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            cdf_[i] = sum;
+        }
+        for (double &c : cdf_) {
+            c /= sum;
+        }
+    }
+
+    size_t operator()(std::mt19937_64 &rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    }
+
+private:
+    std::vector<double> cdf_;
+};
+
+struct Workload {
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    std::vector<std::shared_ptr<const std::string>> shared_values;
+    Zipf zipf;
+    double get_ratio;
+    long ops_per_thread;
+};
+
+struct Result {
+    double mops;
+    double hit_rate;
+};
+
+template <typename Op>
+double runThreads(int threads, long ops_per_thread, Op op) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(0x9e3779b97f4a7c15ULL * (t + 1));
+            ready.fetch_add(1);
+            while (!go.load()) {
+            }
+            for (long i = 0; i < ops_per_thread; ++i) {
+                op(rng);
+            }
+        });
+    }
+    while (ready.load() != threads) {
+    }
+    auto start = bench::Clock::now();
+    go.store(true);
+    for (auto &w : workers) {
+        w.join();
+    }
+    return threads * ops_per_thread / bench::secondsSince(start) / 1e6;
+}
+
+Result runLegacy(const Workload &w, int threads, size_t max_entries) {
+    LegacyCache cache(max_entries);
+    std::atomic<uint64_t> hits{0}, lookups{0};
+    double mops = runThreads(threads, w.ops_per_thread, [&](std::mt19937_64 &rng) {
+        size_t k = w.zipf(rng);
+        if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < w.get_ratio) {
+            std::string value;
+            lookups.fetch_add(1, std::memory_order_relaxed);
+            if (cache.get(w.keys[k], value)) {
+                hits.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                cache.put(w.keys[k], w.values[k]);
+            }
+        } else {
+            cache.put(w.keys[k], w.values[k]);
+        }
+    });
+    return {mops, lookups ? static_cast<double>(hits) / lookups : 0.0};
+}
+
+Result runSharded(const Workload &w, int threads, size_t max_bytes, size_t shards) {
+    Cache cache(max_bytes, shards);
+    double mops = runThreads(threads, w.ops_per_thread, [&](std::mt19937_64 &rng) {
+        size_t k = w.zipf(rng);
+        if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < w.get_ratio) {
+            if (!cache.get(w.keys[k])) {
+                cache.put(w.keys[k], w.shared_values[k]);
+            }
+        } else {
+            cache.put(w.keys[k], w.shared_values[k]);
+        }
+    });
+    Cache::Stats stats = cache.stats();
+    uint64_t lookups = stats.hits + stats.misses;
+    return {mops, lookups ? static_cast<double>(stats.hits) / lookups : 0.0};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: cache_bench [--keys=10000] [--value-size=4096] [--zipf=0.99]\n"
+                    "                   [--get-ratio=0.9] [--ops=500000] [--max-threads=16]\n"
+                    "                   [--shards=16] [--budget-mb=16]\n"
+                    "The legacy cache gets the entry limit the byte budget works out to.\n");
+        return 0;
+    }
+    size_t num_keys = args.getInt("keys", 10000);
+    size_t value_size = args.getInt("value-size", 4096);
+    size_t shards = args.getInt("shards", 16);
+    size_t budget = static_cast<size_t>(args.getInt("budget-mb", 16)) << 20;
+    int max_threads = static_cast<int>(args.getInt("max-threads", 16));
+
+    Workload w{{}, {}, {}, Zipf(num_keys, args.getDouble("zipf", 0.99)), args.getDouble("get-ratio", 0.9),
+               args.getInt("ops", 500000)};
+    for (size_t i = 0; i < num_keys; ++i) {
+        w.keys.push_back("/proxy/item/" + std::to_string(i));
+        w.values.push_back(std::string(value_size, static_cast<char>('a' + i % 26)));
+        w.shared_values.push_back(std::make_shared<const std::string>(w.values.back()));
+    }
+    size_t max_entries = std::max<size_t>(1, budget / value_size);
+
+    std::printf("%zu keys, %zu-byte values, budget %zu MiB (~%zu entries), %.0f%% gets\n", num_keys, value_size,
+                budget >> 20, max_entries, w.get_ratio * 100);
+    std::printf("%8s %14s %10s %14s %10s\n", "threads", "legacy Mops/s", "hit rate", "sharded Mops/s", "hit rate");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        Result legacy = runLegacy(w, threads, max_entries);
+        Result sharded = runSharded(w, threads, budget, shards);
+        std::printf("%8d %14.2f %9.1f%% %14.2f %9.1f%%\n", threads, legacy.mops, legacy.hit_rate * 100,
+                    sharded.mops, sharded.hit_rate * 100);
+    }
+    return 0;
+}
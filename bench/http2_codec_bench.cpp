@@ -0,0 +1,477 @@
+// The native HTTP/2 codec (Http2Framer, HPACK) against nghttp2. It checks first and
+// fails the run on any mismatch:
+//   - header blocks from nghttp2's deflater decode to the same fields with HpackDecoder,
+//     and blocks from HpackEncoder decode to the same fields with nghttp2's inflater,
+//     across a table size change and with a sensitive field;
+//   - Huffman round trips of random bytes;
+//   - the frames an nghttp2 client session sends are what Http2Framer parses;
+//   - frames written by Http2Framer (SETTINGS, a HEADERS block split into CONTINUATION,
+//     PING, WINDOW_UPDATE, GOAWAY) are accepted as such by an nghttp2 server session.
+// Then it measures, on one core:
+//   frames  - a request stream (HEADERS + DATA per request) through Http2Framer plus
+//             HpackDecoder, versus nghttp2_session_mem_recv on a server session
+//   decode  - ns per header block and per field, HpackDecoder vs nghttp2's inflater
+//   encode  - ns per header block, HpackEncoder vs nghttp2's deflater
+
+#include "bench_util.hpp"
+#include "http/http2_framer.hpp"
+#include <nghttp2/nghttp2.h>
+#include <random>
+
+namespace {
+
+using Fields = std::vector<std::pair<std::string, std::string>>;
+
+std::string randomToken(std::mt19937 &rng, size_t len) {
+    static const char alphabet[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-_";
+    std::string s(len, ' ');
+    for (char &c : s) {
+        c = alphabet[rng() % (sizeof(alphabet) - 1)];
+    }
+    return s;
+}
+
+// Browser-like requests and responses: repeated fields the dynamic table catches,
+// per-request paths and ids, and now and then a value with arbitrary bytes.
+std::vector<Fields> corpus(size_t blocks, unsigned seed) {
+    std::mt19937 rng(seed);
+    const std::string ua = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                           "Chrome/124.0.0.0 Safari/537.36";
+    const std::string cookie = "session=" + randomToken(rng, 32) + "; theme=dark; _ga=GA1.1." + randomToken(rng, 20);
+    std::vector<Fields> result;
+    for (size_t i = 0; i < blocks; ++i) {
+        Fields fields;
+        if (i % 2 == 0) {
+            fields = {{":method", i % 10 == 0 ? "POST" : "GET"},
+                      {":scheme", "https"},
+                      {":authority", "shop.example.com"},
+                      {":path", "/static/" + randomToken(rng, 8) + ".js?v=" + std::to_string(rng() % 100)},
+                      {"user-agent", ua},
+                      {"accept", "*/*"},
+                      {"accept-encoding", "gzip, deflate, br"},
+                      {"accept-language", "en-US,en;q=0.9"},
+                      {"cookie", cookie},
+                      {"x-request-id", randomToken(rng, 16)}};
+        } else {
+            fields = {{":status", i % 14 == 1 ? "304" : "200"},
+                      {"content-type", "application/javascript"},
+                      {"content-length", std::to_string(rng() % 100000)},
+                      {"cache-control", "public, max-age=31536000"},
+                      {"etag", "\"" + randomToken(rng, 12) + "\""},
+                      {"server", "blaze"},
+                      {"date", "Fri, 16 Oct 2026 10:00:" + std::to_string(10 + rng() % 50) + " GMT"}};
+        }
+        if (i % 7 == 3) {
+            std::string binary(rng() % 40 + 1, ' ');
+            for (char &c : binary) {
+                c = static_cast<char>(rng() % 256);
+            }
+            fields.emplace_back("x-binary", binary);
+        }
+        result.push_back(std::move(fields));
+    }
+    return result;
+}
+
+std::vector<nghttp2_nv> toNv(const Fields &fields) {
+    std::vector<nghttp2_nv> nva;
+    for (const auto &field : fields) {
+        nva.push_back(nghttp2_nv{(uint8_t *)field.first.data(), (uint8_t *)field.second.data(), field.first.size(),
+                                 field.second.size(), NGHTTP2_NV_FLAG_NONE});
+    }
+    return nva;
+}
+
+std::vector<HpackField> toHpack(const Fields &fields) {
+    std::vector<HpackField> result;
+    for (const auto &field : fields) {
+        result.push_back(HpackField{field.first, field.second, field.first == "authorization"});
+    }
+    return result;
+}
+
+std::string nghttp2Deflate(nghttp2_hd_deflater *deflater, const Fields &fields) {
+    std::vector<nghttp2_nv> nva = toNv(fields);
+    std::string out(nghttp2_hd_deflate_bound(deflater, nva.data(), nva.size()), '\0');
+    ssize_t n = nghttp2_hd_deflate_hd(deflater, (uint8_t *)&out[0], out.size(), nva.data(), nva.size());
+    if (n < 0) {
+        std::fprintf(stderr, "nghttp2_hd_deflate_hd: %s\n", nghttp2_strerror(static_cast<int>(n)));
+        std::exit(1);
+    }
+    out.resize(n);
+    return out;
+}
+
+// Returns false on an inflate error.
+bool nghttp2Inflate(nghttp2_hd_inflater *inflater, const std::string &block, Fields *fields) {
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(block.data());
+    size_t len = block.size();
+    while (true) {
+        nghttp2_nv nv;
+        int flags = 0;
+        ssize_t n = nghttp2_hd_inflate_hd2(inflater, &nv, &flags, in, len, 1);
+        if (n < 0) {
+            return false;
+        }
+        in += n;
+        len -= n;
+        if ((flags & NGHTTP2_HD_INFLATE_EMIT) && fields) {
+            fields->emplace_back(std::string((const char *)nv.name, nv.namelen),
+                                 std::string((const char *)nv.value, nv.valuelen));
+        }
+        if (flags & NGHTTP2_HD_INFLATE_FINAL) {
+            nghttp2_hd_inflate_end_headers(inflater);
+            return true;
+        }
+        if (len == 0 && !(flags & NGHTTP2_HD_INFLATE_EMIT)) {
+            return false;
+        }
+    }
+}
+
+int failures = 0;
+
+void check(bool ok, const std::string &what) {
+    if (!ok) {
+        ++failures;
+        std::printf("MISMATCH: %s\n", what.c_str());
+    }
+}
+
+void verifyHpack(const std::vector<Fields> &blocks) {
+    nghttp2_hd_deflater *deflater;
+    nghttp2_hd_deflate_new(&deflater, 4096);
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    nghttp2_hd_inflater *inflater;
+    nghttp2_hd_inflate_new(&inflater);
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (i == blocks.size() / 2) {
+            // Both directions shrink the table halfway through.
+            nghttp2_hd_deflate_change_table_size(deflater, 1024);
+            encoder.setMaxTableSize(1024);
+        }
+        Fields fields = blocks[i];
+        if (i % 5 == 0) {
+            fields.emplace_back("authorization", "Bearer " + std::to_string(i));
+        }
+
+        std::string block = nghttp2Deflate(deflater, fields);
+        Fields decoded;
+        try {
+            decoder.decode(reinterpret_cast<const uint8_t *>(block.data()), block.size(),
+                           [&](std::string_view name, std::string_view value) {
+                               decoded.emplace_back(std::string(name), std::string(value));
+                           });
+        } catch (const std::exception &e) {
+            check(false, "HpackDecoder threw on block " + std::to_string(i) + ": " + e.what());
+            break;
+        }
+        check(decoded == fields, "HpackDecoder output differs on block " + std::to_string(i));
+
+        std::vector<HpackField> hpack = toHpack(fields);
+        std::string ours(HpackEncoder::maxEncodedSize(hpack.data(), hpack.size()), '\0');
+        ours.resize(encoder.encode(hpack.data(), hpack.size(), (uint8_t *)&ours[0]));
+        Fields inflated;
+        check(nghttp2Inflate(inflater, ours, &inflated), "nghttp2 rejected HpackEncoder block " + std::to_string(i));
+        check(inflated == fields, "nghttp2 decodes HpackEncoder block " + std::to_string(i) + " differently");
+    }
+    nghttp2_hd_deflate_del(deflater);
+    nghttp2_hd_inflate_del(inflater);
+
+    std::mt19937 rng(7);
+    for (int i = 0; i < 2000; ++i) {
+        std::string s(rng() % 64, ' ');
+        for (char &c : s) {
+            c = static_cast<char>(rng() % 256);
+        }
+        std::string encoded(huffmanEncodedLength(s), '\0');
+        uint8_t *end = huffmanEncode(s, (uint8_t *)&encoded[0]);
+        std::string decoded;
+        huffmanDecode((const uint8_t *)encoded.data(), end - (const uint8_t *)encoded.data(), decoded);
+        check(decoded == s && end - (const uint8_t *)encoded.data() == (long)encoded.size(), "Huffman round trip");
+    }
+}
+
+struct SentFrame {
+    uint8_t type;
+    uint8_t flags;
+    int32_t stream_id;
+    size_t length;
+    bool operator==(const SentFrame &o) const {
+        return type == o.type && flags == o.flags && stream_id == o.stream_id && length == o.length;
+    }
+};
+
+ssize_t readBody(nghttp2_session *, int32_t, uint8_t *buf, size_t length, uint32_t *flags,
+                 nghttp2_data_source *source, void *) {
+    size_t &remaining = *static_cast<size_t *>(source->ptr);
+    size_t n = std::min(length, remaining);
+    std::memset(buf, 'b', n);
+    remaining -= n;
+    if (remaining == 0) {
+        *flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return n;
+}
+
+// What an nghttp2 client session sends for `requests` requests with `body` bytes each,
+// client preface excluded; frames lists them as nghttp2 reports them.
+std::string clientStream(const std::vector<Fields> &blocks, size_t requests, size_t body,
+                         std::vector<SentFrame> *frames) {
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_frame_send_callback(
+        callbacks, [](nghttp2_session *, const nghttp2_frame *frame, void *user_data) {
+            auto *sent = static_cast<std::vector<SentFrame> *>(user_data);
+            if (sent) {
+                sent->push_back(SentFrame{frame->hd.type, frame->hd.flags, frame->hd.stream_id, frame->hd.length});
+            }
+            return 0;
+        });
+    nghttp2_session *session;
+    nghttp2_session_client_new(&session, callbacks, frames);
+    nghttp2_session_callbacks_del(callbacks);
+
+    nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_ENABLE_PUSH, 0}};
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, 1);
+    std::vector<size_t> remaining(requests, body);
+    for (size_t i = 0; i < requests; ++i) {
+        std::vector<nghttp2_nv> nva = toNv(blocks[(2 * i) % blocks.size()]);
+        nghttp2_data_provider provider;
+        provider.source.ptr = &remaining[i];
+        provider.read_callback = readBody;
+        nghttp2_submit_request(session, nullptr, nva.data(), nva.size(), body ? &provider : nullptr, nullptr);
+        if (i % 16 == 0) {
+            nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, nullptr);
+        }
+    }
+    std::string out;
+    while (true) {
+        const uint8_t *data;
+        ssize_t n = nghttp2_session_mem_send(session, &data);
+        if (n <= 0) {
+            break;
+        }
+        out.append((const char *)data, n);
+    }
+    nghttp2_session_del(session);
+    return out.substr(NGHTTP2_CLIENT_MAGIC_LEN);
+}
+
+void verifyFrames(const std::vector<Fields> &blocks) {
+    // nghttp2 writes, we parse.
+    std::vector<SentFrame> sent;
+    std::string stream = clientStream(blocks, 40, 40000, &sent);
+    Http2Framer framer;
+    HpackDecoder decoder;
+    std::vector<SentFrame> parsed;
+    size_t request = 0;
+    size_t consumed = framer.parseFrames((const uint8_t *)stream.data(), stream.size(), [&](const Http2Frame &frame) {
+        parsed.push_back(SentFrame{static_cast<uint8_t>(frame.type), frame.flags,
+                                   static_cast<int32_t>(frame.stream_id), frame.length});
+        if (frame.type == Http2FrameType::Headers) {
+            std::string_view fragment = Http2Framer::headerBlockFragment(frame);
+            Fields fields;
+            decoder.decode((const uint8_t *)fragment.data(), fragment.size(),
+                           [&](std::string_view name, std::string_view value) {
+                               fields.emplace_back(std::string(name), std::string(value));
+                           });
+            check(fields == blocks[(2 * request++) % blocks.size()], "request headers differ");
+        }
+    });
+    check(consumed == stream.size(), "Http2Framer left bytes of nghttp2's stream unparsed");
+    check(parsed == sent, "Http2Framer frames differ from what nghttp2 sent (" + std::to_string(parsed.size()) +
+                              " vs " + std::to_string(sent.size()) + ")");
+
+    // We write, nghttp2 parses.
+    struct Received {
+        std::vector<uint8_t> types;
+        Fields fields;
+    } received;
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(
+        callbacks, [](nghttp2_session *, const nghttp2_frame *frame, void *user_data) {
+            static_cast<Received *>(user_data)->types.push_back(frame->hd.type);
+            return 0;
+        });
+    nghttp2_session_callbacks_set_on_header_callback(
+        callbacks, [](nghttp2_session *, const nghttp2_frame *, const uint8_t *name, size_t namelen,
+                      const uint8_t *value, size_t valuelen, uint8_t, void *user_data) {
+            static_cast<Received *>(user_data)->fields.emplace_back(std::string((const char *)name, namelen),
+                                                                    std::string((const char *)value, valuelen));
+            return 0;
+        });
+    nghttp2_session *session;
+    nghttp2_session_server_new(&session, callbacks, &received);
+    nghttp2_session_callbacks_del(callbacks);
+
+    // A block larger than one frame, so it needs CONTINUATION frames.
+    Fields request_fields = {{":method", "GET"},   {":scheme", "https"},
+                             {":authority", "a"},  {":path", "/"},
+                             {"x-large", std::string(40000, 'q')}};
+    std::vector<HpackField> hpack = toHpack(request_fields);
+    HpackEncoder encoder;
+    std::vector<uint8_t> out(100000);
+    size_t len = 0;
+    std::memcpy(out.data(), NGHTTP2_CLIENT_MAGIC, NGHTTP2_CLIENT_MAGIC_LEN);
+    len += NGHTTP2_CLIENT_MAGIC_LEN;
+    Http2Setting settings[] = {{NGHTTP2_SETTINGS_ENABLE_PUSH, 0}, {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1 << 20}};
+    len += Http2Framer::writeSettings(out.data() + len, out.size() - len, settings, 2);
+    len += Http2Framer::writeHeaders(out.data() + len, out.size() - len, 1, hpack.data(), hpack.size(), true, encoder);
+    const uint8_t opaque[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    len += Http2Framer::writePing(out.data() + len, out.size() - len, opaque, false);
+    len += Http2Framer::writeWindowUpdate(out.data() + len, out.size() - len, 0, 65536);
+    len += Http2Framer::writeGoAway(out.data() + len, out.size() - len, 0, NGHTTP2_NO_ERROR);
+    ssize_t n = nghttp2_session_mem_recv(session, out.data(), len);
+    check(n == static_cast<ssize_t>(len), "nghttp2 rejected Http2Framer output: " +
+                                              std::string(n < 0 ? nghttp2_strerror(static_cast<int>(n)) : "short"));
+    std::vector<uint8_t> expected = {NGHTTP2_SETTINGS, NGHTTP2_HEADERS, NGHTTP2_PING, NGHTTP2_WINDOW_UPDATE,
+                                     NGHTTP2_GOAWAY};
+    check(received.types == expected, "nghttp2 saw different frames than Http2Framer wrote");
+    check(received.fields == request_fields, "nghttp2 decoded different request headers");
+    nghttp2_session_del(session);
+}
+
+void benchFrames(const std::vector<Fields> &blocks, long passes) {
+    // Small bodies: nothing opens the flow control window beyond the initial 64 KiB.
+    std::string stream = clientStream(blocks, 2000, 24, nullptr);
+    size_t frames = 0;
+    Http2Framer().parseFrames((const uint8_t *)stream.data(), stream.size(), [&](const Http2Frame &) { ++frames; });
+
+    auto start = bench::Clock::now();
+    size_t fields = 0;
+    for (long pass = 0; pass < passes; ++pass) {
+        Http2Framer framer;
+        HpackDecoder decoder;
+        framer.parseFrames((const uint8_t *)stream.data(), stream.size(), [&](const Http2Frame &frame) {
+            if (frame.type == Http2FrameType::Headers) {
+                std::string_view fragment = Http2Framer::headerBlockFragment(frame);
+                decoder.decode((const uint8_t *)fragment.data(), fragment.size(),
+                               [&](std::string_view, std::string_view) { ++fields; });
+            } else if (frame.type == Http2FrameType::Data) {
+                fields += Http2Framer::dataPayload(frame).size() > 0;
+            }
+        });
+    }
+    double ours = bench::secondsSince(start);
+
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_header_callback(
+        callbacks, [](nghttp2_session *, const nghttp2_frame *, const uint8_t *, size_t, const uint8_t *, size_t,
+                      uint8_t, void *) { return 0; });
+    std::string with_magic = std::string(NGHTTP2_CLIENT_MAGIC, NGHTTP2_CLIENT_MAGIC_LEN) + stream;
+    start = bench::Clock::now();
+    for (long pass = 0; pass < passes; ++pass) {
+        nghttp2_session *session;
+        nghttp2_session_server_new(&session, callbacks, nullptr);
+        nghttp2_session_mem_recv(session, (const uint8_t *)with_magic.data(), with_magic.size());
+        nghttp2_session_del(session);
+    }
+    double theirs = bench::secondsSince(start);
+    nghttp2_session_callbacks_del(callbacks);
+
+    std::printf("%-8s %-22s %12.0f frames/s %8.1f MB/s\n", "frames", "Http2Framer+HPACK", frames * passes / ours,
+                stream.size() * passes / ours / 1e6);
+    std::printf("%-8s %-22s %12.0f frames/s %8.1f MB/s\n", "frames", "nghttp2 session", frames * passes / theirs,
+                stream.size() * passes / theirs / 1e6);
+}
+
+void benchHpack(const std::vector<Fields> &blocks, long passes) {
+    std::vector<std::string> encoded;
+    size_t field_count = 0;
+    nghttp2_hd_deflater *deflater;
+    nghttp2_hd_deflate_new(&deflater, 4096);
+    for (const Fields &fields : blocks) {
+        encoded.push_back(nghttp2Deflate(deflater, fields));
+        field_count += fields.size();
+    }
+    nghttp2_hd_deflate_del(deflater);
+    double total = static_cast<double>(blocks.size()) * passes;
+
+    auto start = bench::Clock::now();
+    size_t sink = 0;
+    for (long pass = 0; pass < passes; ++pass) {
+        HpackDecoder decoder;
+        for (const std::string &block : encoded) {
+            decoder.decode((const uint8_t *)block.data(), block.size(),
+                           [&](std::string_view name, std::string_view value) { sink += name.size() + value.size(); });
+        }
+    }
+    double ours = bench::secondsSince(start);
+    start = bench::Clock::now();
+    for (long pass = 0; pass < passes; ++pass) {
+        nghttp2_hd_inflater *inflater;
+        nghttp2_hd_inflate_new(&inflater);
+        for (const std::string &block : encoded) {
+            nghttp2Inflate(inflater, block, nullptr);
+        }
+        nghttp2_hd_inflate_del(inflater);
+    }
+    double theirs = bench::secondsSince(start);
+    std::printf("%-8s %-22s %9.0f ns/block %6.1f ns/field\n", "decode", "HpackDecoder", ours / total * 1e9,
+                ours / (field_count * static_cast<double>(passes)) * 1e9);
+    std::printf("%-8s %-22s %9.0f ns/block %6.1f ns/field\n", "decode", "nghttp2 inflater", theirs / total * 1e9,
+                theirs / (field_count * static_cast<double>(passes)) * 1e9);
+
+    std::vector<std::vector<HpackField>> hpack;
+    for (const Fields &fields : blocks) {
+        hpack.push_back(toHpack(fields));
+    }
+    std::vector<uint8_t> out(1 << 16);
+    start = bench::Clock::now();
+    for (long pass = 0; pass < passes; ++pass) {
+        HpackEncoder encoder;
+        for (const auto &fields : hpack) {
+            sink += encoder.encode(fields.data(), fields.size(), out.data());
+        }
+    }
+    ours = bench::secondsSince(start);
+    std::vector<std::vector<nghttp2_nv>> nvs;
+    for (const Fields &fields : blocks) {
+        nvs.push_back(toNv(fields));
+    }
+    start = bench::Clock::now();
+    for (long pass = 0; pass < passes; ++pass) {
+        nghttp2_hd_deflater *pass_deflater;
+        nghttp2_hd_deflate_new(&pass_deflater, 4096);
+        for (const auto &nva : nvs) {
+            sink += nghttp2_hd_deflate_hd(pass_deflater, out.data(), out.size(), nva.data(), nva.size());
+        }
+        nghttp2_hd_deflate_del(pass_deflater);
+    }
+    theirs = bench::secondsSince(start);
+    std::printf("%-8s %-22s %9.0f ns/block\n", "encode", "HpackEncoder", ours / total * 1e9);
+    std::printf("%-8s %-22s %9.0f ns/block\n", "encode", "nghttp2 deflater", theirs / total * 1e9);
+    if (sink == 0) {
+        std::printf("\n");
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: http2_codec_bench [--blocks=2000] [--passes=50] [--seed=1]\n");
+        return 0;
+    }
+    long blocks = std::max(args.getInt("blocks", 2000), 2L);
+    long passes = std::max(args.getInt("passes", 50), 1L);
+    std::vector<Fields> corpus_blocks = corpus(blocks, static_cast<unsigned>(args.getInt("seed", 1)));
+
+    verifyHpack(corpus_blocks);
+    verifyFrames(corpus_blocks);
+    if (failures > 0) {
+        std::printf("verify: %d mismatches against nghttp2\n", failures);
+        return 1;
+    }
+    std::printf("verify: matches nghttp2\n");
+
+    benchFrames(corpus_blocks, passes);
+    benchHpack(corpus_blocks, passes);
+    return 0;
+}
@@ -0,0 +1,1144 @@
+// End-to-end load generator for http_server. Opens --connections connections, over
+// TLS or plaintext, speaking HTTP/1.1 keep-alive (one request in flight) or h2
+// (--streams in flight), spread over --threads epoll threads, and requests --paths in
+// rotation:
+//   closed loop      - every connection sends its next request as soon as the previous
+//                      one is answered (the default)
+//   fixed rate       - --rate requests/s in total, on a schedule fixed in advance
+//                      (wrk2 style). A request that cannot go out on time because its
+//                      connection is still busy is timed from when it should have been
+//                      sent, so a stalled server cannot hide the requests it delayed.
+// Latency is reported corrected for coordinated omission: in rate mode by the schedule
+// above; in closed-loop mode with HdrHistogram's correction, taking the median latency
+// as the interval at which a connection would have sent requests. Raw figures are
+// printed next to the corrected ones.
+//
+// --server=path/to/http_server starts the server in a scratch directory with a
+// throwaway certificate and a static tree (/index.html, 1 KiB; /large.bin, 1 MiB). The
+// /proxy paths get a stub backend on --backend-port unless something listens there
+// already. --suite runs a fixed set of scenarios (static, fixed rate, proxy, h2, a new
+// connection per request), and --json and --compare work as in micro_bench.
+//
+//   ./bench/load_gen --suite --server=./http_server --json=before.json
+
+#include "bench_util.hpp"
+#include "stub_backend.hpp"
+#include "tls_util.hpp"
+#include <nghttp2/nghttp2.h>
+#include <openssl/ssl.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace {
+
+// Log-linear histogram of nanoseconds: 128 sub-buckets per power of two, so a
+// percentile is within 1% of the recorded value.
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts_(kBuckets, 0) {}
+
+    void record(uint64_t ns, uint64_t n = 1) {
+        counts_[index(ns)] += n;
+        total_ += n;
+        sum_ += static_cast<double>(ns) * n;
+        max_ = std::max(max_, ns);
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? sum_ / total_ : 0; }
+
+    uint64_t percentile(double q) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(upperBound(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    // HdrHistogram's correction for coordinated omission: a request that took v while
+    // requests were expected every `interval` stands in for the ones that would have
+    // been sent meanwhile, which would have waited v - interval, v - 2 * interval, ...
+    LatencyHistogram corrected(uint64_t interval) const {
+        LatencyHistogram out = *this;
+        if (interval == 0) {
+            return out;
+        }
+        for (size_t i = 0; i < kBuckets; ++i) {
+            uint64_t value = std::min(upperBound(i), max_);
+            if (counts_[i] == 0 || value <= interval) {
+                continue;
+            }
+            for (uint64_t missing = value - interval; missing >= interval; missing -= interval) {
+                out.record(missing, counts_[i]);
+            }
+        }
+        return out;
+    }
+
+private:
+    static const size_t kSubBucketBits = 7;
+    static const size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static const size_t kMaxBits = 40;
+    static const size_t kBuckets = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    static size_t index(uint64_t ns) {
+        if (ns < kSubBuckets) {
+            return ns;
+        }
+        size_t msb = 63 - __builtin_clzll(ns);
+        if (msb >= kMaxBits) {
+            return kBuckets - 1;
+        }
+        size_t shift = msb - kSubBucketBits;
+        return (shift + 1) * kSubBuckets + ((ns >> shift) & (kSubBuckets - 1));
+    }
+
+    static uint64_t upperBound(size_t i) {
+        if (i < kSubBuckets) {
+            return i + 1;
+        }
+        size_t shift = i / kSubBuckets - 1;
+        return (kSubBuckets + i % kSubBuckets + 1) << shift;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    double sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    bool tls = true;
+    bool h2 = false;
+    size_t connections = 32;
+    size_t threads = 1;
+    size_t streams = 16;        // h2 requests in flight per connection
+    double rate = 0;            // requests/s over all connections; 0 is closed loop
+    double duration = 10;       // seconds measured
+    double warmup = 1;          // seconds run first and not measured
+    long requests_per_conn = 0; // reconnect after this many requests; 0 is never
+    std::vector<std::string> paths = {"/index.html"};
+};
+
+struct Stats {
+    LatencyHistogram latency; // intended or actual send to the last byte of the response
+    LatencyHistogram setup;   // connect() to the finished TLS handshake
+    uint64_t completed = 0;
+    uint64_t bad_status = 0; // answered, but not 2xx or 3xx
+    uint64_t errors = 0;     // requests lost to a broken connection or a protocol error
+    uint64_t retried = 0;    // sent again because the server closed the connection first
+    uint64_t connect_errors = 0;
+    uint64_t bytes = 0;
+    uint64_t unfinished = 0; // due before the end but not answered by then
+    double cpu_seconds = 0;  // of the client threads
+
+    void merge(const Stats &other) {
+        latency.merge(other.latency);
+        setup.merge(other.setup);
+        completed += other.completed;
+        bad_status += other.bad_status;
+        errors += other.errors;
+        retried += other.retried;
+        connect_errors += other.connect_errors;
+        bytes += other.bytes;
+        unfinished += other.unfinished;
+        cpu_seconds += other.cpu_seconds;
+    }
+};
+
+std::vector<std::string> splitList(const std::string &list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        if (comma > start) {
+            items.push_back(list.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return items;
+}
+
+bool startsWithNoCase(const char *p, const char *end, const char *prefix) {
+    size_t n = std::strlen(prefix);
+    return static_cast<size_t>(end - p) >= n && strncasecmp(p, prefix, n) == 0;
+}
+
+// Length of the complete HTTP/1.1 response at the start of in, or 0 if more is needed;
+// -1 if it cannot be parsed.
+long responseLength(const std::string &in, int &status, bool &close) {
+    size_t head_end = in.find("\r\n\r\n");
+    if (head_end == std::string::npos) {
+        return in.size() > 64 * 1024 ? -1 : 0;
+    }
+    if (in.compare(0, 9, "HTTP/1.1 ") != 0 && in.compare(0, 9, "HTTP/1.0 ") != 0) {
+        return -1;
+    }
+    status = std::atoi(in.c_str() + 9);
+    close = in.compare(0, 9, "HTTP/1.0 ") == 0;
+    long content_length = -1;
+    bool chunked = false;
+    const char *p = in.data();
+    const char *end = p + head_end;
+    while ((p = static_cast<const char *>(std::memchr(p, '\n', end - p))) != nullptr) {
+        ++p;
+        if (startsWithNoCase(p, end, "content-length:")) {
+            content_length = std::strtol(p + 15, nullptr, 10);
+        } else if (startsWithNoCase(p, end, "transfer-encoding:")) {
+            chunked = true;
+        } else if (startsWithNoCase(p, end, "connection:")) {
+            const char *value = p + 11;
+            while (value < end && *value == ' ') {
+                ++value;
+            }
+            close = startsWithNoCase(value, end, "close");
+        }
+    }
+
+    size_t body = head_end + 4;
+    if (!chunked) {
+        size_t length = body + (content_length > 0 ? content_length : 0);
+        return in.size() >= length ? static_cast<long>(length) : 0;
+    }
+    size_t pos = body;
+    while (true) {
+        size_t line_end = in.find("\r\n", pos);
+        if (line_end == std::string::npos) {
+            return 0;
+        }
+        size_t chunk = std::strtoul(in.c_str() + pos, nullptr, 16);
+        pos = line_end + 2;
+        if (chunk == 0) {
+            size_t trailer_end = in.find("\r\n\r\n", pos - 2);
+            return trailer_end == std::string::npos ? 0 : static_cast<long>(trailer_end + 4);
+        }
+        pos += chunk + 2;
+        if (pos > in.size()) {
+            return 0;
+        }
+    }
+}
+
+// One epoll thread driving its share of the connections.
+class Worker {
+public:
+    Worker(const Options &options, SSL_CTX *ctx, size_t first, size_t count, bench::Clock::time_point start,
+           bench::Clock::time_point measure_start, bench::Clock::time_point end)
+        : options_(options), ctx_(ctx), conns_(count), measure_start_(measure_start), end_(end) {
+        epoll_fd_ = epoll_create1(0);
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = kTimerTag;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev);
+        if (options_.rate > 0) {
+            interval_ = std::chrono::nanoseconds(static_cast<int64_t>(options_.connections * 1e9 / options_.rate));
+        }
+        for (size_t i = 0; i < count; ++i) {
+            Conn &c = conns_[i];
+            c.worker = this;
+            c.index = i;
+            c.next_path = first + i;
+            // Spread the connections' schedules evenly over one interval.
+            c.next_due = start + std::chrono::nanoseconds(static_cast<int64_t>(
+                                     options_.rate > 0 ? (first + i) * 1e9 / options_.rate : 0));
+            c.retry_at = start;
+        }
+        for (const std::string &path : options_.paths) {
+            h1_requests_.push_back("GET " + path + " HTTP/1.1\r\nHost: " + options_.host + ":" +
+                                   std::to_string(options_.port) + "\r\nUser-Agent: blaze-load-gen\r\nAccept: */*\r\n\r\n");
+        }
+        authority_ = options_.host + ":" + std::to_string(options_.port);
+    }
+
+    ~Worker() {
+        for (Conn &c : conns_) {
+            reset(c);
+        }
+        close(timer_fd_);
+        close(epoll_fd_);
+    }
+
+    void run() {
+        double cpu_start = threadCpuSeconds();
+        epoll_event events[256];
+        scan(bench::Clock::now());
+        while (bench::Clock::now() < end_) {
+            int n = epoll_wait(epoll_fd_, events, 256, -1);
+            bool timer = false;
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.u64 == kTimerTag) {
+                    uint64_t expirations;
+                    ssize_t r = ::read(timer_fd_, &expirations, sizeof(expirations));
+                    (void)r;
+                    timer = true;
+                    continue;
+                }
+                Conn &c = conns_[events[i].data.u64];
+                if (c.fd != -1) {
+                    onEvent(c, events[i].events);
+                }
+            }
+            if (timer) {
+                scan(bench::Clock::now());
+            }
+        }
+        finish();
+        stats.cpu_seconds = threadCpuSeconds() - cpu_start;
+    }
+
+    Stats stats;
+
+private:
+    static const uint64_t kTimerTag = ~uint64_t(0);
+
+    enum class State { Closed, Connecting, Handshaking, Ready };
+
+    struct Sent {
+        size_t path;
+        bench::Clock::time_point start;
+    };
+
+    struct Stream {
+        Sent sent;
+        int status = 0;
+        size_t bytes = 0;
+    };
+
+    struct Conn {
+        Worker *worker = nullptr;
+        size_t index = 0;
+        int fd = -1;
+        SSL *ssl = nullptr;
+        nghttp2_session *h2 = nullptr;
+        State state = State::Closed;
+        bench::Clock::time_point setup_started;
+        bench::Clock::time_point retry_at;
+        bench::Clock::time_point next_due; // fixed rate: when the next request is due
+        std::string out;
+        size_t out_sent = 0;
+        std::string in;
+        std::deque<Sent> in_flight;                  // HTTP/1.1, oldest first
+        std::unordered_map<int32_t, Stream> streams; // h2
+        std::deque<Sent> retry;                      // to send again on the next connection
+        long issued = 0;
+        long answered = 0;
+        bool closing = false; // no more requests on this connection
+        size_t next_path = 0;
+    };
+
+    static double threadCpuSeconds() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    bool measuring(bench::Clock::time_point now) const { return now >= measure_start_ && now < end_; }
+
+    size_t inFlight(const Conn &c) const { return options_.h2 ? c.streams.size() : c.in_flight.size(); }
+
+    bool canIssue(const Conn &c) const {
+        return c.state == State::Ready && !c.closing && inFlight(c) < (options_.h2 ? options_.streams : 1) &&
+               (options_.requests_per_conn == 0 || c.issued < options_.requests_per_conn);
+    }
+
+    // Runs when the timer fires: opens connections whose retry time has come, sends due
+    // requests and sets the timer for the next thing that has to happen without a
+    // socket event. A busy connection is not waited for; its next response drives it.
+    void scan(bench::Clock::time_point now) {
+        armed_ = end_;
+        for (Conn &c : conns_) {
+            if (c.state == State::Closed) {
+                if (c.retry_at <= now) {
+                    open(c, now);
+                } else {
+                    armed_ = std::min(armed_, c.retry_at);
+                }
+            }
+            if (options_.rate > 0 && canIssue(c)) {
+                if (c.next_due <= now) {
+                    drive(c);
+                }
+                if (canIssue(c)) {
+                    armed_ = std::min(armed_, c.next_due);
+                }
+            }
+        }
+        setTimer(armed_);
+    }
+
+    // Makes the timer fire at `when` if that is earlier than it would.
+    void wakeAt(bench::Clock::time_point when) {
+        if (when < armed_) {
+            armed_ = when;
+            setTimer(when);
+        }
+    }
+
+    // steady_clock is CLOCK_MONOTONIC.
+    void setTimer(bench::Clock::time_point when) {
+        struct itimerspec spec {};
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = std::max<int64_t>(ns % 1000000000, 1);
+        timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void open(Conn &c, bench::Clock::time_point now) {
+        c.setup_started = now;
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(options_.port);
+        inet_pton(AF_INET, options_.host.c_str(), &addr.sin_addr);
+        if (connect(c.fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+            connectFailed(c);
+            return;
+        }
+        c.state = State::Connecting;
+        struct epoll_event ev {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u64 = c.index;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    void connectFailed(Conn &c) {
+        ++stats.connect_errors;
+        reset(c);
+        c.retry_at = bench::Clock::now() + std::chrono::milliseconds(100);
+        wakeAt(c.retry_at);
+    }
+
+    void reset(Conn &c) {
+        if (c.h2) {
+            nghttp2_session_del(c.h2);
+            c.h2 = nullptr;
+        }
+        if (c.ssl) {
+            SSL_free(c.ssl);
+            c.ssl = nullptr;
+        }
+        if (c.fd != -1) {
+            close(c.fd);
+            c.fd = -1;
+        }
+        c.state = State::Closed;
+        c.out.clear();
+        c.out_sent = 0;
+        c.in.clear();
+        c.in_flight.clear();
+        c.streams.clear();
+        c.issued = 0;
+        c.answered = 0;
+        c.closing = false;
+    }
+
+    // Closes the connection and opens the next one right away. Requests still in
+    // flight are lost, unless the server closed a connection it had answered on before
+    // without starting on them: HTTP lets it close an idle keep-alive connection, and
+    // clients then resend, as happens here with the original start time.
+    void reconnect(Conn &c, bool closed_idle = false) {
+        if (closed_idle && c.answered > 0 && c.in.empty()) {
+            for (const Sent &sent : c.in_flight) {
+                c.retry.push_back(sent);
+            }
+            for (const auto &stream : c.streams) {
+                c.retry.push_back(stream.second.sent);
+            }
+            stats.retried += inFlight(c);
+        } else {
+            stats.errors += inFlight(c);
+        }
+        reset(c);
+        c.retry_at = bench::Clock::now();
+        if (c.retry_at < end_) {
+            open(c, c.retry_at);
+        }
+    }
+
+    void onEvent(Conn &c, uint32_t events) {
+        if (c.state == State::Connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                connectFailed(c);
+                return;
+            }
+            if (!(events & EPOLLOUT)) {
+                return;
+            }
+            if (options_.tls) {
+                c.ssl = SSL_new(ctx_);
+                SSL_set_fd(c.ssl, c.fd);
+                SSL_set_tlsext_host_name(c.ssl, "localhost");
+                SSL_set_connect_state(c.ssl);
+                c.state = State::Handshaking;
+            } else if (!ready(c)) {
+                return;
+            }
+        }
+        drive(c);
+    }
+
+    bool ready(Conn &c) {
+        if (options_.h2 && options_.tls) {
+            const unsigned char *alpn = nullptr;
+            unsigned int alpn_len = 0;
+            SSL_get0_alpn_selected(c.ssl, &alpn, &alpn_len);
+            if (alpn_len != 2 || std::memcmp(alpn, "h2", 2) != 0) {
+                std::fprintf(stderr, "load_gen: the server did not agree to h2\n");
+                std::exit(1);
+            }
+        }
+        auto now = bench::Clock::now();
+        if (measuring(now)) {
+            stats.setup.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - c.setup_started).count());
+        }
+        c.state = State::Ready;
+        if (options_.h2) {
+            startH2(c);
+        }
+        return true;
+    }
+
+    // Moves the connection along as far as it goes without blocking: handshake, new
+    // requests, writes, reads and the responses they complete.
+    void drive(Conn &c) {
+        if (c.state == State::Handshaking) {
+            int r = SSL_do_handshake(c.ssl);
+            if (r != 1) {
+                int err = SSL_get_error(c.ssl, r);
+                if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+                    connectFailed(c);
+                }
+                return;
+            }
+            ready(c);
+        }
+        if (c.state != State::Ready) {
+            return;
+        }
+        while (true) {
+            uint64_t before = completions_;
+            issue(c);
+            if (!flush(c) || !receive(c)) {
+                return;
+            }
+            if (completions_ == before) {
+                break;
+            }
+        }
+        if (options_.rate > 0 && canIssue(c)) {
+            wakeAt(c.next_due);
+        }
+    }
+
+    void issue(Conn &c) {
+        auto now = bench::Clock::now();
+        while (canIssue(c)) {
+            Sent sent{0, now};
+            if (!c.retry.empty()) {
+                sent = c.retry.front();
+                c.retry.pop_front();
+            } else {
+                if (options_.rate > 0) {
+                    if (c.next_due > now) {
+                        break;
+                    }
+                    sent.start = c.next_due;
+                    c.next_due += interval_;
+                }
+                sent.path = c.next_path++ % options_.paths.size();
+            }
+            ++c.issued;
+            if (options_.h2) {
+                submitH2(c, sent);
+            } else {
+                c.out += h1_requests_[sent.path];
+                c.in_flight.push_back(sent);
+            }
+        }
+    }
+
+    // -1 for would block, 0 for end of stream or error.
+    ssize_t readSome(Conn &c, char *buf, size_t len) {
+        if (!c.ssl) {
+            ssize_t n = ::read(c.fd, buf, len);
+            return n >= 0 ? n : (errno == EAGAIN || errno == EINTR ? -1 : 0);
+        }
+        int n = SSL_read(c.ssl, buf, static_cast<int>(len));
+        if (n > 0) {
+            return n;
+        }
+        int err = SSL_get_error(c.ssl, n);
+        return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? -1 : 0;
+    }
+
+    ssize_t writeSome(Conn &c, const char *buf, size_t len) {
+        if (!c.ssl) {
+            ssize_t n = ::write(c.fd, buf, len);
+            return n >= 0 ? n : (errno == EAGAIN || errno == EINTR ? -1 : 0);
+        }
+        int n = SSL_write(c.ssl, buf, static_cast<int>(len));
+        if (n > 0) {
+            return n;
+        }
+        int err = SSL_get_error(c.ssl, n);
+        return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? -1 : 0;
+    }
+
+    bool flush(Conn &c) {
+        if (c.h2) {
+            const uint8_t *data;
+            ssize_t n;
+            while ((n = nghttp2_session_mem_send(c.h2, &data)) > 0) {
+                c.out.append(reinterpret_cast<const char *>(data), n);
+            }
+        }
+        while (c.out_sent < c.out.size()) {
+            ssize_t n = writeSome(c, c.out.data() + c.out_sent, c.out.size() - c.out_sent);
+            if (n == -1) {
+                return true;
+            }
+            if (n == 0) {
+                reconnect(c);
+                return false;
+            }
+            c.out_sent += n;
+        }
+        c.out.clear();
+        c.out_sent = 0;
+        return true;
+    }
+
+    bool receive(Conn &c) {
+        char buf[64 * 1024];
+        while (true) {
+            ssize_t n = readSome(c, buf, sizeof(buf));
+            if (n == -1) {
+                break;
+            }
+            if (n == 0) {
+                reconnect(c, true);
+                return false;
+            }
+            if (c.h2) {
+                if (nghttp2_session_mem_recv(c.h2, reinterpret_cast<const uint8_t *>(buf), n) < 0) {
+                    reconnect(c);
+                    return false;
+                }
+                continue;
+            }
+            c.in.append(buf, n);
+            int status = 0;
+            bool close_after = false;
+            long length;
+            while (!c.in.empty() && (length = responseLength(c.in, status, close_after)) != 0) {
+                if (length < 0 || c.in_flight.empty()) {
+                    reconnect(c);
+                    return false;
+                }
+                complete(c, c.in_flight.front().start, status, length);
+                c.in_flight.pop_front();
+                c.in.erase(0, length);
+                c.closing = c.closing || close_after;
+            }
+        }
+
+        bool spent = options_.requests_per_conn > 0 && c.issued >= options_.requests_per_conn;
+        bool h2_done = c.h2 && !nghttp2_session_want_read(c.h2) && !nghttp2_session_want_write(c.h2);
+        if (inFlight(c) == 0 && (c.closing || spent || h2_done)) {
+            reconnect(c);
+            return false;
+        }
+        return true;
+    }
+
+    void complete(Conn &c, bench::Clock::time_point start, int status, size_t bytes) {
+        ++completions_;
+        ++c.answered;
+        auto now = bench::Clock::now();
+        if (!measuring(now)) {
+            return;
+        }
+        stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+        ++stats.completed;
+        stats.bytes += bytes;
+        if (status < 200 || status >= 400) {
+            ++stats.bad_status;
+        }
+    }
+
+    // ---- h2, on an nghttp2 client session ----
+
+    void startH2(Conn &c) {
+        nghttp2_session_callbacks *callbacks;
+        nghttp2_session_callbacks_new(&callbacks);
+        nghttp2_session_callbacks_set_on_header_callback(
+            callbacks, [](nghttp2_session *, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+                          const uint8_t *value, size_t, uint8_t, void *user_data) -> int {
+                Conn &c = *static_cast<Conn *>(user_data);
+                auto it = c.streams.find(frame->hd.stream_id);
+                if (it != c.streams.end() && namelen == 7 && std::memcmp(name, ":status", 7) == 0) {
+                    it->second.status = std::atoi(reinterpret_cast<const char *>(value));
+                }
+                return 0;
+            });
+        nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+            callbacks,
+            [](nghttp2_session *, uint8_t, int32_t stream_id, const uint8_t *, size_t len, void *user_data) -> int {
+                Conn &c = *static_cast<Conn *>(user_data);
+                auto it = c.streams.find(stream_id);
+                if (it != c.streams.end()) {
+                    it->second.bytes += len;
+                }
+                return 0;
+            });
+        nghttp2_session_callbacks_set_on_stream_close_callback(
+            callbacks, [](nghttp2_session *, int32_t stream_id, uint32_t error_code, void *user_data) -> int {
+                Conn &c = *static_cast<Conn *>(user_data);
+                Worker &w = *c.worker;
+                auto it = c.streams.find(stream_id);
+                if (it == c.streams.end()) {
+                    return 0;
+                }
+                if (error_code == NGHTTP2_REFUSED_STREAM) {
+                    // Not processed, e.g. beyond the last stream of a GOAWAY; safe to resend.
+                    c.retry.push_back(it->second.sent);
+                    ++w.stats.retried;
+                } else if (error_code != NGHTTP2_NO_ERROR) {
+                    ++w.stats.errors;
+                } else {
+                    w.complete(c, it->second.sent.start, it->second.status, it->second.bytes);
+                }
+                c.streams.erase(it);
+                return 0;
+            });
+        nghttp2_session_client_new(&c.h2, callbacks, &c);
+        nghttp2_session_callbacks_del(callbacks);
+
+        nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100},
+                                             {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1 << 24}};
+        nghttp2_submit_settings(c.h2, NGHTTP2_FLAG_NONE, settings, 2);
+        nghttp2_session_set_local_window_size(c.h2, NGHTTP2_FLAG_NONE, 0, 1 << 26);
+    }
+
+    void submitH2(Conn &c, const Sent &sent) {
+        const std::string &target = options_.paths[sent.path];
+        auto nv = [](const char *name, const std::string &value) {
+            return nghttp2_nv{(uint8_t *)name, (uint8_t *)value.data(), std::strlen(name), value.size(),
+                              NGHTTP2_NV_FLAG_NONE};
+        };
+        static const std::string get = "GET";
+        const std::string &scheme = options_.tls ? https_ : http_;
+        nghttp2_nv headers[] = {nv(":method", get), nv(":scheme", scheme), nv(":authority", authority_),
+                                nv(":path", target)};
+        int32_t id = nghttp2_submit_request(c.h2, nullptr, headers, 4, nullptr, nullptr);
+        if (id < 0) {
+            ++stats.errors;
+            c.closing = true;
+            return;
+        }
+        c.streams[id] = Stream{sent};
+    }
+
+    // At a fixed rate, requests that were due but not answered when the run ended.
+    void finish() {
+        if (options_.rate <= 0) {
+            return;
+        }
+        for (Conn &c : conns_) {
+            stats.unfinished += inFlight(c) + c.retry.size();
+            if (c.next_due < end_) {
+                stats.unfinished += (end_ - c.next_due) / interval_ + 1;
+            }
+        }
+    }
+
+    const Options &options_;
+    SSL_CTX *ctx_;
+    std::vector<Conn> conns_;
+    bench::Clock::time_point measure_start_;
+    bench::Clock::time_point end_;
+    bench::Clock::duration interval_{0}; // per connection, fixed rate
+    int epoll_fd_;
+    int timer_fd_;
+    std::vector<std::string> h1_requests_;
+    std::string authority_;
+    const std::string https_ = "https";
+    const std::string http_ = "http";
+    uint64_t completions_ = 0;
+    bench::Clock::time_point armed_; // when the timer fires next
+};
+
+struct RunResult {
+    Stats stats;
+    double seconds;
+    LatencyHistogram corrected;
+    uint64_t interval_ns; // used for the correction
+};
+
+RunResult runLoad(const Options &options) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    static const unsigned char kH2[] = "\x02h2";
+    static const unsigned char kH1[] = "\x08http/1.1";
+    if (options.h2) {
+        SSL_CTX_set_alpn_protos(ctx, kH2, 3);
+    } else {
+        SSL_CTX_set_alpn_protos(ctx, kH1, 9);
+    }
+
+    auto start = bench::Clock::now();
+    auto measure_start = start + std::chrono::duration_cast<bench::Clock::duration>(
+                                     std::chrono::duration<double>(options.warmup));
+    auto end = measure_start + std::chrono::duration_cast<bench::Clock::duration>(
+                                   std::chrono::duration<double>(options.duration));
+    size_t threads = std::max<size_t>(1, std::min(options.threads, options.connections));
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> running;
+    size_t first = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        size_t count = options.connections / threads + (t < options.connections % threads ? 1 : 0);
+        workers.push_back(std::make_unique<Worker>(options, ctx, first, count, start, measure_start, end));
+        first += count;
+    }
+    for (auto &worker : workers) {
+        running.emplace_back([&worker] { worker->run(); });
+    }
+    for (std::thread &thread : running) {
+        thread.join();
+    }
+
+    RunResult result;
+    for (auto &worker : workers) {
+        result.stats.merge(worker->stats);
+    }
+    workers.clear();
+    SSL_CTX_free(ctx);
+    result.seconds = options.duration;
+    if (options.rate > 0) {
+        // Already timed from the schedule.
+        result.interval_ns = 0;
+    } else {
+        result.interval_ns = result.stats.latency.percentile(0.5);
+    }
+    result.corrected = result.stats.latency.corrected(result.interval_ns);
+    return result;
+}
+
+void printResult(const Options &options, const RunResult &r) {
+    const Stats &s = r.stats;
+    std::printf("%s%s, %zu connections%s on %zu threads, ", options.h2 ? "h2" : "HTTP/1.1",
+                options.tls ? " over TLS" : "", options.connections,
+                options.h2 ? (" x " + std::to_string(options.streams) + " streams").c_str() : "",
+                std::max<size_t>(1, std::min(options.threads, options.connections)));
+    if (options.rate > 0) {
+        std::printf("fixed rate %.0f/s", options.rate);
+    } else {
+        std::printf("closed loop");
+    }
+    if (options.requests_per_conn > 0) {
+        std::printf(", %ld requests per connection", options.requests_per_conn);
+    }
+    std::printf(", %.1f s\n  paths:", r.seconds);
+    for (const std::string &path : options.paths) {
+        std::printf(" %s", path.c_str());
+    }
+    std::printf("\n  requests %llu (%.1f/s), %.1f MB/s, %llu not 2xx/3xx, %llu errors, %llu retried",
+                static_cast<unsigned long long>(s.completed), s.completed / r.seconds, s.bytes / r.seconds / 1e6,
+                static_cast<unsigned long long>(s.bad_status), static_cast<unsigned long long>(s.errors),
+                static_cast<unsigned long long>(s.retried));
+    if (options.rate > 0) {
+        std::printf(", %llu unfinished", static_cast<unsigned long long>(s.unfinished));
+    }
+    std::printf("\n");
+    std::printf("  client CPU %.1f us per request\n", s.completed ? s.cpu_seconds * 1e6 / s.completed : 0.0);
+    if (s.setup.count() > 0 || s.connect_errors > 0) {
+        std::printf("  connection setup: %llu, p50 %.3f ms, p99 %.3f ms; %llu failed\n",
+                    static_cast<unsigned long long>(s.setup.count()), s.setup.percentile(0.5) / 1e6,
+                    s.setup.percentile(0.99) / 1e6, static_cast<unsigned long long>(s.connect_errors));
+    }
+    std::printf("  latency ms      mean      p50      p90      p99    p99.9      max\n");
+    auto row = [](const char *label, const LatencyHistogram &h) {
+        std::printf("  %-11s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", label, h.mean() / 1e6, h.percentile(0.5) / 1e6,
+                    h.percentile(0.9) / 1e6, h.percentile(0.99) / 1e6, h.percentile(0.999) / 1e6, h.max() / 1e6);
+    };
+    if (options.rate > 0) {
+        row("scheduled", r.corrected);
+    } else {
+        row("corrected", r.corrected);
+        row("raw", s.latency);
+    }
+}
+
+void addJson(std::vector<bench::JsonResult> &json, const std::string &name, const RunResult &r) {
+    const Stats &s = r.stats;
+    long n = static_cast<long>(s.completed);
+    double ns_per_request = n ? r.seconds * 1e9 / n : 0;
+    json.push_back({name + "/request", n, ns_per_request, n ? s.cpu_seconds * 1e9 / n : 0,
+                    {{"requests_per_second", n / r.seconds},
+                     {"errors", static_cast<double>(s.errors + s.bad_status + s.connect_errors)}}});
+    const std::pair<const char *, double> quantiles[] = {{"p50", 0.5}, {"p99", 0.99}, {"p99.9", 0.999}};
+    for (const auto &q : quantiles) {
+        double value = static_cast<double>(r.corrected.percentile(q.second));
+        json.push_back({name + "/latency_" + q.first, n, value, value, {}});
+    }
+    if (s.setup.count() > 0) {
+        double value = static_cast<double>(s.setup.percentile(0.5));
+        json.push_back({name + "/setup_p50", static_cast<long>(s.setup.count()), value, value, {}});
+    }
+}
+
+bool listening(int port) {
+    int fd = bench::connectLoopback(port);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+// http_server run from a scratch directory holding a throwaway certificate and a small
+// static tree.
+class SpawnedServer {
+public:
+    SpawnedServer(const std::string &binary, int port) {
+        char dir_template[] = "/tmp/load_gen.XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            throw std::runtime_error("mkdtemp failed");
+        }
+        dir_ = dir_template;
+        bench::writeSelfSignedCert(dir_ + "/server.crt", dir_ + "/server.key");
+        mkdir((dir_ + "/static").c_str(), 0755);
+        const std::string tail = "</body></html>\n";
+        std::string page = "<!DOCTYPE html>\n<html><head><title>load_gen</title></head><body>\n";
+        while (page.size() + tail.size() < 1024) {
+            page += "<p>The quick brown fox jumps over the lazy dog.</p>\n";
+        }
+        page.resize(1024 - tail.size());
+        std::ofstream(dir_ + "/static/index.html") << page << tail;
+        std::ofstream(dir_ + "/static/large.bin", std::ios::binary) << std::string(1 << 20, 'z');
+
+        std::string absolute = binary;
+        if (!absolute.empty() && absolute[0] != '/') {
+            char cwd[4096];
+            absolute = std::string(getcwd(cwd, sizeof(cwd)) ? cwd : ".") + "/" + binary;
+        }
+        if (listening(port)) {
+            throw std::runtime_error("something already listens on port " + std::to_string(port));
+        }
+        pid_ = fork();
+        if (pid_ == 0) {
+            if (chdir(dir_.c_str()) != 0) {
+                _exit(127);
+            }
+            int log = ::open("server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            execl(absolute.c_str(), absolute.c_str(), static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        for (int i = 0; i < 200 && !listening(port); ++i) {
+            int status;
+            if (waitpid(pid_, &status, WNOHANG) == pid_) {
+                pid_ = -1;
+                throw std::runtime_error(binary + " exited; see " + dir_ + "/server.log");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (!listening(port)) {
+            throw std::runtime_error(binary + " did not start listening on port " + std::to_string(port));
+        }
+    }
+
+    ~SpawnedServer() {
+        if (pid_ > 0) {
+            kill(pid_, SIGTERM);
+            waitpid(pid_, nullptr, 0);
+        }
+        std::string cleanup = "rm -rf '" + dir_ + "'";
+        if (std::system(cleanup.c_str()) != 0) {
+            std::fprintf(stderr, "load_gen: could not remove %s\n", dir_.c_str());
+        }
+    }
+
+private:
+    std::string dir_;
+    pid_t pid_ = -1;
+};
+
+struct Scenario {
+    const char *name;
+    std::function<void(Options &)> adjust;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf(
+            "usage: load_gen [--host=127.0.0.1] [--port=8080] [--tls=1] [--h2] [--connections=32] [--threads=1]\n"
+            "                [--streams=16] [--rate=0 (closed loop)] [--duration=10] [--warmup=1]\n"
+            "                [--requests-per-connection=0] [--paths=/index.html,/proxy/]\n"
+            "                [--server=path/to/http_server] [--backend-port=8081] [--backend-body=1024]\n"
+            "                [--suite] [--json=out.json] [--compare=baseline.json]\n");
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Options options;
+    options.host = args.get("host", options.host);
+    options.port = static_cast<int>(args.getInt("port", options.port));
+    options.tls = args.getInt("tls", 1) != 0;
+    options.h2 = args.getInt("h2", 0) != 0;
+    options.connections = std::max(1L, args.getInt("connections", static_cast<long>(options.connections)));
+    options.threads = std::max(1L, args.getInt("threads", static_cast<long>(options.threads)));
+    options.streams = std::max(1L, args.getInt("streams", static_cast<long>(options.streams)));
+    options.rate = args.getDouble("rate", 0);
+    options.duration = args.getDouble("duration", args.getInt("suite", 0) ? 5 : options.duration);
+    options.warmup = args.getDouble("warmup", options.warmup);
+    options.requests_per_conn = args.getInt("requests-per-connection", 0);
+    if (!args.get("paths", "").empty()) {
+        options.paths = splitList(args.get("paths", ""));
+    }
+    bool suite = args.getInt("suite", 0) != 0;
+    std::string server_binary = args.get("server", "");
+    int backend_port = static_cast<int>(args.getInt("backend-port", 8081));
+    std::string json_path = args.get("json", "");
+    std::string compare_path = args.get("compare", "");
+
+    std::map<std::string, double> baseline;
+    if (!compare_path.empty()) {
+        baseline = bench::readJsonBaseline(compare_path);
+        if (baseline.empty()) {
+            std::fprintf(stderr, "load_gen: no results in %s\n", compare_path.c_str());
+            return 1;
+        }
+    }
+
+    bool proxied = suite;
+    for (const std::string &path : options.paths) {
+        proxied = proxied || path.compare(0, 6, "/proxy") == 0;
+    }
+    std::unique_ptr<bench::StubBackend> backend;
+    std::unique_ptr<SpawnedServer> server;
+    try {
+        if (proxied && backend_port > 0) {
+            if (listening(backend_port)) {
+                std::printf("using the backend already listening on port %d\n", backend_port);
+            } else {
+                backend = std::make_unique<bench::StubBackend>(args.getInt("backend-body", 1024), false, backend_port);
+            }
+        }
+        if (!server_binary.empty()) {
+            server = std::make_unique<SpawnedServer>(server_binary, options.port);
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "load_gen: %s\n", e.what());
+        return 1;
+    }
+
+    std::vector<Scenario> scenarios;
+    if (suite) {
+        scenarios = {
+            {"h1/static", [](Options &o) { o.paths = {"/index.html"}; }},
+            {"h1/static_rate", [](Options &o) { o.paths = {"/index.html"}; }}, // rate set from h1/static
+            {"h1/proxy", [](Options &o) { o.paths = {"/proxy/"}; }},
+            {"h2/static",
+             [](Options &o) {
+                 o.paths = {"/index.html"};
+                 o.h2 = true;
+                 o.connections = std::max<size_t>(1, o.connections / 4);
+             }},
+            {"h1/new_connection",
+             [](Options &o) {
+                 o.paths = {"/index.html"};
+                 o.requests_per_conn = 1;
+             }},
+        };
+    } else {
+        scenarios = {{"run", [](Options &) {}}};
+    }
+
+    std::vector<bench::JsonResult> json;
+    double closed_loop_rate = 0;
+    for (const Scenario &scenario : scenarios) {
+        Options run = options;
+        scenario.adjust(run);
+        if (suite) {
+            // The rate run offers half of what the closed loop reached: the latency of a
+            // server that keeps up.
+            run.rate = std::string(scenario.name) == "h1/static_rate" ? std::max(100.0, closed_loop_rate / 2) : 0;
+        }
+        if (suite) {
+            std::printf("== %s\n", scenario.name);
+        }
+        RunResult result = runLoad(run);
+        printResult(run, result);
+        if (suite && std::string(scenario.name) == "h1/static") {
+            closed_loop_rate = result.stats.completed / result.seconds;
+        }
+        size_t first = json.size();
+        addJson(json, scenario.name, result);
+        if (!baseline.empty()) {
+            for (size_t i = first; i < json.size(); ++i) {
+                auto base = baseline.find(json[i].name);
+                if (base != baseline.end() && base->second > 0) {
+                    std::printf("  %-28s %+7.1f%% vs baseline\n", json[i].name.c_str(),
+                                (json[i].real_ns / base->second - 1) * 100);
+                }
+            }
+        }
+        std::fflush(stdout);
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream out(json_path);
+        out << bench::jsonReport("load_gen", json, 1);
+        if (!out) {
+            std::fprintf(stderr, "load_gen: cannot write %s\n", json_path.c_str());
+            return 1;
+        }
+        std::printf("results written to %s\n", json_path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Cost of a log line at the call site, per thread, for --threads threads logging at once:
+//   ostream      - what the server did before Logger: a line streamed to std::cout
+//                  (redirected to /dev/null here) and flushed with std::endl
+//   async        - LOG_INFO with the line written by the background thread; "drained"
+//                  adds the time until Logger::flush() returns, and records dropped
+//                  because a ring filled up are reported
+//   filtered     - LOG_INFO with the run-time level raised to Warn
+//   compiled out - LOG_TRACE, which a default (INFO) build removes entirely
+// Every line has the shape of the old per-event trace: "Calling callback for fd {} with
+// events {}".
+
+#include "bench_util.hpp"
+#include <fcntl.h>
+#include <thread>
+
+namespace {
+
+template <typename F>
+double nsPerCall(size_t threads, long per_thread, F &&body) {
+    std::vector<std::thread> workers;
+    auto start = bench::Clock::now();
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&body, per_thread, t] {
+            for (long i = 0; i < per_thread; ++i) {
+                body(static_cast<int>(t), i);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    return bench::secondsSince(start) * 1e9 / per_thread;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: log_bench [--threads=4] [--lines=200000] (per thread)\n");
+        return 0;
+    }
+    size_t threads = args.getInt("threads", 4);
+    long lines = args.getInt("lines", 200000);
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1) {
+        std::perror("/dev/null");
+        return 1;
+    }
+    Logger::setOutput(null_fd);
+    std::printf("%zu threads, %ld lines each; ns per line per thread\n", threads, lines);
+
+    // std::cout goes to /dev/null too, by way of fd 1.
+    int saved_stdout = dup(STDOUT_FILENO);
+    std::fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    double ostream_ns = nsPerCall(threads, lines, [](int fd, long i) {
+        std::cout << "Calling callback for fd " << fd << " with events " << i << std::endl;
+    });
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    std::printf("ostream + endl    %8.1f\n", ostream_ns);
+
+    Logger::setLevel(LogLevel::Info);
+    uint64_t dropped_before = Logger::dropped();
+    auto start = bench::Clock::now();
+    double async_ns =
+        nsPerCall(threads, lines, [](int fd, long i) { LOG_INFO("Calling callback for fd {} with events {}", fd, i); });
+    Logger::flush();
+    double drained_ns = bench::secondsSince(start) * 1e9 / lines;
+    uint64_t dropped = Logger::dropped() - dropped_before;
+    std::printf("async             %8.1f   (drained %.1f, %llu of %ld dropped)\n", async_ns, drained_ns,
+                static_cast<unsigned long long>(dropped), lines * static_cast<long>(threads));
+
+    Logger::setLevel(LogLevel::Warn);
+    double filtered_ns =
+        nsPerCall(threads, lines, [](int fd, long i) { LOG_INFO("Calling callback for fd {} with events {}", fd, i); });
+    std::printf("filtered          %8.1f\n", filtered_ns);
+
+    double compiled_out_ns =
+        nsPerCall(threads, lines, [](int fd, long i) { LOG_TRACE("Calling callback for fd {} with events {}", fd, i); });
+    std::printf("compiled out      %8.1f\n", compiled_out_ns);
+    close(null_fd);
+    return 0;
+}
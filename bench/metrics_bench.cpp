@@ -0,0 +1,71 @@
+// Cost of recording a metric at the call site, per thread, for --threads threads
+// recording at once:
+//   counter     - Metrics::add
+//   histogram   - Metrics::record with a precomputed duration
+//   stage timer - a StageTimer around nothing: two clock reads and a record
+//   clock pair  - the two steady_clock reads alone, for comparison
+// and the time one scrape takes to aggregate the shards and render Prometheus text.
+
+#include "bench_util.hpp"
+#include "core/metrics.hpp"
+#include <thread>
+
+namespace {
+
+template <typename F>
+double nsPerCall(size_t threads, long per_thread, F &&body) {
+    std::vector<std::thread> workers;
+    auto start = bench::Clock::now();
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&body, per_thread] {
+            for (long i = 0; i < per_thread; ++i) {
+                body(i);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    return bench::secondsSince(start) * 1e9 / per_thread;
+}
+
+volatile int64_t sink;
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: metrics_bench [--threads=4] [--calls=10000000] (per thread) [--scrapes=100]\n");
+        return 0;
+    }
+    size_t threads = args.getInt("threads", 4);
+    long calls = args.getInt("calls", 10000000);
+    long scrapes = args.getInt("scrapes", 100);
+
+    std::printf("%zu threads, %ld calls each; ns per call per thread\n", threads, calls);
+    double counter_ns = nsPerCall(threads, calls, [](long) { Metrics::add(Counter::Requests); });
+    std::printf("counter        %8.2f\n", counter_ns);
+
+    double histogram_ns = nsPerCall(threads, calls, [](long i) {
+        Metrics::record(Stage::Parse, std::chrono::nanoseconds(200 + (i & 1023)));
+    });
+    std::printf("histogram      %8.2f\n", histogram_ns);
+
+    double timer_ns = nsPerCall(threads, calls, [](long) { StageTimer timer(Stage::Write); });
+    std::printf("stage timer    %8.2f\n", timer_ns);
+
+    double clock_ns = nsPerCall(threads, calls, [](long) {
+        auto start = Metrics::Clock::now();
+        sink = (Metrics::Clock::now() - start).count();
+    });
+    std::printf("clock pair     %8.2f\n", clock_ns);
+
+    size_t bytes = 0;
+    auto start = bench::Clock::now();
+    for (long i = 0; i < scrapes; ++i) {
+        bytes = Metrics::prometheusText().size();
+    }
+    std::printf("scrape         %8.1f us  (%zu bytes)\n", bench::secondsSince(start) * 1e6 / scrapes, bytes);
+    return 0;
+}
@@ -0,0 +1,458 @@
+// Microbenchmark suite for the core components, with results that can be compared
+// between commits:
+//   http1/parse, http1/generate - HttpParser::parseRequest and generateResponse
+//   http2/parse, http2/generate - the same request and response through Http2Framer
+//                                 and HPACK: a HEADERS frame decoded into a Request, and
+//                                 a response encoded as HEADERS + DATA
+//   cache/get_put               - Cache get, put on a miss, zipf keys, 1..--threads threads
+//   worker_pool/submit          - throughput of submit() from one thread, and latency
+//                                 from submit() to the task starting (p50/p99 counters)
+//   static_file/serve           - StaticFile::serve for a 1 KiB and a 1 MiB file
+// Every case runs until --min-time seconds have passed, --repetitions times, and the
+// median is reported. --json writes the results in Google Benchmark's JSON layout, so
+// its compare.py works on them too; --compare reads such a file and prints the change
+// of every benchmark against it.
+//
+//   ./bench/micro_bench --json=before.json
+//   (change, rebuild)
+//   ./bench/micro_bench --compare=before.json
+
+#include "bench_util.hpp"
+#include "core/worker_pool.hpp"
+#include "http/cache.hpp"
+#include "http/http2_framer.hpp"
+#include "http/http_parser.hpp"
+#include "http/static_file.hpp"
+#include <atomic>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <thread>
+
+namespace {
+
+// Extra values a case reports next to its time, e.g. latency percentiles.
+using Counters = std::vector<std::pair<std::string, double>>;
+
+struct Case {
+    std::string name;
+    // Runs the operation `iterations` times; the harness times the call.
+    std::function<void(long iterations, Counters &counters)> run;
+};
+
+using Result = bench::JsonResult;
+
+double processCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Grows the iteration count until a run takes min_time, then keeps the median of
+// `repetitions` runs of that size.
+Result measure(const Case &c, double min_time, int repetitions) {
+    Counters counters;
+    long iterations = 1;
+    while (true) {
+        auto start = bench::Clock::now();
+        c.run(iterations, counters);
+        double elapsed = bench::secondsSince(start);
+        if (elapsed >= min_time || iterations >= (1L << 40)) {
+            break;
+        }
+        double scale = elapsed > 0 ? min_time * 1.2 / elapsed : 100;
+        iterations = static_cast<long>(iterations * std::min(std::max(scale, 2.0), 100.0));
+    }
+
+    std::vector<Result> runs;
+    for (int r = 0; r < repetitions; ++r) {
+        Result result{c.name, iterations, 0, 0, {}};
+        double cpu_start = processCpuSeconds();
+        auto start = bench::Clock::now();
+        c.run(iterations, result.counters);
+        result.real_ns = bench::secondsSince(start) * 1e9 / iterations;
+        result.cpu_ns = (processCpuSeconds() - cpu_start) * 1e9 / iterations;
+        runs.push_back(std::move(result));
+    }
+    std::sort(runs.begin(), runs.end(), [](const Result &a, const Result &b) { return a.real_ns < b.real_ns; });
+    return runs[runs.size() / 2];
+}
+
+// ---- HTTP/1.1 and HTTP/2 ------------------------------------------------------------
+
+struct RequestSample {
+    const char *name;
+    const char *method;
+    const char *path;
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+std::vector<RequestSample> requestSamples() {
+    return {
+        {"small", "GET", "/", {{"Host", "localhost:8080"}, {"User-Agent", "curl/8.5.0"}, {"Accept", "*/*"}}},
+        {"browser",
+         "GET",
+         "/static/js/app.3f9c1b.js?v=20240501",
+         {{"Host", "www.example.com"},
+          {"sec-ch-ua", "\"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\""},
+          {"sec-ch-ua-mobile", "?0"},
+          {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                         "Chrome/124.0.0.0 Safari/537.36"},
+          {"sec-ch-ua-platform", "\"Linux\""},
+          {"Accept", "*/*"},
+          {"Sec-Fetch-Site", "same-origin"},
+          {"Sec-Fetch-Mode", "no-cors"},
+          {"Sec-Fetch-Dest", "script"},
+          {"Referer", "https://www.example.com/dashboard"},
+          {"Accept-Encoding", "gzip, deflate, br, zstd"},
+          {"Accept-Language", "en-US,en;q=0.9,de;q=0.8"},
+          {"Cookie", "_ga=GA1.1.1498230917.1712745332; session=9f8e7d6c5b4a39281706f5e4d3c2b1a0; "
+                     "theme=dark; _gcl_au=1.1.1734826209.1712745332"}}},
+    };
+}
+
+std::string http1Request(const RequestSample &sample) {
+    std::string raw = std::string(sample.method) + " " + sample.path + " HTTP/1.1\r\n";
+    for (const auto &header : sample.headers) {
+        raw += header.first + ": " + header.second + "\r\n";
+    }
+    return raw + "\r\n";
+}
+
+std::vector<HpackField> http2Fields(const RequestSample &sample, std::vector<std::string> &lowered) {
+    lowered.clear();
+    for (const auto &header : sample.headers) {
+        std::string name = header.first;
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        lowered.push_back(name == "host" ? ":authority" : name);
+    }
+    std::vector<HpackField> fields = {{":method", sample.method}, {":scheme", "https"}, {":path", sample.path}};
+    for (size_t i = 0; i < sample.headers.size(); ++i) {
+        fields.push_back({lowered[i], sample.headers[i].second});
+    }
+    return fields;
+}
+
+Response sampleResponse(size_t body_size) {
+    Response response{200, "OK", "HTTP/1.1", {}, std::string(body_size, 'x')};
+    response.headers.add("Content-Type", "text/html; charset=utf-8");
+    response.headers.add("Content-Length", std::to_string(body_size));
+    response.headers.add("Cache-Control", "public, max-age=3600");
+    response.headers.add("ETag", "\"5f3c-18f2a3b4c5d\"");
+    response.headers.add("Last-Modified", "Wed, 01 May 2024 10:00:00 GMT");
+    response.headers.add("Vary", "Accept-Encoding");
+    return response;
+}
+
+void addHttpCases(std::vector<Case> &cases) {
+    static HttpParser parser;
+    for (const RequestSample &sample : requestSamples()) {
+        std::string raw = http1Request(sample);
+        cases.push_back({std::string("http1/parse/") + sample.name, [raw](long iterations, Counters &) {
+                             for (long i = 0; i < iterations; ++i) {
+                                 Request request = parser.parseRequest(raw);
+                                 if (request.method.empty()) {
+                                     std::abort();
+                                 }
+                             }
+                         }});
+
+        // A connection's worth of requests, encoded by one HPACK encoder so that all but
+        // the first are mostly table references, as a browser sends them. Each pass
+        // decodes the batch with a fresh decoder.
+        const size_t kBatch = 64;
+        std::vector<std::string> lowered;
+        std::vector<HpackField> fields = http2Fields(sample, lowered);
+        HpackEncoder encoder;
+        auto frames = std::make_shared<std::string>();
+        for (size_t s = 0; s < kBatch; ++s) {
+            uint8_t buffer[16384];
+            size_t n = Http2Framer::writeHeaders(buffer, sizeof(buffer), static_cast<uint32_t>(2 * s + 1),
+                                                 fields.data(), fields.size(), true, encoder);
+            frames->append(reinterpret_cast<const char *>(buffer), n);
+        }
+        cases.push_back({std::string("http2/parse/") + sample.name, [frames](long iterations, Counters &) {
+                             Http2Framer framer;
+                             const uint8_t *data = reinterpret_cast<const uint8_t *>(frames->data());
+                             for (long done = 0; done < iterations;) {
+                                 HpackDecoder decoder;
+                                 framer.parseFrames(data, frames->size(), [&](const Http2Frame &frame) {
+                                     if (done >= iterations) {
+                                         return;
+                                     }
+                                     std::string_view block = Http2Framer::headerBlockFragment(frame);
+                                     Request request;
+                                     request.version = "HTTP/2";
+                                     decoder.decode(reinterpret_cast<const uint8_t *>(block.data()), block.size(),
+                                                    [&](std::string_view name, std::string_view value) {
+                                                        if (name == ":method") {
+                                                            request.method = value;
+                                                        } else if (name == ":path") {
+                                                            request.path = value;
+                                                        } else if (name[0] != ':') {
+                                                            request.headers.add(name, value);
+                                                        }
+                                                    });
+                                     if (request.path.empty()) {
+                                         std::abort();
+                                     }
+                                     ++done;
+                                 });
+                             }
+                         }});
+    }
+
+    for (size_t body_size : {size_t(0), size_t(4096)}) {
+        auto response = std::make_shared<Response>(sampleResponse(body_size));
+        std::string suffix = body_size ? "/4k" : "/empty";
+        cases.push_back({"http1/generate" + suffix, [response](long iterations, Counters &) {
+                             for (long i = 0; i < iterations; ++i) {
+                                 std::string message = parser.generateResponse(*response);
+                                 if (message.empty()) {
+                                     std::abort();
+                                 }
+                             }
+                         }});
+        cases.push_back({"http2/generate" + suffix, [response](long iterations, Counters &) {
+                             HpackEncoder encoder;
+                             std::vector<HpackField> fields;
+                             std::string status = std::to_string(response->status_code);
+                             std::vector<std::string> names;
+                             for (const HeaderField &field : response->headers) {
+                                 std::string name(field.name);
+                                 std::transform(name.begin(), name.end(), name.begin(),
+                                                [](unsigned char c) { return std::tolower(c); });
+                                 names.push_back(name);
+                             }
+                             std::string out(16384 + response->body.size() + Http2Framer::kFrameHeaderSize, '\0');
+                             uint8_t *buffer = reinterpret_cast<uint8_t *>(&out[0]);
+                             for (long i = 0; i < iterations; ++i) {
+                                 fields.clear();
+                                 fields.push_back({":status", status});
+                                 size_t n = 0;
+                                 for (const HeaderField &field : response->headers) {
+                                     fields.push_back({names[n++], field.value});
+                                 }
+                                 bool body = !response->body.empty();
+                                 size_t len = Http2Framer::writeHeaders(buffer, out.size(), 1, fields.data(),
+                                                                        fields.size(), !body, encoder);
+                                 if (body) {
+                                     len += Http2Framer::writeFrame(
+                                         buffer + len, out.size() - len, Http2FrameType::Data, Http2Flags::EndStream,
+                                         1, reinterpret_cast<const uint8_t *>(response->body.data()),
+                                         response->body.size());
+                                 }
+                                 if (len == 0) {
+                                     std::abort();
+                                 }
+                             }
+                         }});
+    }
+}
+
+// ---- Cache --------------------------------------------------------------------------
+
+void addCacheCases(std::vector<Case> &cases, size_t max_threads) {
+    const size_t kKeys = 100000;
+    const size_t kSequence = 1 << 16;
+    auto keys = std::make_shared<std::vector<std::string>>();
+    for (size_t i = 0; i < kKeys; ++i) {
+        keys->push_back("/proxy/api/items/" + std::to_string(i) + "?page=1");
+    }
+    auto value = std::make_shared<const std::string>(2048, 'v');
+
+    // Precomputed zipf(0.99) key indexes, so the timed loop does not sample.
+    auto sequence = std::make_shared<std::vector<uint32_t>>(kSequence);
+    {
+        std::vector<double> cdf(kKeys);
+        double sum = 0;
+        for (size_t i = 0; i < kKeys; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), 0.99);
+            cdf[i] = sum;
+        }
+        std::mt19937_64 rng(42);
+        for (uint32_t &index : *sequence) {
+            double u = std::uniform_real_distribution<double>(0.0, sum)(rng);
+            index = static_cast<uint32_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        }
+    }
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        cases.push_back({"cache/get_put/threads:" + std::to_string(threads),
+                         [=](long iterations, Counters &counters) {
+                             // Room for about a third of the keys, so misses and evictions happen.
+                             Cache cache(kKeys / 3 * (value->size() + 256));
+                             std::vector<std::thread> workers;
+                             long per_thread = iterations / static_cast<long>(threads) + 1;
+                             for (size_t t = 0; t < threads; ++t) {
+                                 workers.emplace_back([&, t] {
+                                     size_t pos = t * (kSequence / threads);
+                                     for (long i = 0; i < per_thread; ++i) {
+                                         const std::string &key = (*keys)[(*sequence)[pos++ & (kSequence - 1)]];
+                                         if (!cache.get(key)) {
+                                             cache.put(key, value);
+                                         }
+                                     }
+                                 });
+                             }
+                             for (std::thread &worker : workers) {
+                                 worker.join();
+                             }
+                             CacheStats stats = cache.stats();
+                             counters = {{"hit_rate", stats.hits / double(stats.hits + stats.misses)}};
+                         }});
+    }
+}
+
+// ---- WorkerPool ---------------------------------------------------------------------
+
+void addWorkerPoolCases(std::vector<Case> &cases, size_t workers) {
+    auto pool = std::make_shared<WorkerPool>(workers);
+
+    cases.push_back({"worker_pool/submit/throughput", [pool](long iterations, Counters &) {
+                         std::atomic<long> done{0};
+                         for (long i = 0; i < iterations; ++i) {
+                             pool->submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                         }
+                         while (done.load(std::memory_order_acquire) < iterations) {
+                             std::this_thread::yield();
+                         }
+                     }});
+
+    // One task in flight at a time: the time from submit() to the task running, which
+    // includes waking an idle worker.
+    cases.push_back({"worker_pool/submit/latency", [pool](long iterations, Counters &counters) {
+                         std::vector<double> samples;
+                         samples.reserve(static_cast<size_t>(std::min(iterations, 1L << 20)));
+                         for (long i = 0; i < iterations; ++i) {
+                             std::atomic<bool> ran{false};
+                             bench::Clock::time_point started;
+                             auto submitted = bench::Clock::now();
+                             pool->submit([&] {
+                                 started = bench::Clock::now();
+                                 ran.store(true, std::memory_order_release);
+                             });
+                             while (!ran.load(std::memory_order_acquire)) {
+                                 std::this_thread::yield();
+                             }
+                             if (samples.size() < samples.capacity()) {
+                                 samples.push_back(std::chrono::duration<double, std::nano>(started - submitted).count());
+                             }
+                         }
+                         counters = {{"p50_ns", bench::percentile(samples, 0.50)},
+                                     {"p99_ns", bench::percentile(samples, 0.99)}};
+                     }});
+}
+
+// ---- StaticFile ---------------------------------------------------------------------
+
+void addStaticFileCases(std::vector<Case> &cases, const std::string &root) {
+    struct Sample {
+        const char *name;
+        const char *path;
+        size_t size;
+    };
+    const Sample samples[] = {{"small", "/small.html", 1024}, {"large", "/large.bin", 1 << 20}};
+    for (const Sample &sample : samples) {
+        std::ofstream(root + sample.path, std::ios::binary) << std::string(sample.size, 'a');
+    }
+
+    auto static_file = std::make_shared<StaticFile>(root);
+    for (const Sample &sample : samples) {
+        std::string path = sample.path;
+        cases.push_back({std::string("static_file/serve/") + sample.name, [static_file, path](long iterations,
+                                                                                               Counters &) {
+                             Request request{"GET", {path.data(), path.size()}, "HTTP/1.1",
+                                             {{"Host", "localhost"}, {"Accept-Encoding", "gzip, br"}}, ""};
+                             for (long i = 0; i < iterations; ++i) {
+                                 Response response = static_file->serve(request);
+                                 if (response.status_code != 200) {
+                                     std::abort();
+                                 }
+                             }
+                         }});
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: micro_bench [--filter=substring] [--min-time=0.2] [--repetitions=3] [--threads=%u]\n"
+                    "                   [--workers=4] [--json=out.json] [--compare=baseline.json]\n",
+                    std::max(1u, std::thread::hardware_concurrency()));
+        return 0;
+    }
+    std::string filter = args.get("filter", "");
+    double min_time = args.getDouble("min-time", 0.2);
+    int repetitions = static_cast<int>(std::max(1L, args.getInt("repetitions", 3)));
+    size_t max_threads = std::max(1L, args.getInt("threads", std::max(1u, std::thread::hardware_concurrency())));
+    size_t workers = std::max(1L, args.getInt("workers", 4));
+    std::string json_path = args.get("json", "");
+    std::string compare_path = args.get("compare", "");
+
+    char tmp_template[] = "/tmp/micro_bench.XXXXXX";
+    if (!mkdtemp(tmp_template)) {
+        std::perror("micro_bench: mkdtemp");
+        return 1;
+    }
+    std::string tmp_root = tmp_template;
+
+    std::map<std::string, double> baseline;
+    if (!compare_path.empty()) {
+        baseline = bench::readJsonBaseline(compare_path);
+        if (baseline.empty()) {
+            std::fprintf(stderr, "micro_bench: no results in %s\n", compare_path.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    {
+        bench::QuietLog quiet;
+        std::vector<Case> cases;
+        addHttpCases(cases);
+        addCacheCases(cases, max_threads);
+        addWorkerPoolCases(cases, workers);
+        addStaticFileCases(cases, tmp_root);
+
+        std::printf("%-34s %12s %12s %14s", "benchmark", "time (ns)", "cpu (ns)", "iterations");
+        std::printf(baseline.empty() ? "\n" : " %9s\n", "vs base");
+        for (const Case &c : cases) {
+            if (c.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            Result result = measure(c, min_time, repetitions);
+            std::printf("%-34s %12.1f %12.1f %14ld", result.name.c_str(), result.real_ns, result.cpu_ns,
+                        result.iterations);
+            auto base = baseline.find(result.name);
+            if (base != baseline.end() && base->second > 0) {
+                std::printf(" %+8.1f%%", (result.real_ns / base->second - 1) * 100);
+            } else if (!baseline.empty()) {
+                std::printf(" %9s", "new");
+            }
+            for (const auto &counter : result.counters) {
+                std::printf("  %s=%g", counter.first.c_str(), counter.second);
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+            results.push_back(std::move(result));
+        }
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream out(json_path);
+        out << bench::jsonReport("micro_bench", results, repetitions);
+        if (!out) {
+            std::fprintf(stderr, "micro_bench: cannot write %s\n", json_path.c_str());
+            return 1;
+        }
+        std::printf("results written to %s\n", json_path.c_str());
+    }
+
+    std::string cleanup = "rm -rf '" + tmp_root + "'";
+    return std::system(cleanup.c_str()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+// Latency of L7Proxy::forward against a local stub backend:
+//   new connection - max_idle=0, so every request connects, sends, reads and closes
+//   pooled         - keep-alive connections from the UpstreamPool
+// The stub answers every request on a connection with a fixed body, framed either by
+// Content-Length or as chunks (--chunked). Reports p50/p99 latency, throughput and how
+// many backend connections each run opened.
+
+#include "bench_util.hpp"
+#include "stub_backend.hpp"
+#include "proxy/l7_proxy.hpp"
+#include <atomic>
+#include <thread>
+
+namespace {
+
+struct RunResult {
+    std::vector<double> latencies_us;
+    double seconds;
+    UpstreamPool::Stats pool;
+    long failures;
+};
+
+RunResult run(int port, size_t max_idle, int threads, long requests, size_t body_size) {
+    UpstreamPoolConfig config;
+    config.max_idle = max_idle;
+    L7Proxy proxy("127.0.0.1", port, config);
+    Request request{"GET", "/proxy/item", "HTTP/1.1", {{"Host", "backend"}, {"Accept", "*/*"}}, ""};
+
+    std::vector<std::vector<double>> per_thread(threads);
+    std::atomic<long> failures{0};
+    auto start = bench::Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (long i = 0; i < requests / threads; ++i) {
+                auto begin = bench::Clock::now();
+                try {
+                    if (proxy.forward(request).body.size() != body_size) {
+                        ++failures;
+                        continue;
+                    }
+                } catch (const std::exception &) {
+                    ++failures;
+                    continue;
+                }
+                per_thread[t].push_back(bench::secondsSince(begin) * 1e6);
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    RunResult result{{}, bench::secondsSince(start), proxy.poolStats(), failures.load()};
+    for (auto &samples : per_thread) {
+        result.latencies_us.insert(result.latencies_us.end(), samples.begin(), samples.end());
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: proxy_bench [--requests=10000] [--threads=4] [--body=1024] [--chunked]\n"
+                    "The new-connection run leaves its sockets in TIME_WAIT; keep --requests well\n"
+                    "below the ephemeral port range.\n");
+        return 0;
+    }
+    long requests = args.getInt("requests", 10000);
+    int threads = static_cast<int>(args.getInt("threads", 4));
+    bool chunked = args.getInt("chunked", 0) != 0;
+    size_t body_size = args.getInt("body", 1024);
+    bench::StubBackend backend(body_size, chunked);
+
+    std::printf("%ld requests, %d threads, %zu-byte %s bodies\n", requests, threads, body_size,
+                chunked ? "chunked" : "Content-Length");
+    std::printf("%-16s %10s %10s %10s %10s %8s\n", "mode", "req/s", "p50 us", "p99 us", "connects", "failed");
+    const struct {
+        const char *name;
+        size_t max_idle;
+    } modes[] = {{"new connection", 0}, {"pooled", 64}};
+    for (const auto &mode : modes) {
+        RunResult r = run(backend.port(), mode.max_idle, threads, requests, body_size);
+        double rps = r.latencies_us.size() / r.seconds;
+        std::printf("%-16s %10.0f %10.1f %10.1f %10llu %8ld\n", mode.name, rps, bench::percentile(r.latencies_us, 0.5),
+                    bench::percentile(r.latencies_us, 0.99), static_cast<unsigned long long>(r.pool.connects),
+                    r.failures);
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Cost of writing HTTP/1.1 responses, for a few body sizes:
+//   serialize - building one response with the old ostringstream generator (head and
+//               body streamed into a stringstream, copied out by str(), appended to the
+//               output queue) versus writeResponseHead() into a reused buffer with the
+//               body sent by reference. "copied" counts the bytes each moves through
+//               user-space buffers per response.
+//   session   - an HttpSession on one end of a socketpair, a client pipelining
+//               --pipeline requests at a time on the other; reports the session's write
+//               and read syscalls per response, from /proc/thread-self/io.
+
+#include "bench_util.hpp"
+#include "core/event_loop.hpp"
+#include "http/http_session.hpp"
+#include "http/response_writer.hpp"
+#include <poll.h>
+#include <sstream>
+#include <thread>
+#include <fstream>
+
+namespace {
+
+Response makeResponse(size_t body_size) {
+    return Response{200, "OK", "HTTP/1.1", {{"Content-Type", "text/plain"}, {"Cache-Control", "max-age=60"}},
+                    std::string(body_size, 'x')};
+}
+
+// What HttpParser::generateResponse did before writeResponseHead().
+std::string legacyGenerate(const Response &response) {
+    std::stringstream ss;
+    ss << response.version << " " << response.status_code << " " << response.status_message << "\r\n";
+    for (const auto &header : response.headers) {
+        ss << header.name << ": " << header.value << "\r\n";
+    }
+    ss << "Content-Length: " << response.body.size() << "\r\n";
+    ss << "\r\n";
+    ss << response.body;
+    return ss.str();
+}
+
+void serialize(size_t body_size, long iterations) {
+    Response response = makeResponse(body_size);
+    std::string out;
+    size_t legacy_size = 0;
+    auto start = bench::Clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        out.clear();
+        out += legacyGenerate(response);
+        legacy_size = out.size();
+    }
+    double legacy_ns = bench::secondsSince(start) * 1e9 / iterations;
+
+    size_t head_size = 0;
+    start = bench::Clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        out.clear();
+        writeResponseHead(response, out);
+        head_size = out.size();
+        if (body_size < 1024) {
+            out += response.body; // the session copies small bodies behind their head
+        }
+    }
+    double writer_ns = bench::secondsSince(start) * 1e9 / iterations;
+    size_t writer_copied = head_size + (body_size < 1024 ? body_size : 0);
+
+    std::printf("%-10s %8zu %12.0f %12zu %12.0f %12zu\n", "serialize", body_size, legacy_ns, 3 * legacy_size,
+                writer_ns, writer_copied);
+}
+
+struct SyscallCounts {
+    long reads = 0;
+    long writes = 0;
+};
+
+SyscallCounts threadSyscalls() {
+    std::ifstream in("/proc/thread-self/io");
+    SyscallCounts counts;
+    std::string key;
+    long value;
+    while (in >> key >> value) {
+        if (key == "syscr:") {
+            counts.reads = value;
+        } else if (key == "syscw:") {
+            counts.writes = value;
+        }
+    }
+    return counts;
+}
+
+void session(size_t body_size, long requests, int pipeline) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        std::perror("socketpair");
+        return;
+    }
+    const std::string request = "GET /item HTTP/1.1\r\nHost: bench\r\n\r\n";
+    const size_t response_size = [&] {
+        std::string head;
+        writeResponseHead(makeResponse(body_size), head);
+        return head.size() + body_size;
+    }();
+
+    std::thread client([&] {
+        std::string batch;
+        for (int i = 0; i < pipeline; ++i) {
+            batch += request;
+        }
+        std::vector<char> buffer(256 * 1024);
+        for (long sent = 0; sent < requests; sent += pipeline) {
+            if (::write(fds[1], batch.data(), batch.size()) != static_cast<ssize_t>(batch.size())) {
+                break;
+            }
+            size_t expected = response_size * pipeline;
+            while (expected > 0) {
+                ssize_t n = ::read(fds[1], buffer.data(), std::min(buffer.size(), expected));
+                if (n <= 0) {
+                    return;
+                }
+                expected -= n;
+            }
+        }
+        shutdown(fds[1], SHUT_WR);
+    });
+
+    EventLoop loop;
+    SessionLimits limits;
+    limits.max_requests = static_cast<size_t>(requests) + 1;
+    HttpParser parser;
+    RequestHandler handler = [&](const Request &) { return makeResponse(body_size); };
+    auto conn = std::make_unique<Connection>(fds[0], nullptr);
+    conn->set_nonblocking(true);
+    HttpSession http(std::move(conn), parser, handler, limits, loop, [] {});
+
+    SyscallCounts before = threadSyscalls();
+    auto start = bench::Clock::now();
+    Session::Status status = Session::Status::WantRead;
+    while (status != Session::Status::Close) {
+        struct pollfd pfd = {fds[0], static_cast<short>(status == Session::Status::WantWrite ? POLLOUT : POLLIN), 0};
+        poll(&pfd, 1, -1);
+        status = http.process();
+    }
+    double seconds = bench::secondsSince(start);
+    SyscallCounts after = threadSyscalls();
+    client.join();
+    close(fds[1]);
+
+    std::printf("%-10s %8zu %12.2f %12.2f %12.0f\n", "session", body_size,
+                static_cast<double>(after.writes - before.writes) / requests,
+                static_cast<double>(after.reads - before.reads) / requests, requests / seconds);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: response_writer_bench [--iterations=200000] [--requests=100000] [--pipeline=16]\n");
+        return 0;
+    }
+    long iterations = args.getInt("iterations", 200000);
+    long requests = args.getInt("requests", 100000);
+    int pipeline = static_cast<int>(args.getInt("pipeline", 16));
+    requests -= requests % pipeline;
+    bench::QuietLog quiet;
+    const size_t body_sizes[] = {0, 512, 4096, 65536};
+
+    std::printf("%-10s %8s %12s %12s %12s %12s\n", "run", "body", "legacy ns", "copied", "writer ns", "copied");
+    for (size_t body_size : body_sizes) {
+        serialize(body_size, iterations);
+    }
+    std::printf("\n%-10s %8s %12s %12s %12s   (%ld requests, %d pipelined)\n", "run", "body", "writes/resp",
+                "reads/resp", "resp/s", requests, pipeline);
+    for (size_t body_size : body_sizes) {
+        session(body_size, requests, pipeline);
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Bytes on the wire and server CPU per request for a static tree, per content coding:
+//   identity / gzip / br - StaticFile serving the original or its precompressed variant
+//   gzip on the fly      - compressing the file on every request (zlib level 6), which is
+//                          what precompression replaces
+// The tree is copied to a temporary directory first, so the .gz/.br variants StaticFile
+// writes next to the files do not end up in the source tree.
+
+#include "bench_util.hpp"
+#include "http/static_file.hpp"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// Copies regular files below src into dst and collects their paths relative to src.
+void copyTree(const std::string &src, const std::string &dst, const std::string &rel,
+              std::vector<std::string> &files) {
+    DIR *d = opendir((src + rel).c_str());
+    if (!d) {
+        return;
+    }
+    mkdir((dst + rel).c_str(), 0755);
+    while (struct dirent *ent = readdir(d)) {
+        std::string name = ent->d_name;
+        bool variant = name.size() > 3 && (name.substr(name.size() - 3) == ".gz" || name.substr(name.size() - 3) == ".br");
+        if (name == "." || name == ".." || variant) {
+            continue;
+        }
+        std::string child = rel + "/" + name;
+        struct stat st;
+        if (stat((src + child).c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            copyTree(src, dst, child, files);
+        } else if (S_ISREG(st.st_mode)) {
+            std::ofstream(dst + child, std::ios::binary) << readFile(src + child);
+            files.push_back(child);
+        }
+    }
+    closedir(d);
+}
+
+size_t wireBytes(const Response &response) {
+    return (response.raw ? response.raw->size() : 0) + (response.file ? response.file->length : 0);
+}
+
+size_t gzipOnTheFly(const std::string &data) {
+    z_stream stream{};
+    deflateInit2(&stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    deflate(&stream, Z_FINISH);
+    size_t n = stream.total_out;
+    deflateEnd(&stream);
+    return n;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: static_bench [--root=static] [--requests=2000]\n");
+        return 0;
+    }
+    std::string root = args.get("root", "static");
+    long requests = args.getInt("requests", 2000);
+
+    char tmp_template[] = "/tmp/static_bench.XXXXXX";
+    if (!mkdtemp(tmp_template)) {
+        std::perror("static_bench: mkdtemp");
+        return 1;
+    }
+    std::string tmp_root = tmp_template;
+    std::vector<std::string> files;
+    copyTree(root, tmp_root, "", files);
+    if (files.empty()) {
+        std::fprintf(stderr, "static_bench: no files below %s\n", root.c_str());
+        return 1;
+    }
+
+    const char *codings[] = {"identity", "gzip", "br"};
+    size_t totals[3] = {0, 0, 0};
+    double cpu_us[3] = {0, 0, 0};
+    size_t fly_total = 0;
+    double fly_cpu_us = 0;
+    {
+        bench::QuietLog quiet;
+        {
+            // The first request for a file queues its variants; the destructor waits for them.
+            StaticFile builder(tmp_root);
+            for (const std::string &file : files) {
+                builder.serve(Request{"GET", {file.data(), file.size()}, "HTTP/1.1", {}, ""});
+            }
+        }
+        StaticFile static_file(tmp_root);
+
+        std::printf("%-32s %10s %10s %10s\n", "file", "identity", "gzip", "br");
+        for (const std::string &file : files) {
+            size_t bytes[3];
+            for (int c = 0; c < 3; ++c) {
+                Request request{"GET", {file.data(), file.size()}, "HTTP/1.1", {{"Accept-Encoding", codings[c]}}, ""};
+                bytes[c] = wireBytes(static_file.serve(request));
+                totals[c] += bytes[c];
+            }
+            std::printf("%-32s %10zu %10zu %10zu\n", file.c_str(), bytes[0], bytes[1], bytes[2]);
+
+            std::string data = readFile(tmp_root + file);
+            long rounds = requests / 10 + 1; // compression is slow enough to need fewer rounds
+            size_t compressed = 0;
+            double start = threadCpuSeconds();
+            for (long i = 0; i < rounds; ++i) {
+                compressed = gzipOnTheFly(data);
+            }
+            fly_cpu_us += (threadCpuSeconds() - start) * 1e6 / rounds;
+            fly_total += compressed;
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            double start = threadCpuSeconds();
+            for (long i = 0; i < requests; ++i) {
+                for (const std::string &file : files) {
+                    Request request{"GET", {file.data(), file.size()}, "HTTP/1.1",
+                                    {{"Accept-Encoding", codings[c]}}, ""};
+                    Response response = static_file.serve(request);
+                    if (wireBytes(response) == 0) {
+                        std::printf(" ");
+                    }
+                }
+            }
+            cpu_us[c] = (threadCpuSeconds() - start) * 1e6 / requests;
+        }
+    }
+
+    std::printf("\ncorpus: %zu files; bytes on the wire and server CPU for one pass over all files\n",
+                files.size());
+    for (int c = 0; c < 3; ++c) {
+        std::printf("  %-22s %10zu bytes  %8.2f us CPU\n", codings[c], totals[c], cpu_us[c]);
+    }
+    std::printf("  %-22s %10zu bytes  %8.2f us CPU (bodies only)\n", "gzip on the fly", fly_total, fly_cpu_us);
+
+    std::string cleanup = "rm -rf '" + tmp_root + "'";
+    return std::system(cleanup.c_str()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#ifndef STUB_BACKEND_HPP
+#define STUB_BACKEND_HPP
+
+// A loopback HTTP/1.1 backend for the proxy benchmarks: answers every request on a
+// keep-alive connection with a fixed body, optionally after a delay, one thread per
+// connection.
+
+#include "bench_util.hpp"
+#include <atomic>
+#include <thread>
+
+namespace bench {
+
+class StubBackend {
+public:
+    // port 0 picks a free one.
+    StubBackend(size_t body_size, bool chunked, int port = 0) {
+        std::string body(body_size, 'x');
+        if (chunked) {
+            response_ = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+            for (size_t off = 0; off < body.size(); off += 1024) {
+                size_t n = std::min<size_t>(1024, body.size() - off);
+                char size_line[32];
+                std::snprintf(size_line, sizeof(size_line), "%zx\r\n", n);
+                response_ += size_line + body.substr(off, n) + "\r\n";
+            }
+            response_ += "0\r\n\r\n";
+        } else {
+            response_ = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        }
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd_, 1024) != 0) {
+            std::perror("stub backend");
+            std::exit(1);
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        acceptor_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~StubBackend() {
+        shutdown(listen_fd_, SHUT_RDWR);
+        close(listen_fd_);
+        acceptor_.join();
+    }
+
+    int port() const { return port_; }
+    long served() const { return served_.load(); }
+
+    // Injected slowness: every response from now on waits this long first.
+    void setDelay(std::chrono::microseconds delay) { delay_us_ = delay.count(); }
+
+private:
+    void acceptLoop() {
+        while (true) {
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd == -1) {
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::thread([this, fd] { serve(fd); }).detach();
+        }
+    }
+
+    // Answers each complete request head on the connection until the proxy closes it.
+    void serve(int fd) {
+        std::string in;
+        char buf[4096];
+        while (true) {
+            size_t end;
+            while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = ::read(fd, buf, sizeof(buf));
+                if (n <= 0) {
+                    close(fd);
+                    return;
+                }
+                in.append(buf, n);
+            }
+            in.erase(0, end + 4);
+            long delay = delay_us_.load();
+            if (delay > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(delay));
+            }
+            ++served_;
+            if (::write(fd, response_.data(), response_.size()) != static_cast<ssize_t>(response_.size())) {
+                close(fd);
+                return;
+            }
+        }
+    }
+
+    std::string response_;
+    int listen_fd_;
+    int port_;
+    std::atomic<long> delay_us_{0};
+    std::atomic<long> served_{0};
+    std::thread acceptor_;
+};
+
+// A loopback port nothing listens on, to stand in for a backend that is down.
+inline int deadPort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+} // namespace bench
+
+#endif // STUB_BACKEND_HPP
@@ -0,0 +1,159 @@
+// TLS handshakes/sec against Connection + TlsContext, with and without resumption.
+// The server side is an EventLoopGroup that drives each handshake with a HandshakeDriver
+// and closes once it completes;
+// clients either start every connection from scratch or offer the session from their
+// previous connection (a session ticket, or a session ID with --resume=cache).
+// --stalled=N additionally holds N connections open that never send a ClientHello; with
+// handshakes on non-blocking sockets they must not slow anyone else down.
+
+#include "bench_util.hpp"
+#include "tls_util.hpp"
+#include "core/connection.hpp"
+#include "core/event_loop_group.hpp"
+#include "core/handshake.hpp"
+#include "core/tls_context.hpp"
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <atomic>
+#include <csignal>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+struct Result {
+    double rate;
+    uint64_t handshakes;
+    uint64_t reused;
+};
+
+Result driveClients(int port, SSL_CTX *client_ctx, size_t num_clients, double seconds, bool resume) {
+    std::atomic<uint64_t> handshakes{0}, reused{0};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> clients;
+    auto start = bench::Clock::now();
+    for (size_t i = 0; i < num_clients; ++i) {
+        clients.emplace_back([&] {
+            SSL_SESSION *session = nullptr;
+            uint64_t local = 0, local_reused = 0;
+            char buf[256];
+            while (!done.load(std::memory_order_relaxed)) {
+                int fd = bench::connectLoopback(port);
+                if (fd == -1) {
+                    continue;
+                }
+                SSL *ssl = SSL_new(client_ctx);
+                SSL_set_fd(ssl, fd);
+                if (resume && session) {
+                    SSL_set_session(ssl, session);
+                }
+                if (SSL_connect(ssl) == 1) {
+                    ++local;
+                    if (SSL_session_reused(ssl)) {
+                        ++local_reused;
+                    }
+                    // Reading to the server's close_notify also consumes TLS 1.3 tickets.
+                    while (SSL_read(ssl, buf, sizeof(buf)) > 0) {}
+                    if (resume) {
+                        // TLS 1.3 tickets are single-use, so always keep the newest session.
+                        SSL_SESSION_free(session);
+                        session = SSL_get1_session(ssl);
+                    }
+                    // Without a close_notify OpenSSL marks the session as not resumable.
+                    SSL_shutdown(ssl);
+                } else {
+                    ERR_clear_error();
+                }
+                SSL_free(ssl);
+                close(fd);
+            }
+            SSL_SESSION_free(session);
+            handshakes += local;
+            reused += local_reused;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    done = true;
+    for (auto &t : clients) {
+        t.join();
+    }
+    double elapsed = bench::secondsSince(start);
+    return Result{handshakes / elapsed, handshakes.load(), reused.load()};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: tls_handshake_bench [--port=18443] [--clients=4] [--seconds=3] [--loops=<cores>]\n"
+                    "                           [--key=rsa|ec] [--tls=1.3|1.2] [--resume=ticket|cache] [--stalled=0]\n");
+        return 0;
+    }
+    int port = static_cast<int>(args.getInt("port", 18443));
+    size_t clients = args.getInt("clients", 4);
+    double seconds = args.getDouble("seconds", 3.0);
+    size_t loops = args.getInt("loops", std::max(1u, std::thread::hardware_concurrency()));
+    std::string key_type = args.get("key", "rsa");
+    std::string version = args.get("tls", "1.3");
+    std::string resume_mode = args.get("resume", "ticket");
+    long stalled = args.getInt("stalled", 0);
+
+    try {
+        std::string cert = "/tmp/blaze_bench_" + std::to_string(getpid()) + ".crt";
+        std::string key = "/tmp/blaze_bench_" + std::to_string(getpid()) + ".key";
+        bench::writeSelfSignedCert(cert, key, key_type);
+        TlsContext tls(cert, key);
+        std::remove(cert.c_str());
+        std::remove(key.c_str());
+
+        SSL_CTX *client_ctx = SSL_CTX_new(TLS_client_method());
+        int proto = version == "1.2" ? TLS1_2_VERSION : TLS1_3_VERSION;
+        SSL_CTX_set_min_proto_version(client_ctx, proto);
+        SSL_CTX_set_max_proto_version(client_ctx, proto);
+        SSL_CTX_set_session_cache_mode(client_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+        if (resume_mode == "cache") {
+            // Without a ticket the server falls back to its session ID cache (TLS 1.2 only).
+            SSL_CTX_set_options(client_ctx, SSL_OP_NO_TICKET);
+        }
+
+        Result full{}, resumed{};
+        {
+            bench::QuietLog quiet;
+            EventLoopGroup group(loops, port);
+            // No sweep runs here, so the stalled connections are never timed out.
+            std::unordered_map<EventLoop *, std::unique_ptr<HandshakeDriver>> drivers;
+            for (size_t i = 0; i < group.size(); ++i) {
+                drivers[&group.at(i)] = std::make_unique<HandshakeDriver>(group.at(i), std::chrono::hours(1));
+            }
+            group.start([&tls, &drivers](int client_fd, EventLoop &loop) {
+                // Destroying the connection once the handshake is done sends close_notify.
+                drivers.at(&loop)->start(std::make_unique<Connection>(client_fd, &tls),
+                                         [](std::unique_ptr<Connection>) {});
+            });
+            std::vector<int> stalled_fds;
+            for (long i = 0; i < stalled; ++i) {
+                stalled_fds.push_back(bench::connectLoopback(port));
+            }
+            full = driveClients(port, client_ctx, clients, seconds, false);
+            resumed = driveClients(port, client_ctx, clients, seconds, true);
+            group.stop();
+            group.join();
+            for (int fd : stalled_fds) {
+                close(fd);
+            }
+        }
+        SSL_CTX_free(client_ctx);
+
+        std::printf("TLS %s, %s key, %zu clients, %zu loops, %ld stalled connections\n", version.c_str(),
+                    key_type.c_str(), clients, loops, stalled);
+        std::printf("full handshakes:    %10.0f hs/s (%lu handshakes)\n", full.rate, (unsigned long)full.handshakes);
+        std::printf("with resumption:    %10.0f hs/s (%lu handshakes, %lu resumed via %s)\n", resumed.rate,
+                    (unsigned long)resumed.handshakes, (unsigned long)resumed.reused, resume_mode.c_str());
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "tls_handshake_bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
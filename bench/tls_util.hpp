@@ -0,0 +1,50 @@
+#ifndef BENCH_TLS_UTIL_HPP
+#define BENCH_TLS_UTIL_HPP
+
+// Throwaway self-signed certificates for benchmarks that need a TLS server.
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace bench {
+
+// Writes a self-signed certificate and its private key as PEM files. key_type is
+// "rsa" (2048-bit, what blaze.sh generates) or "ec" (P-256).
+inline void writeSelfSignedCert(const std::string &cert_path, const std::string &key_path,
+                                const std::string &key_type = "rsa") {
+    EVP_PKEY *pkey = key_type == "ec" ? EVP_EC_gen("P-256") : EVP_RSA_gen(2048);
+    X509 *x509 = X509_new();
+    if (!pkey || !x509) {
+        throw std::runtime_error("Failed to allocate key or certificate");
+    }
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME *name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"blaze-bench", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    X509_sign(x509, pkey, EVP_sha256());
+
+    FILE *cert = std::fopen(cert_path.c_str(), "w");
+    FILE *key = std::fopen(key_path.c_str(), "w");
+    bool ok = cert && key && PEM_write_X509(cert, x509) &&
+              PEM_write_PrivateKey(key, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+    if (cert) std::fclose(cert);
+    if (key) std::fclose(key);
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    if (!ok) {
+        throw std::runtime_error("Failed to write " + cert_path + " / " + key_path);
+    }
+}
+
+} // namespace bench
+
+#endif // BENCH_TLS_UTIL_HPP
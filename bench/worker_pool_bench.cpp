@@ -0,0 +1,198 @@
+// WorkerPool scheduling cost at 1, 2, 4 ... --max-threads workers:
+//   legacy   - the previous WorkerPool: one std::queue of std::function behind one mutex
+//              and condition variable
+//   stealing - WorkerPool: per-worker Chase-Lev deques, a lock-free injection queue and
+//              inline task storage
+// Scenarios, each with tasks that only bump a counter so the pool itself is measured:
+//   submit    - --producers threads submit --tasks tasks between them from outside the
+//               pool, the way the event loops hand off requests; tasks/s until all ran
+//   fork-join - --tasks / --fanout root tasks each submit --fanout children from inside
+//               the pool, which the stealing pool keeps on the worker's own deque
+//   latency   - one thread submits --latency-tasks tasks at --rate per second; the time
+//               from submit() to the task starting, which includes waking a parked worker
+
+#include "bench_util.hpp"
+#include "core/metrics.hpp"
+#include "core/worker_pool.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+namespace {
+
+// Copied from the previous include/core/worker_pool.hpp and src/core/worker_pool.cpp,
+// without the trace logging.
+class LegacyWorkerPool {
+public:
+    LegacyWorkerPool(size_t num_workers) : stop_(false) {
+        for (size_t i = 0; i < num_workers; ++i) {
+            workers_.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex_);
+                        condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                        if (stop_ && tasks_.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks_.front());
+                        tasks_.pop();
+                    }
+                    Metrics::adjust(Gauge::WorkerQueueDepth, -1);
+                    task();
+                }
+            });
+        }
+    }
+
+    ~LegacyWorkerPool() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            stop_ = true;
+        }
+        condition_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            tasks_.emplace(std::move(task));
+        }
+        Metrics::adjust(Gauge::WorkerQueueDepth, 1);
+        condition_.notify_one();
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex queue_mutex_;
+    std::condition_variable condition_;
+    bool stop_;
+};
+
+struct Options {
+    long tasks;
+    size_t producers;
+    long fanout;
+    long latency_tasks;
+    double rate;
+};
+
+void waitFor(const std::atomic<long> &done, long target) {
+    while (done.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+template <typename Pool>
+double submitMtasks(size_t workers, const Options &o) {
+    Pool pool(workers);
+    std::atomic<long> done{0};
+    long per_producer = o.tasks / static_cast<long>(o.producers);
+    auto start = bench::Clock::now();
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < o.producers; ++p) {
+        producers.emplace_back([&] {
+            for (long i = 0; i < per_producer; ++i) {
+                pool.submit([&done] { done.fetch_add(1, std::memory_order_release); });
+            }
+        });
+    }
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    long total = per_producer * static_cast<long>(o.producers);
+    waitFor(done, total);
+    return total / bench::secondsSince(start) / 1e6;
+}
+
+template <typename Pool>
+double forkJoinMtasks(size_t workers, const Options &o) {
+    Pool pool(workers);
+    std::atomic<long> done{0};
+    long roots = std::max(1L, o.tasks / o.fanout);
+    auto start = bench::Clock::now();
+    for (long r = 0; r < roots; ++r) {
+        pool.submit([&pool, &done, &o] {
+            for (long c = 0; c < o.fanout; ++c) {
+                pool.submit([&done] { done.fetch_add(1, std::memory_order_release); });
+            }
+        });
+    }
+    waitFor(done, roots * o.fanout);
+    return roots * (o.fanout + 1) / bench::secondsSince(start) / 1e6;
+}
+
+struct Latency {
+    double p50_us;
+    double p99_us;
+    double p999_us;
+};
+
+template <typename Pool>
+Latency submitLatency(size_t workers, const Options &o) {
+    Pool pool(workers);
+    std::vector<double> samples(static_cast<size_t>(o.latency_tasks));
+    std::atomic<long> done{0};
+    auto interval = std::chrono::duration_cast<bench::Clock::duration>(std::chrono::duration<double>(1.0 / o.rate));
+    auto next = bench::Clock::now();
+    for (long i = 0; i < o.latency_tasks; ++i) {
+        next += interval;
+        while (bench::Clock::now() < next) {
+            std::this_thread::yield();
+        }
+        auto submitted = bench::Clock::now();
+        pool.submit([&samples, &done, i, submitted] {
+            samples[i] = std::chrono::duration<double, std::micro>(bench::Clock::now() - submitted).count();
+            done.fetch_add(1, std::memory_order_release);
+        });
+    }
+    waitFor(done, o.latency_tasks);
+    return {bench::percentile(samples, 0.50), bench::percentile(samples, 0.99), bench::percentile(samples, 0.999)};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench::Args args(argc, argv);
+    if (args.help()) {
+        std::printf("usage: worker_pool_bench [--max-threads=64] [--tasks=1000000] [--producers=4]\n"
+                    "                         [--fanout=16] [--latency-tasks=20000] [--rate=20000]\n");
+        return 0;
+    }
+    size_t max_threads = args.getInt("max-threads", 64);
+    Options o{args.getInt("tasks", 1000000), static_cast<size_t>(std::max(1L, args.getInt("producers", 4))),
+              std::max(1L, args.getInt("fanout", 16)), args.getInt("latency-tasks", 20000),
+              args.getDouble("rate", 20000)};
+    bench::QuietLog quiet;
+
+    std::printf("%ld tasks from %zu producers; fork-join fanout %ld; latency at %.0f tasks/s, %u CPUs\n", o.tasks,
+                o.producers, o.fanout, o.rate, std::thread::hardware_concurrency());
+    std::printf("%8s %14s %10s %17s %10s   %-24s %s\n", "threads", "submit legacy", "stealing", "fork-join legacy",
+                "stealing", "latency us legacy", "stealing");
+    std::printf("%8s %14s %10s %17s %10s   %-24s %s\n", "", "Mtasks/s", "Mtasks/s", "Mtasks/s", "Mtasks/s",
+                "p50/p99/p99.9", "p50/p99/p99.9");
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double legacy_submit = submitMtasks<LegacyWorkerPool>(threads, o);
+        double stealing_submit = submitMtasks<WorkerPool>(threads, o);
+        double legacy_fork = forkJoinMtasks<LegacyWorkerPool>(threads, o);
+        double stealing_fork = forkJoinMtasks<WorkerPool>(threads, o);
+        Latency legacy = submitLatency<LegacyWorkerPool>(threads, o);
+        Latency stealing = submitLatency<WorkerPool>(threads, o);
+        char legacy_latency[64], stealing_latency[64];
+        std::snprintf(legacy_latency, sizeof(legacy_latency), "%.1f/%.1f/%.1f", legacy.p50_us, legacy.p99_us,
+                      legacy.p999_us);
+        std::snprintf(stealing_latency, sizeof(stealing_latency), "%.1f/%.1f/%.1f", stealing.p50_us,
+                      stealing.p99_us, stealing.p999_us);
+        std::printf("%8zu %14.2f %10.2f %17.2f %10.2f   %-24s %s\n", threads, legacy_submit, stealing_submit,
+                    legacy_fork, stealing_fork, legacy_latency, stealing_latency);
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <string>
+
+// Connection buffers recycled between connections. A session hands its buffers back
+// when it goes idle or closes and the next busy session on the same thread takes them,
+// so idle keep-alive connections hold no buffers and busy ones do not grow new ones
+// from malloc. Every thread keeps its own free list, so nothing is locked. Buffers that
+// grew past kMaxKept (after a large request, say) are freed rather than kept, so the
+// pool does not hold on to peaks.
+class BufferPool {
+public:
+    static const size_t kBufferSize = 16 * 1024; // capacity of a new buffer
+    static const size_t kMaxKept = 64 * 1024;
+    static const size_t kMaxFree = 256; // per thread
+
+    // An empty buffer with at least kBufferSize capacity.
+    static std::string acquire();
+    // Takes buffer's storage, leaving it empty with no capacity.
+    static void release(std::string &buffer);
+};
+
+#endif // BUFFER_POOL_HPP
@@ -1,29 +1,69 @@
 #ifndef CONNECTION_HPP
 #define CONNECTION_HPP
 
+#include <chrono>
 #include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <openssl/ssl.h>
 
+class TlsContext;
+
 class Connection
 {
 public:
-    Connection(int fd, bool use_tls, const std::string &cert_file, const std::string &key_file);
+    enum class HandshakeStatus
+    {
+        Done,
+        WantRead,
+        WantWrite,
+        Failed
+    };
+
+    // tls == nullptr means a plaintext connection. The TlsContext is shared by all
+    // connections and must outlive them. The TLS handshake is not run here; call
+    // handshake() until it returns Done.
+    Connection(int fd, const TlsContext *tls);
     ~Connection();
 
+    // Advances the TLS handshake as far as the socket allows. On a non-blocking fd this
+    // returns WantRead/WantWrite when the socket has to become readable/writable first.
+    // ALPN (is_http2) is known once it returns Done. Plaintext connections are always Done.
+    HandshakeStatus handshake();
+    bool handshake_done() const;
+    void set_nonblocking(bool value);
+    int fd() const;
+
+    // Like ::read/::write: on a non-blocking connection -1 with errno == EAGAIN means
+    // "try again when the socket is ready", also when TLS is in use. read() returns 0
+    // once the peer has closed.
     ssize_t read(char *buffer, size_t len);
     ssize_t write(const char *buffer, size_t len);
+    // Like ::writev. TLS has no vectored write: pieces below a record's worth are
+    // gathered into one SSL_write, larger ones are written in turn, and a short write
+    // ends the call. After EAGAIN, call again with the same leading bytes.
+    ssize_t writev(const struct iovec *iov, int count);
+    // Sends up to count bytes of file_fd starting at offset and advances offset by the
+    // amount sent; same return and errno conventions as write(). Plaintext connections
+    // use sendfile(2), so the data never enters user space. TLS has to encrypt in user
+    // space and goes through a fixed 16 KiB buffer per call.
+    ssize_t send_file(int file_fd, off_t &offset, size_t count);
     int accept();
     bool is_http2() const;
+    // Plaintext connections can be written with splice(2) on fd() directly.
+    bool is_tls() const;
     bool is_websocket() const;
     void set_websocket(bool value);
+    bool session_reused() const;
 
 private:
     int fd_;
     bool use_tls_;
-    SSL_CTX *ssl_ctx_;
     SSL *ssl_;
     bool is_http2_;
+    bool handshake_done_;
     bool is_websocket_ = false;
+    std::chrono::steady_clock::time_point handshake_started_{}; // set by the first handshake() step
 };
 
-#endif // CONNECTION_HPP
\ No newline at end of file
+#endif // CONNECTION_HPP
@@ -1,9 +1,13 @@
 #ifndef EVENT_LOOP_HPP
 #define EVENT_LOOP_HPP
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #ifdef __linux__
 #include <sys/epoll.h>
@@ -18,13 +22,44 @@ public:
 
     void addFd(int fd, uint32_t events, std::function<void(int, uint32_t)> callback);
 
+    void modifyFd(int fd, uint32_t events);
+
+    // Safe to call from inside the fd's own callback.
     void removeFd(int fd);
 
     void run();
 
+    // Queues task to run on the loop thread. Safe to call from any thread.
+    void post(std::function<void()> task);
+
+    // Runs callback on the loop thread every interval, starting one interval from now.
+    // Must be called before run() or on the loop thread.
+    void runEvery(std::chrono::milliseconds interval, std::function<void()> callback);
+
+    // Makes run() return after the current batch of events. Safe to call from any thread.
+    void stop();
+
 private:
     int event_fd_; // epoll or kqueue file descriptor
+    int wake_fds_[2]; // read/write ends used by stop(); both ends are one eventfd on Linux
+    std::atomic<bool> stopped_;
+    std::mutex posted_mutex_;
+    std::vector<std::function<void()>> posted_;
+    // Callbacks removed while the current batch of events is dispatched; destroyed after it.
+    std::vector<std::function<void(int, uint32_t)>> retired_;
+
+    struct Timer {
+        std::chrono::steady_clock::time_point due;
+        std::chrono::milliseconds interval;
+        std::function<void()> callback;
+    };
+    std::vector<Timer> timers_;
+
+    void wakeup();
+    void runPosted();
+    int msUntilNextTimer() const; // -1 if there are no timers
+    void runDueTimers();
     std::unordered_map<int, std::function<void(int, uint32_t)>> callbacks_; 
 };
 
-#endif // EVENT_LOOP_HPP
\ No newline at end of file
+#endif // EVENT_LOOP_HPP
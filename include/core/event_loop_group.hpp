@@ -0,0 +1,56 @@
+#ifndef EVENT_LOOP_GROUP_HPP
+#define EVENT_LOOP_GROUP_HPP
+
+#include "core/event_loop.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Runs one EventLoop per thread, each with its own SO_REUSEPORT listen socket on the
+// same port. The kernel spreads new connections across the sockets, so an accepted
+// connection is handled by the thread that accepted it for its whole lifetime, with no
+// handoff through a shared queue.
+// With port < 0 no sockets are bound and the loops only run work handed to them
+// through next() (for example connections accepted elsewhere).
+class EventLoopGroup {
+public:
+    // Called on the accepting loop's thread for every accepted client socket. The socket
+    // is non-blocking.
+    using AcceptHandler = std::function<void(int client_fd, EventLoop &loop)>;
+
+    EventLoopGroup(size_t num_loops, int port, bool pin_threads = true);
+    ~EventLoopGroup();
+
+    void start(AcceptHandler handler);
+    void join();
+    void stop();
+
+    // start() followed by join().
+    void run(AcceptHandler handler);
+
+    size_t size() const { return loops_.size(); }
+
+    EventLoop &at(size_t index) { return *loops_[index].loop; }
+
+    // Round-robin pick of a loop, e.g. to post() an accepted connection to.
+    EventLoop &next();
+
+private:
+    struct LoopThread {
+        std::unique_ptr<EventLoop> loop;
+        int listen_fd;
+        int spare_fd; // see dropConnection()
+        std::thread thread;
+    };
+
+    void acceptAll(LoopThread &lt);
+
+    std::vector<LoopThread> loops_;
+    AcceptHandler handler_;
+    std::atomic<size_t> next_loop_{0};
+    bool pin_threads_;
+};
+
+#endif // EVENT_LOOP_GROUP_HPP
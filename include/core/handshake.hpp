@@ -0,0 +1,44 @@
+#ifndef HANDSHAKE_HPP
+#define HANDSHAKE_HPP
+
+#include "core/connection.hpp"
+#include "core/event_loop.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+// Called on the loop thread with a connection whose handshake and ALPN negotiation
+// have completed. The fd is still non-blocking and no longer registered with the loop.
+using HandshakeCallback = std::function<void(std::unique_ptr<Connection>)>;
+
+// Runs TLS handshakes on one loop without blocking its thread: each fd (which must be
+// non-blocking) is registered for whichever readiness the handshake is waiting on
+// (SSL_ERROR_WANT_READ / SSL_ERROR_WANT_WRITE) and advanced from the loop's callbacks.
+// A failed handshake closes the connection, and so does closeExpired() once it has run
+// longer than the timeout. Only used on the loop thread.
+class HandshakeDriver {
+public:
+    HandshakeDriver(EventLoop &loop, std::chrono::milliseconds timeout);
+
+    void start(std::unique_ptr<Connection> conn, HandshakeCallback on_ready);
+
+    // Closes the handshakes older than the timeout; each counts as a HandshakeFailure.
+    void closeExpired();
+
+private:
+    struct Pending {
+        std::unique_ptr<Connection> conn;
+        HandshakeCallback on_ready;
+        uint32_t registered; // events the fd is registered for
+        std::chrono::steady_clock::time_point started;
+    };
+
+    void advance(int fd);
+
+    EventLoop &loop_;
+    std::chrono::milliseconds timeout_;
+    std::unordered_map<int, Pending> pending_;
+};
+
+#endif // HANDSHAKE_HPP
@@ -0,0 +1,28 @@
+#ifndef LISTENER_HPP
+#define LISTENER_HPP
+
+#include <cstddef>
+#include <sys/socket.h>
+
+// Creates a TCP socket bound to INADDR_ANY:port and puts it into listening state.
+// With reuse_port, SO_REUSEPORT is set so several sockets can bind the same port and
+// the kernel load-balances incoming connections across them.
+int createListenSocket(int port, bool reuse_port, bool non_blocking, int backlog = SOMAXCONN);
+
+// accept() returning a non-blocking, close-on-exec client socket with TCP_NODELAY set,
+// or -1 with errno set.
+int acceptNonBlocking(int listen_fd);
+
+// A descriptor held in reserve for dropConnection(), or -1 if none could be opened.
+int openSpareFd();
+
+// For accept() failing with EMFILE or ENFILE: the connection stays in the backlog and a
+// level-triggered listen socket keeps reporting it. Closes spare_fd to make room,
+// accepts the connection and closes it (the client sees a reset), then reopens spare_fd.
+// False if there was no spare or nothing could be accepted.
+bool dropConnection(int listen_fd, int &spare_fd);
+
+// Pins the calling thread to the given CPU. Returns false where affinity is unsupported.
+bool pinThreadToCore(size_t core);
+
+#endif // LISTENER_HPP
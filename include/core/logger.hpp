@@ -0,0 +1,245 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// Asynchronous logging. A log call copies its arguments into a ring buffer that belongs
+// to the calling thread, with no lock, no formatting and no syscall. A background thread
+// formats the records and writes them out in batches. When a ring is full the record is
+// dropped and counted; the caller never blocks.
+//
+//   LOG_INFO("Server listening on port {}", port);
+//
+// The format must be a string literal. Each {} is replaced by the next argument.
+// Arguments may be integers, floating point numbers, enums, pointers, C strings, or
+// anything convertible to std::string_view. Strings are copied, so they need not
+// outlive the call.
+//
+// Sites below BLAZE_LOG_MIN_LEVEL compile to nothing, arguments included, though the
+// arguments are still type-checked and count as used. The
+// BLAZE_LOG_LEVEL CMake option sets it and defaults to INFO, so LOG_DEBUG and
+// LOG_TRACE cost nothing in a normal build. Above that, Logger::setLevel filters at
+// run time.
+
+#ifndef BLAZE_LOG_MIN_LEVEL
+#define BLAZE_LOG_MIN_LEVEL 2 // Info
+#endif
+
+enum class LogLevel : uint8_t { Trace, Debug, Info, Warn, Error, Off };
+
+namespace log_detail {
+
+enum class ArgType : uint8_t { Int, Uint, Double, Bool, Char, Pointer, String };
+
+// Each record starts with this; the arguments follow as a type byte and a value.
+struct RecordHeader {
+    uint32_t size;   // whole record, a multiple of 8; level Off marks ring padding
+    LogLevel level;
+    uint8_t args;
+    const char *format;
+    int64_t time_ns; // since the epoch
+};
+
+const size_t kMaxString = 1024; // longer string arguments are cut
+
+// Single producer (the owning thread), single consumer (the writer thread).
+struct Ring {
+    static const size_t kCapacity = 256 * 1024;
+
+    Ring() : buffer(new char[kCapacity]) {}
+    ~Ring() { delete[] buffer; }
+
+    // Room for size bytes, or nullptr if the ring is full.
+    char *reserve(size_t size) {
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        size_t offset = pos & (kCapacity - 1);
+        size_t pad = offset + size > kCapacity ? kCapacity - offset : 0;
+        if (pos + pad + size - cached_tail > kCapacity) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (pos + pad + size - cached_tail > kCapacity) {
+                return nullptr;
+            }
+        }
+        if (pad) {
+            // Records never wrap; the tail of the buffer is skipped.
+            uint32_t pad_size = static_cast<uint32_t>(pad);
+            std::memcpy(buffer + offset, &pad_size, sizeof(pad_size));
+            buffer[offset + offsetof(RecordHeader, level)] = static_cast<char>(LogLevel::Off);
+            head.store(pos + pad, std::memory_order_release);
+            return buffer;
+        }
+        return buffer + offset;
+    }
+
+    void commit(size_t size) {
+        uint64_t pos = head.load(std::memory_order_relaxed) + size;
+        head.store(pos, std::memory_order_release);
+        // Past half full the writer is woken rather than left to its next poll, once
+        // until it has drained the ring.
+        if (pos - cached_tail > kCapacity / 2) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (pos - cached_tail > kCapacity / 2 && !nudged.exchange(true, std::memory_order_relaxed)) {
+                wakeWriter();
+            }
+        }
+    }
+
+    char *buffer;
+    alignas(64) std::atomic<uint64_t> head{0}; // bytes ever written
+    uint64_t cached_tail = 0;                  // producer's last view of tail
+    alignas(64) std::atomic<uint64_t> tail{0}; // bytes ever consumed
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> nudged{false};
+    std::atomic<bool> orphaned{false};         // the owning thread has exited
+
+private:
+    static void wakeWriter();
+};
+
+inline thread_local Ring *thread_ring = nullptr;
+inline std::atomic<LogLevel> runtime_level{static_cast<LogLevel>(BLAZE_LOG_MIN_LEVEL)};
+
+// Creates and registers the calling thread's ring; starts the writer thread.
+Ring *registerThread();
+
+template <typename T>
+size_t encodedSize(const T &value) {
+    if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, char *>) {
+        return 1 + 4 + (value ? std::min(std::strlen(value), kMaxString) : 6);
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        return 1 + 4 + std::min(std::string_view(value).size(), kMaxString);
+    } else {
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>,
+                      "log arguments must be numbers, enums, pointers or strings");
+        return 1 + 8;
+    }
+}
+
+inline void encodeString(char *&p, std::string_view s) {
+    uint32_t len = static_cast<uint32_t>(std::min(s.size(), kMaxString));
+    *p++ = static_cast<char>(ArgType::String);
+    std::memcpy(p, &len, 4);
+    std::memcpy(p + 4, s.data(), len);
+    p += 4 + len;
+}
+
+template <typename V>
+void encodeValue(char *&p, ArgType type, V value) {
+    static_assert(sizeof(V) == 8, "values are stored in 8 bytes");
+    *p++ = static_cast<char>(type);
+    std::memcpy(p, &value, 8);
+    p += 8;
+}
+
+template <typename T>
+void encode(char *&p, const T &value) {
+    if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, char *>) {
+        encodeString(p, value ? std::string_view(value) : std::string_view("(null)"));
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        encodeString(p, std::string_view(value));
+    } else if constexpr (std::is_same_v<T, bool>) {
+        encodeValue(p, ArgType::Bool, static_cast<uint64_t>(value));
+    } else if constexpr (std::is_same_v<T, char>) {
+        encodeValue(p, ArgType::Char, static_cast<uint64_t>(static_cast<unsigned char>(value)));
+    } else if constexpr (std::is_enum_v<T>) {
+        encodeValue(p, ArgType::Int, static_cast<int64_t>(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+        encodeValue(p, ArgType::Double, static_cast<double>(value));
+    } else if constexpr (std::is_pointer_v<T>) {
+        encodeValue(p, ArgType::Pointer, reinterpret_cast<uint64_t>(value));
+    } else if constexpr (std::is_signed_v<T>) {
+        encodeValue(p, ArgType::Int, static_cast<int64_t>(value));
+    } else {
+        encodeValue(p, ArgType::Uint, static_cast<uint64_t>(value));
+    }
+}
+
+} // namespace log_detail
+
+class Logger {
+public:
+    static bool enabled(LogLevel level) { return level >= log_detail::runtime_level.load(std::memory_order_relaxed); }
+    static LogLevel level() { return log_detail::runtime_level.load(std::memory_order_relaxed); }
+    static void setLevel(LogLevel level) { log_detail::runtime_level.store(level, std::memory_order_relaxed); }
+
+    // Where lines are written: stderr unless changed. The caller keeps the fd open.
+    static void setOutput(int fd);
+    // Returns once everything logged before the call has been written.
+    static void flush();
+    // Records lost to full rings so far. Each loss is also reported in the log.
+    static uint64_t dropped();
+
+    template <typename... Args>
+    static void log(LogLevel level, const char *format, const Args &...args) {
+        using namespace log_detail;
+        size_t size = sizeof(RecordHeader) + (size_t(0) + ... + encodedSize(args));
+        size = (size + 7) & ~size_t(7);
+        Ring *ring = thread_ring ? thread_ring : registerThread();
+        char *p = size <= Ring::kCapacity / 4 ? ring->reserve(size) : nullptr;
+        if (!p) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        RecordHeader header;
+        header.size = static_cast<uint32_t>(size);
+        header.level = level;
+        header.args = static_cast<uint8_t>(sizeof...(args));
+        header.format = format;
+        header.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+        std::memcpy(p, &header, sizeof(header));
+        p += sizeof(header);
+        (encode(p, args), ...);
+        ring->commit(size);
+    }
+};
+
+#define BLAZE_LOG(level, ...)                                                                                          \
+    do {                                                                                                               \
+        if (Logger::enabled(level)) {                                                                                  \
+            Logger::log(level, __VA_ARGS__);                                                                           \
+        }                                                                                                              \
+    } while (0)
+
+#define BLAZE_LOG_NOTHING(...)                                                                                         \
+    do {                                                                                                               \
+        if (false) {                                                                                                   \
+            Logger::log(LogLevel::Trace, __VA_ARGS__);                                                                 \
+        }                                                                                                              \
+    } while (0)
+
+#if BLAZE_LOG_MIN_LEVEL <= 0
+#define LOG_TRACE(...) BLAZE_LOG(LogLevel::Trace, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) BLAZE_LOG_NOTHING(__VA_ARGS__)
+#endif
+#if BLAZE_LOG_MIN_LEVEL <= 1
+#define LOG_DEBUG(...) BLAZE_LOG(LogLevel::Debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) BLAZE_LOG_NOTHING(__VA_ARGS__)
+#endif
+#if BLAZE_LOG_MIN_LEVEL <= 2
+#define LOG_INFO(...) BLAZE_LOG(LogLevel::Info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) BLAZE_LOG_NOTHING(__VA_ARGS__)
+#endif
+#if BLAZE_LOG_MIN_LEVEL <= 3
+#define LOG_WARN(...) BLAZE_LOG(LogLevel::Warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...) BLAZE_LOG_NOTHING(__VA_ARGS__)
+#endif
+#if BLAZE_LOG_MIN_LEVEL <= 4
+#define LOG_ERROR(...) BLAZE_LOG(LogLevel::Error, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) BLAZE_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#endif // LOGGER_HPP
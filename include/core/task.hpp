@@ -0,0 +1,95 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A move-only void() callable. Callables of up to kInlineSize bytes are stored in the
+// object itself, so wrapping the usual lambda (a few pointers and a shared_ptr) does not
+// allocate; larger ones are moved to the heap. The whole object is one cache line.
+class Task {
+public:
+    static const size_t kInlineSize = 56;
+
+    Task() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+    Task(F &&f) {
+        using Callable = std::decay_t<F>;
+        if constexpr (sizeof(Callable) <= kInlineSize && alignof(Callable) <= alignof(void *) &&
+                      std::is_nothrow_move_constructible<Callable>::value) {
+            new (storage_) Callable(std::forward<F>(f));
+            ops_ = &inlineOps<Callable>;
+        } else {
+            *reinterpret_cast<Callable **>(storage_) = new Callable(std::forward<F>(f));
+            ops_ = &heapOps<Callable>;
+        }
+    }
+
+    Task(Task &&other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->relocate(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->relocate(other.storage_, storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*relocate)(void *from, void *to); // move-constructs into to and destroys from
+        void (*destroy)(void *storage);
+    };
+
+    template <typename Callable>
+    static constexpr Ops inlineOps = {
+        [](void *s) { (*static_cast<Callable *>(s))(); },
+        [](void *from, void *to) {
+            Callable *source = static_cast<Callable *>(from);
+            new (to) Callable(std::move(*source));
+            source->~Callable();
+        },
+        [](void *s) { static_cast<Callable *>(s)->~Callable(); },
+    };
+
+    template <typename Callable>
+    static constexpr Ops heapOps = {
+        [](void *s) { (**static_cast<Callable **>(s))(); },
+        [](void *from, void *to) { *static_cast<Callable **>(to) = *static_cast<Callable **>(from); },
+        [](void *s) { delete *static_cast<Callable **>(s); },
+    };
+
+    const Ops *ops_ = nullptr;
+    alignas(void *) unsigned char storage_[kInlineSize];
+};
+
+#endif // TASK_HPP
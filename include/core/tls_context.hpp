@@ -0,0 +1,62 @@
+#ifndef TLS_CONTEXT_HPP
+#define TLS_CONTEXT_HPP
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <openssl/ssl.h>
+
+// Process-wide server SSL_CTX: the certificate and key are loaded and checked once at
+// startup and every Connection creates its SSL from it. Returning clients resume either
+// through the server-side session cache (session IDs) or through session tickets
+// encrypted with a key that rotates every ticket_key_lifetime; tickets issued under the
+// previous key are still accepted (and renewed) for one more lifetime.
+class TlsContext
+{
+public:
+    TlsContext(const std::string &cert_file, const std::string &key_file,
+               std::vector<std::string> alpn_protocols = {"h2", "http/1.1"},
+               std::chrono::seconds ticket_key_lifetime = std::chrono::hours(1),
+               long session_cache_size = 20480);
+    ~TlsContext();
+
+    TlsContext(const TlsContext &) = delete;
+    TlsContext &operator=(const TlsContext &) = delete;
+
+    SSL_CTX *get() const { return ssl_ctx_; }
+
+    // Starts encrypting new tickets with a fresh key right away.
+    void rotateTicketKeys();
+
+private:
+    struct TicketKey
+    {
+        unsigned char name[16];
+        unsigned char aes_key[32];
+        unsigned char hmac_key[32];
+        std::chrono::steady_clock::time_point created;
+    };
+
+    static int selectAlpn(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                          const unsigned char *in, unsigned int inlen, void *arg);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int ticketKeyCallback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                                 EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc);
+#else
+    static int ticketKeyCallback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                                 EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx, int enc);
+#endif
+
+    TicketKey makeTicketKey() const;
+    // Rotates if the current key has expired and drops keys too old to accept. Caller holds keys_mutex_.
+    void expireTicketKeys();
+
+    SSL_CTX *ssl_ctx_;
+    std::string alpn_wire_; // protocols in ALPN wire format, in server preference order
+    std::chrono::seconds ticket_key_lifetime_;
+    std::mutex keys_mutex_;
+    std::vector<TicketKey> ticket_keys_; // newest first
+};
+
+#endif // TLS_CONTEXT_HPP
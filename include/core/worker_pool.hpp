@@ -1,26 +1,60 @@
 #ifndef WORKER_POOL_HPP
 #define WORKER_POOL_HPP
 
-#include <thread>
-#include <queue>
-#include <functional>
-#include <mutex>
+#include "core/task.hpp"
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+// A work-stealing thread pool. Each worker owns a Chase-Lev deque: tasks a worker submits
+// go to the bottom of its own deque and it runs them newest first, while idle workers
+// steal the oldest from the top. Tasks submitted from any other thread (the event loops)
+// go through a bounded lock-free injection queue, with a locked overflow list behind it
+// for bursts. Idle workers spin briefly before parking on a condition variable, and
+// submit() only takes the lock to wake one when nobody is already looking for work.
 class WorkerPool {
 public:
-    WorkerPool(size_t num_workers);
+    // With pin_threads, worker i is pinned to CPU i modulo the number of CPUs.
+    WorkerPool(size_t num_workers, bool pin_threads = false);
+    // Runs every task already submitted, then joins the workers.
     ~WorkerPool();
 
-    void submit(std::function<void()> task);
+    void submit(Task task);
 
 private:
-    std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    std::mutex queue_mutex_;
-    std::condition_variable condition_;
-    bool stop_;
+    struct Node;
+    struct Worker;
+    class InjectionQueue;
+
+    bool findTask(Worker &self, Task &task);
+    bool spin(Worker &self, Task &task);
+    bool park();
+    bool hasWork() const;
+    void wake();
+    void run(Worker &self);
+
+    Node *allocNode(Worker &self);
+    void take(Worker &self, Node *node, Task &task);
+
+    static thread_local Worker *current_;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::unique_ptr<InjectionQueue> injection_;
+    std::mutex overflow_mutex_;
+    std::deque<Task> overflow_;
+    std::atomic<size_t> overflow_size_{0};
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+    std::atomic<size_t> spinning_{0};
+    std::atomic<size_t> sleeping_{0};
+    std::atomic<bool> waking_{false}; // a notify is in flight
+    size_t waiters_ = 0;              // guarded by park_mutex_, as are notified_ and stop_
+    size_t notified_ = 0;
+    size_t max_spinning_;
+    bool stop_ = false;
 };
 
-#endif // WORKER_POOL_HPP
\ No newline at end of file
+#endif // WORKER_POOL_HPP
@@ -1,20 +1,181 @@
 #ifndef CACHE_HPP
 #define CACHE_HPP
 
-#include <unordered_map>
-#include <string>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
 
-class Cache {
+// Byte-budgeted LRU cache of immutable values, split into shards by key hash so
+// threads only contend when they touch the same shard. Values are shared: a hit hands
+// out another reference to the stored value instead of copying it, and an evicted
+// value stays alive for whoever still holds it. T::size() is the value's size in bytes.
+template <typename T>
+class BasicCache {
 public:
-    Cache(size_t max_size);
-    bool get(const std::string& key, std::string& value);
-    void put(const std::string& key, const std::string& value);
+    using Value = std::shared_ptr<const T>;
+    using Stats = CacheStats;
+
+    // max_bytes is split evenly across the shards; a value that does not fit in one
+    // shard's share is not cached.
+    explicit BasicCache(size_t max_bytes, size_t num_shards = 16);
+
+    // nullptr on a miss.
+    Value get(const std::string& key);
+    void put(const std::string& key, Value value);
+    bool erase(const std::string& key);
+
+    // Summed over the shards; each shard is consistent, the total is approximate.
+    Stats stats() const;
+
+    // Roughly the largest value put() keeps, for callers that want to know before
+    // building one.
+    size_t maxValueSize() const { return shard_budget_ > kEntryOverhead ? shard_budget_ - kEntryOverhead : 0; }
 
 private:
-    std::unordered_map<std::string, std::string> cache_;
-    std::mutex mutex_;
-    size_t max_size_;
+    // Rough per-entry bookkeeping (list node, hash node, control block) counted against
+    // the budget, so that many tiny values cannot blow past it.
+    static const size_t kEntryOverhead = 128;
+
+    struct Node {
+        std::string key;
+        Value value;
+        size_t charge;
+    };
+
+    // Cache-line aligned so that one shard's lock and counters do not share a line
+    // with its neighbour's.
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::list<Node> lru; // most recently used first
+        std::unordered_map<std::string, typename std::list<Node>::iterator> index;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+    };
+
+    Shard& shardFor(const std::string& key);
+
+    size_t shard_budget_;
+    std::vector<std::unique_ptr<Shard>> shards_;
 };
 
-#endif // CACHE_HPP
\ No newline at end of file
+using Cache = BasicCache<std::string>;
+
+template <typename T>
+BasicCache<T>::BasicCache(size_t max_bytes, size_t num_shards) {
+    if (num_shards == 0) {
+        throw std::invalid_argument("Cache needs at least one shard");
+    }
+    shard_budget_ = max_bytes / num_shards;
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+}
+
+template <typename T>
+typename BasicCache<T>::Shard& BasicCache<T>::shardFor(const std::string& key) {
+    // Mix the hash so that shard selection does not depend on its low bits alone.
+    size_t h = std::hash<std::string>{}(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return *shards_[h % shards_.size()];
+}
+
+template <typename T>
+typename BasicCache<T>::Value BasicCache<T>::get(const std::string& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        ++shard.misses;
+        return nullptr;
+    }
+    ++shard.hits;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->value;
+}
+
+template <typename T>
+void BasicCache<T>::put(const std::string& key, Value value) {
+    if (!value) {
+        return;
+    }
+    size_t charge = key.size() + value->size() + kEntryOverhead;
+    Shard& shard = shardFor(key);
+    // Released after the lock, so freeing large evicted values does not hold it up.
+    std::list<Node> evicted;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.bytes -= it->second->charge;
+            evicted.splice(evicted.end(), shard.lru, it->second);
+            shard.index.erase(it);
+        }
+        if (charge > shard_budget_) {
+            return;
+        }
+        while (shard.bytes + charge > shard_budget_ && !shard.lru.empty()) {
+            Node& victim = shard.lru.back();
+            shard.bytes -= victim.charge;
+            shard.index.erase(victim.key);
+            evicted.splice(evicted.end(), shard.lru, std::prev(shard.lru.end()));
+            ++shard.evictions;
+        }
+        shard.lru.push_front(Node{key, std::move(value), charge});
+        shard.index.emplace(key, shard.lru.begin());
+        shard.bytes += charge;
+        ++shard.insertions;
+    }
+}
+
+template <typename T>
+bool BasicCache<T>::erase(const std::string& key) {
+    Shard& shard = shardFor(key);
+    std::list<Node> erased;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    shard.bytes -= it->second->charge;
+    erased.splice(erased.end(), shard.lru, it->second);
+    shard.index.erase(it);
+    return true;
+}
+
+template <typename T>
+typename BasicCache<T>::Stats BasicCache<T>::stats() const {
+    Stats total;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total.hits += shard->hits;
+        total.misses += shard->misses;
+        total.insertions += shard->insertions;
+        total.evictions += shard->evictions;
+        total.entries += shard->index.size();
+        total.bytes += shard->bytes;
+    }
+    return total;
+}
+
+#endif // CACHE_HPP
@@ -0,0 +1,28 @@
+#ifndef CHAR_SCAN_HPP
+#define CHAR_SCAN_HPP
+
+#include <string>
+
+// Byte classes of the HTTP/1.1 grammar that the request parser scans over.
+enum class CharClass
+{
+    Token,         // method and header names (RFC 9110 tchar)
+    RequestTarget, // visible ASCII, no spaces
+    FieldValue     // header values: visible ASCII, obs-text, SP and HTAB
+};
+
+// Returns the first byte in [p, end) that is not in the class, or end. Stopping at a
+// delimiter (' ', ':', CR) and validating every byte before it is the same scan, so
+// callers check the returned byte instead of validating separately.
+//
+// Runs 32 bytes at a time with AVX2, 16 with SSE4.2, or byte by byte, picked once by
+// CPUID at startup.
+const char *scanWhile(CharClass char_class, const char *p, const char *end);
+
+// Kernel scanWhile() currently uses: "avx2", "sse4.2" or "scalar".
+std::string scanKernel();
+// Switches kernels, e.g. to compare them in a benchmark. Returns false if the CPU does
+// not support the requested one.
+bool setScanKernel(const std::string &name);
+
+#endif // CHAR_SCAN_HPP
@@ -0,0 +1,112 @@
+#ifndef HEADERS_HPP
+#define HEADERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory_resource>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Header names the server looks at, resolved once when a field is added so that
+// looking them up is an index instead of a scan with string compares.
+enum class HeaderId : uint8_t
+{
+    Other, // any name not listed here
+    Accept,
+    AcceptEncoding,
+    Age,
+    Authorization,
+    CacheControl,
+    Connection,
+    ContentEncoding,
+    ContentLength,
+    ContentType,
+    Cookie,
+    Date,
+    ETag,
+    Expect,
+    Host,
+    IfModifiedSince,
+    IfNoneMatch,
+    KeepAlive,
+    LastModified,
+    Location,
+    ProxyConnection,
+    Server,
+    SetCookie,
+    TE,
+    Trailer,
+    TransferEncoding,
+    Upgrade,
+    UserAgent,
+    Vary,
+    Count
+};
+
+// The ID of a header name, matched case-insensitively; HeaderId::Other if unknown.
+HeaderId headerId(std::string_view name);
+
+struct HeaderField
+{
+    std::string_view name;
+    std::string_view value;
+    HeaderId id;
+};
+
+// The header fields of a request or response, in order and with repeats kept (e.g.
+// several Set-Cookie). Names and values live in one buffer owned by the container and
+// the fields are views into it, so a message with n headers costs two allocations
+// instead of a hash table plus 2n strings. Lookups are case-insensitive; the first
+// field with a known ID is found by index.
+//
+// Both allocations come from a memory resource, e.g. a connection's request arena.
+// Copies allocate from the default resource, so copying is how headers outlive it.
+class Headers
+{
+public:
+    Headers() = default;
+    explicit Headers(std::pmr::memory_resource *resource) : fields_(resource), storage_(resource) {}
+    Headers(std::initializer_list<std::pair<std::string_view, std::string_view>> fields);
+    Headers(const Headers &other);
+    Headers &operator=(const Headers &other);
+    // A moved-from Headers is empty.
+    Headers(Headers &&other) noexcept;
+    Headers &operator=(Headers &&other);
+
+    // Appends a field, even if one with this name exists.
+    void add(std::string_view name, std::string_view value);
+    // Same, with the name's ID already known (e.g. from the request parser).
+    void add(std::string_view name, std::string_view value, HeaderId id);
+    // Replaces every field with this name by one field at the end.
+    void set(std::string_view name, std::string_view value);
+    void remove(std::string_view name);
+    void clear();
+    // Room for fields with bytes of names and values in total.
+    void reserve(size_t fields, size_t bytes);
+
+    // Value of the first field with this name or ID, or nullptr.
+    const std::string_view *get(HeaderId id) const;
+    const std::string_view *get(std::string_view name) const;
+
+    size_t size() const { return fields_.size(); }
+    bool empty() const { return fields_.empty(); }
+    std::pmr::vector<HeaderField>::const_iterator begin() const { return fields_.begin(); }
+    std::pmr::vector<HeaderField>::const_iterator end() const { return fields_.end(); }
+
+private:
+    static const uint16_t kUnindexed = UINT16_MAX;
+
+    std::string_view store(std::string_view s);
+    void rebase(const char *old_base);
+    void reindex();
+
+    std::pmr::vector<HeaderField> fields_; // views into storage_
+    std::pmr::vector<char> storage_;       // grown by hand, see reserve()
+    // 1 + index of the first field with each ID, 0 if there is none. Messages with more
+    // fields than fit are searched instead.
+    uint16_t first_[static_cast<size_t>(HeaderId::Count)] = {};
+};
+
+#endif // HEADERS_HPP
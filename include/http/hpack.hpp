@@ -0,0 +1,138 @@
+#ifndef HPACK_HPP
+#define HPACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// HPACK (RFC 7541) header compression for HTTP/2 HEADERS blocks.
+
+struct HpackField {
+    std::string_view name;
+    std::string_view value;
+    bool sensitive = false; // never indexed, e.g. authorization
+};
+
+// Huffman code from RFC 7541 Appendix B. Decoding walks a 4-bit state table built
+// from the code once, so a byte costs two lookups.
+size_t huffmanEncodedLength(std::string_view s);
+// Writes the code for s to out, which needs room for huffmanEncodedLength(s) bytes;
+// returns the end of the written bytes.
+uint8_t *huffmanEncode(std::string_view s, uint8_t *out);
+// Appends the decoded bytes to out. Throws std::runtime_error on an invalid code or
+// bad padding.
+void huffmanDecode(const uint8_t *data, size_t len, std::string &out);
+
+// Index of the static table entry (1-61) with exactly this name and value, or 0.
+// Names are found through a perfect hash over the table's 52 distinct names.
+size_t hpackStaticIndex(std::string_view name, std::string_view value, size_t &name_index);
+
+// The dynamic table: entries in a ring, newest first. Evicted slots keep their string
+// capacity, so once warm an insert does not allocate.
+class HpackTable {
+public:
+    explicit HpackTable(size_t max_size) : max_size_(max_size) {}
+
+    // Entry i, 0 being the newest. i < count().
+    std::string_view name(size_t i) const { return at(i).name(); }
+    std::string_view value(size_t i) const { return at(i).value(); }
+    size_t count() const { return count_; }
+    size_t size() const { return size_; } // per RFC 7541: name + value + 32 per entry
+    size_t maxSize() const { return max_size_; }
+
+    // Evicts as needed. An entry larger than the table just empties it.
+    void insert(std::string_view name, std::string_view value);
+    void setMaxSize(size_t max_size);
+
+    // Newest entry with this name and value (exact) or this name (name_match), as a
+    // table position, or -1.
+    long find(std::string_view name, std::string_view value, long &name_match) const;
+
+private:
+    struct Entry {
+        std::string bytes; // name followed by value
+        size_t name_len = 0;
+        uint32_t name_hash = 0;
+        uint64_t older_link = 0; // link to the next older entry in the same name bucket
+        std::string_view name() const { return std::string_view(bytes).substr(0, name_len); }
+        std::string_view value() const { return std::string_view(bytes).substr(name_len); }
+    };
+
+    static const size_t kNameBuckets = 256;
+
+    static uint32_t hash(std::string_view s);
+    const Entry &at(size_t i) const { return ring_[(head_ + ring_.size() - 1 - i) & (ring_.size() - 1)]; }
+    void evictOldest();
+
+    std::vector<Entry> ring_; // power-of-two size; head_ is the next slot to fill
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t size_ = 0;
+    size_t max_size_;
+    // Entries with a name hashing to a bucket form a chain from the newest one; a link
+    // is an entry's insertion number + 1. Evicted entries need no unlinking: entries
+    // leave in insertion order, so a chain is cut at the first link to one.
+    uint64_t inserted_ = 0;
+    uint64_t name_buckets_[kNameBuckets] = {};
+};
+
+class HpackDecoder {
+public:
+    // max_table_size is what we advertise as SETTINGS_HEADER_TABLE_SIZE.
+    explicit HpackDecoder(size_t max_table_size = 4096);
+
+    // Decodes one complete header block, calling on_field(name, value) for each field
+    // in order. The views are only valid during the call. Throws std::runtime_error on
+    // a malformed block; the connection is then unusable (COMPRESSION_ERROR).
+    template <typename F>
+    void decode(const uint8_t *data, size_t len, F &&on_field) {
+        using Fn = std::remove_reference_t<F>;
+        decodeBlock(data, len,
+                    [](void *ctx, std::string_view name, std::string_view value) {
+                        (*static_cast<Fn *>(ctx))(name, value);
+                    },
+                    const_cast<void *>(static_cast<const void *>(&on_field)));
+    }
+
+    const HpackTable &table() const { return table_; }
+
+private:
+    using Sink = void (*)(void *ctx, std::string_view name, std::string_view value);
+
+    void decodeBlock(const uint8_t *data, size_t len, Sink sink, void *ctx);
+    std::string_view readString(const uint8_t *&p, const uint8_t *end, std::string &scratch);
+    std::string_view indexedName(uint64_t index) const;
+
+    HpackTable table_;
+    size_t max_table_size_;
+    std::string name_scratch_;  // Huffman-decoded strings, reused between fields
+    std::string value_scratch_;
+};
+
+class HpackEncoder {
+public:
+    // max_table_size is the peer's SETTINGS_HEADER_TABLE_SIZE.
+    explicit HpackEncoder(size_t max_table_size = 4096);
+
+    // Upper bound on what encode() writes for these fields.
+    static size_t maxEncodedSize(const HpackField *fields, size_t count);
+
+    // Writes the header block for fields to out, which must have room for
+    // maxEncodedSize() bytes, and returns its length. Fields are indexed unless they
+    // are sensitive or too large for the table; strings are Huffman coded when shorter.
+    size_t encode(const HpackField *fields, size_t count, uint8_t *out);
+
+    // The peer changed its table size; the next block starts with a size update.
+    void setMaxTableSize(size_t max_table_size);
+
+private:
+    uint8_t *encodeField(const HpackField &field, uint8_t *out);
+
+    HpackTable table_;
+    bool size_update_pending_ = false;
+};
+
+#endif // HPACK_HPP
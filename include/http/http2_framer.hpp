@@ -1,16 +1,104 @@
 #ifndef HTTP2_FRAMER_HPP
 #define HTTP2_FRAMER_HPP
 
-#include <string>
-#include <vector>
+#include "http/hpack.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// HTTP/2 frame layer (RFC 7540 section 4 and 6) without nghttp2: frames are parsed in
+// place from the connection's read buffer and written into buffers the caller owns,
+// so neither direction allocates.
+
+enum class Http2FrameType : uint8_t {
+    Data = 0x0,
+    Headers = 0x1,
+    Priority = 0x2,
+    RstStream = 0x3,
+    Settings = 0x4,
+    PushPromise = 0x5,
+    Ping = 0x6,
+    GoAway = 0x7,
+    WindowUpdate = 0x8,
+    Continuation = 0x9,
+};
+
+namespace Http2Flags {
+const uint8_t EndStream = 0x1;
+const uint8_t Ack = 0x1; // SETTINGS and PING
+const uint8_t EndHeaders = 0x4;
+const uint8_t Padded = 0x8;
+const uint8_t Priority = 0x20;
+} // namespace Http2Flags
+
+// A frame as it sits in the buffer; payload points into it.
+struct Http2Frame {
+    uint32_t length;
+    Http2FrameType type; // may be a value not listed above; such frames are ignored
+    uint8_t flags;
+    uint32_t stream_id;
+    const uint8_t *payload;
+};
+
+struct Http2Setting {
+    uint16_t id;
+    uint32_t value;
+};
 
 class Http2Framer {
 public:
-    Http2Framer() = default;
+    static const size_t kFrameHeaderSize = 9;
+    static const uint32_t kDefaultMaxFrameSize = 16384;
+
+    // max_frame_size: the largest frame we accept (our SETTINGS_MAX_FRAME_SIZE).
+    explicit Http2Framer(uint32_t max_frame_size = kDefaultMaxFrameSize) : max_frame_size_(max_frame_size) {}
+
+    // True, with frame set, if data starts with a complete frame; its size is
+    // kFrameHeaderSize + frame.length. Throws std::runtime_error on an oversized frame.
+    bool parseFrame(const uint8_t *data, size_t len, Http2Frame &frame) const;
+
+    // Calls on_frame(const Http2Frame &) for each complete frame at the start of data
+    // and returns the bytes they took; the rest is the start of an incomplete frame.
+    template <typename F>
+    size_t parseFrames(const uint8_t *data, size_t len, F &&on_frame) const {
+        size_t consumed = 0;
+        Http2Frame frame;
+        while (parseFrame(data + consumed, len - consumed, frame)) {
+            consumed += kFrameHeaderSize + frame.length;
+            on_frame(frame);
+        }
+        return consumed;
+    }
+
+    // The header block fragment of a HEADERS, PUSH_PROMISE or CONTINUATION frame and
+    // the data of a DATA frame, without padding and priority fields. Throw
+    // std::runtime_error if the padding is longer than the frame.
+    static std::string_view headerBlockFragment(const Http2Frame &frame);
+    static std::string_view dataPayload(const Http2Frame &frame);
+
+    // Writers: each writes one or more frames to out and returns the bytes written,
+    // or 0 if cap is too small (nothing is written then).
+    static size_t writeFrame(uint8_t *out, size_t cap, Http2FrameType type, uint8_t flags, uint32_t stream_id,
+                             const uint8_t *payload, size_t len);
+    static size_t writeSettings(uint8_t *out, size_t cap, const Http2Setting *settings, size_t count);
+    static size_t writeSettingsAck(uint8_t *out, size_t cap);
+    static size_t writePing(uint8_t *out, size_t cap, const uint8_t opaque[8], bool ack);
+    static size_t writeWindowUpdate(uint8_t *out, size_t cap, uint32_t stream_id, uint32_t increment);
+    static size_t writeRstStream(uint8_t *out, size_t cap, uint32_t stream_id, uint32_t error_code);
+    static size_t writeGoAway(uint8_t *out, size_t cap, uint32_t last_stream_id, uint32_t error_code);
+    // A HEADERS frame with the encoded fields, followed by CONTINUATION frames if the
+    // block is larger than max_frame_size (the peer's setting).
+    static size_t writeHeaders(uint8_t *out, size_t cap, uint32_t stream_id, const HpackField *fields, size_t count,
+                               bool end_stream, HpackEncoder &encoder, uint32_t max_frame_size = kDefaultMaxFrameSize);
+
+    uint32_t maxFrameSize() const { return max_frame_size_; }
+    void setMaxFrameSize(uint32_t max_frame_size) { max_frame_size_ = max_frame_size; }
 
-    void parseFrames(const std::string& data);
+private:
+    static void writeFrameHeader(uint8_t *out, uint32_t length, Http2FrameType type, uint8_t flags,
+                                 uint32_t stream_id);
 
-    std::string generateFrame(const std::string& payload, uint8_t type, uint32_t stream_id);
+    uint32_t max_frame_size_;
 };
 
-#endif // HTTP2_FRAMER_HPP
\ No newline at end of file
+#endif // HTTP2_FRAMER_HPP
@@ -0,0 +1,92 @@
+#ifndef HTTP2_SESSION_HPP
+#define HTTP2_SESSION_HPP
+
+#include "core/connection.hpp"
+#include "http/response_stream.hpp"
+#include "http/session.hpp"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct nghttp2_session;
+
+// One HTTP/2 connection (ALPN "h2"), with its own nghttp2 session. Every stream is a
+// request of its own: headers and body are collected per stream, the handler runs
+// when the stream's END_STREAM arrives, and the response is submitted on that stream.
+// A body larger than max_buffered_body is streamed instead (Request::body_stream): the
+// handler runs as soon as that is known, and the stream's flow-control window is only
+// reopened as the response's stream takes the body.
+// Up to max_concurrent_streams requests are in flight at once and their DATA frames
+// are interleaved as flow control allows, so a slow response (e.g. a streamed proxy
+// answer) does not hold up the others. nghttp2 only sizes DATA frames: their payload
+// is queued straight from the response body, file or stream buffer. SETTINGS, PING
+// and WINDOW_UPDATE are handled by nghttp2; shutdown() sends GOAWAY.
+class Http2Session : public Session
+{
+public:
+    Http2Session(std::unique_ptr<Connection> conn, const RequestHandler &handler, const SessionLimits &limits,
+                 EventLoop &loop, std::function<void()> wake);
+    ~Http2Session() override;
+
+    Status process() override;
+    void shutdown() override;
+
+    int fd() const override { return conn_->fd(); }
+    std::chrono::steady_clock::time_point last_activity() const override { return last_activity_; }
+
+private:
+    struct Stream;
+    struct Callbacks; // nghttp2 callbacks
+    class StreamSink;
+
+    // A piece of pending output: serialized frame bytes, then optionally a region of a
+    // shared body string or of a file written from where it lies.
+    struct OutputChunk
+    {
+        std::string bytes;
+        size_t offset = 0;
+        std::shared_ptr<const std::string> data;
+        const char *data_ptr = nullptr;
+        size_t data_remaining = 0;
+        std::shared_ptr<const FileBody> file;
+        off_t file_offset = 0;
+        size_t file_remaining = 0;
+    };
+
+    bool readAvailable();
+    void streamRequestBody(Stream &stream, int64_t length);
+    void releaseRequestBody(Stream &stream);
+    void answerReadyStreams();
+    void submitResponse(Stream &stream, Response response);
+    void submitHead(Stream &stream, const Response &head, bool has_body, long long content_length);
+    void submitRaw(Stream &stream, Response response);
+    void feed(Stream &stream, const char *data, size_t len);
+    size_t feedHead(Stream &stream, const char *data, size_t len);
+    void feedBody(Stream &stream, const char *data, size_t len);
+    bool queueData(Stream &stream, const uint8_t *framehd, size_t length);
+    OutputChunk &appendableChunk();
+    bool pumpSources();
+    bool flush();
+
+    std::unique_ptr<Connection> conn_;
+    const RequestHandler &handler_;
+    const SessionLimits &limits_;
+    EventLoop &loop_;
+    std::function<void()> wake_;
+
+    nghttp2_session *session_ = nullptr;
+    std::unordered_map<int32_t, std::unique_ptr<Stream>> streams_;
+    std::vector<int32_t> ready_; // streams whose request is complete, in arrival order
+    std::deque<OutputChunk> out_; // output not written yet
+    size_t pending_output_ = 0;    // its bytes
+    uint64_t bytes_written_ = 0;
+    bool write_blocked_ = false;
+    bool peer_closed_ = false;
+    std::chrono::steady_clock::time_point last_activity_;
+};
+
+#endif // HTTP2_SESSION_HPP
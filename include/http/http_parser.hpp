@@ -1,45 +1,74 @@
 #ifndef HTTP_PARSER_HPP
 #define HTTP_PARSER_HPP
 
-#include <string>
-#include <unordered_map>
+#include "http/headers.hpp"
+#include "http/request_body.hpp"
 #include <memory>
+#include <memory_resource>
+#include <string>
+#include <sys/types.h>
 
+// Handlers get a Request that may live in a per-connection request arena (see
+// RequestView::toRequest); copy it to keep any part beyond the handler call. Copies
+// allocate from the default resource.
 struct Request
 {
-    std::string method;
-    std::string path;
-    std::string version;
-    std::unordered_map<std::string, std::string> headers;
-    std::string body;
+    std::pmr::string method;
+    std::pmr::string path;
+    std::pmr::string version;
+    Headers headers;
+    std::pmr::string body;
+    // Set instead of body when the body is too large to buffer; it arrives through this
+    // while the request is being handled.
+    std::shared_ptr<RequestBody> body_stream;
 };
 
+// A region of an open file used as a response body. The bytes are never loaded into
+// memory; plaintext connections hand them to the kernel with sendfile(2). Owns fd.
+struct FileBody
+{
+    FileBody(int fd, off_t offset, size_t length) : fd(fd), offset(offset), length(length) {}
+    ~FileBody();
+    FileBody(const FileBody &) = delete;
+    FileBody &operator=(const FileBody &) = delete;
+
+    int fd;
+    off_t offset;
+    size_t length;
+};
+
+class ResponseStream;
+
 struct Response
 {
     int status_code;
     std::string status_message;
     std::string version;
-    std::unordered_map<std::string, std::string> headers;
+    Headers headers;
     std::string body;
+    // Complete, already serialized HTTP/1.1 message (e.g. a cache hit). When set it is
+    // sent as-is instead of being generated from the fields above.
+    std::shared_ptr<const std::string> raw;
+    // With raw: header lines that end its head, blank line included, so raw stops before
+    // the blank line (e.g. a cache hit's Age).
+    std::string raw_fields;
+    // With raw: the body, sent by reference after the head; raw is then only the head.
+    std::shared_ptr<const std::string> raw_body;
+    // With raw: its head has no Date or Server header; they are added as it is sent
+    // (e.g. a static file's head, built once and served for as long as the file is).
+    bool raw_add_date = false;
+    // When set, the body is this file region instead of `body`.
+    std::shared_ptr<const FileBody> file;
+    // When set, the whole message (head and body) comes from this stream instead.
+    std::shared_ptr<ResponseStream> stream;
 };
 
-class Connection; // Forward declaration
-
+// HTTP/1.1 only; HTTP/2 connections are framed by Http2Session.
 class HttpParser
 {
 public:
-    HttpParser();
-    ~HttpParser();
-
-    Request parseRequest(const std::string &data, const Connection &conn);
-    std::string generateResponse(const Response &response, const Connection &conn);
-
     Request parseRequest(const std::string &data);
     std::string generateResponse(const Response &response);
-
-private:
-    struct Impl;
-    std::unique_ptr<Impl> pimpl_; 
 };
 
 #endif // HTTP_PARSER_HPP
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef HTTP_SERVER_HPP
+#define HTTP_SERVER_HPP
+
+#include "core/event_loop.hpp"
+#include "core/event_loop_group.hpp"
+#include "core/handshake.hpp"
+#include "core/tls_context.hpp"
+#include "core/worker_pool.hpp"
+#include "http/http_parser.hpp"
+#include "http/http_session.hpp"
+#include "http/session.hpp"
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct HttpServerConfig
+{
+    int port = 8080;
+    // true: NUM_LOOPS SO_REUSEPORT loops accept and run every request inline.
+    // false: one acceptor, num_loops I/O loops for handshakes and readiness, and
+    // requests handled on num_workers WorkerPool threads.
+    bool reuse_port = false;
+    size_t num_loops = 1;
+    size_t num_workers = 16;
+    // A connection whose TLS handshake has not finished by then is closed.
+    std::chrono::milliseconds handshake_timeout{10000};
+    SessionLimits limits;
+};
+
+// Accepts connections, runs their handshakes on the event loops and serves a session
+// on each: HTTP/2 if ALPN picked "h2", HTTP/1.1 keep-alive otherwise. A session is owned by the loop that accepted it; in
+// worker mode its fd is armed EPOLLONESHOT and each readiness event hands the session
+// to a worker, which returns it to the loop when it is done. A session waiting on a
+// streamed response is not armed at all; the stream wakes it. Idle sessions are closed
+// by a once-a-second sweep on each loop; they, and all sessions on shutdown, get
+// Session::shutdown() first. The same sweep drops handshakes past handshake_timeout.
+class HttpServer
+{
+public:
+    HttpServer(const HttpServerConfig &config, const TlsContext *tls, HttpParser &parser, RequestHandler handler);
+    ~HttpServer();
+
+    // Blocks until stop() is called.
+    void run();
+    void stop();
+
+private:
+    struct SessionEntry
+    {
+        std::shared_ptr<Session> session;
+        bool busy = false;       // a worker is running process()
+        bool rewake = false;     // woken while busy; process() again when it returns
+        uint32_t armed = 0;      // events the fd is registered for
+    };
+    using SessionMap = std::unordered_map<int, SessionEntry>;
+
+    // accepted: when accept() returned the socket.
+    void startConnection(EventLoop &loop, int client_fd, std::chrono::steady_clock::time_point accepted);
+    void addSession(EventLoop &loop, std::unique_ptr<Connection> conn);
+    void dispatch(EventLoop &loop, int fd);
+    void finish(EventLoop &loop, int fd, Session::Status status);
+    void closeIdleSessions(EventLoop &loop);
+
+    HttpServerConfig config_;
+    const TlsContext *tls_;
+    HttpParser &parser_;
+    RequestHandler handler_;
+
+    std::unique_ptr<EventLoopGroup> loops_;
+    std::unique_ptr<EventLoop> acceptor_; // worker mode only
+    int listen_fd_ = -1;
+    int spare_fd_ = -1; // see dropConnection()
+    // One session map per loop, only touched on that loop's thread.
+    std::unordered_map<EventLoop *, SessionMap> sessions_;
+    std::unordered_map<EventLoop *, std::unique_ptr<HandshakeDriver>> handshakes_;
+    std::unique_ptr<WorkerPool> workers_; // declared last: joined before the loops go away
+};
+
+#endif // HTTP_SERVER_HPP
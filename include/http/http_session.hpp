@@ -0,0 +1,93 @@
+#ifndef HTTP_SESSION_HPP
+#define HTTP_SESSION_HPP
+
+#include "core/connection.hpp"
+#include "http/http_parser.hpp"
+#include "http/request_parser.hpp"
+#include "http/response_stream.hpp"
+#include "http/session.hpp"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+// One HTTP/1.1 connection after its handshake: a growing read buffer, every complete
+// request in it answered in order (pipelining), and responses queued in an output
+// queue that is flushed as far as the non-blocking socket allows. Heads are written
+// into the queue's buffer, large bodies stay where they are, and everything in front
+// of the next file or stream goes out with a single writev. File bodies are
+// streamed from the file as the socket drains, so memory use does not grow with their
+// size; so are streamed responses (Response::stream), which may also have to wait for
+// their source, in which case the stream wakes the session through the event loop. A
+// request body larger than max_buffered_body is not buffered either: the handler gets
+// it as Request::body_stream and the session reads it from the socket only as far as
+// the response's stream takes it. The connection is kept open between requests unless
+// the client asks for Connection: close, speaks HTTP/1.0, or a limit is hit.
+//
+// Not thread-safe: the owner makes sure only one thread calls process() at a time.
+class HttpSession : public Session
+{
+public:
+    // wake is handed to streamed responses; it must make the owner call process() again.
+    HttpSession(std::unique_ptr<Connection> conn, HttpParser &parser, const RequestHandler &handler,
+                const SessionLimits &limits, EventLoop &loop, std::function<void()> wake);
+    ~HttpSession() override;
+
+    // Flushes pending output, reads what is available, answers every complete request
+    // and flushes again. Call whenever the socket is readable or writable.
+    Status process() override;
+
+    int fd() const override { return conn_->fd(); }
+    std::chrono::steady_clock::time_point last_activity() const override { return last_activity_; }
+
+private:
+    bool readAvailable();
+    bool feedRequestBody();
+    void answerBufferedRequests();
+    void queueResponse(Response response, bool keep_alive, bool http10 = false);
+    void queueError(int status_code, const char *status_message);
+    bool flush();
+    ssize_t writeQueuedBytes();
+
+    std::unique_ptr<Connection> conn_;
+    HttpParser &parser_;
+    const RequestHandler &handler_;
+    const SessionLimits &limits_;
+    EventLoop &loop_;
+    std::function<void()> wake_;
+
+    RequestParser request_parser_;
+    // Output in send order. A chunk is bytes followed by an optional body, file region
+    // or stream, so a file response is its head plus the file, and small responses
+    // share one chunk.
+    struct OutputChunk
+    {
+        std::string bytes;
+        size_t offset = 0;
+        std::shared_ptr<const std::string> body; // a large body, or a large raw message
+        size_t body_offset = 0;
+        std::shared_ptr<const FileBody> file;
+        off_t file_offset = 0;
+        size_t file_remaining = 0;
+        std::shared_ptr<ResponseStream> stream;
+        std::shared_ptr<RequestBody> request_body; // what stream reads, dropped once it is done
+
+        size_t bodyRemaining() const { return body ? body->size() - body_offset : 0; }
+    };
+
+    std::string &outputBytes();
+
+    std::string in_; // in_ and spare_bytes_ come from the BufferPool while in use
+    std::shared_ptr<RequestBody> request_body_; // streamed body still arriving in in_
+    std::deque<OutputChunk> out_;
+    std::string spare_bytes_;  // buffer of a written chunk, reused by the next one
+    size_t pending_bytes_ = 0; // unsent bytes in out_, file regions excluded
+    size_t requests_served_ = 0;
+    bool peer_closed_ = false;
+    bool close_after_flush_ = false;
+    bool waiting_for_stream_ = false; // flush() stopped at a stream without data
+    std::chrono::steady_clock::time_point last_activity_;
+};
+
+#endif // HTTP_SESSION_HPP
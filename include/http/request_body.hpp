@@ -0,0 +1,52 @@
+#ifndef REQUEST_BODY_HPP
+#define REQUEST_BODY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A request body too large to buffer, passed on while it arrives (Request::body_stream).
+// The session appends what it reads from the client and whoever handles the request,
+// e.g. a proxied upload, takes it out as it goes. The session stops reading once
+// kCapacity bytes wait, so a slow consumer holds back the client instead of filling
+// memory. Both sides run under the session, one thread at a time.
+class RequestBody
+{
+public:
+    static const size_t kCapacity = 64 * 1024;
+    static const int64_t kUnknownLength = -1;
+
+    explicit RequestBody(int64_t length) : length_(length) {}
+
+    // Content-Length, or kUnknownLength for an HTTP/2 request without one.
+    int64_t length() const { return length_; }
+
+    // Session side. A discarded body takes any amount and drops it.
+    void append(const char *data, size_t len);
+    void finish() { finished_ = true; }
+    size_t space() const;
+    uint64_t received() const { return received_; }
+    // Bytes taken out or dropped so far, which HTTP/2 returns to the flow-control window.
+    uint64_t released() const { return released_; }
+    // Nobody will read the rest: what is buffered and what still arrives is dropped, so
+    // the session can skip to the end of the body.
+    void discard();
+
+    // Consumer side.
+    std::string_view data() const { return std::string_view(buffer_).substr(offset_); }
+    void consume(size_t n);
+    // Nothing more will be appended; with data() empty the body is over.
+    bool finished() const { return finished_; }
+
+private:
+    int64_t length_;
+    std::string buffer_;
+    size_t offset_ = 0;
+    uint64_t received_ = 0;
+    uint64_t released_ = 0;
+    bool finished_ = false;
+    bool discarded_ = false;
+};
+
+#endif // REQUEST_BODY_HPP
@@ -0,0 +1,100 @@
+#ifndef REQUEST_PARSER_HPP
+#define REQUEST_PARSER_HPP
+
+#include "http/http_parser.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+
+struct HeaderView
+{
+    std::string_view name;
+    std::string_view value;
+    HeaderId id;
+};
+
+// A parsed HTTP/1.1 request. Every field points into the buffer that was passed to
+// RequestParser::parse() and is only valid while that buffer is unchanged.
+struct RequestView
+{
+    static constexpr size_t kMaxHeaders = 64;
+
+    std::string_view method;
+    std::string_view path;
+    std::string_view version;
+    HeaderView headers[kMaxHeaders];
+    size_t num_headers = 0;
+    std::string_view body;
+
+    // First header with this name (case-insensitive), or nullptr.
+    const std::string_view *header(std::string_view name) const;
+    // Owning copy, allocated from resource; repeated headers stay separate fields.
+    Request toRequest(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
+};
+
+// Resumable push parser for HTTP/1.1 requests. The caller keeps appending to its buffer
+// and calls parse() with the whole unconsumed buffer (starting at the request) until it
+// returns Complete or Error; scanning resumes where the previous call stopped, so a
+// request arriving in many small reads is not rescanned from the start.
+//
+// Lines may end in CRLF or a bare LF, empty lines before the request line are skipped,
+// and the body is framed by Content-Length. A body longer than max_buffered_body is not
+// waited for: parse() completes after the head and the caller reads the streamedBody()
+// bytes that follow it. Transfer-Encoding, obsolete line folding,
+// control characters in header values and conflicting Content-Length values are
+// rejected. Delimiter search and character validation share one pass (char_scan.hpp).
+class RequestParser
+{
+public:
+    enum class Status
+    {
+        NeedMore,
+        Complete,
+        Error
+    };
+
+    // max_request_size bounds the head plus a buffered body, max_body_size a streamed one.
+    explicit RequestParser(size_t max_request_size = 1 << 20, size_t max_buffered_body = SIZE_MAX,
+                           uint64_t max_body_size = UINT64_MAX);
+
+    Status parse(std::string_view buffer);
+    // Valid after Complete.
+    const RequestView &request() const { return request_; }
+    // Bytes of the buffer taken by the complete request, including skipped empty lines;
+    // a streamed body is not part of it.
+    size_t consumed() const { return head_end_ + (streamed_ ? 0 : content_length_); }
+    // Length of the body that follows the head, if it is streamed; 0 otherwise.
+    uint64_t streamedBody() const { return streamed_ ? content_length_ : 0; }
+    // Status code and reason to answer with after Error.
+    int errorCode() const { return error_code_; }
+    const char *errorMessage() const { return error_message_; }
+    // Prepares for the next request; call after erasing consumed() bytes or when
+    // passing the buffer from the next request on.
+    void reset();
+
+private:
+    bool findHeadEnd(std::string_view buffer);
+    bool parseHead(std::string_view buffer);
+    bool parseRequestLine(const char *&p, const char *end);
+    bool parseHeaderLine(const char *&p, const char *end);
+    Status fail(int code, const char *message);
+
+    size_t max_request_size_;
+    size_t max_buffered_body_;
+    uint64_t max_body_size_;
+    RequestView request_;
+    size_t start_ = 0;      // first byte of the request line
+    size_t line_start_ = 0; // start of the line being scanned
+    size_t scan_pos_ = 0;   // where the search for the end of the head resumes
+    size_t head_end_ = 0;   // one past the empty line; 0 until the head is complete
+    size_t content_length_ = 0;
+    bool has_content_length_ = false;
+    bool streamed_ = false;
+    const char *head_base_ = nullptr; // buffer the head views point into
+    int error_code_ = 0;
+    const char *error_message_ = "";
+};
+
+#endif // REQUEST_PARSER_HPP
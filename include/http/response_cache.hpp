@@ -0,0 +1,104 @@
+#ifndef RESPONSE_CACHE_HPP
+#define RESPONSE_CACHE_HPP
+
+#include "http/cache.hpp"
+#include "http/http_parser.hpp"
+#include "http/response_stream.hpp"
+#include "core/worker_pool.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shared HTTP cache in front of an origin (RFC 9111, the parts a reverse proxy needs).
+// GET responses are stored under method, Host and request target, plus the request's
+// values of the headers named in Vary. Only responses the origin marks as fresh with
+// s-maxage or max-age are stored; no-store, private, no-cache, Vary: * and Set-Cookie
+// keep a response out. HEAD is answered from the stored GET response.
+//
+// Misses are streamed from the origin and stored from a copy taken on the way (up to
+// what fits in the cache). A stale entry within its stale-while-revalidate window is
+// still served while one background fetch refreshes it. Concurrent misses for the same
+// key wait, without holding a thread, for the single origin response in flight instead
+// of each going to the origin.
+class ResponseCache {
+public:
+    // Blocking fetch, used for background revalidation.
+    using Fetch = std::function<Response(const Request&)>;
+    // Returns a streamed response (Response::stream); tee, if given, gets a copy.
+    using Stream = std::function<Response(const Request&, std::shared_ptr<ResponseTee>)>;
+
+    struct Stats {
+        CacheStats store;
+        uint64_t coalesced = 0; // misses that waited for another request's fetch
+        uint64_t stale = 0;     // stale entries served while revalidating
+        uint64_t revalidations = 0;
+    };
+
+    ResponseCache(size_t max_bytes, Fetch fetch, Stream stream, size_t revalidate_workers = 1);
+
+    // Answers from the cache when it can, otherwise with a response from stream (whose
+    // copy may be stored). Cached answers are complete responses; the others stream.
+    Response serve(const Request& request);
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // A stored response, or (with vary set and no response) the marker stored under the
+    // primary key that says which request headers select the variant.
+    struct Entry {
+        std::vector<std::string> vary; // lower-case header names
+        int status_code = 0;
+        // Shared with every response rendered from the entry; null in a Vary marker.
+        std::shared_ptr<const std::string> head; // status line and headers, without Age and the blank line
+        std::shared_ptr<const std::string> body;
+        Clock::time_point stored_at;
+        long initial_age = 0; // Age the origin reported
+        long fresh_for = 0;   // freshness lifetime in seconds
+        long stale_for = 0;   // stale-while-revalidate window in seconds
+
+        size_t size() const { return (head ? head->size() : 0) + (body ? body->size() : 0); }
+    };
+
+    struct Found {
+        std::string key; // secondary key if the primary key varies
+        std::shared_ptr<const Entry> entry;
+    };
+
+    // An origin response in flight for a key; waiters run when it is over.
+    struct Flight {
+        std::vector<std::function<void()>> waiters;
+    };
+
+    class StoreTee;
+    class WaitStream;
+
+    Found lookup(const std::string& primary, const Request& request);
+    Response serveStored(const std::string& primary, const Request& request);
+    Response streamMiss(const std::string& key, const std::string& primary, const Request& request);
+    void revalidate(const std::string& key, const std::string& primary, const Request& request);
+    void store(const std::string& primary, const Request& request, const Response& response);
+    void finishFlight(const std::string& key);
+    static long age(const Entry& entry);
+    static Response render(const Entry& entry, long age);
+
+    BasicCache<Entry> entries_;
+    Fetch fetch_;
+    Stream stream_;
+
+    mutable std::mutex flights_mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights_; // key -> fetch in progress
+    uint64_t coalesced_ = 0;
+    uint64_t stale_ = 0;
+    uint64_t revalidations_ = 0;
+
+    // Last member: destroyed first, so queued revalidations finish while the rest is alive.
+    WorkerPool revalidate_pool_;
+};
+
+#endif // RESPONSE_CACHE_HPP
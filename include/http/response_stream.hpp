@@ -0,0 +1,63 @@
+#ifndef RESPONSE_STREAM_HPP
+#define RESPONSE_STREAM_HPP
+
+#include "http/http_parser.hpp"
+#include <cstddef>
+#include <functional>
+#include <sys/types.h>
+
+class EventLoop;
+
+// Where a stream writes its response, as an HTTP/1.1 message: the client socket of an
+// HTTP/1.1 connection, or an HTTP/2 stream that turns it into frames.
+class ResponseSink
+{
+public:
+    virtual ~ResponseSink() = default;
+
+    // Like write(2): the number of bytes taken, or -1 with errno set (EAGAIN when full).
+    virtual ssize_t write(const char *data, size_t len) = 0;
+
+    // A plaintext socket the body may be spliced into, bypassing write(); -1 if none.
+    virtual int spliceFd() const = 0;
+};
+
+// A response whose head and body are produced over time, e.g. relayed from a backend.
+// The session pulls from it as the client socket drains, so nothing is buffered beyond
+// what the stream itself keeps, and no thread waits for the source.
+class ResponseStream
+{
+public:
+    enum class Status
+    {
+        Done,      // the whole response has been written
+        WantWrite, // the client socket is full
+        WantData,  // waiting for the source; wake will be called
+        Failed     // the response cannot be completed; close the connection
+    };
+
+    virtual ~ResponseStream() = default;
+
+    // Called once when the response is queued, on whichever thread runs the session.
+    // The stream calls wake on loop's thread whenever send() can make progress again.
+    virtual void start(EventLoop &loop, std::function<void()> wake) = 0;
+
+    // Writes what is available to sink. Calls for one session never overlap.
+    virtual Status send(ResponseSink &sink) = 0;
+};
+
+// Gets a copy of a streamed response as it is relayed, e.g. to cache it.
+class ResponseTee
+{
+public:
+    virtual ~ResponseTee() = default;
+
+    // Status and headers have arrived. Returns how many body bytes to copy at most;
+    // 0 or a longer body means no copy and no complete().
+    virtual size_t begin(const Response &head) = 0;
+
+    // The whole body arrived; response has the head and the copied body.
+    virtual void complete(const Response &response) = 0;
+};
+
+#endif // RESPONSE_STREAM_HPP
@@ -0,0 +1,28 @@
+#ifndef RESPONSE_WRITER_HPP
+#define RESPONSE_WRITER_HPP
+
+#include "http/http_parser.hpp"
+#include <string>
+#include <string_view>
+
+// HTTP/1.1 response heads, written straight into the caller's output buffer. Status
+// lines of the common codes, the Server header and the Date header (formatted at most
+// once a second per thread) are ready-made bytes, so a typical head is a handful of
+// appends without temporaries. Bodies are not copied here; the caller sends them after
+// the head (see Connection::writev).
+
+// The current time as an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT". Valid
+// until the calling thread's next call.
+std::string_view cachedHttpDate();
+
+// The Date and Server header lines writeResponseHead() adds, for heads serialized
+// ahead of time. Valid until the calling thread's next call.
+std::string_view cachedDateAndServerLines();
+
+// Appends the status line, headers and terminating blank line of response to out.
+// Date, Server and Content-Length are added unless the response has them (or, for
+// Content-Length, Transfer-Encoding, or it is a 1xx, 204 or 304 response). extra_headers is appended as given, e.g.
+// "Connection: close\r\n".
+void writeResponseHead(const Response &response, std::string &out, std::string_view extra_headers = {});
+
+#endif // RESPONSE_WRITER_HPP
@@ -0,0 +1,50 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include "http/http_parser.hpp"
+#include <chrono>
+#include <functional>
+
+using RequestHandler = std::function<Response(const Request &)>;
+
+struct SessionLimits
+{
+    size_t max_requests = 1000;                     // per HTTP/1.1 connection, then it is closed
+    std::chrono::milliseconds idle_timeout{15000};  // keep-alive timeout between requests
+    size_t max_request_size = 1 << 20;              // request line + headers + buffered body
+    size_t max_buffered_body = 64 << 10;            // larger bodies are streamed (Request::body_stream)
+    uint64_t max_body_size = 1ull << 30;            // streamed bodies included
+    size_t max_pending_output = 1 << 20;            // stop answering pipelined requests above this
+    uint32_t max_concurrent_streams = 128;          // per HTTP/2 connection
+};
+
+// One client connection after its handshake, speaking whichever protocol ALPN chose.
+// The server calls process() whenever the socket (or a streamed response) is ready,
+// and arms the socket for what the returned status asks for.
+//
+// Not thread-safe: the owner makes sure only one thread calls into a session at a time.
+class Session
+{
+public:
+    enum class Status
+    {
+        WantRead,  // all output written; wait for the next request
+        WantWrite, // output is pending; wait for the socket to become writable
+        WantData,  // a streamed response waits for its source; wake will be called
+        Close      // done or failed; destroy the session to close the connection
+    };
+
+    virtual ~Session() = default;
+
+    // Reads what is available, answers what it can and writes as far as the socket allows.
+    virtual Status process() = 0;
+
+    // The server is about to drop the connection (idle or shutting down); tell the
+    // client if the protocol has a way to.
+    virtual void shutdown() {}
+
+    virtual int fd() const = 0;
+    virtual std::chrono::steady_clock::time_point last_activity() const = 0;
+};
+
+#endif // SESSION_HPP
@@ -2,15 +2,87 @@
 #define STATIC_FILE_HPP
 
 #include "http_parser.hpp" // Updated to include http_parser.hpp directly
+#include "core/event_loop.hpp"
+#include "core/worker_pool.hpp"
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
 
+// Serves files below root_dir. Files that have been requested are kept in an index
+// keyed by normalized request path: open fd, size, mtime, ETag, MIME type and the
+// pre-serialized 200 head and 304 response, so a hit costs a hash lookup and the
+// body goes out with sendfile. On Linux the tree is watched with inotify and entries
+// are dropped when their file changes; elsewhere nothing is cached.
+//
+// Text-like files also get gzip and (if built with brotli) br variants, stored next to
+// the original as name.gz / name.br. Existing variants at least as new as the original
+// are used as they are; missing ones are compressed on a background thread when the
+// file is first requested, and the original is served until they are written. The
+// variant is picked from Accept-Encoding and sent like any other file.
 class StaticFile {
 public:
-    StaticFile(const std::string& root_dir);
-    Response serve(const std::string& path);
+    explicit StaticFile(const std::string& root_dir, size_t max_open_files = 4096, size_t compress_workers = 1);
+    // Waits for the variants being compressed.
+    ~StaticFile();
+
+    Response serve(const Request& request);
+
+    // "/a/b.html" for a request target, after percent-decoding and resolving "." and
+    // ".." segments; the query is dropped. Empty if the target is malformed or would
+    // leave the root.
+    static std::string normalizePath(std::string_view target);
 
 private:
+    enum Encoding { kIdentity, kGzip, kBrotli, kNumEncodings };
+
+    // One representation of a file: the original or a precompressed copy next to it.
+    struct Variant {
+        std::shared_ptr<const FileBody> body; // null if this encoding is not available
+        std::string etag;
+        std::shared_ptr<const std::string> head;         // head of the 200 response
+        std::shared_ptr<const std::string> not_modified; // complete 304 response
+    };
+
+    struct Entry {
+        std::string file_path; // served file relative to the root, e.g. "/docs/index.html"
+        time_t mtime;
+        Variant variants[kNumEncodings];
+    };
+
+    std::shared_ptr<const Entry> lookup(const std::string& path);
+    std::shared_ptr<const Entry> load(const std::string& path);
+    int openVariant(const std::string& full_path, Encoding encoding, const struct stat& st) const;
+    void compressLater(const std::string& full_path, Encoding encoding);
+    bool compressVariant(const std::string& full_path, Encoding encoding) const;
+    Encoding chooseEncoding(const Request& request, const Entry& entry) const;
+    bool notModified(const Request& request, const Entry& entry, const Variant& variant) const;
+
+    void watchTree(const std::string& rel_dir);
+    void onWatchEvents();
+    void invalidate(const std::string& rel_path);
+
     std::string root_dir_;
+    size_t max_open_files_;
+
+    std::shared_mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const Entry>> index_;
+    uint64_t generation_ = 0; // bumped by every invalidation
+
+    bool watching_ = false; // entries are only cached while the root is watched
+    int inotify_fd_ = -1;
+    std::unordered_map<int, std::string> watches_; // wd -> directory relative to the root
+    std::unique_ptr<EventLoop> watch_loop_;
+    std::thread watch_thread_;
+
+    std::mutex compress_mutex_;
+    std::unordered_set<std::string> compressing_; // variant paths queued or being written
+    WorkerPool compress_pool_;                    // declared last: drained before the rest goes away
 };
 
-#endif // STATIC_FILE_HPP
\ No newline at end of file
+#endif // STATIC_FILE_HPP
@@ -1,17 +1,40 @@
 #ifndef L7_PROXY_HPP
 #define L7_PROXY_HPP
 
-#include "./http/http_parser.hpp" 
+#include "./http/http_parser.hpp"
+#include "http/response_stream.hpp"
+#include "proxy/upstream_group.hpp"
+#include <memory>
 #include <string>
+#include <vector>
 
+// Forwards requests to a group of backends over pooled keep-alive HTTP/1.1
+// connections; the group picks the backend. An idempotent request whose backend fails
+// before answering is retried on another one. Safe to call from several threads at once.
 class L7Proxy {
 public:
-    L7Proxy(const std::string& backend_host, int backend_port);
+    L7Proxy(const std::string& backend_host, int backend_port,
+            const UpstreamPoolConfig& pool_config = UpstreamPoolConfig());
+    L7Proxy(const std::vector<UpstreamConfig>& upstreams, const LoadBalancerConfig& config);
+
+    // Blocks until the whole response has been read into memory. The request body must
+    // be buffered (no body_stream).
     Response forward(const Request& request);
 
+    // Returns at once with a response whose stream relays the backend's answer
+    // without blocking: status and headers as the backend sent them, the body in
+    // bounded pieces as the client takes it. tee, if given, sees a copy. A streamed
+    // request body is sent on as it arrives, and such a request is not retried.
+    Response stream(const Request& request, std::shared_ptr<ResponseTee> tee = nullptr);
+
+    // Summed over the upstreams.
+    UpstreamPool::Stats poolStats() const;
+    std::vector<UpstreamGroup::Stats> upstreamStats() const;
+
 private:
-    std::string backend_host_;
-    int backend_port_;
+    std::string serializeRequest(const Request& request) const;
+
+    UpstreamGroup upstreams_;
 };
 
-#endif // L7_PROXY_HPP
\ No newline at end of file
+#endif // L7_PROXY_HPP
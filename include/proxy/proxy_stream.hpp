@@ -0,0 +1,106 @@
+#ifndef PROXY_STREAM_HPP
+#define PROXY_STREAM_HPP
+
+#include "http/request_body.hpp"
+#include "http/response_stream.hpp"
+#include "proxy/upstream_group.hpp"
+#include "proxy/upstream_response.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// One request relayed to a backend without blocking. The backend socket comes from the
+// pool in non-blocking mode and is watched by the session's event loop; every step
+// (connect, sending the request, reading the head, relaying the body) runs in send()
+// and stops when a socket would block.
+//
+// The body never sits in memory as a whole: one read's worth is buffered at a time and
+// the backend is not read again until the client took it. A Content-Length body going
+// to a plaintext client is moved with splice(2) through a pipe and never enters user
+// space. Bodies without a length are re-framed as chunked for HTTP/1.1 clients.
+//
+// Without a Host header in request_data (an HTTP/1.0 client), add_host names the
+// upstream of each attempt in one.
+//
+// A streamed request body (Request::body_stream) goes out after the head in the same
+// bounded pieces: what the client sent so far is sent on, and send() waits for the
+// session to read more once it ran out.
+//
+// If the backend fails before the head was relayed, an idempotent request is tried on
+// another upstream of the group; once none is left, the client gets a 502. A request
+// whose body was streamed is never retried, as that body is gone.
+class ProxyStream : public ResponseStream, public std::enable_shared_from_this<ProxyStream> {
+public:
+    ProxyStream(UpstreamGroup& upstreams, std::string affinity_key, std::string request_data, bool head_request,
+                bool retryable, bool client_http11, bool add_host, std::shared_ptr<ResponseTee> tee,
+                std::shared_ptr<RequestBody> body = nullptr);
+    ~ProxyStream() override;
+
+    void start(EventLoop& loop, std::function<void()> wake) override;
+    Status send(ResponseSink& sink) override;
+
+private:
+    enum class State { Connecting, SendingRequest, ReadingHead, Body, Done };
+    // How the body is read from the backend.
+    enum class Framing { None, Length, Chunked, UntilClose };
+
+    Status step(ResponseSink& sink);
+    Status await(uint32_t events);
+    bool connectUpstream();
+    void setHost();
+    bool nextBodyPiece();
+    void endAttempt(bool ok);
+    bool retryStale();
+    void fail(const char* reason);
+    void beginBody(const Response& head, const UpstreamFraming& framing);
+    void relay(const char* data, size_t len);
+    void finishBody();
+    void releaseUpstream(bool reusable);
+
+    UpstreamGroup& upstreams_;
+    std::string affinity_key_;
+    std::string request_data_;
+    bool head_request_;
+    bool retryable_; // idempotent request: may be resent on a fresh connection
+    bool client_http11_;
+    bool add_host_;
+    size_t host_line_ = 0; // length of the Host line set in request_data_
+    std::shared_ptr<ResponseTee> tee_;
+    std::shared_ptr<RequestBody> body_; // the rest of the request, while it is sent
+    bool body_chunked_;                 // its length is unknown
+
+    EventLoop* loop_ = nullptr;
+    std::function<void()> wake_;
+
+    State state_ = State::Connecting;
+    std::vector<size_t> tried_;               // upstreams picked so far
+    size_t upstream_ = UpstreamGroup::kNone; // current attempt's upstream
+    UpstreamGroup::Clock::time_point started_; // for the proxy stage histogram
+    UpstreamGroup::Clock::time_point attempt_start_;
+    UpstreamGroup::Clock::duration head_latency_{0};
+    bool head_ok_ = true; // not a 502/503/504
+    int fd_ = -1;
+    bool reused_ = false;
+    bool registered_ = false; // fd_ is in loop_
+    size_t sent_ = 0;         // bytes of request_data_ written
+    std::string in_;          // backend bytes not processed yet (head)
+    std::string out_;         // bytes for the client
+    size_t out_pos_ = 0;
+
+    Framing framing_ = Framing::None;
+    bool keep_alive_ = true;
+    bool client_chunked_ = false;
+    uint64_t remaining_ = 0; // Framing::Length: body bytes still to read
+    ChunkedDecoder decoder_;
+    bool body_done_ = false;
+    bool extra_bytes_ = false; // the backend sent more than the body
+
+    // splice(2) path: backend -> pipe -> client socket.
+    int pipe_[2] = {-1, -1};
+    size_t piped_ = 0; // bytes in the pipe
+
+    Response tee_response_; // head and body copy for tee_
+    size_t tee_limit_ = 0;
+};
+
+#endif // PROXY_STREAM_HPP
@@ -0,0 +1,145 @@
+#ifndef UPSTREAM_GROUP_HPP
+#define UPSTREAM_GROUP_HPP
+
+#include "./http/http_parser.hpp"
+#include "proxy/upstream_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct UpstreamConfig {
+    std::string host; // IPv4 address
+    int port = 80;
+    unsigned weight = 1;
+};
+
+enum class BalancePolicy {
+    RoundRobin,       // smooth weighted round robin
+    LeastOutstanding, // power of two choices: the one with fewer requests in flight per weight
+    ConsistentHash,   // ring hash on a header, cookie or the request target
+};
+
+struct LoadBalancerConfig {
+    BalancePolicy policy = BalancePolicy::LeastOutstanding;
+    // ConsistentHash key: this request header, else this cookie, else the request target.
+    std::string hash_header;
+    std::string hash_cookie;
+
+    // Active health checks: GET health_path on every upstream each interval; 2xx/3xx
+    // passes. Empty path disables them.
+    std::string health_path;
+    std::chrono::milliseconds health_interval{5000};
+    std::chrono::milliseconds health_timeout{1000};
+    unsigned unhealthy_threshold = 2; // failed checks in a row to take an upstream out
+    unsigned healthy_threshold = 2;   // passed checks in a row to bring it back
+
+    // Passive outlier ejection: this many failed requests in a row (connection errors,
+    // 502/503/504, or answers slower than slow_response) eject an upstream for
+    // base_ejection times the number of times it was ejected, up to max_ejection.
+    // 0 disables ejection; a zero slow_response disables the latency check.
+    unsigned consecutive_failures = 5;
+    std::chrono::milliseconds slow_response{0};
+    std::chrono::milliseconds base_ejection{30000};
+    std::chrono::milliseconds max_ejection{300000};
+    unsigned max_ejection_percent = 50; // never eject more than this share of the upstreams
+
+    // Tries per idempotent request, each on a different upstream.
+    unsigned max_attempts = 2;
+
+    UpstreamPoolConfig pool;
+};
+
+// A weighted set of backends: picks one per request by the configured policy, skipping
+// those that failed their health checks or were ejected for misbehaving. When every
+// upstream is out, all of them are considered again rather than failing every request.
+// Each upstream has its own UpstreamPool. Thread-safe.
+class UpstreamGroup {
+public:
+    using Clock = std::chrono::steady_clock;
+    static const size_t kNone = static_cast<size_t>(-1);
+
+    struct Stats {
+        std::string host;
+        int port;
+        unsigned weight;
+        uint64_t requests;
+        uint64_t failures;
+        uint64_t ejections;
+        int outstanding;
+        bool healthy; // passing active health checks
+        bool ejected;
+        UpstreamPool::Stats pool;
+    };
+
+    UpstreamGroup(const std::vector<UpstreamConfig>& upstreams, const LoadBalancerConfig& config);
+    ~UpstreamGroup();
+
+    UpstreamGroup(const UpstreamGroup&) = delete;
+    UpstreamGroup& operator=(const UpstreamGroup&) = delete;
+
+    // What ConsistentHash hashes for request; empty for the other policies.
+    std::string affinityKey(const Request& request) const;
+
+    // Index of the upstream for the next attempt, avoiding those in tried when any
+    // other is left. Counts the request as outstanding on it until finish().
+    size_t pick(const std::string& affinity_key, const std::vector<size_t>& tried);
+
+    // Ends an attempt started by pick(). ok is false for a connection error or a
+    // 502/503/504; latency is how long the upstream took to answer.
+    void finish(size_t index, bool ok, Clock::duration latency);
+
+    // max_attempts, but no more than there are upstreams.
+    unsigned maxAttempts() const;
+
+    UpstreamPool& pool(size_t index) { return upstreams_[index]->pool; }
+    const UpstreamPool& pool(size_t index) const { return upstreams_[index]->pool; }
+    size_t size() const { return upstreams_.size(); }
+    std::vector<Stats> stats() const;
+
+private:
+    struct Upstream {
+        Upstream(const UpstreamConfig& config, const UpstreamPoolConfig& pool_config)
+            : config(config), pool(config.host, config.port, pool_config) {}
+
+        UpstreamConfig config;
+        UpstreamPool pool;
+        std::atomic<int> outstanding{0};
+        std::atomic<bool> healthy{true};
+        std::atomic<int64_t> ejected_until{0}; // Clock ticks; 0 when not ejected
+
+        // Guarded by UpstreamGroup::mutex_.
+        int current_weight = 0; // smooth round robin
+        unsigned failures_in_row = 0;
+        unsigned checks_in_row = 0; // health checks in a row that disagree with healthy
+        uint64_t requests = 0;
+        uint64_t failures = 0;
+        uint64_t ejections = 0;
+    };
+
+    bool available(const Upstream& upstream, Clock::time_point now) const;
+    size_t pickRoundRobin(const std::vector<size_t>& candidates);
+    size_t pickLeastOutstanding(const std::vector<size_t>& candidates);
+    size_t pickHashed(const std::string& key, const std::vector<size_t>& candidates) const;
+    void maybeEjectLocked(Upstream& upstream, Clock::time_point now);
+    void healthLoop();
+    bool checkHealth(const Upstream& upstream) const;
+
+    LoadBalancerConfig config_;
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+    std::vector<std::pair<uint64_t, size_t>> ring_; // ConsistentHash: point -> upstream, sorted
+
+    mutable std::mutex mutex_;
+
+    std::thread health_thread_;
+    std::mutex health_mutex_;
+    std::condition_variable health_cv_;
+    bool stop_ = false;
+};
+
+#endif // UPSTREAM_GROUP_HPP
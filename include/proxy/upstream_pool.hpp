@@ -0,0 +1,72 @@
+#ifndef UPSTREAM_POOL_HPP
+#define UPSTREAM_POOL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+struct UpstreamPoolConfig {
+    size_t max_idle = 32; // idle connections kept open; 0 disables reuse
+    std::chrono::milliseconds idle_timeout{30000};
+    // Send/receive timeout on backend sockets, so a stuck backend cannot hold a worker forever.
+    std::chrono::milliseconds io_timeout{30000};
+};
+
+// Idle persistent HTTP/1.1 connections to one backend. A connection is handed out
+// again only after the caller read its last response completely, and it is checked
+// before reuse: one the backend closed or wrote to while it sat idle is dropped, as
+// is one that idled longer than idle_timeout. Most recently released goes out first.
+class UpstreamPool {
+public:
+    struct Stats {
+        uint64_t connects = 0; // new connections opened
+        uint64_t reuses = 0;   // idle connections handed out again
+        uint64_t dropped = 0;  // idle connections closed as dead, expired or over max_idle
+        size_t idle = 0;
+    };
+
+    UpstreamPool(const std::string& host, int port, const UpstreamPoolConfig& config = UpstreamPoolConfig());
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    // An idle connection that passed the check, or a new one (reused says which).
+    // Throws std::runtime_error if a new connection cannot be made. With nonblocking
+    // the socket is switched to O_NONBLOCK and a new connection may still be in
+    // progress: wait until it is writable and check SO_ERROR.
+    int acquire(bool& reused, bool nonblocking = false);
+
+    // Hands back a connection that may carry another request; closes it if the pool is full.
+    void release(int fd);
+
+    const std::string& host() const { return host_; }
+    int port() const { return port_; }
+    // "Host: host:port\r\n", for requests that name no host of their own.
+    std::string hostLine() const { return "Host: " + host_ + ":" + std::to_string(port_) + "\r\n"; }
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Idle {
+        int fd;
+        Clock::time_point since;
+    };
+
+    int connectBackend(bool nonblocking);
+    static bool stillIdle(int fd);
+    void pruneLocked(Clock::time_point now);
+
+    std::string host_;
+    int port_;
+    UpstreamPoolConfig config_;
+
+    mutable std::mutex mutex_;
+    std::deque<Idle> idle_; // oldest at the front
+    Stats stats_;
+};
+
+#endif // UPSTREAM_POOL_HPP
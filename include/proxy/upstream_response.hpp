@@ -0,0 +1,44 @@
+#ifndef UPSTREAM_RESPONSE_HPP
+#define UPSTREAM_RESPONSE_HPP
+
+#include "http/http_parser.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Pieces of an HTTP/1.1 client for backend responses, shared by the blocking and the
+// streaming proxy paths.
+
+// Connection-level headers a proxy must not forward in either direction.
+bool isHopByHopHeader(std::string_view name);
+
+// How the body of a backend response ends.
+struct UpstreamFraming {
+    long long content_length = -1; // -1: no Content-Length
+    bool chunked = false;           // Transfer-Encoding: chunked (overrides Content-Length)
+    bool keep_alive = true;         // the backend keeps the connection open afterwards
+};
+
+// Parses the status line and header lines of a backend response; head ends with the
+// CRLF of the last header line. Hop-by-hop headers and the framing headers go into
+// framing instead of response.headers. Throws std::runtime_error if it is malformed.
+void parseUpstreamHead(std::string_view head, Response& response, UpstreamFraming& framing);
+
+// Incremental decoder for a chunked body; feed it the bytes as they arrive.
+class ChunkedDecoder {
+public:
+    // Appends the payload in data to out and returns how many bytes it consumed. That
+    // is less than len only once done(): the rest follows the body. Trailer fields are
+    // dropped. Throws std::runtime_error on malformed input.
+    size_t decode(const char* data, size_t len, std::string& out);
+    bool done() const { return state_ == State::Done; }
+
+private:
+    enum class State { Size, Data, DataEnd, Trailer, Done };
+
+    State state_ = State::Size;
+    std::string line_; // partial size, chunk end or trailer line
+    uint64_t remaining_ = 0;
+};
+
+#endif // UPSTREAM_RESPONSE_HPP
@@ -0,0 +1,29 @@
+#include "core/buffer_pool.hpp"
+#include <vector>
+
+namespace {
+
+thread_local std::vector<std::string> free_buffers;
+
+} // namespace
+
+std::string BufferPool::acquire() {
+    if (free_buffers.empty()) {
+        std::string buffer;
+        buffer.reserve(kBufferSize);
+        return buffer;
+    }
+    std::string buffer = std::move(free_buffers.back());
+    free_buffers.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(std::string &buffer) {
+    if (buffer.capacity() < kBufferSize || buffer.capacity() > kMaxKept || free_buffers.size() >= kMaxFree) {
+        std::string().swap(buffer);
+        return;
+    }
+    buffer.clear();
+    free_buffers.push_back(std::move(buffer));
+    buffer = std::string();
+}
@@ -1,72 +1,109 @@
 #include "core/connection.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "core/tls_context.hpp"
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
-#include <iostream>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <openssl/err.h> // Added for ERR_print_errors_fp
 
-Connection::Connection(int fd, bool use_tls, const std::string& cert_file, const std::string& key_file)
-    : fd_(fd), use_tls_(use_tls), ssl_ctx_(nullptr), ssl_(nullptr), is_http2_(false) {
-    if (use_tls_) {
-        SSL_load_error_strings();
-        OpenSSL_add_ssl_algorithms();
-        ssl_ctx_ = SSL_CTX_new(TLS_server_method());
-        if (!ssl_ctx_) {
-            ERR_print_errors_fp(stderr);
-            throw std::runtime_error("Failed to create SSL context");
-        }
-
-        if (SSL_CTX_use_certificate_file(ssl_ctx_, cert_file.c_str(), SSL_FILETYPE_PEM) <= 0) {
-            ERR_print_errors_fp(stderr);
-            throw std::runtime_error("Failed to load certificate file: " + cert_file);
-        }
-        if (SSL_CTX_use_PrivateKey_file(ssl_ctx_, key_file.c_str(), SSL_FILETYPE_PEM) <= 0) {
-            ERR_print_errors_fp(stderr);
-            throw std::runtime_error("Failed to load private key file: " + key_file);
-        }
+namespace {
 
-        if (SSL_CTX_check_private_key(ssl_ctx_) != 1) {
-            ERR_print_errors_fp(stderr);
-            throw std::runtime_error("Private key does not match certificate");
-        }
+// The first queued OpenSSL error as text; the queue is cleared either way.
+void takeSslError(char *reason, size_t len) {
+    reason[0] = '\0';
+    unsigned long err = ERR_get_error();
+    if (err) {
+        ERR_error_string_n(err, reason, len);
+    }
+    ERR_clear_error();
+}
 
-        // Enable ALPN with HTTP/2 and HTTP/1.1
-        const unsigned char *alpn = (const unsigned char *)"\x02h2\x08http/1.1";
-        unsigned int alpnlen = 11; // Length of "\x02h2\x08http/1.1"
-        SSL_CTX_set_alpn_protos(ssl_ctx_, alpn, alpnlen);
+} // namespace
 
-        ssl_ = SSL_new(ssl_ctx_);
+Connection::Connection(int fd, const TlsContext* tls)
+    : fd_(fd), use_tls_(tls != nullptr), ssl_(nullptr), is_http2_(false), handshake_done_(!use_tls_) {
+    Metrics::adjust(Gauge::OpenConnections, 1);
+    if (use_tls_) {
+        ssl_ = SSL_new(tls->get());
         if (!ssl_) {
             ERR_print_errors_fp(stderr);
             throw std::runtime_error("Failed to create SSL object");
         }
-
         SSL_set_fd(ssl_, fd_);
-        int ssl_err = SSL_accept(ssl_);
-        if (ssl_err <= 0) {
-            ERR_print_errors_fp(stderr);
-            int err_code = SSL_get_error(ssl_, ssl_err);
-            throw std::runtime_error("SSL handshake failed with error code: " + std::to_string(err_code));
-        }
+        SSL_set_accept_state(ssl_);
+    }
+}
 
-        const unsigned char *negotiated_proto;
-        unsigned int proto_len;
-        SSL_get0_alpn_selected(ssl_, &negotiated_proto, &proto_len);
-        if (negotiated_proto) {
-            std::string proto(reinterpret_cast<const char*>(negotiated_proto), proto_len);
-            std::cout << "Negotiated ALPN protocol: " << proto << std::endl;
-            is_http2_ = (proto == "h2");
-        } else {
-            std::cout << "No ALPN protocol negotiated, defaulting to HTTP/1.1" << std::endl;
-            is_http2_ = false;
+Connection::HandshakeStatus Connection::handshake() {
+    if (handshake_done_) {
+        return HandshakeStatus::Done;
+    }
+    if (handshake_started_ == std::chrono::steady_clock::time_point()) {
+        handshake_started_ = std::chrono::steady_clock::now();
+    }
+
+    int ssl_ret = SSL_do_handshake(ssl_);
+    if (ssl_ret != 1) {
+        int err_code = SSL_get_error(ssl_, ssl_ret);
+        if (err_code == SSL_ERROR_WANT_READ) {
+            return HandshakeStatus::WantRead;
+        }
+        if (err_code == SSL_ERROR_WANT_WRITE) {
+            return HandshakeStatus::WantWrite;
         }
+        char reason[256];
+        takeSslError(reason, sizeof(reason));
+        LOG_WARN("SSL handshake failed on fd {} with error code {}: {}", fd_, err_code, reason);
+        Metrics::add(Counter::HandshakeFailures);
+        return HandshakeStatus::Failed;
+    }
+    handshake_done_ = true;
+    Metrics::record(Stage::TlsHandshake, std::chrono::steady_clock::now() - handshake_started_);
+
+    const unsigned char *negotiated_proto;
+    unsigned int proto_len;
+    SSL_get0_alpn_selected(ssl_, &negotiated_proto, &proto_len);
+    if (negotiated_proto) {
+        std::string proto(reinterpret_cast<const char*>(negotiated_proto), proto_len);
+        LOG_DEBUG("Negotiated ALPN protocol: {}", proto);
+        is_http2_ = (proto == "h2");
+    } else {
+        LOG_DEBUG("No ALPN protocol negotiated, defaulting to HTTP/1.1");
+        is_http2_ = false;
     }
+    return HandshakeStatus::Done;
+}
+
+bool Connection::handshake_done() const {
+    return handshake_done_;
+}
+
+void Connection::set_nonblocking(bool value) {
+    int flags = fcntl(fd_, F_GETFL, 0);
+    fcntl(fd_, F_SETFL, value ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+int Connection::fd() const {
+    return fd_;
 }
 
 Connection::~Connection() {
-    if (use_tls_) {
-        if (ssl_) SSL_free(ssl_);
-        if (ssl_ctx_) SSL_CTX_free(ssl_ctx_);
+    Metrics::adjust(Gauge::OpenConnections, -1);
+    if (use_tls_ && ssl_ && handshake_done_) {
+        // A clean close_notify keeps the session resumable; OpenSSL drops sessions of
+        // connections that were freed without one.
+        SSL_shutdown(ssl_);
+    }
+    if (ssl_) {
+        SSL_free(ssl_);
     }
     close(fd_);
 }
@@ -76,8 +113,18 @@ ssize_t Connection::read(char* buffer, size_t len) {
         ssize_t bytes_read = SSL_read(ssl_, buffer, len);
         if (bytes_read <= 0) {
             int ssl_err = SSL_get_error(ssl_, bytes_read);
-            ERR_print_errors_fp(stderr);
-            std::cerr << "SSL_read failed with error code: " << ssl_err << std::endl;
+            if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
+                errno = EAGAIN;
+                return -1;
+            }
+            if (ssl_err == SSL_ERROR_ZERO_RETURN) {
+                return 0; // peer sent close_notify
+            }
+            // Usually a peer that went away without close_notify.
+            char reason[256];
+            takeSslError(reason, sizeof(reason));
+            LOG_DEBUG("SSL_read failed on fd {} with error code {}: {}", fd_, ssl_err, reason);
+            return -1;
         }
         return bytes_read;
     }
@@ -89,18 +136,91 @@ ssize_t Connection::write(const char* buffer, size_t len) {
         ssize_t bytes_written = SSL_write(ssl_, buffer, len);
         if (bytes_written <= 0) {
             int ssl_err = SSL_get_error(ssl_, bytes_written);
-            ERR_print_errors_fp(stderr);
-            std::cerr << "SSL_write failed with error code: " << ssl_err << std::endl;
+            if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
+                errno = EAGAIN;
+                return -1;
+            }
+            char reason[256];
+            takeSslError(reason, sizeof(reason));
+            LOG_DEBUG("SSL_write failed on fd {} with error code {}: {}", fd_, ssl_err, reason);
+            return -1;
         }
         return bytes_written;
     }
     return ::write(fd_, buffer, len);
 }
 
+ssize_t Connection::writev(const struct iovec* iov, int count) {
+    if (!use_tls_) {
+        return ::writev(fd_, iov, count);
+    }
+    // A record per small piece would cost its own header, MAC and syscall.
+    char buffer[16384];
+    size_t total = 0;
+    int i = 0;
+    while (i < count) {
+        const char* data = static_cast<const char*>(iov[i].iov_base);
+        size_t len = iov[i].iov_len;
+        if (len < sizeof(buffer)) {
+            len = 0;
+            for (; i < count && len + iov[i].iov_len <= sizeof(buffer); ++i) {
+                memcpy(buffer + len, iov[i].iov_base, iov[i].iov_len);
+                len += iov[i].iov_len;
+            }
+            data = buffer;
+        } else {
+            ++i;
+        }
+        if (len == 0) {
+            continue;
+        }
+        ssize_t written = write(data, len);
+        if (written <= 0) {
+            return total > 0 ? static_cast<ssize_t>(total) : written;
+        }
+        total += written;
+        if (static_cast<size_t>(written) < len) {
+            break;
+        }
+    }
+    return total;
+}
+
+ssize_t Connection::send_file(int file_fd, off_t& offset, size_t count) {
+#ifdef __linux__
+    if (!use_tls_) {
+        return ::sendfile(fd_, file_fd, &offset, count);
+    }
+#endif
+    // After WANT_WRITE OpenSSL needs the same bytes again; re-reading from the unchanged
+    // offset provides them.
+    char buffer[16384];
+    ssize_t bytes_read = ::pread(file_fd, buffer, std::min(count, sizeof(buffer)), offset);
+    if (bytes_read <= 0) {
+        if (bytes_read == 0) {
+            errno = EIO; // file shrank underneath us
+        }
+        return -1;
+    }
+    ssize_t bytes_written = write(buffer, bytes_read);
+    if (bytes_written > 0) {
+        offset += bytes_written;
+    }
+    return bytes_written;
+}
+
 int Connection::accept() {
     return ::accept(fd_, nullptr, nullptr);
 }
 
 bool Connection::is_http2() const {
     return is_http2_;
-}
\ No newline at end of file
+}
+
+bool Connection::is_tls() const {
+    return use_tls_;
+}
+
+bool Connection::session_reused() const {
+    return use_tls_ && SSL_session_reused(ssl_);
+}
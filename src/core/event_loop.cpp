@@ -1,27 +1,60 @@
 #include "core/event_loop.hpp"
+#include "core/logger.hpp"
 #include <stdexcept>
-#include <iostream>
 #include <unistd.h> // For close
 #include <errno.h>  // For errno
 #include <string.h> // For strerror
+#ifdef __linux__
+#include <sys/eventfd.h>
+#else
+#include <fcntl.h>
+#endif
 
-EventLoop::EventLoop() {
+EventLoop::EventLoop() : stopped_(false) {
 #ifdef __linux__
     event_fd_ = epoll_create1(0);
     if (event_fd_ == -1) {
         throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
     }
+    wake_fds_[0] = wake_fds_[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fds_[0] == -1) {
+        close(event_fd_);
+        throw std::runtime_error("Failed to create eventfd: " + std::string(strerror(errno)));
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fds_[0];
+    if (epoll_ctl(event_fd_, EPOLL_CTL_ADD, wake_fds_[0], &ev) == -1) {
+        close(wake_fds_[0]);
+        close(event_fd_);
+        throw std::runtime_error("Failed to add eventfd to epoll: " + std::string(strerror(errno)));
+    }
 #elif defined(__APPLE__) || defined(__FreeBSD__)
     event_fd_ = kqueue();
     if (event_fd_ == -1) {
         throw std::runtime_error("Failed to create kqueue instance: " + std::string(strerror(errno)));
     }
+    if (pipe(wake_fds_) == -1) {
+        close(event_fd_);
+        throw std::runtime_error("Failed to create wake pipe: " + std::string(strerror(errno)));
+    }
+    fcntl(wake_fds_[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_fds_[1], F_SETFL, O_NONBLOCK);
+    struct kevent ev;
+    EV_SET(&ev, wake_fds_[0], EVFILT_READ, EV_ADD, 0, 0, nullptr);
+    if (kevent(event_fd_, &ev, 1, nullptr, 0, nullptr) == -1) {
+        throw std::runtime_error("Failed to add wake pipe to kqueue: " + std::string(strerror(errno)));
+    }
 #endif
 }
 
 EventLoop::~EventLoop() {
+    close(wake_fds_[0]);
+    if (wake_fds_[1] != wake_fds_[0]) {
+        close(wake_fds_[1]);
+    }
     if (close(event_fd_) == -1) {
-        std::cerr << "Failed to close event_fd_: " << strerror(errno) << std::endl;
+        LOG_ERROR("Failed to close event_fd_: {}", strerror(errno));
     }
 }
 
@@ -29,7 +62,7 @@ void EventLoop::addFd(int fd, uint32_t events, std::function<void(int, uint32_t)
 #ifdef __linux__
     struct epoll_event ev;
     ev.events = events;
-    ev.data.fd = fd; 
+    ev.data.fd = fd;
     if (epoll_ctl(event_fd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
         throw std::runtime_error("Failed to add fd to epoll: " + std::string(strerror(errno)));
     }
@@ -40,50 +73,158 @@ void EventLoop::addFd(int fd, uint32_t events, std::function<void(int, uint32_t)
         throw std::runtime_error("Failed to add fd to kqueue: " + std::string(strerror(errno)));
     }
 #endif
-    callbacks_[fd] = std::move(callback); 
+    callbacks_[fd] = std::move(callback);
+}
+
+void EventLoop::removeFd(int fd) {
+#ifdef __linux__
+    epoll_ctl(event_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    kevent(event_fd_, &ev, 1, nullptr, 0, nullptr);
+#endif
+    auto it = callbacks_.find(fd);
+    if (it != callbacks_.end()) {
+        retired_.push_back(std::move(it->second));
+        callbacks_.erase(it);
+    }
+}
+
+void EventLoop::modifyFd(int fd, uint32_t events) {
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(event_fd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        throw std::runtime_error("Failed to modify fd in epoll: " + std::string(strerror(errno)));
+    }
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+    struct kevent ev[2];
+    EV_SET(&ev[0], fd, EVFILT_READ, (events & EPOLLIN) ? EV_ADD : EV_DELETE, 0, 0, nullptr);
+    EV_SET(&ev[1], fd, EVFILT_WRITE, (events & EPOLLOUT) ? EV_ADD : EV_DELETE, 0, 0, nullptr);
+    kevent(event_fd_, ev, 2, nullptr, 0, nullptr);
+#endif
+}
+
+void EventLoop::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        posted_.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+void EventLoop::runPosted() {
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        tasks.swap(posted_);
+    }
+    for (auto &task : tasks) {
+        task();
+    }
+}
+
+void EventLoop::runEvery(std::chrono::milliseconds interval, std::function<void()> callback) {
+    timers_.push_back(Timer{std::chrono::steady_clock::now() + interval, interval, std::move(callback)});
+}
+
+int EventLoop::msUntilNextTimer() const {
+    if (timers_.empty()) {
+        return -1;
+    }
+    auto next = timers_.front().due;
+    for (const auto &timer : timers_) {
+        next = std::min(next, timer.due);
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - std::chrono::steady_clock::now());
+    return wait.count() < 0 ? 0 : static_cast<int>(wait.count()) + 1;
+}
+
+void EventLoop::runDueTimers() {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < timers_.size(); ++i) {
+        if (timers_[i].due <= now) {
+            timers_[i].due = now + timers_[i].interval;
+            timers_[i].callback();
+        }
+    }
+}
+
+void EventLoop::stop() {
+    stopped_ = true;
+    wakeup();
+}
+
+void EventLoop::wakeup() {
+    uint64_t one = 1;
+    if (::write(wake_fds_[1], &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        LOG_ERROR("Failed to wake event loop: {}", strerror(errno));
+    }
 }
 
 void EventLoop::run() {
     const int MAX_EVENTS = 100;
 #ifdef __linux__
     struct epoll_event events[MAX_EVENTS];
-    while (true) {
-        int nfds = epoll_wait(event_fd_, events, MAX_EVENTS, -1);
+    while (!stopped_) {
+        int nfds = epoll_wait(event_fd_, events, MAX_EVENTS, msUntilNextTimer());
         if (nfds == -1) {
-            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
-            continue; 
+            if (errno != EINTR) {
+                LOG_ERROR("epoll_wait failed: {}", strerror(errno));
+            }
+            continue;
         }
         for (int i = 0; i < nfds; ++i) {
             int fd = events[i].data.fd;
             uint32_t ev = events[i].events;
+            if (fd == wake_fds_[0]) {
+                uint64_t count;
+                while (::read(wake_fds_[0], &count, sizeof(count)) > 0) {}
+                runPosted();
+                continue;
+            }
             auto it = callbacks_.find(fd);
             if (it != callbacks_.end()) {
-                std::cout << "Calling callback for fd " << fd << " with events " << ev << std::endl;
+                LOG_TRACE("Calling callback for fd {} with events {}", fd, ev);
                 it->second(fd, ev); // Call the stored callback
             } else {
-                std::cerr << "No callback found for fd " << fd << std::endl;
+                LOG_WARN("No callback found for fd {}", fd);
             }
         }
+        retired_.clear();
+        runDueTimers();
     }
 #elif defined(__APPLE__) || defined(__FreeBSD__)
     struct kevent events[MAX_EVENTS];
-    while (true) {
-        int nfds = kevent(event_fd_, nullptr, 0, events, MAX_EVENTS, nullptr);
+    while (!stopped_) {
+        int timeout_ms = msUntilNextTimer();
+        struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        int nfds = kevent(event_fd_, nullptr, 0, events, MAX_EVENTS, timeout_ms < 0 ? nullptr : &timeout);
         if (nfds == -1) {
-            std::cerr << "kevent failed: " << strerror(errno) << std::endl;
+            LOG_ERROR("kevent failed: {}", strerror(errno));
             continue; // Or handle the error more gracefully
         }
         for (int i = 0; i < nfds; ++i) {
             int fd = events[i].ident;
             uint32_t ev = events[i].filter;
+            if (fd == wake_fds_[0]) {
+                char drain[64];
+                while (::read(wake_fds_[0], drain, sizeof(drain)) > 0) {}
+                runPosted();
+                continue;
+            }
             auto it = callbacks_.find(fd);
             if (it != callbacks_.end()) {
-                std::cout << "Calling callback for fd " << fd << " with events " << ev << std::endl;
+                LOG_TRACE("Calling callback for fd {} with events {}", fd, ev);
                 it->second(fd, ev); // Call the stored callback
             } else {
-                std::cerr << "No callback found for fd " << fd << std::endl;
+                LOG_WARN("No callback found for fd {}", fd);
             }
         }
+        retired_.clear();
+        runDueTimers();
     }
 #endif
-}
\ No newline at end of file
+}
@@ -0,0 +1,102 @@
+#include "core/event_loop_group.hpp"
+#include "core/listener.hpp"
+#include "core/logger.hpp"
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+EventLoopGroup::EventLoopGroup(size_t num_loops, int port, bool pin_threads) : pin_threads_(pin_threads) {
+    if (num_loops == 0) {
+        throw std::invalid_argument("EventLoopGroup needs at least one loop");
+    }
+    // Sockets are bound up front so that a bind failure surfaces in the caller's thread.
+    loops_.resize(num_loops);
+    for (auto &lt : loops_) {
+        lt.loop = std::make_unique<EventLoop>();
+        lt.listen_fd = port >= 0 ? createListenSocket(port, true, true) : -1;
+        lt.spare_fd = port >= 0 ? openSpareFd() : -1;
+    }
+}
+
+EventLoopGroup::~EventLoopGroup() {
+    stop();
+    join();
+    for (auto &lt : loops_) {
+        if (lt.listen_fd != -1) {
+            close(lt.listen_fd);
+        }
+        if (lt.spare_fd != -1) {
+            close(lt.spare_fd);
+        }
+    }
+}
+
+void EventLoopGroup::start(AcceptHandler handler) {
+    handler_ = std::move(handler);
+    unsigned cores = std::thread::hardware_concurrency();
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        LoopThread &lt = loops_[i];
+        if (lt.listen_fd != -1) {
+            lt.loop->addFd(lt.listen_fd, EPOLLIN, [this, &lt](int, uint32_t) { acceptAll(lt); });
+        }
+        lt.thread = std::thread([this, &lt, i, cores] {
+            if (pin_threads_ && cores > 0 && !pinThreadToCore(i % cores)) {
+                LOG_WARN("Failed to pin event loop {} to core {}", i, i % cores);
+            }
+            lt.loop->run();
+        });
+    }
+    LOG_INFO("Started {} event loops", loops_.size());
+}
+
+EventLoop &EventLoopGroup::next() {
+    return *loops_[next_loop_.fetch_add(1, std::memory_order_relaxed) % loops_.size()].loop;
+}
+
+void EventLoopGroup::join() {
+    for (auto &lt : loops_) {
+        if (lt.thread.joinable()) {
+            lt.thread.join();
+        }
+    }
+}
+
+void EventLoopGroup::stop() {
+    for (auto &lt : loops_) {
+        lt.loop->stop();
+    }
+}
+
+void EventLoopGroup::run(AcceptHandler handler) {
+    start(std::move(handler));
+    join();
+}
+
+void EventLoopGroup::acceptAll(LoopThread &lt) {
+    // The listen socket is non-blocking, so drain the whole backlog per wakeup.
+    size_t dropped = 0;
+    while (true) {
+        int client_fd = acceptNonBlocking(lt.listen_fd);
+        if (client_fd == -1) {
+            int err = errno;
+            if (err == EINTR) {
+                continue;
+            }
+            // Out of descriptors: shed the backlog instead of being woken for it again at once.
+            if ((err == EMFILE || err == ENFILE) && dropConnection(lt.listen_fd, lt.spare_fd)) {
+                ++dropped;
+                continue;
+            }
+            if (dropped > 0) {
+                LOG_ERROR("Out of file descriptors; dropped {} new connections", dropped);
+            }
+            if (err != EAGAIN && err != EWOULDBLOCK && dropped == 0) {
+                LOG_ERROR("Failed to accept connection: {}", strerror(err));
+            }
+            return;
+        }
+        handler_(client_fd, *lt.loop);
+    }
+}
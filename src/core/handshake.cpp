@@ -0,0 +1,72 @@
+#include "core/handshake.hpp"
+#include "core/metrics.hpp"
+
+namespace {
+
+uint32_t eventsFor(Connection::HandshakeStatus status) {
+    return status == Connection::HandshakeStatus::WantWrite ? EPOLLOUT : EPOLLIN;
+}
+
+} // namespace
+
+HandshakeDriver::HandshakeDriver(EventLoop &loop, std::chrono::milliseconds timeout) : loop_(loop), timeout_(timeout) {}
+
+void HandshakeDriver::start(std::unique_ptr<Connection> conn, HandshakeCallback on_ready) {
+    // The ClientHello is often already queued when the connection is accepted, so try
+    // once before paying for an epoll registration.
+    Connection::HandshakeStatus status = conn->handshake();
+    if (status == Connection::HandshakeStatus::Done) {
+        on_ready(std::move(conn));
+        return;
+    }
+    if (status == Connection::HandshakeStatus::Failed) {
+        return;
+    }
+
+    int fd = conn->fd();
+    uint32_t registered = eventsFor(status);
+    pending_[fd] = Pending{std::move(conn), std::move(on_ready), registered, std::chrono::steady_clock::now()};
+    loop_.addFd(fd, registered, [this](int fd, uint32_t) { advance(fd); });
+}
+
+void HandshakeDriver::advance(int fd) {
+    auto it = pending_.find(fd);
+    if (it == pending_.end()) {
+        return;
+    }
+    Pending &pending = it->second;
+    Connection::HandshakeStatus status = pending.conn->handshake();
+    switch (status) {
+    case Connection::HandshakeStatus::WantRead:
+    case Connection::HandshakeStatus::WantWrite:
+        if (eventsFor(status) != pending.registered) {
+            pending.registered = eventsFor(status);
+            loop_.modifyFd(fd, pending.registered);
+        }
+        return;
+    case Connection::HandshakeStatus::Done: {
+        loop_.removeFd(fd);
+        Pending done = std::move(pending);
+        pending_.erase(it);
+        done.on_ready(std::move(done.conn));
+        return;
+    }
+    case Connection::HandshakeStatus::Failed:
+        loop_.removeFd(fd);
+        pending_.erase(it);
+        return;
+    }
+}
+
+void HandshakeDriver::closeExpired() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        if (now - it->second.started > timeout_) {
+            Metrics::add(Counter::HandshakeFailures);
+            loop_.removeFd(it->first);
+            it = pending_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#include "core/listener.hpp"
+#include <stdexcept>
+#include <string>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+int createListenSocket(int port, bool reuse_port, bool non_blocking, int backlog) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        throw std::runtime_error("Failed to create socket: " + std::string(strerror(errno)));
+    }
+
+    int optval = 1;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1) {
+        close(listen_fd);
+        throw std::runtime_error("Failed to set SO_REUSEADDR: " + std::string(strerror(errno)));
+    }
+    if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+        close(listen_fd);
+        throw std::runtime_error("Failed to set SO_REUSEPORT: " + std::string(strerror(errno)));
+    }
+
+    if (non_blocking && fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK) == -1) {
+        close(listen_fd);
+        throw std::runtime_error("Failed to set O_NONBLOCK: " + std::string(strerror(errno)));
+    }
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(listen_fd);
+        throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
+    }
+
+    if (listen(listen_fd, backlog) == -1) {
+        close(listen_fd);
+        throw std::runtime_error("Failed to listen on socket: " + std::string(strerror(errno)));
+    }
+
+    return listen_fd;
+}
+
+int acceptNonBlocking(int listen_fd) {
+#ifdef __linux__
+    int client_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int client_fd = ::accept(listen_fd, nullptr, nullptr);
+    if (client_fd != -1) {
+        fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (client_fd != -1) {
+        // A response goes out as several writes (head, then file body; one TLS record
+        // each). With Nagle the second waits for the client's delayed ACK.
+        int optval = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    }
+    return client_fd;
+}
+
+int openSpareFd() {
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+bool dropConnection(int listen_fd, int &spare_fd) {
+    if (spare_fd == -1) {
+        spare_fd = openSpareFd();
+        return false;
+    }
+    close(spare_fd);
+    int client_fd = ::accept(listen_fd, nullptr, nullptr);
+    if (client_fd != -1) {
+        close(client_fd);
+    }
+    spare_fd = openSpareFd();
+    return client_fd != -1;
+}
+
+bool pinThreadToCore(size_t core) {
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+#else
+    (void)core;
+    return false;
+#endif
+}
@@ -0,0 +1,289 @@
+#include "core/logger.hpp"
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace log_detail;
+
+namespace {
+
+const char *const kLevelNames[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR"};
+const auto kIdleWait = std::chrono::milliseconds(10); // between polls when the rings are empty
+
+// The writer thread and the rings it drains. Never destroyed: threads may log while
+// the process exits, so an atexit handler flushes instead.
+class Writer {
+public:
+    Writer() : thread_([this] { run(); }) {
+        thread_.detach();
+        std::atexit([] { Logger::flush(); });
+    }
+
+    Ring *add() {
+        auto ring = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.push_back(ring);
+        return ring.get();
+    }
+
+    void setOutput(int fd) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fd_ = fd;
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t ticket = ++flush_requested_;
+        wake_.notify_one();
+        flushed_cv_.wait(lock, [&] { return flushed_ >= ticket; });
+    }
+
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_;
+    }
+
+    // Without the mutex: a producer must not wait on the writer. A wakeup that races
+    // with the writer going to sleep is only late by one poll interval.
+    void wake() {
+        nudged_.store(true, std::memory_order_relaxed);
+        wake_.notify_one();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            uint64_t requested = flush_requested_;
+            nudged_.store(false, std::memory_order_relaxed);
+            bool drained = drainAll();
+            writeOut();
+            if (requested != flushed_) {
+                flushed_ = requested;
+                flushed_cv_.notify_all();
+            }
+            if (!drained) {
+                wake_.wait_for(lock, kIdleWait, [&] {
+                    return flush_requested_ != flushed_ || nudged_.load(std::memory_order_relaxed);
+                });
+            }
+        }
+    }
+
+    // Formats every committed record, oldest first across all rings, and frees rings
+    // of exited threads once empty. Returns whether there was anything to write.
+    bool drainAll() {
+        records_.clear();
+        heads_.resize(rings_.size());
+        for (size_t i = 0; i < rings_.size(); ++i) {
+            Ring &ring = *rings_[i];
+            reportDropped(ring.dropped.exchange(0, std::memory_order_relaxed));
+            uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+            heads_[i] = ring.head.load(std::memory_order_acquire);
+            while (tail != heads_[i]) {
+                const char *record = ring.buffer + (tail & (Ring::kCapacity - 1));
+                RecordHeader header;
+                std::memcpy(&header, record, offsetof(RecordHeader, args));
+                if (header.level != LogLevel::Off) {
+                    std::memcpy(&header, record, sizeof(header));
+                    records_.push_back({header.time_ns, record});
+                }
+                tail += header.size;
+            }
+        }
+        std::stable_sort(records_.begin(), records_.end(),
+                         [](const auto &a, const auto &b) { return a.first < b.first; });
+        for (const auto &record : records_) {
+            RecordHeader header;
+            std::memcpy(&header, record.second, sizeof(header));
+            format(header, record.second + sizeof(header));
+        }
+        bool drained = !records_.empty() || !out_.empty();
+        for (size_t i = 0; i < rings_.size();) {
+            Ring &ring = *rings_[i];
+            ring.tail.store(heads_[i], std::memory_order_release);
+            ring.nudged.store(false, std::memory_order_relaxed);
+            if (ring.orphaned.load(std::memory_order_acquire) &&
+                heads_[i] == ring.head.load(std::memory_order_acquire)) {
+                rings_[i] = std::move(rings_.back());
+                rings_.pop_back();
+                heads_[i] = heads_.back();
+                heads_.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        return drained;
+    }
+
+    void reportDropped(uint64_t lost) {
+        if (lost == 0) {
+            return;
+        }
+        dropped_ += lost;
+        appendTime(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count());
+        out_ += kLevelNames[static_cast<int>(LogLevel::Warn)];
+        out_ += ' ';
+        appendNumber(lost);
+        out_ += " log messages dropped, ring full\n";
+    }
+
+    // One line: time, level, then the format with each {} replaced by an argument.
+    void format(const RecordHeader &header, const char *args) {
+        appendTime(header.time_ns);
+        out_ += kLevelNames[static_cast<int>(header.level)];
+        out_ += ' ';
+        size_t remaining = header.args;
+        for (const char *f = header.format; *f; ++f) {
+            if (f[0] == '{' && f[1] == '}' && remaining > 0) {
+                args = appendArg(args);
+                --remaining;
+                ++f;
+            } else {
+                out_ += *f;
+            }
+        }
+        out_ += '\n';
+    }
+
+    const char *appendArg(const char *p) {
+        ArgType type = static_cast<ArgType>(*p++);
+        if (type == ArgType::String) {
+            uint32_t len;
+            std::memcpy(&len, p, 4);
+            out_.append(p + 4, len);
+            return p + 4 + len;
+        }
+        uint64_t bits;
+        std::memcpy(&bits, p, 8);
+        switch (type) {
+        case ArgType::Int:
+            appendNumber(static_cast<int64_t>(bits));
+            break;
+        case ArgType::Uint:
+            appendNumber(bits);
+            break;
+        case ArgType::Double: {
+            double value;
+            std::memcpy(&value, &bits, 8);
+            char text[32];
+            int n = std::snprintf(text, sizeof(text), "%g", value);
+            out_.append(text, n);
+            break;
+        }
+        case ArgType::Bool:
+            out_ += bits ? "true" : "false";
+            break;
+        case ArgType::Char:
+            out_ += static_cast<char>(bits);
+            break;
+        case ArgType::Pointer: {
+            char text[24];
+            int n = std::snprintf(text, sizeof(text), "0x%llx", static_cast<unsigned long long>(bits));
+            out_.append(text, n);
+            break;
+        }
+        case ArgType::String:
+            break;
+        }
+        return p + 8;
+    }
+
+    template <typename T>
+    void appendNumber(T value) {
+        char text[24];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        out_.append(text, result.ptr);
+    }
+
+    // UTC, e.g. 2024-05-01T12:34:56.789012Z; the date part is reformatted once a second.
+    void appendTime(int64_t time_ns) {
+        time_t seconds = static_cast<time_t>(time_ns / 1000000000);
+        if (seconds != time_seconds_) {
+            struct tm tm;
+            gmtime_r(&seconds, &tm);
+            std::snprintf(time_prefix_, sizeof(time_prefix_), "%04d-%02d-%02dT%02d:%02d:%02d.", tm.tm_year + 1900,
+                          tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+            time_seconds_ = seconds;
+        }
+        char micros[16];
+        std::snprintf(micros, sizeof(micros), "%06dZ ", static_cast<int>(time_ns % 1000000000 / 1000));
+        out_ += time_prefix_;
+        out_ += micros;
+    }
+
+    // Called with mutex_ held; the rings are not touched while writing.
+    void writeOut() {
+        size_t written = 0;
+        while (written < out_.size()) {
+            ssize_t n = ::write(fd_, out_.data() + written, out_.size() - written);
+            if (n > 0) {
+                written += n;
+            } else if (n == -1 && errno == EINTR) {
+                continue;
+            } else {
+                break; // nowhere to report it; the lines are lost
+            }
+        }
+        out_.clear();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_cv_;
+    std::atomic<bool> nudged_{false};
+    std::vector<std::shared_ptr<Ring>> rings_;
+    std::vector<uint64_t> heads_;                            // per ring, as of this pass
+    std::vector<std::pair<int64_t, const char *>> records_; // this pass's, by time
+    int fd_ = STDERR_FILENO;
+    uint64_t flush_requested_ = 0;
+    uint64_t flushed_ = 0;
+    uint64_t dropped_ = 0;
+    std::string out_;
+    time_t time_seconds_ = -1;
+    char time_prefix_[64] = {};
+    std::thread thread_;
+};
+
+Writer &writer() {
+    static Writer *instance = new Writer();
+    return *instance;
+}
+
+// Marks the thread's ring orphaned when the thread exits; the writer frees it once drained.
+struct RingOwner {
+    ~RingOwner() {
+        if (thread_ring) {
+            thread_ring->orphaned.store(true, std::memory_order_release);
+            thread_ring = nullptr;
+        }
+    }
+};
+
+} // namespace
+
+Ring *log_detail::registerThread() {
+    thread_local RingOwner owner;
+    thread_ring = writer().add();
+    return thread_ring;
+}
+
+void Ring::wakeWriter() { writer().wake(); }
+
+void Logger::setOutput(int fd) { writer().setOutput(fd); }
+
+void Logger::flush() { writer().flush(); }
+
+uint64_t Logger::dropped() { return writer().dropped(); }
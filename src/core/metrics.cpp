@@ -0,0 +1,201 @@
+#include "core/metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace metrics_detail;
+
+namespace {
+
+const char *const kStageNames[] = {"accept", "tls_handshake", "parse", "cache_lookup", "static_file", "proxy", "write"};
+static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) == static_cast<size_t>(Stage::Count), "stage names");
+
+struct CounterInfo {
+    const char *name;
+    const char *help;
+};
+
+const CounterInfo kCounters[] = {
+    {"blaze_connections_accepted_total", "Client connections accepted."},
+    {"blaze_tls_handshake_failures_total", "Client connections dropped because the TLS handshake failed or timed out."},
+    {"blaze_requests_total", "Requests handed to the request handler, HTTP/2 streams included."},
+    {"blaze_cache_hits_total", "Proxied GET and HEAD requests answered from the response cache."},
+    {"blaze_cache_misses_total", "Proxied GET and HEAD requests the response cache had no usable entry for."},
+};
+static_assert(sizeof(kCounters) / sizeof(kCounters[0]) == static_cast<size_t>(Counter::Count), "counter names");
+
+const CounterInfo kGauges[] = {
+    {"blaze_open_connections", "Client connections open, including those still in the TLS handshake."},
+    {"blaze_worker_queue_depth", "Tasks waiting in worker pool queues."},
+};
+static_assert(sizeof(kGauges) / sizeof(kGauges[0]) == static_cast<size_t>(Gauge::Count), "gauge names");
+
+// Histogram buckets exported to Prometheus: powers of two from 256 ns to about 69 s.
+// Each is a bucket boundary of the recording histograms, so the counts are exact.
+const size_t kFirstExportedBit = 8;
+const size_t kLastExportedBit = 36;
+const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// Plain sums of shards.
+struct Totals {
+    uint64_t buckets[static_cast<size_t>(Stage::Count)][kBuckets] = {};
+    uint64_t count[static_cast<size_t>(Stage::Count)] = {};
+    uint64_t sum_ns[static_cast<size_t>(Stage::Count)] = {};
+    uint64_t counters[static_cast<size_t>(Counter::Count)] = {};
+    uint64_t gauges[static_cast<size_t>(Gauge::Count)] = {};
+
+    void add(const Shard &shard) {
+        for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+            const Histogram &histogram = shard.stages[s];
+            for (size_t b = 0; b < kBuckets; ++b) {
+                buckets[s][b] += histogram.buckets[b].load(std::memory_order_relaxed);
+            }
+            count[s] += histogram.count.load(std::memory_order_relaxed);
+            sum_ns[s] += histogram.sum_ns.load(std::memory_order_relaxed);
+        }
+        for (size_t c = 0; c < static_cast<size_t>(Counter::Count); ++c) {
+            counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+        }
+        for (size_t g = 0; g < static_cast<size_t>(Gauge::Count); ++g) {
+            gauges[g] += shard.gauges[g].load(std::memory_order_relaxed); // wraps back for negative deltas
+        }
+    }
+};
+
+// The shards of running threads, and what exited threads recorded.
+struct Registry {
+    std::mutex mutex;
+    std::vector<Shard *> shards;
+    Totals retired;
+};
+
+Registry &registry() {
+    static Registry *instance = new Registry(); // threads may record during exit
+    return *instance;
+}
+
+// Folds the thread's shard into the retired totals when the thread exits.
+struct ShardOwner {
+    ~ShardOwner() {
+        Shard *shard = thread_shard;
+        if (!shard) {
+            return;
+        }
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.retired.add(*shard);
+        for (size_t i = 0; i < reg.shards.size(); ++i) {
+            if (reg.shards[i] == shard) {
+                reg.shards[i] = reg.shards.back();
+                reg.shards.pop_back();
+                break;
+            }
+        }
+        thread_shard = nullptr;
+        delete shard;
+    }
+};
+
+// Upper bound, exclusive, of a recording bucket in nanoseconds.
+uint64_t bucketUpperBound(size_t index) {
+    if (index < kSubBuckets) {
+        return index + 1;
+    }
+    size_t shift = index / kSubBuckets - 1;
+    return (kSubBuckets + index % kSubBuckets + 1) << shift;
+}
+
+void appendf(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+void appendf(std::string &out, const char *format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int n = std::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(line, std::min(static_cast<size_t>(n), sizeof(line) - 1));
+    }
+}
+
+void appendHistograms(std::string &out, const Totals &totals) {
+    out += "# HELP blaze_stage_duration_seconds Time spent in each stage of serving a request.\n"
+           "# TYPE blaze_stage_duration_seconds histogram\n";
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for (size_t bit = kFirstExportedBit; bit <= kLastExportedBit; ++bit) {
+            size_t end = (bit - kSubBucketBits + 1) * kSubBuckets; // first bucket at or above 2^bit
+            for (; bucket < end; ++bucket) {
+                cumulative += totals.buckets[s][bucket];
+            }
+            appendf(out, "blaze_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", kStageNames[s],
+                    std::ldexp(1.0, static_cast<int>(bit)) / 1e9, static_cast<unsigned long long>(cumulative));
+        }
+        appendf(out, "blaze_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", kStageNames[s],
+                static_cast<unsigned long long>(totals.count[s]));
+        appendf(out, "blaze_stage_duration_seconds_sum{stage=\"%s\"} %.9g\n", kStageNames[s], totals.sum_ns[s] / 1e9);
+        appendf(out, "blaze_stage_duration_seconds_count{stage=\"%s\"} %llu\n", kStageNames[s],
+                static_cast<unsigned long long>(totals.count[s]));
+    }
+
+    out += "# HELP blaze_stage_duration_quantile_seconds Stage latency quantiles since start, from the full "
+           "resolution histograms (within about 6%).\n"
+           "# TYPE blaze_stage_duration_quantile_seconds gauge\n";
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        if (totals.count[s] == 0) {
+            continue;
+        }
+        for (double q : kQuantiles) {
+            uint64_t rank = static_cast<uint64_t>(std::ceil(q * totals.count[s]));
+            uint64_t cumulative = 0;
+            size_t bucket = 0;
+            while (bucket + 1 < kBuckets && cumulative + totals.buckets[s][bucket] < rank) {
+                cumulative += totals.buckets[s][bucket++];
+            }
+            appendf(out, "blaze_stage_duration_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9g\n", kStageNames[s],
+                    q, bucketUpperBound(bucket) / 1e9);
+        }
+    }
+}
+
+} // namespace
+
+Shard *metrics_detail::registerThread() {
+    thread_local ShardOwner owner;
+    Shard *shard = new Shard();
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.shards.push_back(shard);
+    thread_shard = shard;
+    return shard;
+}
+
+std::string Metrics::prometheusText() {
+    auto totals = std::make_unique<Totals>();
+    {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        *totals = reg.retired;
+        for (const Shard *shard : reg.shards) {
+            totals->add(*shard);
+        }
+    }
+
+    std::string out;
+    out.reserve(32 * 1024);
+    for (size_t c = 0; c < static_cast<size_t>(Counter::Count); ++c) {
+        appendf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", kCounters[c].name, kCounters[c].help,
+                kCounters[c].name, kCounters[c].name, static_cast<unsigned long long>(totals->counters[c]));
+    }
+    for (size_t g = 0; g < static_cast<size_t>(Gauge::Count); ++g) {
+        appendf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", kGauges[g].name, kGauges[g].help, kGauges[g].name,
+                kGauges[g].name, static_cast<long long>(totals->gauges[g]));
+    }
+    appendHistograms(out, *totals);
+    return out;
+}
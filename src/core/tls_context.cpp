@@ -0,0 +1,203 @@
+#include "core/tls_context.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+TlsContext::TlsContext(const std::string &cert_file, const std::string &key_file,
+                       std::vector<std::string> alpn_protocols,
+                       std::chrono::seconds ticket_key_lifetime, long session_cache_size)
+    : ssl_ctx_(nullptr), ticket_key_lifetime_(ticket_key_lifetime)
+{
+    OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, nullptr);
+
+    ssl_ctx_ = SSL_CTX_new(TLS_server_method());
+    if (!ssl_ctx_)
+    {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error("Failed to create SSL context");
+    }
+
+    try
+    {
+        if (SSL_CTX_use_certificate_chain_file(ssl_ctx_, cert_file.c_str()) <= 0)
+        {
+            ERR_print_errors_fp(stderr);
+            throw std::runtime_error("Failed to load certificate file: " + cert_file);
+        }
+        if (SSL_CTX_use_PrivateKey_file(ssl_ctx_, key_file.c_str(), SSL_FILETYPE_PEM) <= 0)
+        {
+            ERR_print_errors_fp(stderr);
+            throw std::runtime_error("Failed to load private key file: " + key_file);
+        }
+        if (SSL_CTX_check_private_key(ssl_ctx_) != 1)
+        {
+            ERR_print_errors_fp(stderr);
+            throw std::runtime_error("Private key does not match certificate");
+        }
+
+        for (const auto &proto : alpn_protocols)
+        {
+            if (proto.empty() || proto.size() > 255)
+            {
+                throw std::invalid_argument("Invalid ALPN protocol name: " + proto);
+            }
+            alpn_wire_.push_back(static_cast<char>(proto.size()));
+            alpn_wire_ += proto;
+        }
+        // The server side of ALPN is a selection callback; SSL_CTX_set_alpn_protos only
+        // configures what a client offers.
+        SSL_CTX_set_alpn_select_cb(ssl_ctx_, selectAlpn, this);
+
+        // Connections are non-blocking and write from buffers that may move between retries.
+        SSL_CTX_set_mode(ssl_ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+        // Stateful resumption: session IDs looked up in OpenSSL's internal cache.
+        static const unsigned char sid_ctx[] = "BlazeHTTP";
+        SSL_CTX_set_session_id_context(ssl_ctx_, sid_ctx, sizeof(sid_ctx) - 1);
+        SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ssl_ctx_, session_cache_size);
+        SSL_CTX_set_timeout(ssl_ctx_, static_cast<long>(2 * ticket_key_lifetime_.count()));
+
+        // Stateless resumption: session tickets under our own rotating keys.
+        ticket_keys_.push_back(makeTicketKey());
+        SSL_CTX_set_app_data(ssl_ctx_, this);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx_, ticketKeyCallback);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx_, ticketKeyCallback);
+#endif
+    }
+    catch (...)
+    {
+        SSL_CTX_free(ssl_ctx_);
+        throw;
+    }
+}
+
+TlsContext::~TlsContext()
+{
+    SSL_CTX_free(ssl_ctx_);
+    OPENSSL_cleanse(ticket_keys_.data(), ticket_keys_.size() * sizeof(TicketKey));
+}
+
+void TlsContext::rotateTicketKeys()
+{
+    std::lock_guard<std::mutex> lock(keys_mutex_);
+    ticket_keys_.insert(ticket_keys_.begin(), makeTicketKey());
+    expireTicketKeys();
+}
+
+TlsContext::TicketKey TlsContext::makeTicketKey() const
+{
+    TicketKey key;
+    if (RAND_bytes(key.name, sizeof(key.name)) != 1 ||
+        RAND_bytes(key.aes_key, sizeof(key.aes_key)) != 1 ||
+        RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) != 1)
+    {
+        throw std::runtime_error("Failed to generate session ticket key");
+    }
+    key.created = std::chrono::steady_clock::now();
+    return key;
+}
+
+void TlsContext::expireTicketKeys()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now - ticket_keys_.front().created >= ticket_key_lifetime_)
+    {
+        ticket_keys_.insert(ticket_keys_.begin(), makeTicketKey());
+    }
+    // Keep the current key plus any key young enough that its tickets are still valid.
+    while (ticket_keys_.size() > 1 && now - ticket_keys_.back().created >= 2 * ticket_key_lifetime_)
+    {
+        OPENSSL_cleanse(&ticket_keys_.back(), sizeof(TicketKey));
+        ticket_keys_.pop_back();
+    }
+}
+
+int TlsContext::selectAlpn(SSL *, const unsigned char **out, unsigned char *outlen,
+                           const unsigned char *in, unsigned int inlen, void *arg)
+{
+    auto *self = static_cast<TlsContext *>(arg);
+    unsigned char *selected = nullptr;
+    const auto *server = reinterpret_cast<const unsigned char *>(self->alpn_wire_.data());
+    if (SSL_select_next_proto(&selected, outlen, server, self->alpn_wire_.size(), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+    {
+        // No overlap: continue without ALPN, which the connection treats as HTTP/1.1.
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int TlsContext::ticketKeyCallback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                                  EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc)
+#else
+int TlsContext::ticketKeyCallback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                                  EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx, int enc)
+#endif
+{
+    auto *self = static_cast<TlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    std::lock_guard<std::mutex> lock(self->keys_mutex_);
+    self->expireTicketKeys();
+
+    const TicketKey *key = nullptr;
+    int result = 1;
+    if (enc)
+    {
+        key = &self->ticket_keys_.front();
+        std::memcpy(key_name, key->name, sizeof(key->name));
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < self->ticket_keys_.size(); ++i)
+        {
+            if (std::memcmp(key_name, self->ticket_keys_[i].name, sizeof(TicketKey::name)) == 0)
+            {
+                key = &self->ticket_keys_[i];
+                // Tickets under an older key are accepted but replaced with a fresh one. TLS 1.3
+                // clients treat tickets as single-use, so they always get a new one too.
+                result = (i == 0 && SSL_version(ssl) < TLS1_3_VERSION) ? 1 : 2;
+                break;
+            }
+        }
+        if (!key)
+        {
+            return 0; // unknown or expired key: fall back to a full handshake
+        }
+    }
+
+    if (!EVP_CipherInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key->aes_key, iv, enc))
+    {
+        return -1;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(key->hmac_key),
+                                          sizeof(key->hmac_key)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+        OSSL_PARAM_construct_end()};
+    if (!EVP_MAC_CTX_set_params(mac_ctx, params))
+    {
+        return -1;
+    }
+#else
+    if (!HMAC_Init_ex(hmac_ctx, key->hmac_key, sizeof(key->hmac_key), EVP_sha256(), nullptr))
+    {
+        return -1;
+    }
+#endif
+    return result;
+}
@@ -1,48 +1,465 @@
 #include "core/worker_pool.hpp"
-#include <stdexcept>
-#include <iostream>
+#include "core/listener.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <thread>
 
-WorkerPool::WorkerPool(size_t num_workers) : stop_(false) {
-    std::cout << "Starting worker pool with " << num_workers << " workers" << std::endl;
-    for (size_t i = 0; i < num_workers; ++i) {
-        workers_.emplace_back([this, i] {
-            // std::cout << "Worker thread " << i << " started" << std::endl;
-            while (true) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(queue_mutex_);
-                    condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
-                    if (stop_ && tasks_.empty()) {
-                        // std::cout << "Worker thread " << i << " stopping" << std::endl;
-                        return;
-                    }
-                    task = std::move(tasks_.front());
-                    tasks_.pop();
+namespace {
+
+const size_t kInjectionCapacity = 4096; // power of two
+const size_t kDequeCapacity = 256;      // initial, power of two; grows when full
+const size_t kNodeBlock = 64;
+const size_t kOverflowBatch = 32; // overflow tasks moved to a worker's deque per lock
+const int kSpinRounds = 16;
+const int kPausesPerRound = 16;
+const int kYieldRounds = 4;
+const uint32_t kInjectionPollInterval = 61; // tasks between checking the injection queue first
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Chase-Lev deque, in the C11 formulation of Le et al. (PPoPP 2013). The owner pushes
+// and pops at the bottom; thieves take from the top. A full ring is replaced by one
+// twice the size, and replaced rings are kept until the deque goes away because a thief
+// may still be reading one.
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity) {
+        rings_.push_back(std::make_unique<Ring>(capacity));
+        ring_.store(rings_.back().get(), std::memory_order_relaxed);
+    }
+
+    // Owner only.
+    void push(T *item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Ring *ring = ring_.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(ring->mask)) {
+            ring = grow(ring, t, b);
+        }
+        ring->at(b).store(item, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only.
+    T *pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        if (top_.load(std::memory_order_relaxed) >= b) {
+            return nullptr; // top_ only grows, so it is empty without the fence
+        }
+        --b;
+        Ring *ring = ring_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *item = ring->at(b).load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last item: a thief may be taking it too.
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. Returns null when empty or when another thread won the item.
+    T *steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Ring *ring = ring_.load(std::memory_order_acquire);
+        T *item = ring->at(t).load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    bool empty() const {
+        return top_.load(std::memory_order_relaxed) >= bottom_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Ring {
+        explicit Ring(size_t capacity) : mask(capacity - 1), slots(new std::atomic<T *>[capacity]) {}
+        std::atomic<T *> &at(int64_t i) { return slots[static_cast<size_t>(i) & mask]; }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+    };
+
+    Ring *grow(Ring *ring, int64_t t, int64_t b) {
+        rings_.push_back(std::make_unique<Ring>((ring->mask + 1) * 2));
+        Ring *bigger = rings_.back().get();
+        for (int64_t i = t; i < b; ++i) {
+            bigger->at(i).store(ring->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        ring_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::atomic<Ring *> ring_{nullptr};
+    std::vector<std::unique_ptr<Ring>> rings_; // owner only
+};
+
+} // namespace
+
+// A task submitted by a worker to its own deque. Nodes come from the submitting worker's
+// free list and go back to it once the task has been taken, through an atomic stack
+// when a thief took it, so a local submit does not allocate once the lists are warm.
+struct WorkerPool::Node {
+    Task task;
+    Node *next = nullptr;
+    Worker *home = nullptr;
+};
+
+struct WorkerPool::Worker {
+    WorkerPool *pool = nullptr;
+    size_t index = 0;
+    WorkStealingDeque<Node> deque{kDequeCapacity};
+    Node *free_nodes = nullptr;             // owner only
+    std::atomic<Node *> returned{nullptr};  // nodes freed by other workers
+    std::vector<std::unique_ptr<Node[]>> blocks;
+    uint64_t rng = 0;
+    uint32_t ticks = 0;
+    std::thread thread;
+};
+
+// Bounded MPMC queue after Vyukov: every slot carries a sequence number telling producers
+// and consumers whose turn it is, so a push or pop is one CAS on its index and the task
+// is moved in or out of the slot without a lock.
+class WorkerPool::InjectionQueue {
+public:
+    explicit InjectionQueue(size_t capacity) : mask_(capacity - 1), slots_(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Moves from task only when there was room.
+    bool push(Task &task) {
+        size_t pos = enqueue_.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true) {
+            slot = &slots_[pos & mask_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->task = std::move(task);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(Task &task) {
+        size_t pos = dequeue_.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true) {
+            slot = &slots_[pos & mask_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
                 }
-                // std::cout << "Worker thread " << i << " processing task" << std::endl;
-                task();
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+        task = std::move(slot->task);
+        slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // True while a push has claimed a slot, even before its task is readable.
+    bool empty() const {
+        return dequeue_.load(std::memory_order_relaxed) >= enqueue_.load(std::memory_order_seq_cst);
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Task task;
+    };
+
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> enqueue_{0};
+    alignas(64) std::atomic<size_t> dequeue_{0};
+};
+
+thread_local WorkerPool::Worker *WorkerPool::current_ = nullptr;
+
+WorkerPool::WorkerPool(size_t num_workers, bool pin_threads)
+    : injection_(std::make_unique<InjectionQueue>(kInjectionCapacity)),
+      max_spinning_(std::min<size_t>(num_workers, std::thread::hardware_concurrency()) / 2) {
+    LOG_INFO("Starting worker pool with {} workers", num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->pool = this;
+        worker->index = i;
+        worker->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        workers_.push_back(std::move(worker));
+    }
+    unsigned cores = std::thread::hardware_concurrency();
+    for (auto &worker : workers_) {
+        Worker &self = *worker;
+        self.thread = std::thread([this, &self, pin_threads, cores] {
+            if (pin_threads && cores > 0 && !pinThreadToCore(self.index % cores)) {
+                LOG_WARN("Failed to pin worker {} to core {}", self.index, self.index % cores);
             }
+            LOG_TRACE("Worker thread {} started", self.index);
+            run(self);
+            LOG_TRACE("Worker thread {} stopping", self.index);
         });
     }
 }
 
 WorkerPool::~WorkerPool() {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
+        std::lock_guard<std::mutex> lock(park_mutex_);
         stop_ = true;
     }
-    condition_.notify_all();
-    for (auto& worker : workers_) {
-        worker.join();
+    park_cv_.notify_all();
+    for (auto &worker : workers_) {
+        worker->thread.join();
+    }
+    LOG_INFO("Worker pool stopped");
+}
+
+void WorkerPool::submit(Task task) {
+    Metrics::adjust(Gauge::WorkerQueueDepth, 1);
+    Worker *self = current_;
+    if (self && self->pool == this) {
+        Node *node = allocNode(*self);
+        node->task = std::move(task);
+        self->deque.push(node);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // order the push before reading sleeping_
+    } else if (!injection_->push(task)) {
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_.push_back(std::move(task));
+        overflow_size_.fetch_add(1, std::memory_order_seq_cst);
+    }
+    wake();
+}
+
+void WorkerPool::run(Worker &self) {
+    current_ = &self;
+    Task task;
+    bool woken = false;
+    while (true) {
+        if (findTask(self, task) || spin(self, task)) {
+            if (woken) {
+                woken = false;
+                if (hasWork()) {
+                    wake(); // pass the wakeup on while tasks are left
+                }
+            }
+            Metrics::adjust(Gauge::WorkerQueueDepth, -1);
+            task();
+            task.reset();
+        } else if (park()) {
+            woken = true;
+        } else {
+            break;
+        }
+    }
+    current_ = nullptr;
+}
+
+// Own deque newest first, then the injection queue, then the overflow list (a batch of
+// which moves to the own deque, where others can steal it), then a steal from the other
+// workers starting at a random one. Every so often the injection queue
+// goes first, so a worker feeding itself cannot starve the event loops' tasks.
+bool WorkerPool::findTask(Worker &self, Task &task) {
+    if (++self.ticks % kInjectionPollInterval == 0 && injection_->pop(task)) {
+        return true;
+    }
+    if (Node *node = self.deque.pop()) {
+        take(self, node, task);
+        return true;
+    }
+    if (injection_->pop(task)) {
+        return true;
+    }
+    if (overflow_size_.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        if (!overflow_.empty()) {
+            task = std::move(overflow_.front());
+            overflow_.pop_front();
+            size_t moved = 1;
+            for (; moved < kOverflowBatch && !overflow_.empty(); ++moved) {
+                Node *node = allocNode(self);
+                node->task = std::move(overflow_.front());
+                overflow_.pop_front();
+                self.deque.push(node);
+            }
+            overflow_size_.fetch_sub(moved, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    size_t n = workers_.size();
+    self.rng ^= self.rng << 13;
+    self.rng ^= self.rng >> 7;
+    self.rng ^= self.rng << 17;
+    size_t start = static_cast<size_t>(self.rng % n);
+    for (size_t i = 0; i < n; ++i) {
+        Worker &victim = *workers_[(start + i) % n];
+        if (&victim == &self) {
+            continue;
+        }
+        if (Node *node = victim.deque.steal()) {
+            take(self, node, task);
+            return true;
+        }
     }
-    std::cout << "Worker pool stopped" << std::endl;
+    return false;
 }
 
-void WorkerPool::submit(std::function<void()> task) {
+// Keeps looking for a few microseconds before parking, so a task arriving right after
+// the last one is picked up without a wakeup. At most max_spinning_ workers spin at
+// once. The last spinner to find work wakes a sleeper if more is queued, since submit()
+// does not wake anyone while a spinner is about.
+bool WorkerPool::spin(Worker &self, Task &task) {
+    if (spinning_.fetch_add(1, std::memory_order_seq_cst) >= max_spinning_) {
+        spinning_.fetch_sub(1, std::memory_order_seq_cst);
+        return false;
+    }
+    for (int round = 0; round < kSpinRounds + kYieldRounds; ++round) {
+        if (round < kSpinRounds) {
+            for (int i = 0; i < kPausesPerRound; ++i) {
+                cpuRelax();
+            }
+        } else {
+            std::this_thread::yield();
+        }
+        if (findTask(self, task)) {
+            if (spinning_.fetch_sub(1, std::memory_order_seq_cst) == 1 && hasWork()) {
+                wake();
+            }
+            return true;
+        }
+    }
+    spinning_.fetch_sub(1, std::memory_order_seq_cst);
+    return false;
+}
+
+// Returns false once the pool is stopping and no work is left. The sleeper count is
+// raised before the final check for work and submit() reads it after publishing its
+// task, both sides ordered by seq_cst operations (or a fence, for a deque push), so
+// either the check sees the task or submit() sees the sleeper and wakes it.
+bool WorkerPool::park() {
+    std::unique_lock<std::mutex> lock(park_mutex_);
+    sleeping_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool has_work;
+    while (!(has_work = hasWork()) && !stop_) {
+        ++waiters_;
+        park_cv_.wait(lock);
+        --waiters_;
+        // Perhaps not the worker wake() meant; either way the count of wakeups in flight
+        // stays right, and the last one out clears waking_ before checking for work.
+        if (notified_ > 0 && --notified_ == 0) {
+            waking_.store(false, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+    sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    return has_work;
+}
+
+bool WorkerPool::hasWork() const {
+    if (!injection_->empty() || overflow_size_.load(std::memory_order_seq_cst) > 0) {
+        return true;
+    }
+    for (const auto &worker : workers_) {
+        if (!worker->deque.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Wakes one parked worker unless a worker is spinning or one was woken and has not run
+// yet; the woken worker passes the wakeup on once it has found a task. Under the mutex
+// every parked worker is either waiting or yet to make its final check, which will see
+// the task. Notifying after unlocking keeps the woken worker from blocking straight away
+// on the mutex.
+void WorkerPool::wake() {
+    if (spinning_.load(std::memory_order_seq_cst) > 0 || sleeping_.load(std::memory_order_seq_cst) == 0 ||
+        waking_.load(std::memory_order_seq_cst)) {
+        return;
+    }
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        tasks_.emplace(std::move(task));
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        if (waiters_ == notified_) {
+            return;
+        }
+        ++notified_;
+        waking_.store(true, std::memory_order_relaxed);
+    }
+    park_cv_.notify_one();
+}
+
+WorkerPool::Node *WorkerPool::allocNode(Worker &self) {
+    if (!self.free_nodes) {
+        self.free_nodes = self.returned.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (!self.free_nodes) {
+        self.blocks.push_back(std::make_unique<Node[]>(kNodeBlock));
+        Node *block = self.blocks.back().get();
+        for (size_t i = 0; i < kNodeBlock; ++i) {
+            block[i].home = &self;
+            block[i].next = i + 1 < kNodeBlock ? &block[i + 1] : nullptr;
+        }
+        self.free_nodes = block;
     }
-    std::cout << "Task submitted to worker pool" << std::endl;
-    condition_.notify_one();
-}
\ No newline at end of file
+    Node *node = self.free_nodes;
+    self.free_nodes = node->next;
+    return node;
+}
+
+void WorkerPool::take(Worker &self, Node *node, Task &task) {
+    task = std::move(node->task);
+    Worker *home = node->home;
+    if (home == &self) {
+        node->next = self.free_nodes;
+        self.free_nodes = node;
+        return;
+    }
+    // The owner empties the whole stack at once, so a plain push cannot hit ABA.
+    Node *head = home->returned.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!home->returned.compare_exchange_weak(head, node, std::memory_order_release,
+                                                   std::memory_order_relaxed));
+}
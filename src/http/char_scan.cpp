@@ -0,0 +1,204 @@
+#include "http/char_scan.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLAZE_X86_SCAN 1
+#endif
+
+namespace
+{
+
+struct ClassTable
+{
+    bool member[256];
+    // Nibble lookup tables for the AVX2 kernel: byte b is a member iff
+    // lo[b & 0xf] & hi[b >> 4] is non-zero.
+    alignas(16) uint8_t lo[16];
+    alignas(16) uint8_t hi[16];
+    // Byte ranges for the SSE4.2 kernel (pcmpestri, at most 8 pairs). They cover every
+    // non-member and may cover a few members too; hits are confirmed with member[].
+    alignas(16) char stop_ranges[16];
+    int stop_ranges_len;
+};
+
+bool isTokenChar(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return true;
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+        return true;
+    return c != 0 && std::strchr("!#$%&'*+-.^_`|~", c) != nullptr;
+}
+
+ClassTable makeTable(bool (*is_member)(unsigned char), const char *stop_ranges, int stop_ranges_len)
+{
+    ClassTable table{};
+    for (int c = 0; c < 256; ++c)
+        table.member[c] = is_member(static_cast<unsigned char>(c));
+
+    // Give every distinct row (the set of low nibbles allowed under one high nibble)
+    // its own bit.
+    uint16_t patterns[8];
+    int num_patterns = 0;
+    for (int hi = 0; hi < 16; ++hi)
+    {
+        uint16_t row = 0;
+        for (int lo = 0; lo < 16; ++lo)
+            row |= table.member[hi << 4 | lo] ? (1u << lo) : 0;
+        if (row == 0)
+            continue;
+        int bit = 0;
+        while (bit < num_patterns && patterns[bit] != row)
+            ++bit;
+        if (bit == num_patterns)
+        {
+            if (num_patterns == 8)
+                throw std::logic_error("character class needs more than 8 nibble patterns");
+            patterns[num_patterns++] = row;
+        }
+        table.hi[hi] = static_cast<uint8_t>(1u << bit);
+        for (int lo = 0; lo < 16; ++lo)
+            table.lo[lo] |= (row & (1u << lo)) ? table.hi[hi] : 0;
+    }
+
+    std::memcpy(table.stop_ranges, stop_ranges, stop_ranges_len);
+    table.stop_ranges_len = stop_ranges_len;
+    return table;
+}
+
+const ClassTable &tableFor(CharClass char_class)
+{
+    static const ClassTable tables[] = {
+        makeTable(isTokenChar,
+                  "\x00\x20\"\"()"
+                  ",,//:@[]{\xff",
+                  16),
+        makeTable([](unsigned char c) { return c > 0x20 && c < 0x7f; }, "\x00\x20\x7f\xff", 4),
+        makeTable([](unsigned char c) { return c == '\t' || (c >= 0x20 && c != 0x7f); }, "\x00\x08\x0a\x1f\x7f\x7f", 6),
+    };
+    return tables[static_cast<int>(char_class)];
+}
+
+const char *scanScalar(const ClassTable &table, const char *p, const char *end)
+{
+    while (p < end && table.member[static_cast<unsigned char>(*p)])
+        ++p;
+    return p;
+}
+
+#ifdef BLAZE_X86_SCAN
+
+__attribute__((target("sse4.2"))) const char *scanSse42(const ClassTable &table, const char *p, const char *end)
+{
+    const __m128i ranges = _mm_load_si128(reinterpret_cast<const __m128i *>(table.stop_ranges));
+    while (end - p >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int index = _mm_cmpestri(ranges, table.stop_ranges_len, bytes, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (index == 16)
+        {
+            p += 16;
+            continue;
+        }
+        p += index;
+        if (!table.member[static_cast<unsigned char>(*p)])
+            return p;
+        ++p;
+    }
+    return scanScalar(table, p, end);
+}
+
+__attribute__((target("avx2"))) const char *scanAvx2(const ClassTable &table, const char *p, const char *end)
+{
+    const __m256i lo_lut = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(table.lo)));
+    const __m256i hi_lut = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(table.hi)));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    while (end - p >= 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i lo = _mm256_shuffle_epi8(lo_lut, _mm256_and_si256(bytes, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hi_lut, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+        __m256i outside = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(outside));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    // A 16-byte step catches most of the remainder before falling back to bytes.
+    if (end - p >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i lo = _mm_shuffle_epi8(_mm256_castsi256_si128(lo_lut), _mm_and_si128(bytes, _mm_set1_epi8(0x0f)));
+        __m128i hi = _mm_shuffle_epi8(_mm256_castsi256_si128(hi_lut),
+                                      _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0f)));
+        uint32_t mask = static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return scanScalar(table, p, end);
+}
+
+#endif // BLAZE_X86_SCAN
+
+using ScanFn = const char *(*)(const ClassTable &, const char *, const char *);
+
+struct Kernel
+{
+    const char *name;
+    ScanFn scan;
+    bool (*supported)();
+};
+
+const Kernel kKernels[] = {
+#ifdef BLAZE_X86_SCAN
+    {"avx2", scanAvx2, [] { return __builtin_cpu_supports("avx2") != 0; }},
+    {"sse4.2", scanSse42, [] { return __builtin_cpu_supports("sse4.2") != 0; }},
+#endif
+    {"scalar", scanScalar, [] { return true; }},
+};
+
+const Kernel *detectKernel()
+{
+#ifdef BLAZE_X86_SCAN
+    __builtin_cpu_init();
+#endif
+    for (const Kernel &kernel : kKernels)
+    {
+        if (kernel.supported())
+            return &kernel;
+    }
+    return &kKernels[sizeof(kKernels) / sizeof(kKernels[0]) - 1];
+}
+
+const Kernel *active_kernel = detectKernel();
+
+} // namespace
+
+const char *scanWhile(CharClass char_class, const char *p, const char *end)
+{
+    return active_kernel->scan(tableFor(char_class), p, end);
+}
+
+std::string scanKernel()
+{
+    return active_kernel->name;
+}
+
+bool setScanKernel(const std::string &name)
+{
+    for (const Kernel &kernel : kKernels)
+    {
+        if (name == kernel.name && kernel.supported())
+        {
+            active_kernel = &kernel;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,310 @@
+#include "http/headers.hpp"
+#include "http/request_parser.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+struct KnownHeader
+{
+    std::string_view name;
+    HeaderId id;
+};
+
+// Sorted by length, so a name is only compared with the few of its own length.
+constexpr KnownHeader kKnownHeaders[] = {
+    {"te", HeaderId::TE},
+    {"age", HeaderId::Age},
+    {"date", HeaderId::Date},
+    {"etag", HeaderId::ETag},
+    {"host", HeaderId::Host},
+    {"vary", HeaderId::Vary},
+    {"accept", HeaderId::Accept},
+    {"cookie", HeaderId::Cookie},
+    {"expect", HeaderId::Expect},
+    {"server", HeaderId::Server},
+    {"trailer", HeaderId::Trailer},
+    {"upgrade", HeaderId::Upgrade},
+    {"location", HeaderId::Location},
+    {"connection", HeaderId::Connection},
+    {"keep-alive", HeaderId::KeepAlive},
+    {"set-cookie", HeaderId::SetCookie},
+    {"user-agent", HeaderId::UserAgent},
+    {"content-type", HeaderId::ContentType},
+    {"authorization", HeaderId::Authorization},
+    {"cache-control", HeaderId::CacheControl},
+    {"if-none-match", HeaderId::IfNoneMatch},
+    {"last-modified", HeaderId::LastModified},
+    {"content-length", HeaderId::ContentLength},
+    {"accept-encoding", HeaderId::AcceptEncoding},
+    {"content-encoding", HeaderId::ContentEncoding},
+    {"proxy-connection", HeaderId::ProxyConnection},
+    {"if-modified-since", HeaderId::IfModifiedSince},
+    {"transfer-encoding", HeaderId::TransferEncoding},
+};
+
+constexpr size_t kKnownCount = sizeof(kKnownHeaders) / sizeof(kKnownHeaders[0]);
+constexpr size_t kMaxKnownLength = 17;
+
+static_assert(kKnownCount + 1 == static_cast<size_t>(HeaderId::Count), "every HeaderId needs a name");
+
+struct LengthIndex
+{
+    // Names of length n are kKnownHeaders[start[n]] up to kKnownHeaders[start[n + 1]].
+    uint8_t start[kMaxKnownLength + 2] = {};
+};
+
+constexpr LengthIndex makeLengthIndex()
+{
+    LengthIndex index;
+    size_t i = 0;
+    for (size_t length = 0; length <= kMaxKnownLength + 1; ++length)
+    {
+        while (i < kKnownCount && kKnownHeaders[i].name.size() < length)
+            ++i;
+        index.start[length] = static_cast<uint8_t>(i);
+    }
+    return index;
+}
+
+constexpr LengthIndex kByLength = makeLengthIndex();
+
+// Names are compared as 8-byte words, laid out the way memcpy of the bytes lays them out.
+const size_t kWords = (kMaxKnownLength + 7) / 8;
+
+constexpr int byteShift(size_t i)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return 8 * (7 - i % 8);
+#else
+    return 8 * (i % 8);
+#endif
+}
+
+// A known name, plus the case bit of each of its letters: (word | fold) == lower matches
+// letters in either case and every other byte exactly.
+struct Pattern
+{
+    uint64_t lower[kWords] = {};
+    uint64_t fold[kWords] = {};
+};
+
+struct Patterns
+{
+    Pattern of[kKnownCount];
+};
+
+constexpr Patterns makePatterns()
+{
+    Patterns patterns;
+    for (size_t h = 0; h < kKnownCount; ++h)
+    {
+        std::string_view name = kKnownHeaders[h].name;
+        for (size_t i = 0; i < name.size(); ++i)
+        {
+            uint64_t c = static_cast<unsigned char>(name[i]);
+            patterns.of[h].lower[i / 8] |= c << byteShift(i);
+            if (c >= 'a' && c <= 'z')
+                patterns.of[h].fold[i / 8] |= uint64_t(0x20) << byteShift(i);
+        }
+    }
+    return patterns;
+}
+
+constexpr Patterns kPatterns = makePatterns();
+
+} // namespace
+
+HeaderId headerId(std::string_view name)
+{
+    if (name.size() > kMaxKnownLength)
+        return HeaderId::Other;
+    size_t begin = kByLength.start[name.size()];
+    size_t end = kByLength.start[name.size() + 1];
+    if (begin == end)
+        return HeaderId::Other;
+    uint64_t words[kWords] = {};
+    std::memcpy(words, name.data(), name.size());
+    for (size_t i = begin; i < end; ++i)
+    {
+        const Pattern &pattern = kPatterns.of[i];
+        bool match = true;
+        for (size_t w = 0; w < kWords; ++w)
+            match &= (words[w] | pattern.fold[w]) == pattern.lower[w];
+        if (match)
+            return kKnownHeaders[i].id;
+    }
+    return HeaderId::Other;
+}
+
+Headers::Headers(std::initializer_list<std::pair<std::string_view, std::string_view>> fields)
+{
+    size_t bytes = 0;
+    for (const auto &field : fields)
+        bytes += field.first.size() + field.second.size();
+    reserve(fields.size(), bytes);
+    for (const auto &field : fields)
+        add(field.first, field.second);
+}
+
+Headers::Headers(const Headers &other) : fields_(other.fields_), storage_(other.storage_)
+{
+    rebase(other.storage_.data());
+    std::memcpy(first_, other.first_, sizeof(first_));
+}
+
+Headers &Headers::operator=(const Headers &other)
+{
+    if (this != &other)
+    {
+        fields_ = other.fields_;
+        storage_ = other.storage_;
+        rebase(other.storage_.data());
+        std::memcpy(first_, other.first_, sizeof(first_));
+    }
+    return *this;
+}
+
+Headers::Headers(Headers &&other) noexcept
+    : fields_(std::move(other.fields_)), storage_(std::move(other.storage_))
+{
+    // other's index would point past its now empty fields.
+    std::memcpy(first_, other.first_, sizeof(first_));
+    std::memset(other.first_, 0, sizeof(other.first_));
+}
+
+Headers &Headers::operator=(Headers &&other)
+{
+    if (this == &other)
+        return *this;
+    if (storage_.get_allocator() != other.storage_.get_allocator())
+    {
+        *this = other; // the buffer cannot change hands
+        other.clear();
+        return *this;
+    }
+    fields_ = std::move(other.fields_);
+    storage_ = std::move(other.storage_);
+    std::memcpy(first_, other.first_, sizeof(first_));
+    other.clear();
+    return *this;
+}
+
+void Headers::add(std::string_view name, std::string_view value)
+{
+    add(name, value, headerId(name));
+}
+
+void Headers::add(std::string_view name, std::string_view value, HeaderId id)
+{
+    // Both fit before either is stored: growing only moves the views already in fields_.
+    if (storage_.capacity() == 0 || storage_.size() + name.size() + value.size() > storage_.capacity())
+        reserve(0, std::max<size_t>(std::max<size_t>(storage_.capacity(), 128), name.size() + value.size()));
+    std::string_view stored_name = store(name);
+    std::string_view stored_value = store(value);
+    uint16_t &first = first_[static_cast<size_t>(id)];
+    if (id != HeaderId::Other && first == 0 && fields_.size() < kUnindexed - 1)
+        first = static_cast<uint16_t>(fields_.size() + 1);
+    fields_.push_back(HeaderField{stored_name, stored_value, id});
+}
+
+void Headers::set(std::string_view name, std::string_view value)
+{
+    remove(name);
+    add(name, value);
+}
+
+void Headers::remove(std::string_view name)
+{
+    HeaderId id = headerId(name);
+    auto removed = std::remove_if(fields_.begin(), fields_.end(), [&](const HeaderField &field) {
+        return id != HeaderId::Other ? field.id == id : equalsIgnoreCase(field.name, name);
+    });
+    if (removed == fields_.end())
+        return;
+    // Their bytes stay in storage_ until clear().
+    fields_.erase(removed, fields_.end());
+    reindex();
+}
+
+void Headers::clear()
+{
+    fields_.clear();
+    storage_.clear();
+    std::memset(first_, 0, sizeof(first_));
+}
+
+void Headers::reserve(size_t fields, size_t bytes)
+{
+    fields_.reserve(fields);
+    if (storage_.size() + bytes > storage_.capacity())
+    {
+        std::pmr::vector<char> grown(storage_.get_allocator());
+        grown.reserve(storage_.size() + bytes);
+        grown.insert(grown.end(), storage_.begin(), storage_.end());
+        const char *old_base = storage_.data();
+        storage_.swap(grown);
+        rebase(old_base);
+    }
+}
+
+const std::string_view *Headers::get(HeaderId id) const
+{
+    if (id == HeaderId::Other)
+        return nullptr;
+    if (fields_.size() < kUnindexed - 1)
+    {
+        uint16_t first = first_[static_cast<size_t>(id)];
+        return first ? &fields_[first - 1].value : nullptr;
+    }
+    for (const HeaderField &field : fields_)
+    {
+        if (field.id == id)
+            return &field.value;
+    }
+    return nullptr;
+}
+
+const std::string_view *Headers::get(std::string_view name) const
+{
+    HeaderId id = headerId(name);
+    if (id != HeaderId::Other)
+        return get(id);
+    for (const HeaderField &field : fields_)
+    {
+        if (field.id == HeaderId::Other && equalsIgnoreCase(field.name, name))
+            return &field.value;
+    }
+    return nullptr;
+}
+
+// Copies s behind the stored bytes; the caller has made room.
+std::string_view Headers::store(std::string_view s)
+{
+    size_t offset = storage_.size();
+    storage_.insert(storage_.end(), s.begin(), s.end());
+    return std::string_view(storage_.data() + offset, s.size());
+}
+
+// Points the fields, which point into a buffer starting at old_base (still allocated),
+// at the same bytes in storage_.
+void Headers::rebase(const char *old_base)
+{
+    for (HeaderField &field : fields_)
+    {
+        field.name = std::string_view(storage_.data() + (field.name.data() - old_base), field.name.size());
+        field.value = std::string_view(storage_.data() + (field.value.data() - old_base), field.value.size());
+    }
+}
+
+void Headers::reindex()
+{
+    std::memset(first_, 0, sizeof(first_));
+    for (size_t i = 0; i < fields_.size() && i < kUnindexed - 1; ++i)
+    {
+        uint16_t &first = first_[static_cast<size_t>(fields_[i].id)];
+        if (fields_[i].id != HeaderId::Other && first == 0)
+            first = static_cast<uint16_t>(i + 1);
+    }
+}
@@ -0,0 +1,598 @@
+#include "http/hpack.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+struct StaticEntry {
+    std::string_view name;
+    std::string_view value;
+};
+
+// RFC 7541 Appendix A; index i + 1.
+const StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+const size_t kStaticCount = sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+
+// Perfect hash over the distinct static names: a seed is searched once so that no two
+// names share one of the 256 slots. Entries with the same name are adjacent in the
+// table, so a slot leads to the range of indexes to check values against.
+class StaticNameHash {
+public:
+    StaticNameHash() {
+        for (seed_ = 1;; ++seed_) {
+            std::memset(slots_, 0, sizeof(slots_));
+            bool collision = false;
+            for (size_t i = 0; i < kStaticCount && !collision; ++i) {
+                if (i > 0 && kStaticTable[i].name == kStaticTable[i - 1].name) {
+                    continue;
+                }
+                uint8_t &slot = slots_[hash(kStaticTable[i].name)];
+                collision = slot != 0;
+                slot = static_cast<uint8_t>(i + 1);
+            }
+            if (!collision) {
+                return;
+            }
+        }
+    }
+
+    // First static index with this name, or 0.
+    size_t find(std::string_view name) const {
+        uint8_t slot = slots_[hash(name)];
+        return slot != 0 && kStaticTable[slot - 1].name == name ? slot : 0;
+    }
+
+private:
+    uint8_t hash(std::string_view name) const {
+        uint32_t h = seed_;
+        for (unsigned char c : name) {
+            h = (h ^ c) * 16777619u;
+        }
+        return static_cast<uint8_t>(h ^ (h >> 15));
+    }
+
+    uint32_t seed_;
+    uint8_t slots_[256];
+};
+
+const StaticNameHash &staticNames() {
+    static const StaticNameHash hash;
+    return hash;
+}
+
+struct HuffmanCode {
+    uint32_t code;
+    uint8_t bits;
+};
+
+// RFC 7541 Appendix B, by symbol; 256 is EOS.
+const HuffmanCode kHuffmanCodes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+// Huffman decoding consumes 4 bits per step. A state is an internal node of the code
+// tree (there are exactly 256); an entry says where a nibble leads from it and which
+// symbol, if any, was completed on the way.
+class HuffmanDecodeTable {
+public:
+    enum : uint8_t { kSymbol = 1, kAccept = 2, kFail = 4 };
+
+    struct Step {
+        uint8_t state;
+        uint8_t flags;
+        uint8_t symbol;
+    };
+
+    HuffmanDecodeTable() {
+        // Children of internal nodes: >= 0 another internal node, < 0 leaf -(symbol + 1).
+        int child[256][2];
+        std::memset(child, 0, sizeof(child));
+        // Nodes reached from the root by at most 7 one-bits: where padding may end.
+        bool padding[256] = {true};
+        int nodes = 1;
+        for (int symbol = 0; symbol < 257; ++symbol) {
+            int node = 0;
+            for (int bit = kHuffmanCodes[symbol].bits - 1; bit >= 0; --bit) {
+                int b = (kHuffmanCodes[symbol].code >> bit) & 1;
+                if (bit == 0) {
+                    child[node][b] = -(symbol + 1);
+                    break;
+                }
+                if (child[node][b] == 0) {
+                    int depth = kHuffmanCodes[symbol].bits - bit;
+                    padding[nodes] = padding[node] && b == 1 && depth <= 7;
+                    child[node][b] = nodes++;
+                }
+                node = child[node][b];
+            }
+        }
+
+        for (int state = 0; state < 256; ++state) {
+            for (int nibble = 0; nibble < 16; ++nibble) {
+                Step &step = steps_[state][nibble];
+                step = Step{0, 0, 0};
+                int node = state;
+                for (int bit = 3; bit >= 0; --bit) {
+                    int next = child[node][(nibble >> bit) & 1];
+                    if (next < 0) {
+                        if (next == -257) {
+                            step.flags |= kFail; // EOS inside the string
+                            break;
+                        }
+                        step.flags |= kSymbol;
+                        step.symbol = static_cast<uint8_t>(-next - 1);
+                        node = 0;
+                    } else {
+                        node = next;
+                    }
+                }
+                step.state = static_cast<uint8_t>(node);
+                if (padding[node]) {
+                    step.flags |= kAccept;
+                }
+            }
+        }
+    }
+
+    const Step &step(uint8_t state, uint8_t nibble) const { return steps_[state][nibble]; }
+
+private:
+    Step steps_[256][16];
+};
+
+const HuffmanDecodeTable &huffmanTable() {
+    static const HuffmanDecodeTable table;
+    return table;
+}
+
+// Integer with an N-bit prefix (RFC 7541 5.1); flags are the bits above the prefix.
+uint8_t *encodeInt(uint8_t *out, uint64_t value, int prefix_bits, uint8_t flags) {
+    uint64_t max = (1u << prefix_bits) - 1;
+    if (value < max) {
+        *out++ = static_cast<uint8_t>(flags | value);
+        return out;
+    }
+    *out++ = static_cast<uint8_t>(flags | max);
+    value -= max;
+    while (value >= 128) {
+        *out++ = static_cast<uint8_t>(0x80 | (value & 0x7f));
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+uint64_t decodeInt(const uint8_t *&p, const uint8_t *end, int prefix_bits) {
+    uint64_t max = (1u << prefix_bits) - 1;
+    uint64_t value = *p++ & max;
+    if (value < max) {
+        return value;
+    }
+    for (int shift = 0;; shift += 7) {
+        if (p == end) {
+            throw std::runtime_error("HPACK: truncated integer");
+        }
+        if (shift > 28) {
+            throw std::runtime_error("HPACK: integer overflow");
+        }
+        uint8_t b = *p++;
+        value += static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+}
+
+uint8_t *encodeString(std::string_view s, uint8_t *out) {
+    size_t huffman_len = huffmanEncodedLength(s);
+    if (huffman_len < s.size()) {
+        out = encodeInt(out, huffman_len, 7, 0x80);
+        return huffmanEncode(s, out);
+    }
+    out = encodeInt(out, s.size(), 7, 0);
+    std::memcpy(out, s.data(), s.size());
+    return out + s.size();
+}
+
+// Longest encoding of an integer below 2^32 with any prefix.
+const size_t kMaxIntLength = 6;
+
+} // namespace
+
+size_t huffmanEncodedLength(std::string_view s) {
+    size_t bits = 0;
+    for (unsigned char c : s) {
+        bits += kHuffmanCodes[c].bits;
+    }
+    return (bits + 7) / 8;
+}
+
+uint8_t *huffmanEncode(std::string_view s, uint8_t *out) {
+    uint64_t bits = 0;
+    int pending = 0;
+    for (unsigned char c : s) {
+        bits = (bits << kHuffmanCodes[c].bits) | kHuffmanCodes[c].code;
+        pending += kHuffmanCodes[c].bits;
+        while (pending >= 8) {
+            pending -= 8;
+            *out++ = static_cast<uint8_t>(bits >> pending);
+        }
+    }
+    if (pending > 0) {
+        // Pad with the most significant bits of EOS, all ones.
+        *out++ = static_cast<uint8_t>((bits << (8 - pending)) | (0xff >> pending));
+    }
+    return out;
+}
+
+void huffmanDecode(const uint8_t *data, size_t len, std::string &out) {
+    const HuffmanDecodeTable &table = huffmanTable();
+    uint8_t state = 0;
+    bool accept = true;
+    for (size_t i = 0; i < len; ++i) {
+        for (uint8_t nibble : {static_cast<uint8_t>(data[i] >> 4), static_cast<uint8_t>(data[i] & 0xf)}) {
+            const HuffmanDecodeTable::Step &step = table.step(state, nibble);
+            if (step.flags & HuffmanDecodeTable::kFail) {
+                throw std::runtime_error("HPACK: EOS in Huffman string");
+            }
+            if (step.flags & HuffmanDecodeTable::kSymbol) {
+                out.push_back(static_cast<char>(step.symbol));
+            }
+            state = step.state;
+            accept = step.flags & HuffmanDecodeTable::kAccept;
+        }
+    }
+    if (!accept) {
+        throw std::runtime_error("HPACK: invalid Huffman padding");
+    }
+}
+
+size_t hpackStaticIndex(std::string_view name, std::string_view value, size_t &name_index) {
+    name_index = staticNames().find(name);
+    if (name_index == 0) {
+        return 0;
+    }
+    for (size_t i = name_index; i <= kStaticCount && kStaticTable[i - 1].name == name; ++i) {
+        if (kStaticTable[i - 1].value == value) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+void HpackTable::insert(std::string_view name, std::string_view value) {
+    size_t entry_size = name.size() + value.size() + 32;
+    while (count_ > 0 && size_ + entry_size > max_size_) {
+        evictOldest();
+    }
+    if (entry_size > max_size_) {
+        return;
+    }
+    if (count_ == ring_.size()) {
+        std::vector<Entry> grown(ring_.empty() ? 16 : ring_.size() * 2);
+        for (size_t i = 0; i < count_; ++i) {
+            grown[count_ - 1 - i] = std::move(ring_[(head_ + ring_.size() - 1 - i) & (ring_.size() - 1)]);
+        }
+        ring_.swap(grown);
+        head_ = count_;
+    }
+    Entry &entry = ring_[head_];
+    entry.bytes.assign(name.data(), name.size());
+    entry.bytes.append(value.data(), value.size());
+    entry.name_len = name.size();
+    entry.name_hash = hash(name);
+    uint64_t &bucket = name_buckets_[entry.name_hash & (kNameBuckets - 1)];
+    entry.older_link = bucket;
+    bucket = ++inserted_;
+    head_ = (head_ + 1) & (ring_.size() - 1);
+    ++count_;
+    size_ += entry_size;
+}
+
+void HpackTable::setMaxSize(size_t max_size) {
+    max_size_ = max_size;
+    while (size_ > max_size_) {
+        evictOldest();
+    }
+}
+
+long HpackTable::find(std::string_view name, std::string_view value, long &name_match) const {
+    name_match = -1;
+    uint32_t name_hash = hash(name);
+    uint64_t oldest_link = inserted_ - count_; // links above this are live
+    uint64_t link = name_buckets_[name_hash & (kNameBuckets - 1)];
+    while (link > oldest_link) {
+        long position = static_cast<long>(inserted_ - link);
+        const Entry &entry = at(position);
+        if (entry.name_hash == name_hash && entry.name() == name) {
+            if (entry.value() == value) {
+                return position;
+            }
+            if (name_match < 0) {
+                name_match = position;
+            }
+        }
+        link = entry.older_link;
+    }
+    return -1;
+}
+
+uint32_t HpackTable::hash(std::string_view s) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : s) {
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+void HpackTable::evictOldest() {
+    // The slot keeps its string, and with it the capacity, for the next insert.
+    const Entry &oldest = ring_[(head_ + ring_.size() - count_) & (ring_.size() - 1)];
+    size_ -= oldest.bytes.size() + 32;
+    --count_;
+}
+
+HpackDecoder::HpackDecoder(size_t max_table_size) : table_(max_table_size), max_table_size_(max_table_size) {}
+
+void HpackDecoder::decodeBlock(const uint8_t *data, size_t len, Sink sink, void *ctx) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    bool fields_seen = false;
+    while (p < end) {
+        uint8_t first = *p;
+        if (first & 0x80) {
+            uint64_t index = decodeInt(p, end, 7);
+            if (index == 0) {
+                throw std::runtime_error("HPACK: index 0");
+            }
+            if (index <= kStaticCount) {
+                sink(ctx, kStaticTable[index - 1].name, kStaticTable[index - 1].value);
+            } else if (index - kStaticCount - 1 < table_.count()) {
+                sink(ctx, table_.name(index - kStaticCount - 1), table_.value(index - kStaticCount - 1));
+            } else {
+                throw std::runtime_error("HPACK: index out of range");
+            }
+            fields_seen = true;
+            continue;
+        }
+        if ((first & 0xe0) == 0x20) {
+            // Only allowed at the start of a block.
+            uint64_t size = decodeInt(p, end, 5);
+            if (fields_seen || size > max_table_size_) {
+                throw std::runtime_error("HPACK: invalid table size update");
+            }
+            table_.setMaxSize(size);
+            continue;
+        }
+
+        bool index_field = (first & 0xc0) == 0x40;
+        uint64_t index = decodeInt(p, end, index_field ? 6 : 4);
+        std::string_view name = index == 0 ? readString(p, end, name_scratch_) : indexedName(index);
+        std::string_view value = readString(p, end, value_scratch_);
+        sink(ctx, name, value);
+        fields_seen = true;
+        if (index_field) {
+            if (index > kStaticCount) {
+                // The insert may evict the entry the name points into.
+                name_scratch_.assign(name.data(), name.size());
+                name = name_scratch_;
+            }
+            table_.insert(name, value);
+        }
+    }
+}
+
+std::string_view HpackDecoder::readString(const uint8_t *&p, const uint8_t *end, std::string &scratch) {
+    if (p == end) {
+        throw std::runtime_error("HPACK: truncated string");
+    }
+    bool huffman = *p & 0x80;
+    uint64_t len = decodeInt(p, end, 7);
+    if (len > static_cast<uint64_t>(end - p)) {
+        throw std::runtime_error("HPACK: truncated string");
+    }
+    const uint8_t *start = p;
+    p += len;
+    if (!huffman) {
+        return std::string_view(reinterpret_cast<const char *>(start), len);
+    }
+    scratch.clear();
+    huffmanDecode(start, len, scratch);
+    return scratch;
+}
+
+std::string_view HpackDecoder::indexedName(uint64_t index) const {
+    if (index <= kStaticCount) {
+        return kStaticTable[index - 1].name;
+    }
+    if (index - kStaticCount - 1 < table_.count()) {
+        return table_.name(index - kStaticCount - 1);
+    }
+    throw std::runtime_error("HPACK: index out of range");
+}
+
+HpackEncoder::HpackEncoder(size_t max_table_size) : table_(max_table_size) {}
+
+size_t HpackEncoder::maxEncodedSize(const HpackField *fields, size_t count) {
+    size_t size = kMaxIntLength; // table size update
+    for (size_t i = 0; i < count; ++i) {
+        size += 3 * kMaxIntLength + fields[i].name.size() + fields[i].value.size();
+    }
+    return size;
+}
+
+size_t HpackEncoder::encode(const HpackField *fields, size_t count, uint8_t *out) {
+    uint8_t *p = out;
+    if (size_update_pending_) {
+        p = encodeInt(p, table_.maxSize(), 5, 0x20);
+        size_update_pending_ = false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        p = encodeField(fields[i], p);
+    }
+    return p - out;
+}
+
+void HpackEncoder::setMaxTableSize(size_t max_table_size) {
+    table_.setMaxSize(max_table_size);
+    size_update_pending_ = true;
+}
+
+uint8_t *HpackEncoder::encodeField(const HpackField &field, uint8_t *out) {
+    size_t name_index;
+    size_t index = hpackStaticIndex(field.name, field.value, name_index);
+    if (index != 0) {
+        return encodeInt(out, index, 7, 0x80);
+    }
+    if (!field.sensitive) {
+        long name_match;
+        long position = table_.find(field.name, field.value, name_match);
+        if (position >= 0) {
+            return encodeInt(out, kStaticCount + 1 + position, 7, 0x80);
+        }
+        if (name_index == 0 && name_match >= 0) {
+            name_index = kStaticCount + 1 + name_match;
+        }
+    }
+
+    bool index_field = !field.sensitive && field.name.size() + field.value.size() + 32 <= table_.maxSize();
+    if (index_field) {
+        out = encodeInt(out, name_index, 6, 0x40);
+    } else {
+        out = encodeInt(out, name_index, 4, field.sensitive ? 0x10 : 0x00);
+    }
+    if (name_index == 0) {
+        out = encodeString(field.name, out);
+    }
+    out = encodeString(field.value, out);
+    if (index_field) {
+        table_.insert(field.name, field.value);
+    }
+    return out;
+}
@@ -1,14 +1,163 @@
 #include "http/http2_framer.hpp"
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
-void Http2Framer::parseFrames(const std::string& data) {
-    // Placeholder for HTTP/2 frame parsing
-    // This would involve decoding the binary frame format per RFC 7540
-    throw std::runtime_error("HTTP/2 frame parsing not implemented");
+namespace {
+
+uint32_t readUint32(const uint8_t *p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+uint8_t *writeUint32(uint8_t *p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+    return p + 4;
+}
+
+// The payload without the Pad Length field, the padding and skip bytes after the former.
+std::string_view unpad(const Http2Frame &frame, size_t skip) {
+    const uint8_t *p = frame.payload;
+    size_t len = frame.length;
+    size_t pad = 0;
+    if (frame.flags & Http2Flags::Padded) {
+        if (len < 1) {
+            throw std::runtime_error("HTTP/2: padded frame without pad length");
+        }
+        pad = *p++;
+        --len;
+    }
+    if (skip + pad > len) {
+        throw std::runtime_error("HTTP/2: padding exceeds frame");
+    }
+    return std::string_view(reinterpret_cast<const char *>(p + skip), len - skip - pad);
+}
+
+} // namespace
+
+bool Http2Framer::parseFrame(const uint8_t *data, size_t len, Http2Frame &frame) const {
+    if (len < kFrameHeaderSize) {
+        return false;
+    }
+    uint32_t length = (static_cast<uint32_t>(data[0]) << 16) | (static_cast<uint32_t>(data[1]) << 8) | data[2];
+    if (length > max_frame_size_) {
+        throw std::runtime_error("HTTP/2: frame of " + std::to_string(length) + " bytes exceeds maximum frame size");
+    }
+    if (len - kFrameHeaderSize < length) {
+        return false;
+    }
+    frame.length = length;
+    frame.type = static_cast<Http2FrameType>(data[3]);
+    frame.flags = data[4];
+    frame.stream_id = readUint32(data + 5) & 0x7fffffff;
+    frame.payload = data + kFrameHeaderSize;
+    return true;
+}
+
+std::string_view Http2Framer::headerBlockFragment(const Http2Frame &frame) {
+    if (frame.type == Http2FrameType::Continuation) {
+        return std::string_view(reinterpret_cast<const char *>(frame.payload), frame.length);
+    }
+    if (frame.type == Http2FrameType::PushPromise) {
+        return unpad(frame, 4); // promised stream id
+    }
+    return unpad(frame, (frame.flags & Http2Flags::Priority) ? 5 : 0);
+}
+
+std::string_view Http2Framer::dataPayload(const Http2Frame &frame) {
+    return unpad(frame, 0);
+}
+
+void Http2Framer::writeFrameHeader(uint8_t *out, uint32_t length, Http2FrameType type, uint8_t flags,
+                                   uint32_t stream_id) {
+    out[0] = static_cast<uint8_t>(length >> 16);
+    out[1] = static_cast<uint8_t>(length >> 8);
+    out[2] = static_cast<uint8_t>(length);
+    out[3] = static_cast<uint8_t>(type);
+    out[4] = flags;
+    writeUint32(out + 5, stream_id & 0x7fffffff);
+}
+
+size_t Http2Framer::writeFrame(uint8_t *out, size_t cap, Http2FrameType type, uint8_t flags, uint32_t stream_id,
+                               const uint8_t *payload, size_t len) {
+    if (cap < kFrameHeaderSize + len) {
+        return 0;
+    }
+    writeFrameHeader(out, static_cast<uint32_t>(len), type, flags, stream_id);
+    if (len > 0) {
+        std::memcpy(out + kFrameHeaderSize, payload, len);
+    }
+    return kFrameHeaderSize + len;
+}
+
+size_t Http2Framer::writeSettings(uint8_t *out, size_t cap, const Http2Setting *settings, size_t count) {
+    size_t len = 6 * count;
+    if (cap < kFrameHeaderSize + len) {
+        return 0;
+    }
+    writeFrameHeader(out, static_cast<uint32_t>(len), Http2FrameType::Settings, 0, 0);
+    uint8_t *p = out + kFrameHeaderSize;
+    for (size_t i = 0; i < count; ++i) {
+        p[0] = static_cast<uint8_t>(settings[i].id >> 8);
+        p[1] = static_cast<uint8_t>(settings[i].id);
+        p = writeUint32(p + 2, settings[i].value);
+    }
+    return kFrameHeaderSize + len;
+}
+
+size_t Http2Framer::writeSettingsAck(uint8_t *out, size_t cap) {
+    return writeFrame(out, cap, Http2FrameType::Settings, Http2Flags::Ack, 0, nullptr, 0);
+}
+
+size_t Http2Framer::writePing(uint8_t *out, size_t cap, const uint8_t opaque[8], bool ack) {
+    return writeFrame(out, cap, Http2FrameType::Ping, ack ? Http2Flags::Ack : 0, 0, opaque, 8);
 }
 
-std::string Http2Framer::generateFrame(const std::string& payload, uint8_t type, uint32_t stream_id) {
-    // Placeholder for HTTP/2 frame generation
-    // This would involve creating a binary frame per RFC 7540
-    throw std::runtime_error("HTTP/2 frame generation not implemented");
-}
\ No newline at end of file
+size_t Http2Framer::writeWindowUpdate(uint8_t *out, size_t cap, uint32_t stream_id, uint32_t increment) {
+    uint8_t payload[4];
+    writeUint32(payload, increment & 0x7fffffff);
+    return writeFrame(out, cap, Http2FrameType::WindowUpdate, 0, stream_id, payload, sizeof(payload));
+}
+
+size_t Http2Framer::writeRstStream(uint8_t *out, size_t cap, uint32_t stream_id, uint32_t error_code) {
+    uint8_t payload[4];
+    writeUint32(payload, error_code);
+    return writeFrame(out, cap, Http2FrameType::RstStream, 0, stream_id, payload, sizeof(payload));
+}
+
+size_t Http2Framer::writeGoAway(uint8_t *out, size_t cap, uint32_t last_stream_id, uint32_t error_code) {
+    uint8_t payload[8];
+    writeUint32(writeUint32(payload, last_stream_id & 0x7fffffff), error_code);
+    return writeFrame(out, cap, Http2FrameType::GoAway, 0, 0, payload, sizeof(payload));
+}
+
+size_t Http2Framer::writeHeaders(uint8_t *out, size_t cap, uint32_t stream_id, const HpackField *fields,
+                                 size_t count, bool end_stream, HpackEncoder &encoder, uint32_t max_frame_size) {
+    // Checked against the bound up front: once encoded, the fields are in the
+    // encoder's table and must reach the peer.
+    size_t bound = HpackEncoder::maxEncodedSize(fields, count);
+    size_t max_frames = bound / max_frame_size + 1;
+    if (cap < bound + max_frames * kFrameHeaderSize) {
+        return 0;
+    }
+    size_t block = encoder.encode(fields, count, out + kFrameHeaderSize);
+    size_t frames = block == 0 ? 1 : (block + max_frame_size - 1) / max_frame_size;
+
+    // The block was written behind the first frame header; open gaps for the others,
+    // moving the last fragment first.
+    for (size_t i = frames - 1; i > 0; --i) {
+        size_t fragment = std::min<size_t>(max_frame_size, block - i * max_frame_size);
+        uint8_t *from = out + kFrameHeaderSize + i * max_frame_size;
+        uint8_t *to = out + (i + 1) * kFrameHeaderSize + i * max_frame_size;
+        std::memmove(to, from, fragment);
+        writeFrameHeader(to - kFrameHeaderSize, static_cast<uint32_t>(fragment), Http2FrameType::Continuation,
+                         i == frames - 1 ? Http2Flags::EndHeaders : 0, stream_id);
+    }
+    uint8_t flags = (frames == 1 ? Http2Flags::EndHeaders : 0) | (end_stream ? Http2Flags::EndStream : 0);
+    writeFrameHeader(out, static_cast<uint32_t>(std::min<size_t>(block, max_frame_size)), Http2FrameType::Headers,
+                     flags, stream_id);
+    return block + frames * kFrameHeaderSize;
+}
@@ -0,0 +1,855 @@
+#include "http/http2_session.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "http/request_parser.hpp"
+#include "proxy/upstream_response.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <errno.h>
+#include <nghttp2/nghttp2.h>
+#include <unistd.h>
+
+namespace
+{
+
+// Body bytes buffered per stream before its source is asked to wait.
+const size_t kStreamBuffer = 64 * 1024;
+// Frames gathered from nghttp2 before they are written out together.
+const size_t kWriteBatch = 64 * 1024;
+// Every frame starts with a 9-byte header (RFC 7540 section 4.1).
+const size_t kFrameHeaderSize = 9;
+// Larger heads of a translated HTTP/1.1 message are rejected.
+const size_t kMaxHead = 64 * 1024;
+// Receive window of the connection as a whole: every stream's window fits into it, so a
+// streamed request body waiting for its backend does not hold up the other streams.
+const int32_t kConnectionWindow = 16 << 20;
+
+// Headers that are specific to an HTTP/1.1 connection and not allowed in HTTP/2.
+bool connectionSpecific(HeaderId id)
+{
+    return id == HeaderId::Connection || id == HeaderId::KeepAlive || id == HeaderId::ProxyConnection ||
+           id == HeaderId::TransferEncoding || id == HeaderId::Upgrade || id == HeaderId::ContentLength;
+}
+
+std::string lower(std::string_view name)
+{
+    std::string s(name);
+    for (char &c : s)
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return s;
+}
+
+} // namespace
+
+struct Http2Session::Stream
+{
+    explicit Stream(int32_t id) : id(id) {}
+
+    int32_t id;
+    Request request;
+    size_t request_bytes = 0;
+    std::string cookie; // crumbs joined so far, added as one field when the head ends
+    bool too_large = false;
+    bool dispatched = false;    // in ready_ already: the request body is streamed
+    uint64_t body_released = 0; // request body bytes returned to the flow-control window
+
+    // Response body, sent from these in order: a region of an immutable string (a plain
+    // body, or the body of a pre-serialized message), a file region, then the bytes
+    // buffered from a streamed source.
+    std::shared_ptr<const std::string> data;
+    size_t data_offset = 0;
+    size_t data_remaining = 0;
+    std::shared_ptr<const FileBody> file;
+    off_t file_offset = 0;
+    size_t file_remaining = 0;
+    std::string buffer;
+    size_t buffer_offset = 0;
+    bool eof = false;      // nothing will be added to the body
+    bool deferred = false; // the provider ran dry and waits for resume_data
+    bool head_submitted = false;
+
+    // A streamed or pre-serialized response arrives as an HTTP/1.1 message; these
+    // turn it back into a head and a plain body.
+    std::shared_ptr<ResponseStream> source;
+    bool head_request = false;
+    bool in_head = true;
+    std::string head_buffer;
+    enum class Framing
+    {
+        None,
+        Length,
+        Chunked,
+        UntilEnd
+    } framing = Framing::UntilEnd;
+    uint64_t remaining = 0;
+    ChunkedDecoder decoder;
+
+    size_t buffered() const { return buffer.size() - buffer_offset; }
+    size_t pending() const { return data_remaining + file_remaining + buffered(); }
+};
+
+// nghttp2 callbacks; they see the session through user_data.
+struct Http2Session::Callbacks
+{
+    static int onBeginHeaders(nghttp2_session *, const nghttp2_frame *frame, void *user_data)
+    {
+        auto *self = static_cast<Http2Session *>(user_data);
+        if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+        {
+            auto stream = std::make_unique<Stream>(frame->hd.stream_id);
+            stream->request.version = "HTTP/2";
+            self->streams_[frame->hd.stream_id] = std::move(stream);
+        }
+        return 0;
+    }
+
+    static int onHeader(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+                        const uint8_t *value, size_t valuelen, uint8_t, void *user_data)
+    {
+        auto *self = static_cast<Http2Session *>(user_data);
+        if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST)
+            return 0; // trailers are dropped
+        auto it = self->streams_.find(frame->hd.stream_id);
+        if (it == self->streams_.end())
+            return 0;
+        Stream &stream = *it->second;
+        stream.request_bytes += namelen + valuelen;
+        if (stream.request_bytes > self->limits_.max_request_size)
+        {
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream.id, NGHTTP2_REFUSED_STREAM);
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+
+        std::string_view header_name(reinterpret_cast<const char *>(name), namelen);
+        std::string_view header_value(reinterpret_cast<const char *>(value), valuelen);
+        Request &request = stream.request;
+        if (header_name == ":method")
+            request.method = header_value;
+        else if (header_name == ":path")
+            request.path = header_value;
+        else if (header_name == ":authority")
+            request.headers.set("Host", header_value);
+        else if (header_name[0] == ':')
+            return 0; // :scheme
+        else if (header_name == "cookie")
+        {
+            // HTTP/2 splits cookies into separate fields; HTTP/1.1 wants them in one. The
+            // "; " between crumbs is shorter than the name counted for each of them.
+            if (!stream.cookie.empty())
+                stream.cookie += "; ";
+            stream.cookie += header_value;
+        }
+        else
+            request.headers.add(header_name, header_value);
+        return 0;
+    }
+
+    static int onDataChunkRecv(nghttp2_session *session, uint8_t, int32_t stream_id, const uint8_t *data, size_t len,
+                               void *user_data)
+    {
+        auto *self = static_cast<Http2Session *>(user_data);
+        auto it = self->streams_.find(stream_id);
+        if (it == self->streams_.end())
+        {
+            nghttp2_session_consume(session, stream_id, len);
+            return 0;
+        }
+        Stream &stream = *it->second;
+        Request &request = stream.request;
+        if (!request.body_stream && !stream.too_large && request.body.size() + len > self->limits_.max_buffered_body)
+            self->streamRequestBody(stream, RequestBody::kUnknownLength);
+        if (request.body_stream)
+        {
+            request.body_stream->append(reinterpret_cast<const char *>(data), len);
+            if (request.body_stream->received() > self->limits_.max_body_size)
+                nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+            self->releaseRequestBody(stream);
+            return 0;
+        }
+
+        // A buffered body is taken off the window at once.
+        nghttp2_session_consume(session, stream_id, len);
+        stream.request_bytes += len;
+        if (stream.request_bytes > self->limits_.max_request_size)
+            stream.too_large = true;
+        if (!stream.too_large)
+            request.body.append(reinterpret_cast<const char *>(data), len);
+        return 0;
+    }
+
+    static int onFrameRecv(nghttp2_session *, const nghttp2_frame *frame, void *user_data)
+    {
+        auto *self = static_cast<Http2Session *>(user_data);
+        if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+            return 0;
+        auto it = self->streams_.find(frame->hd.stream_id);
+        if (it == self->streams_.end())
+            return 0;
+        Stream &stream = *it->second;
+        bool end_stream = frame->hd.flags & NGHTTP2_FLAG_END_STREAM;
+        if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST && !stream.cookie.empty())
+        {
+            stream.request.headers.add("cookie", stream.cookie, HeaderId::Cookie);
+            std::string().swap(stream.cookie);
+        }
+        if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST && !end_stream)
+        {
+            // A body announced as too large to buffer is streamed from its first byte.
+            const std::string_view *value = stream.request.headers.get(HeaderId::ContentLength);
+            uint64_t length = 0;
+            if (value && std::from_chars(value->data(), value->data() + value->size(), length).ec == std::errc() &&
+                length > self->limits_.max_buffered_body)
+            {
+                if (length > self->limits_.max_body_size)
+                    stream.too_large = true;
+                else
+                    self->streamRequestBody(stream, static_cast<int64_t>(length));
+            }
+        }
+        if (end_stream)
+        {
+            if (stream.request.body_stream)
+                stream.request.body_stream->finish();
+            if (!stream.dispatched)
+                self->ready_.push_back(stream.id);
+        }
+        return 0;
+    }
+
+    static int onStreamClose(nghttp2_session *session, int32_t stream_id, uint32_t, void *user_data)
+    {
+        auto *self = static_cast<Http2Session *>(user_data);
+        auto it = self->streams_.find(stream_id);
+        if (it == self->streams_.end())
+            return 0;
+        // Request body bytes nobody took still count against the connection's window.
+        if (const std::shared_ptr<RequestBody> &body = it->second->request.body_stream)
+        {
+            body->discard();
+            if (body->received() > it->second->body_released)
+                nghttp2_session_consume_connection(session, body->received() - it->second->body_released);
+        }
+        self->streams_.erase(it);
+        return 0;
+    }
+
+    // Only sizes the next DATA frame (NO_COPY); sendData() queues its payload from the
+    // body sources, so no byte passes through nghttp2's buffers.
+    static ssize_t readBody(nghttp2_session *, int32_t, uint8_t *, size_t length, uint32_t *data_flags,
+                            nghttp2_data_source *source, void *)
+    {
+        Stream &stream = *static_cast<Stream *>(source->ptr);
+        size_t available = stream.data_remaining > 0   ? stream.data_remaining
+                           : stream.file_remaining > 0 ? stream.file_remaining
+                                                       : stream.buffered();
+        size_t n = std::min(length, available);
+        if (n == 0 && !stream.eof)
+        {
+            stream.deferred = true;
+            return NGHTTP2_ERR_DEFERRED;
+        }
+        *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+        if (stream.eof && n == stream.pending())
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return n;
+    }
+
+    static int sendData(nghttp2_session *, nghttp2_frame *, const uint8_t *framehd, size_t length,
+                        nghttp2_data_source *source, void *user_data)
+    {
+        auto *self = static_cast<Http2Session *>(user_data);
+        if (!self->queueData(*static_cast<Stream *>(source->ptr), framehd, length))
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE; // resets the stream
+        // Bound the batch; the rest of the flow-control window goes out with the next one.
+        return self->pending_output_ >= kWriteBatch ? NGHTTP2_ERR_PAUSE : 0;
+    }
+};
+
+// Takes a streamed response's HTTP/1.1 bytes for one HTTP/2 stream.
+class Http2Session::StreamSink : public ResponseSink
+{
+public:
+    StreamSink(Http2Session &session, Stream &stream) : session_(session), stream_(stream) {}
+
+    ssize_t write(const char *data, size_t len) override
+    {
+        if (stream_.buffered() >= kStreamBuffer)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        try
+        {
+            session_.feed(stream_, data, len);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("Bad response on HTTP/2 stream {}: {}", stream_.id, e.what());
+            errno = EPROTO;
+            return -1;
+        }
+        return static_cast<ssize_t>(len);
+    }
+
+    // Bodies are framed into DATA, so they cannot bypass us.
+    int spliceFd() const override { return -1; }
+
+private:
+    Http2Session &session_;
+    Stream &stream_;
+};
+
+Http2Session::Http2Session(std::unique_ptr<Connection> conn, const RequestHandler &handler,
+                           const SessionLimits &limits, EventLoop &loop, std::function<void()> wake)
+    : conn_(std::move(conn)), handler_(handler), limits_(limits), loop_(loop), wake_(std::move(wake)),
+      last_activity_(std::chrono::steady_clock::now())
+{
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, Callbacks::onBeginHeaders);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, Callbacks::onHeader);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, Callbacks::onDataChunkRecv);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, Callbacks::onFrameRecv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, Callbacks::onStreamClose);
+    nghttp2_session_callbacks_set_send_data_callback(callbacks, Callbacks::sendData);
+    // Request body bytes are handed back to the flow-control windows as they are used up
+    // (nghttp2_session_consume), which is what holds back a client streaming a body.
+    nghttp2_option *options;
+    nghttp2_option_new(&options);
+    nghttp2_option_set_no_auto_window_update(options, 1);
+    int rv = nghttp2_session_server_new2(&session_, callbacks, this, options);
+    nghttp2_option_del(options);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rv != 0)
+    {
+        throw std::runtime_error("nghttp2_session_server_new failed: " + std::string(nghttp2_strerror(rv)));
+    }
+
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, limits_.max_concurrent_streams},
+    };
+    nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0]));
+    nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE, 0, kConnectionWindow);
+}
+
+Http2Session::~Http2Session()
+{
+    // Streams go first: their sources may still reference the session's state.
+    streams_.clear();
+    nghttp2_session_del(session_);
+}
+
+Http2Session::Status Http2Session::process()
+{
+    last_activity_ = std::chrono::steady_clock::now();
+    bool read_ok = readAvailable();
+    answerReadyStreams();
+
+    // Move streamed bodies into frames until the socket or every source is drained.
+    while (true)
+    {
+        bool progress = pumpSources();
+        uint64_t before = bytes_written_;
+        if (!flush())
+            return Status::Close;
+        if (write_blocked_ || (!progress && bytes_written_ == before))
+            break;
+    }
+
+    if (!read_ok || peer_closed_)
+        return Status::Close;
+    if (!nghttp2_session_want_read(session_) && !nghttp2_session_want_write(session_) && pending_output_ == 0)
+        return Status::Close; // GOAWAY exchanged
+    return write_blocked_ ? Status::WantWrite : Status::WantRead;
+}
+
+void Http2Session::shutdown()
+{
+    nghttp2_session_terminate_session(session_, NGHTTP2_NO_ERROR);
+    flush();
+}
+
+bool Http2Session::readAvailable()
+{
+    char buffer[16384];
+    // While output backs up, leave the client's frames in the socket.
+    while (pending_output_ <= limits_.max_pending_output)
+    {
+        ssize_t bytes_read = conn_->read(buffer, sizeof(buffer));
+        if (bytes_read > 0)
+        {
+            ssize_t rv = nghttp2_session_mem_recv(session_, reinterpret_cast<const uint8_t *>(buffer), bytes_read);
+            if (rv < 0)
+            {
+                LOG_WARN("HTTP/2 error on fd {}: {}", fd(), nghttp2_strerror(static_cast<int>(rv)));
+                flush(); // GOAWAY, if nghttp2 queued one
+                return false;
+            }
+            continue;
+        }
+        if (bytes_read == 0)
+        {
+            peer_closed_ = true;
+            return true;
+        }
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+// Hands the request to the handler before its body is complete: what arrived so far
+// and the rest of it go through request.body_stream.
+void Http2Session::streamRequestBody(Stream &stream, int64_t length)
+{
+    Request &request = stream.request;
+    request.body_stream = std::make_shared<RequestBody>(length);
+    request.body_stream->append(request.body.data(), request.body.size());
+    stream.body_released = request.body.size(); // consumed while it was buffered
+    request.body.clear();
+    stream.dispatched = true;
+    ready_.push_back(stream.id);
+}
+
+// Gives the stream's window back what the response's stream took of the request body,
+// or what was dropped, so that the client sends more.
+void Http2Session::releaseRequestBody(Stream &stream)
+{
+    uint64_t released = stream.request.body_stream->released();
+    if (released > stream.body_released)
+    {
+        nghttp2_session_consume(session_, stream.id, released - stream.body_released);
+        stream.body_released = released;
+    }
+}
+
+void Http2Session::answerReadyStreams()
+{
+    std::vector<int32_t> ready;
+    ready.swap(ready_);
+    for (int32_t id : ready)
+    {
+        auto it = streams_.find(id);
+        if (it == streams_.end())
+            continue; // reset by the client meanwhile
+        Stream &stream = *it->second;
+        if (stream.too_large)
+        {
+            submitResponse(stream, Response{413, "Payload Too Large", "HTTP/2", {}, "Payload Too Large"});
+            continue;
+        }
+
+        Metrics::add(Counter::Requests);
+        Response response;
+        try
+        {
+            response = handler_(stream.request);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("Error handling {} {} on fd {}: {}", stream.request.method, stream.request.path, fd(), e.what());
+            response = Response{500, "Internal Server Error", "HTTP/2", {}, "Internal Server Error"};
+        }
+        submitResponse(stream, std::move(response));
+    }
+}
+
+void Http2Session::submitResponse(Stream &stream, Response response)
+{
+    stream.head_request = stream.request.method == "HEAD";
+    if (stream.request.body_stream && !response.stream)
+    {
+        stream.request.body_stream->discard();
+        releaseRequestBody(stream);
+    }
+    if (response.stream)
+    {
+        stream.source = std::move(response.stream);
+        stream.source->start(loop_, wake_);
+        return;
+    }
+    if (response.raw)
+    {
+        submitRaw(stream, std::move(response));
+        return;
+    }
+
+    stream.head_submitted = true;
+    long long length = response.file ? static_cast<long long>(response.file->length) : response.body.size();
+    bool has_body = !stream.head_request && length > 0 && response.status_code != 204 &&
+                    response.status_code != 304;
+    if (has_body)
+    {
+        if (response.file)
+        {
+            stream.file_offset = response.file->offset;
+            stream.file_remaining = response.file->length;
+            stream.file = std::move(response.file);
+        }
+        else
+        {
+            stream.data_remaining = response.body.size();
+            stream.data = std::make_shared<const std::string>(std::move(response.body));
+        }
+    }
+    stream.eof = true;
+    submitHead(stream, response, has_body, length);
+}
+
+// A pre-serialized HTTP/1.1 message (e.g. a cache hit): its head is translated, and a
+// body of known extent is sent from the message itself. With a file or raw_body, raw is
+// only the head and that is the body it announces.
+void Http2Session::submitRaw(Stream &stream, Response response)
+{
+    const std::shared_ptr<const std::string> &raw = response.raw;
+    size_t used;
+    try
+    {
+        used = feedHead(stream, raw->data(), raw->size());
+        if (stream.in_head && !response.raw_fields.empty())
+            feedHead(stream, response.raw_fields.data(), response.raw_fields.size());
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("Bad response on HTTP/2 stream {}: {}", stream.id, e.what());
+        used = raw->size();
+    }
+    if (stream.in_head)
+    {
+        nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, stream.id, NGHTTP2_INTERNAL_ERROR);
+        return;
+    }
+
+    size_t offset = response.raw_body ? 0 : used;
+    std::shared_ptr<const std::string> body = response.raw_body ? std::move(response.raw_body) : raw;
+    size_t rest = body->size() - offset;
+    if (response.file)
+    {
+        if (stream.framing == Stream::Framing::Length)
+        {
+            stream.file_offset = response.file->offset;
+            stream.file_remaining = response.file->length;
+            stream.file = std::move(response.file);
+        }
+    }
+    else if (stream.framing == Stream::Framing::Length || stream.framing == Stream::Framing::UntilEnd)
+    {
+        stream.data_offset = offset;
+        stream.data_remaining =
+            stream.framing == Stream::Framing::Length ? std::min<uint64_t>(rest, stream.remaining) : rest;
+        stream.data = std::move(body);
+    }
+    else
+    {
+        feedBody(stream, body->data() + offset, rest);
+    }
+    stream.eof = true;
+}
+
+void Http2Session::submitHead(Stream &stream, const Response &head, bool has_body, long long content_length)
+{
+    stream.head_submitted = true;
+    std::vector<std::pair<std::string, std::string>> fields;
+    fields.emplace_back(":status", std::to_string(head.status_code));
+    for (const auto &header : head.headers)
+    {
+        if (!connectionSpecific(header.id))
+            fields.emplace_back(lower(header.name), header.value);
+    }
+    if (content_length >= 0 && head.status_code != 204 && head.status_code != 304)
+        fields.emplace_back("content-length", std::to_string(content_length));
+
+    std::vector<nghttp2_nv> nva;
+    for (auto &field : fields)
+    {
+        nva.push_back(nghttp2_nv{reinterpret_cast<uint8_t *>(&field.first[0]),
+                                 reinterpret_cast<uint8_t *>(&field.second[0]), field.first.size(),
+                                 field.second.size(), NGHTTP2_NV_FLAG_NONE});
+    }
+    nghttp2_data_provider provider;
+    provider.source.ptr = &stream;
+    provider.read_callback = Callbacks::readBody;
+    int rv = nghttp2_submit_response(session_, stream.id, nva.data(), nva.size(), has_body ? &provider : nullptr);
+    if (rv != 0)
+    {
+        LOG_ERROR("nghttp2_submit_response failed: {}", nghttp2_strerror(rv));
+        nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, stream.id, NGHTTP2_INTERNAL_ERROR);
+    }
+}
+
+// Takes the next bytes of an HTTP/1.1 response message for stream: the head is submitted
+// as HEADERS once complete, the body is unframed into the buffer the DATA provider reads.
+void Http2Session::feed(Stream &stream, const char *data, size_t len)
+{
+    size_t used = stream.in_head ? feedHead(stream, data, len) : 0;
+    if (!stream.in_head)
+        feedBody(stream, data + used, len - used);
+}
+
+// Returns how many of the bytes belonged to the head; all of them while it is incomplete.
+size_t Http2Session::feedHead(Stream &stream, const char *data, size_t len)
+{
+    size_t old = stream.head_buffer.size();
+    stream.head_buffer.append(data, len);
+    size_t end = stream.head_buffer.find("\r\n\r\n");
+    if (end == std::string::npos)
+    {
+        if (stream.head_buffer.size() > kMaxHead)
+            throw std::runtime_error("Response head too large");
+        return len;
+    }
+    Response head;
+    UpstreamFraming framing;
+    parseUpstreamHead(std::string_view(stream.head_buffer).substr(0, end + 2), head, framing);
+    stream.head_buffer.clear();
+    stream.in_head = false;
+
+    if (stream.head_request || head.status_code == 204 || head.status_code == 304)
+        stream.framing = Stream::Framing::None;
+    else if (framing.chunked)
+        stream.framing = Stream::Framing::Chunked;
+    else if (framing.content_length >= 0)
+        stream.framing = Stream::Framing::Length;
+    else
+        stream.framing = Stream::Framing::UntilEnd;
+    stream.remaining = framing.content_length;
+    bool has_body = stream.framing != Stream::Framing::None &&
+                    !(stream.framing == Stream::Framing::Length && stream.remaining == 0);
+    submitHead(stream, head, has_body, framing.content_length);
+    if (!has_body)
+        stream.eof = true;
+    return end + 4 - old;
+}
+
+void Http2Session::feedBody(Stream &stream, const char *data, size_t len)
+{
+    size_t before = stream.buffered();
+    switch (stream.framing)
+    {
+    case Stream::Framing::Length:
+    {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(len, stream.remaining));
+        stream.buffer.append(data, n);
+        stream.remaining -= n;
+        if (stream.remaining == 0)
+            stream.eof = true;
+        break;
+    }
+    case Stream::Framing::Chunked:
+        stream.decoder.decode(data, len, stream.buffer);
+        if (stream.decoder.done())
+            stream.eof = true;
+        break;
+    case Stream::Framing::UntilEnd:
+        stream.buffer.append(data, len);
+        break;
+    case Stream::Framing::None:
+        break;
+    }
+    if (stream.deferred && (stream.buffered() > before || stream.eof))
+    {
+        stream.deferred = false;
+        nghttp2_session_resume_data(session_, stream.id);
+    }
+}
+
+// Queues the DATA frame nghttp2 sized in readBody(): its header, then length bytes from
+// the stream's body sources. Plaintext connections get regions of the body string and
+// the file as they are (write and sendfile straight from them); TLS has to copy to
+// encrypt anyway, so there the bytes go directly into the output buffer.
+bool Http2Session::queueData(Stream &stream, const uint8_t *framehd, size_t length)
+{
+    OutputChunk &chunk = appendableChunk();
+    chunk.bytes.append(reinterpret_cast<const char *>(framehd), kFrameHeaderSize);
+    bool zero_copy = !conn_->is_tls();
+    if (stream.data_remaining > 0)
+    {
+        const char *bytes = stream.data->data() + stream.data_offset;
+        if (zero_copy)
+        {
+            out_.emplace_back();
+            out_.back().data = stream.data;
+            out_.back().data_ptr = bytes;
+            out_.back().data_remaining = length;
+        }
+        else
+        {
+            chunk.bytes.append(bytes, length);
+        }
+        stream.data_offset += length;
+        stream.data_remaining -= length;
+    }
+    else if (stream.file_remaining > 0)
+    {
+        if (zero_copy)
+        {
+            out_.emplace_back();
+            out_.back().file = stream.file;
+            out_.back().file_offset = stream.file_offset;
+            out_.back().file_remaining = length;
+        }
+        else
+        {
+            size_t old = chunk.bytes.size();
+            chunk.bytes.resize(old + length);
+            for (size_t done = 0; done < length;)
+            {
+                ssize_t r = pread(stream.file->fd, &chunk.bytes[old + done], length - done, stream.file_offset + done);
+                if (r <= 0)
+                {
+                    chunk.bytes.resize(old - kFrameHeaderSize);
+                    return false;
+                }
+                done += r;
+            }
+        }
+        stream.file_offset += length;
+        stream.file_remaining -= length;
+    }
+    else
+    {
+        chunk.bytes.append(stream.buffer, stream.buffer_offset, length);
+        stream.buffer_offset += length;
+        if (stream.buffer_offset == stream.buffer.size())
+        {
+            stream.buffer.clear();
+            stream.buffer_offset = 0;
+        }
+    }
+    pending_output_ += kFrameHeaderSize + length;
+    return true;
+}
+
+Http2Session::OutputChunk &Http2Session::appendableChunk()
+{
+    if (out_.empty() || out_.back().data_remaining > 0 || out_.back().file_remaining > 0)
+        out_.emplace_back();
+    return out_.back();
+}
+
+// Lets every streamed response with room in its buffer produce more. True if any did.
+bool Http2Session::pumpSources()
+{
+    bool progress = false;
+    for (auto &entry : streams_)
+    {
+        Stream &stream = *entry.second;
+        if (!stream.source || stream.buffered() >= kStreamBuffer)
+            continue;
+        size_t before = stream.buffered();
+        bool head_before = stream.head_submitted;
+        StreamSink sink(*this, stream);
+        ResponseStream::Status status = stream.source->send(sink);
+        if (stream.request.body_stream)
+        {
+            if (status == ResponseStream::Status::Done || status == ResponseStream::Status::Failed)
+                stream.request.body_stream->discard();
+            releaseRequestBody(stream);
+        }
+        if (status == ResponseStream::Status::Done || status == ResponseStream::Status::Failed)
+        {
+            stream.source.reset();
+            progress = true;
+            if (status == ResponseStream::Status::Failed || !stream.head_submitted)
+            {
+                nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, stream.id, NGHTTP2_INTERNAL_ERROR);
+                continue;
+            }
+            stream.eof = true;
+            if (stream.deferred)
+            {
+                stream.deferred = false;
+                nghttp2_session_resume_data(session_, stream.id);
+            }
+            continue;
+        }
+        progress = progress || stream.buffered() != before || stream.head_submitted != head_before;
+    }
+    return progress;
+}
+
+bool Http2Session::flush()
+{
+    write_blocked_ = false;
+    if (pending_output_ == 0 && !nghttp2_session_want_write(session_))
+        return true;
+    StageTimer timer(Stage::Write);
+    while (true)
+    {
+        while (pending_output_ < kWriteBatch && nghttp2_session_want_write(session_))
+        {
+            // Serializes control and HEADERS frames; DATA frames arrive through sendData().
+            const uint8_t *data;
+            ssize_t n = nghttp2_session_mem_send(session_, &data);
+            if (n < 0)
+            {
+                LOG_ERROR("nghttp2_session_mem_send failed: {}", nghttp2_strerror(static_cast<int>(n)));
+                return false;
+            }
+            if (n == 0)
+                break;
+            appendableChunk().bytes.append(reinterpret_cast<const char *>(data), n);
+            pending_output_ += n;
+        }
+        if (pending_output_ == 0)
+        {
+            // Keep one chunk, and its buffer, for the next frames.
+            out_.resize(std::min<size_t>(out_.size(), 1));
+            if (!out_.empty())
+            {
+                out_.front().bytes.clear();
+                out_.front().offset = 0;
+                out_.front().data.reset();
+                out_.front().file.reset();
+            }
+            return true;
+        }
+
+        OutputChunk &chunk = out_.front();
+        ssize_t written;
+        if (chunk.offset < chunk.bytes.size())
+        {
+            written = conn_->write(chunk.bytes.data() + chunk.offset, chunk.bytes.size() - chunk.offset);
+            if (written > 0)
+                chunk.offset += written;
+        }
+        else if (chunk.data_remaining > 0)
+        {
+            written = conn_->write(chunk.data_ptr, chunk.data_remaining);
+            if (written > 0)
+            {
+                chunk.data_ptr += written;
+                chunk.data_remaining -= written;
+            }
+        }
+        else if (chunk.file_remaining > 0)
+        {
+            written = conn_->send_file(chunk.file->fd, chunk.file_offset, chunk.file_remaining);
+            if (written > 0)
+                chunk.file_remaining -= written;
+        }
+        else
+        {
+            out_.pop_front();
+            continue;
+        }
+
+        if (written > 0)
+        {
+            pending_output_ -= written;
+            bytes_written_ += written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            write_blocked_ = true;
+            return true;
+        }
+        return false;
+    }
+}
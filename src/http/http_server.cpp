@@ -0,0 +1,237 @@
+#include "http/http_server.hpp"
+#include "core/listener.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "http/http2_session.hpp"
+#include <stdexcept>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+HttpServer::HttpServer(const HttpServerConfig &config, const TlsContext *tls, HttpParser &parser, RequestHandler handler)
+    : config_(config), tls_(tls), parser_(parser), handler_(std::move(handler))
+{
+    if (config_.reuse_port)
+    {
+        loops_ = std::make_unique<EventLoopGroup>(config_.num_loops, config_.port);
+    }
+    else
+    {
+        loops_ = std::make_unique<EventLoopGroup>(config_.num_loops, -1);
+        acceptor_ = std::make_unique<EventLoop>();
+        listen_fd_ = createListenSocket(config_.port, false, true);
+        spare_fd_ = openSpareFd();
+        workers_ = std::make_unique<WorkerPool>(config_.num_workers);
+    }
+    for (size_t i = 0; i < loops_->size(); ++i)
+    {
+        EventLoop &loop = loops_->at(i);
+        sessions_[&loop];
+        handshakes_[&loop] = std::make_unique<HandshakeDriver>(loop, config_.handshake_timeout);
+        loop.runEvery(std::chrono::seconds(1), [this, &loop] {
+            handshakes_.at(&loop)->closeExpired();
+            closeIdleSessions(loop);
+        });
+    }
+}
+
+HttpServer::~HttpServer()
+{
+    stop();
+    loops_->join();
+    workers_.reset();
+    // Loops and workers are gone, so nothing else touches the sessions now.
+    for (auto &loop_sessions : sessions_)
+    {
+        for (auto &entry : loop_sessions.second)
+        {
+            entry.second.session->shutdown();
+        }
+    }
+    if (listen_fd_ != -1)
+    {
+        close(listen_fd_);
+    }
+    if (spare_fd_ != -1)
+    {
+        close(spare_fd_);
+    }
+}
+
+void HttpServer::run()
+{
+    if (config_.reuse_port)
+    {
+        loops_->run([this](int client_fd, EventLoop &loop) {
+            startConnection(loop, client_fd, std::chrono::steady_clock::now());
+        });
+        return;
+    }
+
+    loops_->start(nullptr);
+    acceptor_->addFd(listen_fd_, EPOLLIN, [this](int, uint32_t) {
+        size_t dropped = 0;
+        while (true)
+        {
+            int client_fd = acceptNonBlocking(listen_fd_);
+            if (client_fd == -1)
+            {
+                int err = errno;
+                if (err == EINTR)
+                    continue;
+                // Out of descriptors: shed the backlog instead of being woken for it again at once.
+                if ((err == EMFILE || err == ENFILE) && dropConnection(listen_fd_, spare_fd_))
+                {
+                    ++dropped;
+                    continue;
+                }
+                if (dropped > 0)
+                    LOG_ERROR("Out of file descriptors; dropped {} new connections", dropped);
+                if (err != EAGAIN && err != EWOULDBLOCK && dropped == 0)
+                    LOG_ERROR("Failed to accept connection: {}", strerror(err));
+                return;
+            }
+            auto accepted = std::chrono::steady_clock::now();
+            EventLoop *loop = &loops_->next();
+            loop->post([this, loop, client_fd, accepted] { startConnection(*loop, client_fd, accepted); });
+        }
+    });
+    acceptor_->run();
+    loops_->stop();
+    loops_->join();
+}
+
+void HttpServer::stop()
+{
+    if (acceptor_)
+    {
+        acceptor_->stop();
+    }
+    loops_->stop();
+}
+
+void HttpServer::startConnection(EventLoop &loop, int client_fd, std::chrono::steady_clock::time_point accepted)
+{
+    Metrics::add(Counter::ConnectionsAccepted);
+    Metrics::record(Stage::Accept, std::chrono::steady_clock::now() - accepted);
+    std::unique_ptr<Connection> conn;
+    try
+    {
+        conn = std::make_unique<Connection>(client_fd, tls_);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("Error setting up connection on fd {}: {}", client_fd, e.what());
+        close(client_fd);
+        return;
+    }
+    handshakes_.at(&loop)->start(std::move(conn), [this, &loop](std::unique_ptr<Connection> ready) {
+        addSession(loop, std::move(ready));
+    });
+}
+
+void HttpServer::addSession(EventLoop &loop, std::unique_ptr<Connection> conn)
+{
+    int fd = conn->fd();
+    uint32_t armed = workers_ ? (EPOLLIN | EPOLLONESHOT) : EPOLLIN;
+    SessionEntry entry;
+    auto wake = [this, &loop, fd] { dispatch(loop, fd); };
+    if (conn->is_http2())
+    {
+        entry.session = std::make_shared<Http2Session>(std::move(conn), handler_, config_.limits, loop, wake);
+    }
+    else
+    {
+        entry.session = std::make_shared<HttpSession>(std::move(conn), parser_, handler_, config_.limits, loop, wake);
+    }
+    entry.armed = armed;
+    sessions_.at(&loop)[fd] = std::move(entry);
+    loop.addFd(fd, armed, [this, &loop](int fd, uint32_t) { dispatch(loop, fd); });
+    // The first request may already sit in the TLS buffer, where epoll cannot see it.
+    dispatch(loop, fd);
+}
+
+void HttpServer::dispatch(EventLoop &loop, int fd)
+{
+    SessionMap &sessions = sessions_.at(&loop);
+    auto it = sessions.find(fd);
+    if (it == sessions.end())
+    {
+        return;
+    }
+    if (it->second.busy)
+    {
+        it->second.rewake = true;
+        return;
+    }
+    if (!workers_)
+    {
+        finish(loop, fd, it->second.session->process());
+        return;
+    }
+    it->second.busy = true;
+    std::shared_ptr<Session> session = it->second.session;
+    EventLoop *owner = &loop;
+    workers_->submit([this, owner, fd, session] {
+        Session::Status status = session->process();
+        owner->post([this, owner, fd, status] { finish(*owner, fd, status); });
+    });
+}
+
+void HttpServer::finish(EventLoop &loop, int fd, Session::Status status)
+{
+    SessionMap &sessions = sessions_.at(&loop);
+    auto it = sessions.find(fd);
+    if (it == sessions.end())
+    {
+        return;
+    }
+    SessionEntry &entry = it->second;
+    entry.busy = false;
+    if (status == Session::Status::Close)
+    {
+        loop.removeFd(fd);
+        sessions.erase(it);
+        return;
+    }
+    uint32_t events = (status == Session::Status::WantWrite) ? EPOLLOUT : EPOLLIN;
+    if (status == Session::Status::WantData)
+    {
+        // Neither more requests nor a writable socket help; the stream wakes us.
+        events = EPOLLONESHOT;
+    }
+    else if (workers_)
+    {
+        events |= EPOLLONESHOT;
+    }
+    // One-shot registrations must be re-armed after every event.
+    if (workers_ || events != entry.armed)
+    {
+        loop.modifyFd(fd, events);
+        entry.armed = events;
+    }
+    if (entry.rewake)
+    {
+        entry.rewake = false;
+        dispatch(loop, fd);
+    }
+}
+
+void HttpServer::closeIdleSessions(EventLoop &loop)
+{
+    auto now = std::chrono::steady_clock::now();
+    SessionMap &sessions = sessions_.at(&loop);
+    for (auto it = sessions.begin(); it != sessions.end();)
+    {
+        if (!it->second.busy && now - it->second.session->last_activity() > config_.limits.idle_timeout)
+        {
+            it->second.session->shutdown();
+            loop.removeFd(it->first);
+            it = sessions.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,462 @@
+#include "http/http_session.hpp"
+#include "core/buffer_pool.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "http/response_writer.hpp"
+#include <algorithm>
+#include <memory_resource>
+#include <stdexcept>
+#include <string_view>
+#include <errno.h>
+
+namespace
+{
+
+// Smaller bodies are copied behind their head: cheaper than another iovec, and small
+// pipelined responses then leave in one contiguous piece.
+const size_t kInlineBody = 1024;
+// Queued pieces written by one writev.
+const int kMaxIov = 64;
+
+// True if the comma-separated header value contains token (case-insensitive).
+bool hasToken(std::string_view value, std::string_view token)
+{
+    while (true)
+    {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+            item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+            item.remove_suffix(1);
+        if (equalsIgnoreCase(item, token))
+            return true;
+        if (comma == std::string_view::npos)
+            return false;
+        value.remove_prefix(comma + 1);
+    }
+}
+
+bool wantsKeepAlive(const RequestView &request)
+{
+    // HTTP/1.1 defaults to persistent connections; HTTP/1.0 asks for one with
+    // Connection: keep-alive, which the response has to echo.
+    const std::string_view *connection = request.header("Connection");
+    if (request.version == "HTTP/1.1")
+        return !(connection && hasToken(*connection, "close"));
+    return request.version == "HTTP/1.0" && connection && hasToken(*connection, "keep-alive");
+}
+
+// The Connection header line a response needs, if any.
+std::string_view connectionHeader(bool keep_alive, bool http10)
+{
+    if (!keep_alive)
+        return "Connection: close\r\n";
+    return http10 ? "Connection: keep-alive\r\n" : "";
+}
+
+// Appends the head of a pre-serialized response with extra_headers (and Date and Server,
+// if it asks for them) added before its blank line. Returns how much of response.raw
+// that used.
+size_t appendRawHead(const Response &response, std::string_view extra_headers, std::string &out)
+{
+    const std::string &raw = *response.raw;
+    std::string_view date = response.raw_add_date ? cachedDateAndServerLines() : std::string_view();
+    if (!response.raw_fields.empty())
+    {
+        out.append(raw).append(date).append(extra_headers).append(response.raw_fields);
+        return raw.size();
+    }
+    size_t end = raw.find("\r\n\r\n");
+    if (end == std::string::npos)
+    {
+        out.append(raw);
+        return raw.size();
+    }
+    out.append(raw, 0, end + 2).append(date).append(extra_headers).append("\r\n");
+    return end + 4;
+}
+
+// A request's method, target, headers and body fit in this much arena unless the body
+// is large; the arena takes the rest from the heap then.
+const size_t kArenaBlock = 4096;
+
+// Streamed responses write straight to the client socket.
+class ConnectionSink : public ResponseSink
+{
+public:
+    explicit ConnectionSink(Connection &conn) : conn_(conn) {}
+
+    ssize_t write(const char *data, size_t len) override { return conn_.write(data, len); }
+    int spliceFd() const override { return conn_.is_tls() ? -1 : conn_.fd(); }
+
+private:
+    Connection &conn_;
+};
+
+} // namespace
+
+HttpSession::HttpSession(std::unique_ptr<Connection> conn, HttpParser &parser, const RequestHandler &handler,
+                         const SessionLimits &limits, EventLoop &loop, std::function<void()> wake)
+    : conn_(std::move(conn)), parser_(parser), handler_(handler), limits_(limits), loop_(loop),
+      wake_(std::move(wake)),
+      request_parser_(limits.max_request_size, limits.max_buffered_body, limits.max_body_size),
+      last_activity_(std::chrono::steady_clock::now())
+{
+}
+
+HttpSession::~HttpSession()
+{
+    BufferPool::release(in_);
+    BufferPool::release(spare_bytes_);
+}
+
+HttpSession::Status HttpSession::process()
+{
+    last_activity_ = std::chrono::steady_clock::now();
+    if (!flush())
+        return Status::Close;
+
+    if (!close_after_flush_ && !peer_closed_ && !readAvailable())
+        return Status::Close;
+
+    // Answer pipelined requests until the input runs dry or the socket stops taking output.
+    while (true)
+    {
+        size_t before = requests_served_;
+        answerBufferedRequests();
+        if (!flush())
+            return Status::Close;
+        // A streamed request body is read while its response waits for it (or, once
+        // discarded, skipped); its arrival lets the stream go on.
+        if (request_body_ && (out_.empty() || waiting_for_stream_) && request_body_->space() > 0)
+        {
+            if (feedRequestBody())
+                continue;
+            if (peer_closed_ || !readAvailable())
+                return Status::Close;
+            if (!in_.empty() || peer_closed_)
+                continue;
+            return Status::WantRead;
+        }
+        if (!out_.empty())
+            return waiting_for_stream_ ? Status::WantData : Status::WantWrite;
+        if (requests_served_ == before || close_after_flush_)
+            break;
+    }
+
+    if (close_after_flush_ || peer_closed_)
+        return Status::Close;
+    // An idle connection holds no buffers; the next busy one on this thread takes them.
+    if (in_.empty())
+        BufferPool::release(in_);
+    BufferPool::release(spare_bytes_);
+    return Status::WantRead;
+}
+
+bool HttpSession::readAvailable()
+{
+    char buffer[16384];
+    if (in_.capacity() < BufferPool::kBufferSize)
+        in_ = BufferPool::acquire();
+    // Stop reading once a full request's worth (or a streamed body's piece) is buffered;
+    // the rest stays in the socket until the buffered bytes have been taken.
+    size_t limit = request_body_ ? RequestBody::kCapacity : limits_.max_request_size;
+    while (in_.size() <= limit)
+    {
+        ssize_t bytes_read = conn_->read(buffer, sizeof(buffer));
+        if (bytes_read > 0)
+        {
+            in_.append(buffer, bytes_read);
+            continue;
+        }
+        if (bytes_read == 0)
+        {
+            peer_closed_ = true;
+            return true;
+        }
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+// Moves as much of the streamed request body from in_ as it has room for. True if any.
+bool HttpSession::feedRequestBody()
+{
+    uint64_t missing = request_body_->length() - request_body_->received();
+    size_t n = static_cast<size_t>(std::min<uint64_t>({in_.size(), missing, request_body_->space()}));
+    if (n > 0)
+    {
+        request_body_->append(in_.data(), n);
+        in_.erase(0, n);
+    }
+    if (request_body_->received() == static_cast<uint64_t>(request_body_->length()))
+    {
+        request_body_->finish();
+        request_body_.reset();
+    }
+    return n > 0;
+}
+
+void HttpSession::answerBufferedRequests()
+{
+    // The Request handed to the handler lives in this arena, which starts on the stack
+    // and is reset between requests.
+    alignas(std::max_align_t) char arena_space[kArenaBlock];
+    std::pmr::monotonic_buffer_resource arena(arena_space, sizeof(arena_space));
+    size_t consumed = 0;
+    while (!request_body_ && !close_after_flush_ && pending_bytes_ < limits_.max_pending_output)
+    {
+        arena.release();
+        std::string_view pending(in_.data() + consumed, in_.size() - consumed);
+        Metrics::Clock::time_point parse_start = Metrics::Clock::now();
+        RequestParser::Status status = request_parser_.parse(pending);
+        if (status == RequestParser::Status::NeedMore)
+            break;
+        if (status == RequestParser::Status::Error)
+        {
+            queueError(request_parser_.errorCode(), request_parser_.errorMessage());
+            break;
+        }
+
+        const RequestView &view = request_parser_.request();
+        consumed += request_parser_.consumed();
+        ++requests_served_;
+        bool keep_alive = wantsKeepAlive(view) && requests_served_ < limits_.max_requests;
+        bool http10 = view.version == "HTTP/1.0";
+        Request request = view.toRequest(&arena);
+        if (uint64_t length = request_parser_.streamedBody())
+            request.body_stream = std::make_shared<RequestBody>(static_cast<int64_t>(length));
+        request_parser_.reset();
+        Metrics::record(Stage::Parse, Metrics::Clock::now() - parse_start);
+        Metrics::add(Counter::Requests);
+
+        Response response;
+        try
+        {
+            response = handler_(request);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("Error handling {} {} on fd {}: {}", request.method, request.path, fd(), e.what());
+            response = Response{500, "Internal Server Error", "HTTP/1.1", {}, "Internal Server Error"};
+        }
+        if (request.body_stream)
+        {
+            // The body follows the head in in_; only a streamed response reads it.
+            in_.erase(0, consumed);
+            consumed = 0;
+            request_body_ = request.body_stream;
+            if (!response.stream)
+                request_body_->discard();
+            feedRequestBody();
+        }
+        bool streamed = response.stream != nullptr;
+        if (request.method == "HEAD" && !streamed)
+        {
+            if (response.raw)
+            {
+                std::string &bytes = outputBytes();
+                size_t before = bytes.size();
+                appendRawHead(response, connectionHeader(keep_alive, http10), bytes);
+                pending_bytes_ += bytes.size() - before;
+                if (!keep_alive)
+                    close_after_flush_ = true;
+                continue;
+            }
+            // A proxied HEAD already carries the origin's Content-Length and no body.
+            if (!response.headers.get(HeaderId::ContentLength))
+                response.headers.add("Content-Length",
+                                     std::to_string(response.file ? response.file->length : response.body.size()));
+            response.body.clear();
+            response.file.reset();
+        }
+        queueResponse(std::move(response), keep_alive, http10);
+        if (streamed)
+            out_.back().request_body = std::move(request.body_stream);
+    }
+    in_.erase(0, consumed);
+}
+
+void HttpSession::queueResponse(Response response, bool keep_alive, bool http10)
+{
+    if (!keep_alive)
+        close_after_flush_ = true;
+    if (response.stream)
+    {
+        // The stream writes the whole message. Its Connection header is the backend's;
+        // closing afterwards is allowed after any response, and is what an HTTP/1.0
+        // client expects without our keep-alive.
+        if (http10)
+            close_after_flush_ = true;
+        out_.emplace_back();
+        out_.back().stream = response.stream;
+        response.stream->start(loop_, wake_);
+        return;
+    }
+    std::string &bytes = outputBytes();
+    size_t before = bytes.size();
+    std::shared_ptr<const std::string> body;
+    size_t body_offset = 0;
+    std::string_view connection = connectionHeader(keep_alive, http10);
+    if (response.raw)
+    {
+        // Pre-serialized messages carry no Connection header of their own.
+        size_t used = appendRawHead(response, connection, bytes);
+        if (response.raw->size() - used < kInlineBody || response.raw_body)
+        {
+            bytes.append(*response.raw, used);
+        }
+        else
+        {
+            body_offset = used;
+            body = std::move(response.raw);
+        }
+        if (response.raw_body && response.raw_body->size() < kInlineBody)
+            bytes += *response.raw_body;
+        else if (response.raw_body)
+            body = std::move(response.raw_body);
+    }
+    else
+    {
+        // Whatever such a response carries would be read as the start of the next one.
+        int code = response.status_code;
+        if (code < 200 || code == 204 || code == 304)
+        {
+            response.body.clear();
+            response.file.reset();
+        }
+        writeResponseHead(response, bytes, connection);
+        if (!response.file && response.body.size() < kInlineBody)
+            bytes += response.body;
+        else if (!response.file)
+            body = std::make_shared<const std::string>(std::move(response.body));
+    }
+    pending_bytes_ += bytes.size() - before;
+
+    OutputChunk &chunk = out_.back();
+    if (body)
+    {
+        pending_bytes_ += body->size() - body_offset;
+        chunk.body = std::move(body);
+        chunk.body_offset = body_offset;
+    }
+    if (response.file && response.file->length > 0)
+    {
+        chunk.file_offset = response.file->offset;
+        chunk.file_remaining = response.file->length;
+        chunk.file = std::move(response.file);
+    }
+}
+
+std::string &HttpSession::outputBytes()
+{
+    if (out_.empty() || out_.back().body || out_.back().file || out_.back().stream)
+    {
+        out_.emplace_back();
+        if (spare_bytes_.capacity() < BufferPool::kBufferSize)
+            spare_bytes_ = BufferPool::acquire();
+        out_.back().bytes.swap(spare_bytes_);
+    }
+    return out_.back().bytes;
+}
+
+void HttpSession::queueError(int status_code, const char *status_message)
+{
+    queueResponse(Response{status_code, status_message, "HTTP/1.1", {}, status_message}, false);
+}
+
+bool HttpSession::flush()
+{
+    waiting_for_stream_ = false;
+    if (out_.empty())
+        return true;
+    StageTimer timer(Stage::Write);
+    while (!out_.empty())
+    {
+        OutputChunk &chunk = out_.front();
+        ssize_t written;
+        if (chunk.offset < chunk.bytes.size() || chunk.bodyRemaining() > 0)
+        {
+            written = writeQueuedBytes();
+            if (written > 0)
+                continue;
+        }
+        else if (chunk.file_remaining > 0)
+        {
+            written = conn_->send_file(chunk.file->fd, chunk.file_offset, chunk.file_remaining);
+            if (written > 0)
+            {
+                chunk.file_remaining -= written;
+                continue;
+            }
+        }
+        else if (chunk.stream)
+        {
+            ConnectionSink sink(*conn_);
+            ResponseStream::Status status = chunk.stream->send(sink);
+            if (status == ResponseStream::Status::Done)
+            {
+                if (chunk.request_body)
+                    chunk.request_body->discard(); // e.g. the backend answered before taking it all
+                out_.pop_front();
+                continue;
+            }
+            if (status == ResponseStream::Status::Failed)
+                return false;
+            waiting_for_stream_ = status == ResponseStream::Status::WantData;
+            break;
+        }
+        else
+        {
+            // Keep one buffer around for the next responses.
+            if (spare_bytes_.capacity() < chunk.bytes.capacity())
+            {
+                chunk.bytes.clear();
+                spare_bytes_.swap(chunk.bytes);
+            }
+            out_.pop_front();
+            continue;
+        }
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+    return true;
+}
+
+// Writes the heads and bodies queued in front of the next file or stream with one
+// writev and advances past what was written.
+ssize_t HttpSession::writeQueuedBytes()
+{
+    struct iovec iov[kMaxIov];
+    int count = 0;
+    for (OutputChunk &chunk : out_)
+    {
+        if (chunk.offset < chunk.bytes.size() && count < kMaxIov)
+            iov[count++] = {&chunk.bytes[chunk.offset], chunk.bytes.size() - chunk.offset};
+        if (chunk.bodyRemaining() > 0 && count < kMaxIov)
+            iov[count++] = {const_cast<char *>(chunk.body->data()) + chunk.body_offset, chunk.bodyRemaining()};
+        if (count == kMaxIov || chunk.file_remaining > 0 || chunk.stream)
+            break;
+    }
+    ssize_t written = conn_->writev(iov, count);
+    if (written <= 0)
+        return written;
+    pending_bytes_ -= written;
+    size_t left = written;
+    for (auto it = out_.begin(); left > 0; ++it)
+    {
+        size_t n = std::min(left, it->bytes.size() - it->offset);
+        it->offset += n;
+        left -= n;
+        n = std::min(left, it->bodyRemaining());
+        it->body_offset += n;
+        left -= n;
+    }
+    return written;
+}
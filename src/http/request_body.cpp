@@ -0,0 +1,50 @@
+#include "http/request_body.hpp"
+#include <algorithm>
+#include <cstdint>
+
+void RequestBody::append(const char *data, size_t len)
+{
+    received_ += len;
+    if (discarded_)
+    {
+        released_ += len;
+        return;
+    }
+    buffer_.append(data, len);
+}
+
+size_t RequestBody::space() const
+{
+    if (discarded_)
+        return SIZE_MAX;
+    size_t buffered = buffer_.size() - offset_;
+    return buffered < kCapacity ? kCapacity - buffered : 0;
+}
+
+void RequestBody::discard()
+{
+    if (discarded_)
+        return;
+    discarded_ = true;
+    released_ += buffer_.size() - offset_;
+    std::string().swap(buffer_);
+    offset_ = 0;
+}
+
+void RequestBody::consume(size_t n)
+{
+    n = std::min(n, buffer_.size() - offset_);
+    offset_ += n;
+    released_ += n;
+    if (offset_ == buffer_.size())
+    {
+        buffer_.clear();
+        offset_ = 0;
+    }
+    else if (offset_ >= kCapacity)
+    {
+        // The consumer lags behind by a piece; drop what it has taken.
+        buffer_.erase(0, offset_);
+        offset_ = 0;
+    }
+}
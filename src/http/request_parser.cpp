@@ -0,0 +1,282 @@
+#include "http/request_parser.hpp"
+#include "http/char_scan.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+std::string_view trimWhitespace(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Steps over CRLF or a bare LF.
+bool skipLineEnd(const char *&p, const char *end)
+{
+    if (p < end && *p == '\n')
+    {
+        ++p;
+        return true;
+    }
+    if (end - p >= 2 && p[0] == '\r' && p[1] == '\n')
+    {
+        p += 2;
+        return true;
+    }
+    return false;
+}
+
+bool parseContentLength(std::string_view value, size_t &length)
+{
+    if (value.empty() || value.size() > 18)
+        return false;
+    length = 0;
+    for (char c : value)
+    {
+        if (c < '0' || c > '9')
+            return false;
+        length = length * 10 + (c - '0');
+    }
+    return true;
+}
+
+} // namespace
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        unsigned char x = a[i], y = b[i];
+        if (x != y && ((x | 0x20) != (y | 0x20) || (x | 0x20) < 'a' || (x | 0x20) > 'z'))
+            return false;
+    }
+    return true;
+}
+
+const std::string_view *RequestView::header(std::string_view name) const
+{
+    HeaderId id = headerId(name);
+    for (size_t i = 0; i < num_headers; ++i)
+    {
+        if (id != HeaderId::Other ? headers[i].id == id : equalsIgnoreCase(headers[i].name, name))
+            return &headers[i].value;
+    }
+    return nullptr;
+}
+
+Request RequestView::toRequest(std::pmr::memory_resource *resource) const
+{
+    Request request{std::pmr::string(method, resource), std::pmr::string(path, resource),
+                    std::pmr::string(version, resource), Headers(resource), std::pmr::string(body, resource)};
+    size_t bytes = 0;
+    for (size_t i = 0; i < num_headers; ++i)
+        bytes += headers[i].name.size() + headers[i].value.size();
+    request.headers.reserve(num_headers, bytes);
+    for (size_t i = 0; i < num_headers; ++i)
+        request.headers.add(headers[i].name, headers[i].value, headers[i].id);
+    return request;
+}
+
+RequestParser::RequestParser(size_t max_request_size, size_t max_buffered_body, uint64_t max_body_size)
+    : max_request_size_(max_request_size), max_buffered_body_(max_buffered_body), max_body_size_(max_body_size)
+{
+}
+
+void RequestParser::reset()
+{
+    request_.num_headers = 0;
+    start_ = line_start_ = scan_pos_ = head_end_ = 0;
+    content_length_ = 0;
+    has_content_length_ = false;
+    streamed_ = false;
+    head_base_ = nullptr;
+    error_code_ = 0;
+    error_message_ = "";
+}
+
+RequestParser::Status RequestParser::parse(std::string_view buffer)
+{
+    if (error_code_ != 0)
+        return Status::Error;
+
+    if (head_end_ == 0)
+    {
+        if (!findHeadEnd(buffer))
+        {
+            if (error_code_ != 0)
+                return Status::Error;
+            if (scan_pos_ - start_ > max_request_size_)
+                return fail(431, "Request Header Fields Too Large");
+            return Status::NeedMore;
+        }
+        if (!parseHead(buffer))
+            return Status::Error;
+        streamed_ = content_length_ > max_buffered_body_;
+        if (streamed_ && content_length_ > max_body_size_)
+            return fail(413, "Payload Too Large");
+        if (streamed_)
+            return Status::Complete;
+        if (content_length_ > max_request_size_ - std::min(max_request_size_, head_end_ - start_))
+            return fail(413, "Payload Too Large");
+    }
+
+    if (buffer.size() < head_end_ + content_length_)
+        return Status::NeedMore;
+
+    // The caller's buffer may have been reallocated while the body was arriving.
+    if (head_base_ != buffer.data())
+        parseHead(buffer);
+    request_.body = buffer.substr(head_end_, content_length_);
+    return Status::Complete;
+}
+
+bool RequestParser::findHeadEnd(std::string_view buffer)
+{
+    while (scan_pos_ < buffer.size())
+    {
+        const void *found = std::memchr(buffer.data() + scan_pos_, '\n', buffer.size() - scan_pos_);
+        if (!found)
+        {
+            scan_pos_ = buffer.size();
+            return false;
+        }
+        size_t line_end = static_cast<const char *>(found) - buffer.data();
+        bool empty = line_end == line_start_ || (line_end == line_start_ + 1 && buffer[line_start_] == '\r');
+        scan_pos_ = line_end + 1;
+        if (empty)
+        {
+            if (line_start_ == start_)
+            {
+                // Empty lines before the request line are ignored (RFC 9112 section 2.2).
+                start_ = line_start_ = scan_pos_;
+                if (start_ > max_request_size_)
+                {
+                    fail(400, "Bad Request");
+                    return false;
+                }
+                continue;
+            }
+            head_end_ = scan_pos_;
+            return true;
+        }
+        line_start_ = scan_pos_;
+    }
+    return false;
+}
+
+bool RequestParser::parseHead(std::string_view buffer)
+{
+    head_base_ = buffer.data();
+    request_.num_headers = 0;
+    content_length_ = 0;
+    has_content_length_ = false;
+
+    const char *p = buffer.data() + start_;
+    const char *end = buffer.data() + head_end_;
+    if (!parseRequestLine(p, end))
+        return false;
+    // The head ends with an empty line, so every header line is followed by one.
+    while (!(*p == '\n' || (*p == '\r' && p[1] == '\n')))
+    {
+        if (!parseHeaderLine(p, end))
+            return false;
+    }
+    return true;
+}
+
+bool RequestParser::parseRequestLine(const char *&p, const char *end)
+{
+    const char *method_end = scanWhile(CharClass::Token, p, end);
+    if (method_end == p || method_end == end || *method_end != ' ')
+    {
+        fail(400, "Bad Request");
+        return false;
+    }
+    request_.method = std::string_view(p, method_end - p);
+
+    p = method_end + 1;
+    const char *target_end = scanWhile(CharClass::RequestTarget, p, end);
+    if (target_end == p || target_end == end || *target_end != ' ')
+    {
+        fail(400, "Bad Request");
+        return false;
+    }
+    request_.path = std::string_view(p, target_end - p);
+
+    p = target_end + 1;
+    const char *version_end = scanWhile(CharClass::RequestTarget, p, end);
+    request_.version = std::string_view(p, version_end - p);
+    p = version_end;
+    if (!skipLineEnd(p, end) || request_.version.size() != 8 || request_.version.substr(0, 5) != "HTTP/")
+    {
+        fail(400, "Bad Request");
+        return false;
+    }
+    if (request_.version != "HTTP/1.1" && request_.version != "HTTP/1.0")
+    {
+        fail(505, "HTTP Version Not Supported");
+        return false;
+    }
+    return true;
+}
+
+bool RequestParser::parseHeaderLine(const char *&p, const char *end)
+{
+    // A line starting with whitespace (obsolete line folding) fails here as well.
+    const char *name_end = scanWhile(CharClass::Token, p, end);
+    if (name_end == p || name_end == end || *name_end != ':')
+    {
+        fail(400, "Bad Request");
+        return false;
+    }
+    if (request_.num_headers == RequestView::kMaxHeaders)
+    {
+        fail(431, "Request Header Fields Too Large");
+        return false;
+    }
+    HeaderView &header = request_.headers[request_.num_headers++];
+    header.name = std::string_view(p, name_end - p);
+    header.id = headerId(header.name);
+
+    const char *value_end = scanWhile(CharClass::FieldValue, name_end + 1, end);
+    header.value = trimWhitespace(std::string_view(name_end + 1, value_end - name_end - 1));
+    p = value_end;
+    // Anything but the line end here is a control character inside the value.
+    if (!skipLineEnd(p, end))
+    {
+        fail(400, "Bad Request");
+        return false;
+    }
+
+    if (equalsIgnoreCase(header.name, "Content-Length"))
+    {
+        size_t length = 0;
+        if (!parseContentLength(header.value, length) || (has_content_length_ && length != content_length_))
+        {
+            fail(400, "Bad Request");
+            return false;
+        }
+        content_length_ = length;
+        has_content_length_ = true;
+    }
+    else if (equalsIgnoreCase(header.name, "Transfer-Encoding"))
+    {
+        fail(501, "Not Implemented");
+        return false;
+    }
+    return true;
+}
+
+RequestParser::Status RequestParser::fail(int code, const char *message)
+{
+    error_code_ = code;
+    error_message_ = message;
+    return Status::Error;
+}
@@ -0,0 +1,496 @@
+#include "http/response_cache.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "http/request_parser.hpp"
+#include "core/event_loop.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
+
+namespace {
+
+std::string trim(std::string_view s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string_view::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return std::string(s.substr(begin, end - begin + 1));
+}
+
+std::string lower(std::string s) {
+    for (char& c : s) {
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+// Comma-separated list elements, trimmed and lower-cased; empty elements are dropped.
+std::vector<std::string> splitList(std::string_view value) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        if (comma == std::string_view::npos) {
+            comma = value.size();
+        }
+        std::string item = lower(trim(value.substr(start, comma - start)));
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+        start = comma + 1;
+    }
+    return items;
+}
+
+struct CacheControl {
+    bool no_store = false;
+    bool no_cache = false;
+    bool is_private = false;
+    bool is_public = false;
+    long max_age = -1;
+    long s_maxage = -1;
+    long stale_while_revalidate = -1;
+};
+
+CacheControl parseCacheControl(const std::string_view* value) {
+    CacheControl cc;
+    if (!value) {
+        return cc;
+    }
+    for (const std::string& directive : splitList(*value)) {
+        size_t eq = directive.find('=');
+        std::string name = trim(std::string_view(directive).substr(0, eq));
+        std::string arg = eq == std::string::npos ? "" : trim(std::string_view(directive).substr(eq + 1));
+        if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') {
+            arg = arg.substr(1, arg.size() - 2);
+        }
+        long seconds = -1;
+        if (!arg.empty() && std::all_of(arg.begin(), arg.end(), ::isdigit)) {
+            seconds = std::strtol(arg.c_str(), nullptr, 10);
+        }
+        if (name == "no-store") {
+            cc.no_store = true;
+        } else if (name == "no-cache") {
+            cc.no_cache = true;
+        } else if (name == "private") {
+            cc.is_private = true;
+        } else if (name == "public") {
+            cc.is_public = true;
+        } else if (name == "max-age") {
+            cc.max_age = seconds;
+        } else if (name == "s-maxage") {
+            cc.s_maxage = seconds;
+        } else if (name == "stale-while-revalidate") {
+            cc.stale_while_revalidate = seconds;
+        }
+    }
+    return cc;
+}
+
+// Status codes RFC 9110 lets a cache store; anything else goes straight through.
+bool cacheableStatus(int status_code) {
+    switch (status_code) {
+    case 200: case 203: case 204: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Headers that describe the origin connection rather than the response, plus the
+// ones render() writes itself.
+bool skipStoredHeader(std::string_view name) {
+    static const char* const names[] = {
+        "connection", "keep-alive", "proxy-connection", "te", "trailer", "transfer-encoding",
+        "upgrade", "age", "content-length",
+    };
+    for (const char* n : names) {
+        if (equalsIgnoreCase(name, n)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string primaryKey(const Request& request) {
+    const std::string_view* host = request.headers.get(HeaderId::Host);
+    std::string key = "GET " + (host ? lower(std::string(*host)) : std::string());
+    key.append(request.path);
+    return key;
+}
+
+std::string secondaryKey(const std::string& primary, const std::vector<std::string>& vary, const Request& request) {
+    std::string key = primary;
+    for (const std::string& name : vary) {
+        const std::string_view* value = request.headers.get(name);
+        key += '\n';
+        key += name;
+        key += ':';
+        if (value) {
+            key += trim(*value);
+        }
+    }
+    return key;
+}
+
+struct StorePolicy {
+    bool storable = false;
+    long fresh_for = 0;
+    long stale_for = 0;
+    std::vector<std::string> vary; // lower-case header names
+};
+
+// Whether a shared cache may store response to request, and for how long. Only needs
+// the status and headers.
+StorePolicy storePolicy(const Request& request, const Response& response) {
+    StorePolicy policy;
+    if (!cacheableStatus(response.status_code)) {
+        return policy;
+    }
+    CacheControl cc = parseCacheControl(response.headers.get(HeaderId::CacheControl));
+    if (cc.no_store || cc.no_cache || cc.is_private) {
+        return policy;
+    }
+    // Answers to authorized requests are only shared when the origin says so.
+    if (request.headers.get(HeaderId::Authorization) && !cc.is_public && cc.s_maxage < 0) {
+        return policy;
+    }
+    // A cookie set for one client must not be handed to the next.
+    if (response.headers.get(HeaderId::SetCookie)) {
+        return policy;
+    }
+    policy.fresh_for = cc.s_maxage >= 0 ? cc.s_maxage : cc.max_age;
+    policy.stale_for = std::max(cc.stale_while_revalidate, 0L);
+    if (policy.fresh_for < 0 || policy.fresh_for + policy.stale_for == 0) {
+        return policy;
+    }
+    if (const std::string_view* value = response.headers.get(HeaderId::Vary)) {
+        policy.vary = splitList(*value);
+        if (std::find(policy.vary.begin(), policy.vary.end(), "*") != policy.vary.end()) {
+            return policy;
+        }
+    }
+    policy.storable = true;
+    return policy;
+}
+
+} // namespace
+
+// Watches a streamed origin response: stores the copy, or for unsafe methods drops what
+// is stored for the target. With a flight key it also ends that flight once the
+// response is over (or the copy was given up), which wakes the waiting requests.
+class ResponseCache::StoreTee : public ResponseTee {
+public:
+    StoreTee(ResponseCache& cache, std::string flight, std::string primary, const Request& request,
+             bool invalidate = false)
+        : cache_(cache), flight_(std::move(flight)), primary_(std::move(primary)), request_(request),
+          invalidate_(invalidate) {}
+
+    ~StoreTee() override {
+        if (!flight_.empty()) {
+            cache_.finishFlight(flight_);
+        }
+    }
+
+    size_t begin(const Response& head) override {
+        if (invalidate_) {
+            if (head.status_code >= 200 && head.status_code < 400) {
+                cache_.entries_.erase(primary_);
+            }
+            return 0;
+        }
+        return storePolicy(request_, head).storable ? cache_.entries_.maxValueSize() : 0;
+    }
+
+    void complete(const Response& response) override {
+        cache_.store(primary_, request_, response);
+    }
+
+private:
+    ResponseCache& cache_;
+    std::string flight_;
+    std::string primary_;
+    Request request_;
+    bool invalidate_;
+};
+
+// A miss that found another request's origin response in flight. Waits for it to end,
+// then answers from the cache, or, if nothing usable was stored, streams its own.
+class ResponseCache::WaitStream : public ResponseStream {
+public:
+    WaitStream(ResponseCache& cache, std::string primary, const Request& request)
+        : cache_(cache), primary_(std::move(primary)), request_(request) {}
+
+    // Called by the flight, on any thread.
+    void ready() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_ = true;
+        if (loop_) {
+            loop_->post(wake_);
+        }
+    }
+
+    void start(EventLoop& loop, std::function<void()> wake) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        loop_ = &loop;
+        wake_ = std::move(wake);
+        if (ready_) {
+            loop_->post(wake_);
+        }
+    }
+
+    Status send(ResponseSink& sink) override {
+        if (inner_) {
+            return inner_->send(sink);
+        }
+        if (!found_.raw) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!ready_) {
+                    return Status::WantData;
+                }
+            }
+            Response response = cache_.serveStored(primary_, request_);
+            if (!response.raw) {
+                response = cache_.stream_(request_, std::make_shared<StoreTee>(cache_, "", primary_, request_));
+                if (!response.stream) {
+                    return Status::Failed;
+                }
+                inner_ = std::move(response.stream);
+                inner_->start(*loop_, wake_);
+                return inner_->send(sink);
+            }
+            found_ = std::move(response);
+        }
+        std::string_view pieces[] = {*found_.raw, found_.raw_fields,
+                                     found_.raw_body ? std::string_view(*found_.raw_body) : std::string_view()};
+        for (; piece_ < std::size(pieces); ++piece_, offset_ = 0) {
+            while (offset_ < pieces[piece_].size()) {
+                ssize_t n = sink.write(pieces[piece_].data() + offset_, pieces[piece_].size() - offset_);
+                if (n > 0) {
+                    offset_ += n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? Status::WantWrite : Status::Failed;
+            }
+        }
+        return Status::Done;
+    }
+
+private:
+    ResponseCache& cache_;
+    std::string primary_;
+    Request request_;
+
+    std::mutex mutex_;
+    bool ready_ = false;
+    EventLoop* loop_ = nullptr;
+    std::function<void()> wake_;
+
+    Response found_; // the stored response: raw, raw_fields and raw_body, written in turn
+    size_t piece_ = 0;
+    size_t offset_ = 0;
+    std::shared_ptr<ResponseStream> inner_;
+};
+
+ResponseCache::ResponseCache(size_t max_bytes, Fetch fetch, Stream stream, size_t revalidate_workers)
+    : entries_(max_bytes), fetch_(std::move(fetch)), stream_(std::move(stream)), revalidate_pool_(revalidate_workers) {}
+
+Response ResponseCache::serve(const Request& request) {
+    bool head = request.method == "HEAD";
+    if (request.method != "GET" && !head) {
+        // A successful unsafe request invalidates what is stored for its target.
+        return stream_(request, std::make_shared<StoreTee>(*this, "", primaryKey(request), request, true));
+    }
+
+    std::string primary = primaryKey(request);
+    CacheControl request_cc = parseCacheControl(request.headers.get(HeaderId::CacheControl));
+    if (request_cc.no_store || request_cc.no_cache) {
+        if (head || request_cc.no_store) {
+            return stream_(request, nullptr);
+        }
+        return stream_(request, std::make_shared<StoreTee>(*this, "", primary, request));
+    }
+
+    Found found;
+    {
+        StageTimer timer(Stage::CacheLookup);
+        found = lookup(primary, request);
+    }
+    if (found.entry) {
+        long entry_age = age(*found.entry);
+        if (entry_age < found.entry->fresh_for) {
+            Metrics::add(Counter::CacheHits);
+            return render(*found.entry, entry_age);
+        }
+        if (entry_age < found.entry->fresh_for + found.entry->stale_for) {
+            Metrics::add(Counter::CacheHits);
+            revalidate(found.key, primary, request);
+            {
+                std::lock_guard<std::mutex> lock(flights_mutex_);
+                ++stale_;
+            }
+            return render(*found.entry, entry_age);
+        }
+    }
+    Metrics::add(Counter::CacheMisses);
+    if (head) {
+        return stream_(request, nullptr);
+    }
+    return streamMiss(found.key, primary, request);
+}
+
+ResponseCache::Found ResponseCache::lookup(const std::string& primary, const Request& request) {
+    Found found{primary, entries_.get(primary)};
+    if (found.entry && !found.entry->vary.empty()) {
+        found.key = secondaryKey(primary, found.entry->vary, request);
+        found.entry = entries_.get(found.key);
+    }
+    return found;
+}
+
+// The stored response if it may still be served (fresh or within its stale window),
+// otherwise a response without raw.
+Response ResponseCache::serveStored(const std::string& primary, const Request& request) {
+    Found found = lookup(primary, request);
+    if (found.entry) {
+        long entry_age = age(*found.entry);
+        if (entry_age < found.entry->fresh_for + found.entry->stale_for) {
+            return render(*found.entry, entry_age);
+        }
+    }
+    return Response();
+}
+
+Response ResponseCache::streamMiss(const std::string& key, const std::string& primary, const Request& request) {
+    std::shared_ptr<WaitStream> waiter;
+    {
+        std::lock_guard<std::mutex> lock(flights_mutex_);
+        auto it = flights_.find(key);
+        if (it == flights_.end()) {
+            flights_.emplace(key, std::make_shared<Flight>());
+        } else {
+            waiter = std::make_shared<WaitStream>(*this, primary, request);
+            std::weak_ptr<WaitStream> weak = waiter;
+            it->second->waiters.push_back([weak] {
+                if (auto w = weak.lock()) {
+                    w->ready();
+                }
+            });
+            ++coalesced_;
+        }
+    }
+    if (waiter) {
+        Response response{502, "Bad Gateway", "HTTP/1.1", {}, ""};
+        response.stream = std::move(waiter);
+        return response;
+    }
+    // The tee ends the flight, however the response ends.
+    return stream_(request, std::make_shared<StoreTee>(*this, key, primary, request));
+}
+
+void ResponseCache::revalidate(const std::string& key, const std::string& primary, const Request& request) {
+    {
+        std::lock_guard<std::mutex> lock(flights_mutex_);
+        if (!flights_.emplace(key, std::make_shared<Flight>()).second) {
+            return; // already being fetched
+        }
+        ++revalidations_;
+    }
+    revalidate_pool_.submit([this, key, primary, request] {
+        try {
+            store(primary, request, fetch_(request));
+        } catch (const std::exception& e) {
+            LOG_WARN("Revalidating {} failed: {}", request.path, e.what());
+        }
+        finishFlight(key);
+    });
+}
+
+void ResponseCache::store(const std::string& primary, const Request& request, const Response& response) {
+    if (response.raw || response.file || response.stream) {
+        return;
+    }
+    StorePolicy policy = storePolicy(request, response);
+    if (!policy.storable) {
+        return;
+    }
+
+    auto entry = std::make_shared<Entry>();
+    entry->status_code = response.status_code;
+    std::string head = "HTTP/1.1 " + std::to_string(response.status_code) + " " + response.status_message + "\r\n";
+    for (const auto& header : response.headers) {
+        if (!skipStoredHeader(header.name)) {
+            head.append(header.name).append(": ").append(header.value).append("\r\n");
+        }
+    }
+    // A 204 has no body and must not say so (RFC 9110 section 8.6).
+    if (response.status_code != 204) {
+        head += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+    }
+    entry->head = std::make_shared<const std::string>(std::move(head));
+    entry->body = std::make_shared<const std::string>(response.body);
+    entry->stored_at = Clock::now();
+    if (const std::string_view* value = response.headers.get(HeaderId::Age)) {
+        entry->initial_age = std::max(std::strtol(std::string(*value).c_str(), nullptr, 10), 0L);
+    }
+    entry->fresh_for = policy.fresh_for;
+    entry->stale_for = policy.stale_for;
+
+    if (policy.vary.empty()) {
+        entries_.put(primary, std::move(entry));
+    } else {
+        std::string key = secondaryKey(primary, policy.vary, request);
+        auto marker = std::make_shared<Entry>();
+        marker->vary = std::move(policy.vary);
+        entries_.put(primary, std::move(marker));
+        entries_.put(key, std::move(entry));
+    }
+}
+
+void ResponseCache::finishFlight(const std::string& key) {
+    std::shared_ptr<Flight> flight;
+    {
+        std::lock_guard<std::mutex> lock(flights_mutex_);
+        auto it = flights_.find(key);
+        if (it == flights_.end()) {
+            return;
+        }
+        flight = std::move(it->second);
+        flights_.erase(it);
+    }
+    for (const auto& waiter : flight->waiters) {
+        waiter();
+    }
+}
+
+long ResponseCache::age(const Entry& entry) {
+    auto resident = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - entry.stored_at);
+    return entry.initial_age + static_cast<long>(resident.count());
+}
+
+Response ResponseCache::render(const Entry& entry, long age) {
+    // Only the Age line is built per hit; the head and body go out by reference.
+    Response response{entry.status_code, "", "HTTP/1.1", {}, ""};
+    response.raw = entry.head;
+    response.raw_fields = "Age: " + std::to_string(age) + "\r\n\r\n";
+    response.raw_body = entry.body;
+    return response;
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    Stats stats;
+    stats.store = entries_.stats();
+    std::lock_guard<std::mutex> lock(flights_mutex_);
+    stats.coalesced = coalesced_;
+    stats.stale = stale_;
+    stats.revalidations = revalidations_;
+    return stats;
+}
@@ -0,0 +1,128 @@
+#include "http/response_writer.hpp"
+#include <charconv>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+
+const char kServerLine[] = "Server: BlazeHTTP\r\n";
+
+struct StatusLine
+{
+    int code;
+    std::string_view reason;
+    std::string_view line;
+};
+
+const StatusLine kStatusLines[] = {
+    {200, "OK", "HTTP/1.1 200 OK\r\n"},
+    {201, "Created", "HTTP/1.1 201 Created\r\n"},
+    {204, "No Content", "HTTP/1.1 204 No Content\r\n"},
+    {206, "Partial Content", "HTTP/1.1 206 Partial Content\r\n"},
+    {301, "Moved Permanently", "HTTP/1.1 301 Moved Permanently\r\n"},
+    {302, "Found", "HTTP/1.1 302 Found\r\n"},
+    {304, "Not Modified", "HTTP/1.1 304 Not Modified\r\n"},
+    {400, "Bad Request", "HTTP/1.1 400 Bad Request\r\n"},
+    {403, "Forbidden", "HTTP/1.1 403 Forbidden\r\n"},
+    {404, "Not Found", "HTTP/1.1 404 Not Found\r\n"},
+    {405, "Method Not Allowed", "HTTP/1.1 405 Method Not Allowed\r\n"},
+    {413, "Payload Too Large", "HTTP/1.1 413 Payload Too Large\r\n"},
+    {431, "Request Header Fields Too Large", "HTTP/1.1 431 Request Header Fields Too Large\r\n"},
+    {500, "Internal Server Error", "HTTP/1.1 500 Internal Server Error\r\n"},
+    {502, "Bad Gateway", "HTTP/1.1 502 Bad Gateway\r\n"},
+    {503, "Service Unavailable", "HTTP/1.1 503 Service Unavailable\r\n"},
+    {504, "Gateway Timeout", "HTTP/1.1 504 Gateway Timeout\r\n"},
+};
+
+void appendStatusLine(const Response &response, std::string &out)
+{
+    if (response.version == "HTTP/1.1")
+    {
+        for (const StatusLine &status : kStatusLines)
+        {
+            if (status.code == response.status_code && status.reason == response.status_message)
+            {
+                out += status.line;
+                return;
+            }
+        }
+    }
+    char code[16];
+    char *end = std::to_chars(code, code + sizeof(code), response.status_code).ptr;
+    out.append(response.version).append(1, ' ').append(code, end - code).append(1, ' ');
+    out.append(response.status_message).append("\r\n");
+}
+
+// "Date: <IMF-fixdate>\r\n" for the current second, followed by the Server line.
+struct DateLine
+{
+    time_t second = -1;
+    char line[96];
+    size_t length = 0;
+
+    std::string_view current() { return withServer().substr(0, length); }
+
+    std::string_view withServer()
+    {
+        time_t now = time(nullptr);
+        if (now != second)
+        {
+            struct tm tm;
+            gmtime_r(&now, &tm);
+            length = strftime(line, sizeof(line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+            std::memcpy(line + length, kServerLine, sizeof(kServerLine) - 1);
+            second = now;
+        }
+        return std::string_view(line, length + sizeof(kServerLine) - 1);
+    }
+};
+
+thread_local DateLine date_line;
+
+} // namespace
+
+std::string_view cachedHttpDate()
+{
+    std::string_view line = date_line.current();
+    return line.substr(6, line.size() - 8); // without "Date: " and CRLF
+}
+
+std::string_view cachedDateAndServerLines()
+{
+    return date_line.withServer();
+}
+
+void writeResponseHead(const Response &response, std::string &out, std::string_view extra_headers)
+{
+    appendStatusLine(response, out);
+    bool has_date = false;
+    bool has_server = false;
+    bool has_length = false;
+    for (const auto &header : response.headers)
+    {
+        has_date = has_date || header.id == HeaderId::Date;
+        has_server = has_server || header.id == HeaderId::Server;
+        has_length = has_length || header.id == HeaderId::ContentLength || header.id == HeaderId::TransferEncoding;
+        out.append(header.name).append(": ").append(header.value).append("\r\n");
+    }
+    if (!has_date)
+        out += date_line.current();
+    if (!has_server)
+        out += kServerLine;
+    // 1xx, 204 and 304 responses have no body, and 204 and 1xx must not carry the header
+    // (RFC 9110 section 8.6).
+    int code = response.status_code;
+    bool bodiless = code < 200 || code == 204 || code == 304;
+    if (!has_length && !bodiless)
+    {
+        // Required for the client to find the end of the body on a keep-alive connection.
+        char length[24];
+        char *end = std::to_chars(length, length + sizeof(length),
+                                  response.file ? response.file->length : response.body.size())
+                        .ptr;
+        out.append("Content-Length: ").append(length, end - length).append("\r\n");
+    }
+    out += extra_headers;
+    out += "\r\n";
+}
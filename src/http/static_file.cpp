@@ -1,26 +1,645 @@
 #include "http/static_file.hpp"
-#include <fstream>
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "http/request_parser.hpp"
 #include <stdexcept>
-#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef BLAZE_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
-StaticFile::StaticFile(const std::string& root_dir) : root_dir_(root_dir) {}
+namespace {
 
-Response StaticFile::serve(const std::string& path) {
-    std::cout << "Serving static file for path: " << path << std::endl;
+const char* mimeType(const std::string& path) {
+    static const std::unordered_map<std::string, const char*> types = {
+        {"html", "text/html; charset=utf-8"},
+        {"htm", "text/html; charset=utf-8"},
+        {"css", "text/css; charset=utf-8"},
+        {"js", "text/javascript; charset=utf-8"},
+        {"mjs", "text/javascript; charset=utf-8"},
+        {"json", "application/json"},
+        {"map", "application/json"},
+        {"txt", "text/plain; charset=utf-8"},
+        {"xml", "application/xml"},
+        {"svg", "image/svg+xml"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"webp", "image/webp"},
+        {"avif", "image/avif"},
+        {"ico", "image/x-icon"},
+        {"woff", "font/woff"},
+        {"woff2", "font/woff2"},
+        {"ttf", "font/ttf"},
+        {"otf", "font/otf"},
+        {"wasm", "application/wasm"},
+        {"pdf", "application/pdf"},
+        {"mp4", "video/mp4"},
+        {"webm", "video/webm"},
+        {"mp3", "audio/mpeg"},
+        {"zip", "application/zip"},
+    };
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+        return "application/octet-stream";
+    }
+    std::string ext = path.substr(dot + 1);
+    for (char& c : ext) {
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    auto it = types.find(ext);
+    return it == types.end() ? "application/octet-stream" : it->second;
+}
+
+std::string httpDate(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buffer[64];
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+bool parseHttpDate(const std::string& value, time_t& t) {
+    struct tm tm {};
+    const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') {
+        return false;
+    }
+    t = timegm(&tm);
+    return true;
+}
+
+// If-None-Match uses the weak comparison: W/ prefixes are ignored.
+bool etagListMatches(std::string_view list, const std::string& etag) {
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string_view::npos) {
+            comma = list.size();
+        }
+        std::string_view item(list.data() + pos, comma - pos);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+            item.remove_prefix(1);
+        }
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+            item.remove_suffix(1);
+        }
+        if (item.substr(0, 2) == "W/") {
+            item.remove_prefix(2);
+        }
+        if (item == "*" || item == etag) {
+            return true;
+        }
+        pos = comma + 1;
+    }
+    return false;
+}
+
+// Indexed by StaticFile's Encoding.
+const char* const kEncodingName[] = {"identity", "gzip", "br"};
+const char* const kEncodingSuffix[] = {"", ".gz", ".br"};
+
+// Below this, headers dwarf the savings; above it, a variant would keep the compression
+// thread busy for too long.
+const size_t kMinCompressSize = 256;
+const size_t kMaxCompressSize = 16 << 20;
+
+// Variants are written under this prefix and renamed into place. Such names are never
+// served and their churn does not invalidate the index.
+const std::string_view kTempPrefix = ".blaze-tmp.";
 
-    std::string requested_path = path;
-    if (requested_path == "/" || requested_path.empty()) {
-        requested_path = "/index.html"; 
+bool isTempName(std::string_view name) {
+    return name.substr(0, kTempPrefix.size()) == kTempPrefix;
+}
+
+bool isCompressible(const char* mime_type) {
+    std::string_view type(mime_type);
+    return type.substr(0, 5) == "text/" || type == "application/json" || type == "application/xml" ||
+           type == "image/svg+xml" || type == "application/wasm" || type == "image/x-icon" || type == "font/ttf" ||
+           type == "font/otf";
+}
+
+bool olderThan(const struct stat& a, const struct stat& b) {
+#ifdef __APPLE__
+    const struct timespec &ta = a.st_mtimespec, &tb = b.st_mtimespec;
+#else
+    const struct timespec &ta = a.st_mtim, &tb = b.st_mtim;
+#endif
+    return ta.tv_sec < tb.tv_sec || (ta.tv_sec == tb.tv_sec && ta.tv_nsec < tb.tv_nsec);
+}
+
+bool gzipCompress(const std::string& in, std::string& out) {
+    z_stream stream{};
+    // 15 + 16: a gzip wrapper instead of zlib's.
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&stream, in.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    stream.avail_in = static_cast<uInt>(in.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return rc == Z_STREAM_END;
+}
+
+bool brotliCompress(const std::string& in, std::string& out) {
+#ifdef BLAZE_HAVE_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize(in.size());
+    out.resize(size);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, in.size(),
+                               reinterpret_cast<const uint8_t*>(in.data()), &size,
+                               reinterpret_cast<uint8_t*>(&out[0]))) {
+        return false;
     }
+    out.resize(size);
+    return true;
+#else
+    (void)in;
+    (void)out;
+    return false;
+#endif
+}
+
+// q-value the Accept-Encoding list gives coding: its own entry, else "*", else -1.
+double codingQuality(std::string_view accept_encoding, std::string_view coding) {
+    double star = -1;
+    size_t pos = 0;
+    while (pos < accept_encoding.size()) {
+        size_t comma = accept_encoding.find(',', pos);
+        if (comma == std::string_view::npos) {
+            comma = accept_encoding.size();
+        }
+        std::string_view item(accept_encoding.data() + pos, comma - pos);
+        pos = comma + 1;
+
+        size_t semicolon = item.find(';');
+        std::string_view name = item.substr(0, semicolon);
+        while (!name.empty() && (name.front() == ' ' || name.front() == '\t')) {
+            name.remove_prefix(1);
+        }
+        while (!name.empty() && (name.back() == ' ' || name.back() == '\t')) {
+            name.remove_suffix(1);
+        }
+        double q = 1.0;
+        if (semicolon != std::string_view::npos) {
+            std::string_view param = item.substr(semicolon + 1);
+            size_t eq = param.find('=');
+            if (eq != std::string_view::npos) {
+                q = strtod(std::string(param.substr(eq + 1)).c_str(), nullptr);
+            }
+        }
+        if (equalsIgnoreCase(name, coding)) {
+            return q;
+        }
+        if (name == "*") {
+            star = q;
+        }
+    }
+    return star;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
 
-    std::string full_path = root_dir_ + requested_path;
-    std::ifstream file(full_path, std::ios::binary);
-    if (!file.is_open()) {
-        std::cout << "File not found: " << full_path << std::endl;
+StaticFile::StaticFile(const std::string& root_dir, size_t max_open_files, size_t compress_workers)
+    : root_dir_(root_dir), max_open_files_(max_open_files), compress_pool_(compress_workers) {
+    char resolved[PATH_MAX];
+    if (realpath(root_dir.c_str(), resolved)) {
+        root_dir_ = resolved;
+    }
+#ifdef __linux__
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ == -1) {
+        LOG_WARN("inotify unavailable, static files will not be cached: {}", strerror(errno));
+        return;
+    }
+    watchTree("");
+    watching_ = !watches_.empty();
+    watch_loop_ = std::make_unique<EventLoop>();
+    watch_loop_->addFd(inotify_fd_, EPOLLIN, [this](int, uint32_t) { onWatchEvents(); });
+    watch_thread_ = std::thread([this] { watch_loop_->run(); });
+#endif
+}
+
+StaticFile::~StaticFile() {
+    if (watch_loop_) {
+        watch_loop_->stop();
+        watch_thread_.join();
+    }
+    if (inotify_fd_ != -1) {
+        close(inotify_fd_);
+    }
+}
+
+std::string StaticFile::normalizePath(std::string_view target) {
+    size_t end = target.find_first_of("?#");
+    if (end == std::string_view::npos) {
+        end = target.size();
+    }
+    if (end == 0 || target[0] != '/') {
+        return "";
+    }
+
+    std::vector<std::string> segments;
+    std::string segment;
+    for (size_t i = 1; i <= end; ++i) {
+        if (i == end || target[i] == '/') {
+            if (isTempName(segment)) {
+                return "";
+            }
+            if (segment == "..") {
+                if (segments.empty()) {
+                    return ""; // would climb out of the root
+                }
+                segments.pop_back();
+            } else if (!segment.empty() && segment != ".") {
+                segments.push_back(std::move(segment));
+            }
+            segment.clear();
+            continue;
+        }
+        char c = target[i];
+        if (c == '%') {
+            int hi = i + 2 < end ? hexValue(target[i + 1]) : -1;
+            int lo = hi >= 0 ? hexValue(target[i + 2]) : -1;
+            if (lo < 0) {
+                return "";
+            }
+            c = static_cast<char>(hi << 4 | lo);
+            i += 2;
+            // An encoded separator or NUL must not turn into one.
+            if (c == '/' || c == '\0') {
+                return "";
+            }
+        }
+        segment += c;
+    }
+
+    std::string path;
+    for (const std::string& s : segments) {
+        path += '/';
+        path += s;
+    }
+    return path.empty() ? "/" : path;
+}
+
+Response StaticFile::serve(const Request& request) {
+    StageTimer timer(Stage::StaticFile);
+    LOG_DEBUG("Serving static file for path: {}", request.path);
+
+    std::string path = normalizePath(request.path);
+    if (path.empty()) {
+        return Response{400, "Bad Request", "HTTP/1.1", {}, "Bad Request"};
+    }
+    std::shared_ptr<const Entry> entry = lookup(path);
+    if (!entry) {
+        LOG_DEBUG("File not found: {}{}", root_dir_, path);
         return Response{404, "Not Found", "HTTP/1.1", {}, "File not found"};
     }
 
-    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    std::cout << "Serving file content: " << content << std::endl;
-    return Response{200, "OK", "HTTP/1.1", {{"Content-Type", "text/html"}}, content};
-}
\ No newline at end of file
+    const Variant& variant = entry->variants[chooseEncoding(request, *entry)];
+    if (notModified(request, *entry, variant)) {
+        Response response{304, "Not Modified", "HTTP/1.1", {}, ""};
+        response.raw = variant.not_modified;
+        response.raw_add_date = true;
+        return response;
+    }
+    Response response{200, "OK", "HTTP/1.1", {}, ""};
+    response.raw = variant.head;
+    response.raw_add_date = true;
+    response.file = variant.body;
+    return response;
+}
+
+std::shared_ptr<const StaticFile::Entry> StaticFile::lookup(const std::string& path) {
+    uint64_t generation;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(path);
+        if (it != index_.end()) {
+            return it->second;
+        }
+        generation = generation_;
+    }
+
+    std::shared_ptr<const Entry> entry = load(path);
+    if (entry && watching_) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        // Skip the insert if the tree changed while the file was being opened; the entry
+        // might describe the old file.
+        if (generation == generation_ && index_.size() < max_open_files_) {
+            index_.emplace(path, entry);
+        }
+    }
+    return entry;
+}
+
+std::shared_ptr<const StaticFile::Entry> StaticFile::load(const std::string& path) {
+    std::string file_path = path;
+    int fd = open((root_dir_ + file_path).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd != -1 && fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+        close(fd);
+        file_path += (file_path == "/" ? "index.html" : "/index.html");
+        fd = open((root_dir_ + file_path).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<Entry>();
+    entry->file_path = file_path;
+    entry->mtime = st.st_mtime;
+#ifdef __APPLE__
+    const struct timespec& mtim = st.st_mtimespec;
+#else
+    const struct timespec& mtim = st.st_mtim;
+#endif
+    char etag[96];
+    snprintf(etag, sizeof(etag), "%llx-%llx-%llx", static_cast<unsigned long long>(st.st_ino),
+             static_cast<unsigned long long>(st.st_size),
+             static_cast<unsigned long long>(mtim.tv_sec) * 1000000000ull + mtim.tv_nsec);
+
+    const char* mime_type = mimeType(file_path);
+    bool compressible = isCompressible(mime_type) && static_cast<size_t>(st.st_size) >= kMinCompressSize;
+    for (int encoding = kIdentity; encoding < kNumEncodings; ++encoding) {
+        int variant_fd = fd;
+        if (encoding != kIdentity) {
+            if (!compressible) {
+                continue;
+            }
+            variant_fd = openVariant(root_dir_ + file_path, static_cast<Encoding>(encoding), st);
+            if (variant_fd == -1) {
+                if (static_cast<size_t>(st.st_size) <= kMaxCompressSize) {
+                    compressLater(root_dir_ + file_path, static_cast<Encoding>(encoding));
+                }
+                continue;
+            }
+        }
+        struct stat vst;
+        fstat(variant_fd, &vst);
+        Variant& variant = entry->variants[encoding];
+        variant.body = std::make_shared<const FileBody>(variant_fd, 0, static_cast<size_t>(vst.st_size));
+        // Each representation needs its own strong validator.
+        variant.etag = "\"" + std::string(etag) + kEncodingSuffix[encoding] + "\"";
+
+        std::string validators = "ETag: " + variant.etag + "\r\nLast-Modified: " + httpDate(entry->mtime) + "\r\n";
+        if (compressible) {
+            validators += "Vary: Accept-Encoding\r\n";
+        }
+        std::string content_encoding =
+            encoding == kIdentity ? "" : "Content-Encoding: " + std::string(kEncodingName[encoding]) + "\r\n";
+        variant.head = std::make_shared<const std::string>(
+            "HTTP/1.1 200 OK\r\nContent-Type: " + std::string(mime_type) + "\r\n" + content_encoding +
+            "Content-Length: " + std::to_string(vst.st_size) + "\r\n" + validators + "\r\n");
+        variant.not_modified =
+            std::make_shared<const std::string>("HTTP/1.1 304 Not Modified\r\n" + validators + "\r\n");
+    }
+    return entry;
+}
+
+int StaticFile::openVariant(const std::string& full_path, Encoding encoding, const struct stat& st) const {
+    int fd = open((full_path + kEncodingSuffix[encoding]).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat vst;
+    if (fd != -1) {
+        if (fstat(fd, &vst) == 0 && S_ISREG(vst.st_mode) && !olderThan(vst, st)) {
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+void StaticFile::compressLater(const std::string& full_path, Encoding encoding) {
+    std::string variant_path = full_path + kEncodingSuffix[encoding];
+    {
+        std::lock_guard<std::mutex> lock(compress_mutex_);
+        if (!compressing_.insert(variant_path).second) {
+            return;
+        }
+    }
+    // Renaming the variant into place invalidates the original through inotify, so the
+    // next request reloads the entry with the variant.
+    compress_pool_.submit([this, full_path, encoding, variant_path] {
+        compressVariant(full_path, encoding);
+        std::lock_guard<std::mutex> lock(compress_mutex_);
+        compressing_.erase(variant_path);
+    });
+}
+
+bool StaticFile::compressVariant(const std::string& full_path, Encoding encoding) const {
+    std::string variant_path = full_path + kEncodingSuffix[encoding];
+    int source_fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (source_fd == -1 || fstat(source_fd, &st) == -1 || static_cast<size_t>(st.st_size) > kMaxCompressSize) {
+        if (source_fd != -1) {
+            close(source_fd);
+        }
+        return false;
+    }
+    std::string data(static_cast<size_t>(st.st_size), '\0');
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = pread(source_fd, &data[done], data.size() - done, static_cast<off_t>(done));
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    close(source_fd);
+    if (done != data.size()) {
+        return false;
+    }
+    std::string compressed;
+    bool ok = encoding == kGzip ? gzipCompress(data, compressed) : brotliCompress(data, compressed);
+    if (!ok || compressed.size() >= data.size()) {
+        return false;
+    }
+
+    // Write to a temporary name in the same directory and rename, so readers never see a
+    // partial variant.
+    size_t slash = variant_path.rfind('/') + 1;
+    std::string tmp_path = variant_path.substr(0, slash);
+    tmp_path += kTempPrefix;
+    tmp_path += std::string_view(variant_path).substr(slash);
+    tmp_path += ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd == -1) {
+        LOG_WARN("Failed to store {}: {}", variant_path, strerror(errno));
+        return false;
+    }
+    done = 0;
+    while (done < compressed.size()) {
+        ssize_t n = write(fd, compressed.data() + done, compressed.size() - done);
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    bool stored = done == compressed.size() && fchmod(fd, 0644) == 0 &&
+                  rename(tmp_path.c_str(), variant_path.c_str()) == 0;
+    if (!stored) {
+        LOG_WARN("Failed to store {}: {}", variant_path, strerror(errno));
+        unlink(tmp_path.c_str());
+    }
+    close(fd);
+    if (stored) {
+        LOG_INFO("Stored {} ({} -> {} bytes)", variant_path, data.size(), compressed.size());
+    }
+    return stored;
+}
+
+StaticFile::Encoding StaticFile::chooseEncoding(const Request& request, const Entry& entry) const {
+    const std::string_view* accept_encoding = request.headers.get(HeaderId::AcceptEncoding);
+    if (!accept_encoding || (!entry.variants[kGzip].body && !entry.variants[kBrotli].body)) {
+        return kIdentity;
+    }
+    // Highest q-value wins; on a tie the smaller representation does. identity is always
+    // acceptable unless excluded, but only beats a listed coding if it is listed itself.
+    Encoding best = kIdentity;
+    double best_q = std::max(codingQuality(*accept_encoding, "identity"), 0.0);
+    for (Encoding encoding : {kGzip, kBrotli}) {
+        double q = codingQuality(*accept_encoding, kEncodingName[encoding]);
+        if (entry.variants[encoding].body && q > 0 && q >= best_q) {
+            best = encoding;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+bool StaticFile::notModified(const Request& request, const Entry& entry, const Variant& variant) const {
+    if (request.method != "GET" && request.method != "HEAD") {
+        return false;
+    }
+    // If-None-Match takes precedence; If-Modified-Since is only used without it.
+    if (const std::string_view* if_none_match = request.headers.get(HeaderId::IfNoneMatch)) {
+        return etagListMatches(*if_none_match, variant.etag);
+    }
+    if (const std::string_view* if_modified_since = request.headers.get(HeaderId::IfModifiedSince)) {
+        time_t since;
+        return parseHttpDate(std::string(*if_modified_since), since) && entry.mtime <= since;
+    }
+    return false;
+}
+
+void StaticFile::watchTree(const std::string& rel_dir) {
+#ifdef __linux__
+    std::string dir = root_dir_ + rel_dir;
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd == -1) {
+        LOG_WARN("Failed to watch {}: {}", dir, strerror(errno));
+        return;
+    }
+    watches_[wd] = rel_dir;
+
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    while (struct dirent* ent = readdir(d)) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        // Symlinked directories are not followed, so a link cycle cannot recurse forever.
+        bool is_dir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat((dir + "/" + ent->d_name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            watchTree(rel_dir + "/" + ent->d_name);
+        }
+    }
+    closedir(d);
+#else
+    (void)rel_dir;
+#endif
+}
+
+void StaticFile::onWatchEvents() {
+#ifdef __linux__
+    alignas(struct inotify_event) char buffer[16384];
+    while (true) {
+        ssize_t len = read(inotify_fd_, buffer, sizeof(buffer));
+        if (len <= 0) {
+            return;
+        }
+        for (char* p = buffer; p < buffer + len;) {
+            auto* event = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost; nothing in the index can be trusted.
+                std::unique_lock<std::shared_mutex> lock(mutex_);
+                ++generation_;
+                index_.clear();
+                continue;
+            }
+            auto it = watches_.find(event->wd);
+            if (it == watches_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches_.erase(it);
+                continue;
+            }
+            if (event->len > 0 && isTempName(event->name)) {
+                continue;
+            }
+            std::string rel_path = event->len > 0 ? it->second + "/" + event->name : it->second;
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                watchTree(rel_path);
+            }
+            invalidate(rel_path);
+            // A changed or removed variant also invalidates the file it belongs to.
+            for (const char* suffix : {".gz", ".br"}) {
+                size_t len = strlen(suffix);
+                if (rel_path.size() > len && rel_path.compare(rel_path.size() - len, len, suffix) == 0) {
+                    invalidate(rel_path.substr(0, rel_path.size() - len));
+                }
+            }
+        }
+    }
+#endif
+}
+
+void StaticFile::invalidate(const std::string& rel_path) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    ++generation_;
+    for (auto it = index_.begin(); it != index_.end();) {
+        const std::string& file_path = it->second->file_path;
+        bool affected = rel_path.empty() || file_path == rel_path ||
+                        (file_path.size() > rel_path.size() && file_path.compare(0, rel_path.size(), rel_path) == 0 &&
+                         file_path[rel_path.size()] == '/');
+        it = affected ? index_.erase(it) : std::next(it);
+    }
+}
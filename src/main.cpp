@@ -1,19 +1,23 @@
-#include "core/event_loop.hpp"
-#include "core/worker_pool.hpp"
-#include "core/connection.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "core/tls_context.hpp"
 #include "http/http_parser.hpp"
+#include "http/http_server.hpp"
 #include "http/static_file.hpp"
 #include "proxy/l7_proxy.hpp"
-#include "http/cache.hpp"
-#include <iostream>
+#include "http/response_cache.hpp"
+#include <chrono>
+#include <memory>
 #include <stdexcept>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <unistd.h>
-#include <errno.h>
-#include <string.h>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <signal.h>
 
 int main() {
+    // Peers that disconnect mid-write must not kill the process.
+    signal(SIGPIPE, SIG_IGN);
+
     try {
         // Configuration
         const int PORT = 8080;
@@ -24,116 +28,89 @@ int main() {
         const std::string BACKEND_HOST = "127.0.0.1";
         const int BACKEND_PORT = 8081;
         const size_t NUM_WORKERS = 16;
-        const size_t CACHE_SIZE = 100;
+        const size_t CACHE_BYTES = 64 << 20; // proxy response cache budget
+        // With REUSE_PORT, NUM_LOOPS pinned event loops each accept on their own
+        // SO_REUSEPORT socket and handle connections inline instead of using the worker pool.
+        // Otherwise one thread accepts and NUM_LOOPS loops run TLS handshakes for the pool.
+        const bool REUSE_PORT = false;
+        const size_t NUM_LOOPS = std::thread::hardware_concurrency();
+        // Keep-alive: requests per connection and idle time before the server closes it.
+        const size_t MAX_KEEPALIVE_REQUESTS = 1000;
+        const int KEEPALIVE_TIMEOUT_MS = 15000;
+        // Clients that have not finished the TLS handshake by then are disconnected.
+        const int HANDSHAKE_TIMEOUT_MS = 10000;
+        // Idle keep-alive connections kept open to the backend, and how long they may idle.
+        const size_t UPSTREAM_MAX_IDLE = 64;
+        const int UPSTREAM_IDLE_TIMEOUT_MS = 30000;
+        // Backends to balance across: {host, port, weight}; add entries to scale out.
+        const std::vector<UpstreamConfig> UPSTREAMS = {{BACKEND_HOST, BACKEND_PORT, 1}};
+        const BalancePolicy BALANCE_POLICY = BalancePolicy::LeastOutstanding;
+        // GET this path on every backend to take failing ones out of rotation; empty disables.
+        const std::string HEALTH_CHECK_PATH = "";
+        // Prometheus metrics (counters, gauges, per-stage latency histograms) are served
+        // at this path; empty disables it.
+        const std::string METRICS_PATH = "/metrics";
 
         // Initialize components
-        EventLoop event_loop;
-        WorkerPool worker_pool(NUM_WORKERS);
+        // ALPN prefers h2; clients without it get HTTP/1.1 keep-alive.
+        std::unique_ptr<TlsContext> tls_context;
+        if (USE_TLS) {
+            tls_context = std::make_unique<TlsContext>(CERT_FILE, KEY_FILE, std::vector<std::string>{"h2", "http/1.1"});
+        }
+        const TlsContext* tls = tls_context.get();
         HttpParser http_parser;
         StaticFile static_file(STATIC_ROOT);
-        L7Proxy proxy(BACKEND_HOST, BACKEND_PORT);
-        Cache cache(CACHE_SIZE);
-
-        // Set up listening socket
-        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (listen_fd == -1) {
-            throw std::runtime_error("Failed to create socket: " + std::string(strerror(errno)));
-        }
-
-        struct sockaddr_in addr;
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(PORT);
-
-        int optval = 1;
-        if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1) {
-            throw std::runtime_error("Failed to set SO_REUSEADDR: " + std::string(strerror(errno)));
-        }
-
-        if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-            throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
-        }
-
-        if (listen(listen_fd, 10) == -1) {
-            throw std::runtime_error("Failed to listen on socket: " + std::string(strerror(errno)));
-        }
-
-        std::cout << "Server listening on port " << PORT << " with TLS: " << (USE_TLS ? "true" : "false") << std::endl;
+        LoadBalancerConfig balancer_config;
+        balancer_config.policy = BALANCE_POLICY;
+        balancer_config.health_path = HEALTH_CHECK_PATH;
+        balancer_config.pool.max_idle = UPSTREAM_MAX_IDLE;
+        balancer_config.pool.idle_timeout = std::chrono::milliseconds(UPSTREAM_IDLE_TIMEOUT_MS);
+        L7Proxy proxy(UPSTREAMS, balancer_config);
+        // Stores what the backend marks cacheable and coalesces concurrent misses. Misses
+        // are relayed as they arrive; only background revalidation blocks a thread.
+        ResponseCache cache(
+            CACHE_BYTES, [&proxy](const Request& request) { return proxy.forward(request); },
+            [&proxy](const Request& request, std::shared_ptr<ResponseTee> tee) {
+                return proxy.stream(request, std::move(tee));
+            });
 
-        // Event loop callback for new connections
-        event_loop.addFd(listen_fd, EPOLLIN, [&](int fd, uint32_t events) {
-            std::cout << "Event loop triggered for fd " << fd << " with events " << events << std::endl;
+        // Called for every request on a keep-alive connection; runs on a worker, or on the
+        // loop thread with REUSE_PORT.
+        RequestHandler handle_request = [&static_file, &cache, &METRICS_PATH](const Request& request) {
+            LOG_DEBUG("Handling request: {} {} {}", request.method, request.path, request.version);
 
-            int client_fd = accept(listen_fd, nullptr, nullptr);
-            if (client_fd == -1) {
-                std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
-                return;
+            if (!METRICS_PATH.empty() && std::string_view(request.path) == METRICS_PATH) {
+                return Response{200, "OK", "HTTP/1.1", {{"Content-Type", "text/plain; version=0.0.4"}},
+                                Metrics::prometheusText()};
             }
 
-            std::cout << "Accepted new connection on fd " << client_fd << std::endl;
-
-            worker_pool.submit([client_fd, USE_TLS, CERT_FILE, KEY_FILE, &http_parser, &static_file, &proxy, &cache] {
-                try {
-                    std::cout << "Worker thread processing connection on fd " << client_fd << std::endl;
-
-                    Connection conn(client_fd, USE_TLS, CERT_FILE, KEY_FILE);
-                    char buffer[4096];
-                    ssize_t bytes_read = conn.read(buffer, sizeof(buffer));
-                    if (bytes_read <= 0) {
-                        std::cerr << "Failed to read from connection on fd " << client_fd << ": " << strerror(errno) << std::endl;
-                        close(client_fd);
-                        return;
-                    }
-
-                    std::cout << "Read " << bytes_read << " bytes from fd " << client_fd << std::endl;
-
-                    std::string request_data(buffer, bytes_read);
-                    Request request = http_parser.parseRequest(request_data);
-
-                    std::cout << "Parsed request: " << request.method << " " << request.path << " " << request.version << std::endl;
-
-                    std::string cached_response;
-                    if (cache.get(request.path, cached_response)) {
-                        std::cout << "Serving cached response for " << request.path << std::endl;
-                        conn.write(cached_response.c_str(), cached_response.size());
-                        close(client_fd);
-                        return;
-                    }
-
-                    Response response;
-                    if (request.path == "/proxy") {
-                        std::cout << "Forwarding request to proxy" << std::endl;
-                        response = proxy.forward(request);
-                    } else {
-                        std::cout << "Serving static file for " << request.path << std::endl;
-                        response = static_file.serve(request.path);
-                    }
-
-                    std::string response_data = http_parser.generateResponse(response);
-                    cache.put(request.path, response_data);
-
-                    std::cout << "Sending response for " << request.path << std::endl;
-                    ssize_t bytes_written = conn.write(response_data.c_str(), response_data.size());
-                    if (bytes_written <= 0) {
-                        std::cerr << "Failed to write response on fd " << client_fd << ": " << strerror(errno) << std::endl;
-                    } else {
-                        std::cout << "Wrote " << bytes_written << " bytes to fd " << client_fd << std::endl;
-                    }
-
-                    close(client_fd);
-                } catch (const std::exception& e) {
-                    std::cerr << "Error handling connection on fd " << client_fd << ": " << e.what() << std::endl;
-                    close(client_fd);
-                }
-            });
-
-            std::cout << "Submitted task to worker pool for fd " << client_fd << std::endl;
-        });
+            bool proxied = request.path.compare(0, 6, "/proxy") == 0 &&
+                           (request.path.size() == 6 || request.path[6] == '/' || request.path[6] == '?');
+            if (!proxied) {
+                // Static files have their own index with ETags and sendfile bodies.
+                LOG_DEBUG("Serving static file for {}", request.path);
+                return static_file.serve(request);
+            }
 
-        std::cout << "Starting event loop" << std::endl;
-        event_loop.run();
+            LOG_DEBUG("Forwarding request to proxy");
+            return cache.serve(request);
+        };
+
+        HttpServerConfig server_config;
+        server_config.port = PORT;
+        server_config.reuse_port = REUSE_PORT;
+        server_config.num_loops = NUM_LOOPS;
+        server_config.num_workers = NUM_WORKERS;
+        server_config.handshake_timeout = std::chrono::milliseconds(HANDSHAKE_TIMEOUT_MS);
+        server_config.limits.max_requests = MAX_KEEPALIVE_REQUESTS;
+        server_config.limits.idle_timeout = std::chrono::milliseconds(KEEPALIVE_TIMEOUT_MS);
+
+        HttpServer server(server_config, tls, http_parser, handle_request);
+        LOG_INFO("Server listening on port {} with TLS: {}{}", PORT, USE_TLS,
+                 REUSE_PORT ? " on SO_REUSEPORT event loops" : " with a worker pool");
+        server.run();
     } catch (const std::exception& e) {
-        std::cerr << "Server error: " << e.what() << std::endl;
+        LOG_ERROR("Server error: {}", e.what());
         return 1;
     }
 
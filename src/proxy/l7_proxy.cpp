@@ -1,43 +1,279 @@
 #include "proxy/l7_proxy.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include "proxy/proxy_stream.hpp"
+#include "proxy/upstream_response.hpp"
+#include "http/request_parser.hpp"
 #include <stdexcept>
+#include <cerrno>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <unistd.h>
 
-L7Proxy::L7Proxy(const std::string& backend_host, int backend_port)
-    : backend_host_(backend_host), backend_port_(backend_port) {}
+namespace {
 
-Response L7Proxy::forward(const Request& request) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1) {
-        throw std::runtime_error("Failed to create socket for proxy");
+// Larger heads are rejected rather than buffered without bound.
+const size_t kMaxResponseHead = 64 * 1024;
+
+bool idempotent(std::string_view method) {
+    return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS" ||
+           method == "TRACE";
+}
+
+// Thrown when a reused connection turns out to be closed before any response byte
+// arrived, which is the one case where resending the request is safe.
+struct StaleConnection : std::runtime_error {
+    StaleConnection() : std::runtime_error("Backend closed the connection") {}
+};
+
+void sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (sent == 0 && (errno == EPIPE || errno == ECONNRESET)) {
+                throw StaleConnection();
+            }
+            throw std::runtime_error("Failed to send request to backend");
+        }
+        sent += n;
+    }
+}
+
+// Reads one response from a blocking backend connection. The body is framed by
+// Content-Length, chunked encoding (decoded here) or, failing both, the end of the
+// connection.
+class ResponseReader {
+public:
+    explicit ResponseReader(int fd) : fd_(fd) {}
+
+    // Fills response and says whether the connection can carry another request.
+    bool read(bool head_request, Response& response) {
+        UpstreamFraming framing;
+        while (true) {
+            size_t head_end;
+            while ((head_end = buffer_.find("\r\n\r\n", pos_)) == std::string::npos) {
+                if (buffer_.size() - pos_ > kMaxResponseHead) {
+                    throw std::runtime_error("Backend response head too large");
+                }
+                if (!fill()) {
+                    if (buffer_.empty()) {
+                        throw StaleConnection();
+                    }
+                    throw std::runtime_error("Backend closed the connection mid-response");
+                }
+            }
+            parseUpstreamHead(std::string_view(buffer_).substr(pos_, head_end + 2 - pos_), response, framing);
+            pos_ = head_end + 4;
+            // Interim responses (100 Continue and friends) precede the real one.
+            if (response.status_code >= 200 || response.status_code == 101) {
+                break;
+            }
+        }
+
+        bool keep_alive = framing.keep_alive;
+        if (head_request || response.status_code == 204 || response.status_code == 304) {
+            // No body; the origin's Content-Length describes the GET response.
+            if (head_request && framing.content_length >= 0) {
+                response.headers.set("Content-Length", std::to_string(framing.content_length));
+            }
+        } else if (framing.chunked) {
+            ChunkedDecoder decoder;
+            while (true) {
+                pos_ += decoder.decode(buffer_.data() + pos_, buffer_.size() - pos_, response.body);
+                if (decoder.done()) {
+                    break;
+                }
+                buffer_.clear();
+                pos_ = 0;
+                if (!fill()) {
+                    throw std::runtime_error("Backend closed the connection mid-response");
+                }
+            }
+        } else if (framing.content_length >= 0) {
+            while (buffer_.size() - pos_ < static_cast<size_t>(framing.content_length)) {
+                if (!fill()) {
+                    throw std::runtime_error("Backend closed the connection mid-response");
+                }
+            }
+            response.body.assign(buffer_, pos_, framing.content_length);
+            pos_ += framing.content_length;
+        } else {
+            while (fill()) {
+            }
+            response.body.assign(buffer_, pos_, std::string::npos);
+            pos_ = buffer_.size();
+            keep_alive = false;
+        }
+        // Anything after the response would be mistaken for the next one.
+        return keep_alive && pos_ == buffer_.size();
+    }
+
+private:
+    bool fill() {
+        char chunk[16384];
+        while (true) {
+            ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                buffer_.append(chunk, n);
+                return true;
+            }
+            if (n == 0) {
+                return false;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (buffer_.empty() && errno == ECONNRESET) {
+                throw StaleConnection();
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                throw std::runtime_error("Timed out waiting for backend");
+            }
+            throw std::runtime_error("Failed to read response from backend");
+        }
     }
 
-    struct sockaddr_in backend_addr;
-    backend_addr.sin_family = AF_INET;
-    backend_addr.sin_port = htons(backend_port_);
-    inet_pton(AF_INET, backend_host_.c_str(), &backend_addr.sin_addr);
+    int fd_;
+    std::string buffer_;
+    size_t pos_ = 0;
+};
 
-    if (connect(sock, (struct sockaddr*)&backend_addr, sizeof(backend_addr)) == -1) {
-        close(sock);
-        throw std::runtime_error("Failed to connect to backend");
+// One request on connections from pool; a reused connection found closed is replaced.
+Response forwardTo(UpstreamPool& pool, const std::string& request_data, bool head_request, bool retryable) {
+    while (true) {
+        bool reused;
+        int fd = pool.acquire(reused);
+        try {
+            sendAll(fd, request_data);
+            Response response{502, "Bad Gateway", "HTTP/1.1", {}, ""};
+            bool keep_alive = ResponseReader(fd).read(head_request, response);
+            if (keep_alive) {
+                pool.release(fd);
+            } else {
+                close(fd);
+            }
+            return response;
+        } catch (const StaleConnection&) {
+            close(fd);
+            // The backend closed an idle connection as we picked it up; try a fresh one.
+            if (reused && retryable) {
+                continue;
+            }
+            throw std::runtime_error("Backend closed the connection without responding");
+        } catch (...) {
+            close(fd);
+            throw;
+        }
     }
+}
 
-    std::string request_data = request.method + " " + request.path + " " + request.version + "\r\n";
+// request_data with a Host line naming pool's upstream after its request line.
+std::string withHost(const std::string& request_data, const UpstreamPool& pool) {
+    std::string with_host = request_data;
+    with_host.insert(request_data.find("\r\n") + 2, pool.hostLine());
+    return with_host;
+}
+
+LoadBalancerConfig singleBackend(const UpstreamPoolConfig& pool_config) {
+    LoadBalancerConfig config;
+    config.pool = pool_config;
+    return config;
+}
+
+} // namespace
+
+L7Proxy::L7Proxy(const std::string& backend_host, int backend_port, const UpstreamPoolConfig& pool_config)
+    : upstreams_({UpstreamConfig{backend_host, backend_port, 1}}, singleBackend(pool_config)) {}
+
+L7Proxy::L7Proxy(const std::vector<UpstreamConfig>& upstreams, const LoadBalancerConfig& config)
+    : upstreams_(upstreams, config) {}
+
+std::string L7Proxy::serializeRequest(const Request& request) const {
+    // Always HTTP/1.1 towards the backend, so that the connection can stay open.
+    std::string request_data;
+    request_data.append(request.method).append(" ").append(request.path).append(" HTTP/1.1\r\n");
+    bool has_length = false;
     for (const auto& header : request.headers) {
-        request_data += header.first + ": " + header.second + "\r\n";
+        if (isHopByHopHeader(header.name)) {
+            continue;
+        }
+        if (header.id == HeaderId::ContentLength) {
+            has_length = true;
+            continue;
+        }
+        request_data.append(header.name).append(": ").append(header.value).append("\r\n");
+    }
+    // The body is framed by what was received, never by the client's header: an HTTP/2
+    // request need not carry content-length, and an unframed body on a pooled connection
+    // would be read by the backend as the next request. A streamed body follows later.
+    if (request.body_stream && request.body_stream->length() == RequestBody::kUnknownLength) {
+        request_data.append("Transfer-Encoding: chunked\r\n");
+    } else if (request.body_stream) {
+        request_data.append("Content-Length: ").append(std::to_string(request.body_stream->length())).append("\r\n");
+    } else if (has_length || !request.body.empty()) {
+        request_data.append("Content-Length: ").append(std::to_string(request.body.size())).append("\r\n");
+    }
+    request_data.append("\r\n").append(request.body);
+    return request_data;
+}
+
+Response L7Proxy::forward(const Request& request) {
+    if (request.body_stream) {
+        throw std::runtime_error("A streamed request body can only be proxied with L7Proxy::stream");
+    }
+    StageTimer timer(Stage::Proxy);
+    std::string request_data = serializeRequest(request);
+    // Only HTTP/1.0 clients leave Host out; each attempt names the upstream it goes to.
+    bool add_host = !request.headers.get(HeaderId::Host);
+    std::string key = upstreams_.affinityKey(request);
+    bool retryable = idempotent(request.method);
+    std::vector<size_t> tried;
+    while (true) {
+        size_t index = upstreams_.pick(key, tried);
+        tried.push_back(index);
+        auto start = UpstreamGroup::Clock::now();
+        try {
+            UpstreamPool& pool = upstreams_.pool(index);
+            Response response = forwardTo(pool, add_host ? withHost(request_data, pool) : request_data,
+                                          request.method == "HEAD", retryable);
+            int status = response.status_code;
+            upstreams_.finish(index, status != 502 && status != 503 && status != 504,
+                              UpstreamGroup::Clock::now() - start);
+            return response;
+        } catch (const std::exception& e) {
+            upstreams_.finish(index, false, UpstreamGroup::Clock::now() - start);
+            if (!retryable || tried.size() >= upstreams_.maxAttempts()) {
+                throw;
+            }
+            LOG_WARN("Proxy request failed: {}; trying another upstream", e.what());
+        }
     }
-    request_data += "\r\n" + request.body;
-    write(sock, request_data.c_str(), request_data.size());
+}
 
-    char buffer[4096];
-    ssize_t bytes_read = read(sock, buffer, sizeof(buffer));
-    close(sock);
+Response L7Proxy::stream(const Request& request, std::shared_ptr<ResponseTee> tee) {
+    Response response{502, "Bad Gateway", "HTTP/1.1", {}, ""};
+    response.stream = std::make_shared<ProxyStream>(upstreams_, upstreams_.affinityKey(request),
+                                                    serializeRequest(request), request.method == "HEAD",
+                                                    idempotent(request.method), request.version == "HTTP/1.1",
+                                                    !request.headers.get(HeaderId::Host), std::move(tee),
+                                                    request.body_stream);
+    return response;
+}
 
-    if (bytes_read <= 0) {
-        throw std::runtime_error("Failed to read response from backend");
+UpstreamPool::Stats L7Proxy::poolStats() const {
+    UpstreamPool::Stats total;
+    for (const UpstreamGroup::Stats& upstream : upstreams_.stats()) {
+        total.connects += upstream.pool.connects;
+        total.reuses += upstream.pool.reuses;
+        total.dropped += upstream.pool.dropped;
+        total.idle += upstream.pool.idle;
     }
+    return total;
+}
 
-    return Response{200, "OK", "HTTP/1.1", {}, std::string(buffer, bytes_read)};
-}
\ No newline at end of file
+std::vector<UpstreamGroup::Stats> L7Proxy::upstreamStats() const {
+    return upstreams_.stats();
+}
@@ -0,0 +1,495 @@
+#include "proxy/proxy_stream.hpp"
+#include "core/event_loop.hpp"
+#include "core/logger.hpp"
+#include "core/metrics.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Larger heads are rejected rather than buffered without bound.
+const size_t kMaxResponseHead = 64 * 1024;
+// Bytes moved per read from the backend (the pipe's default capacity), and per piece of
+// a streamed request body.
+const size_t kReadChunk = 64 * 1024;
+
+const char kBadGateway[] = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 11\r\n\r\nBad Gateway";
+
+bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+} // namespace
+
+ProxyStream::ProxyStream(UpstreamGroup& upstreams, std::string affinity_key, std::string request_data,
+                         bool head_request, bool retryable, bool client_http11, bool add_host,
+                         std::shared_ptr<ResponseTee> tee, std::shared_ptr<RequestBody> body)
+    : upstreams_(upstreams), affinity_key_(std::move(affinity_key)), request_data_(std::move(request_data)),
+      head_request_(head_request), retryable_(retryable && !body), client_http11_(client_http11),
+      add_host_(add_host), tee_(std::move(tee)), body_(std::move(body)),
+      body_chunked_(body_ && body_->length() == RequestBody::kUnknownLength) {}
+
+ProxyStream::~ProxyStream() {
+    releaseUpstream(false);
+    // The client went away; the upstream is only to blame if it was slow.
+    endAttempt(head_ok_);
+    if (pipe_[0] != -1) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+}
+
+void ProxyStream::start(EventLoop& loop, std::function<void()> wake) {
+    loop_ = &loop;
+    wake_ = std::move(wake);
+    started_ = UpstreamGroup::Clock::now();
+}
+
+ResponseStream::Status ProxyStream::send(ResponseSink& sink) {
+    while (true) {
+        try {
+            return step(sink);
+        } catch (const std::exception& e) {
+            if (state_ == State::Body || state_ == State::Done) {
+                // Part of the response is out already; all we can do is cut it off.
+                LOG_WARN("Proxy response failed: {}", e.what());
+                releaseUpstream(false);
+                endAttempt(false);
+                return Status::Failed;
+            }
+            fail(e.what());
+        }
+    }
+}
+
+ResponseStream::Status ProxyStream::step(ResponseSink& sink) {
+    char buffer[16384];
+    while (true) {
+        switch (state_) {
+        case State::Connecting: {
+            if (upstream_ == UpstreamGroup::kNone) {
+                upstream_ = upstreams_.pick(affinity_key_, tried_);
+                tried_.push_back(upstream_);
+                attempt_start_ = UpstreamGroup::Clock::now();
+                if (add_host_) {
+                    setHost();
+                }
+            }
+            if (fd_ == -1 && !connectUpstream()) {
+                continue;
+            }
+            if (!reused_) {
+                struct pollfd p = {fd_, POLLOUT, 0};
+                if (poll(&p, 1, 0) == 0) {
+                    return await(EPOLLOUT);
+                }
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+                    fail("Failed to connect to backend");
+                    continue;
+                }
+            }
+            state_ = State::SendingRequest;
+            continue;
+        }
+
+        case State::SendingRequest: {
+            if (sent_ == request_data_.size()) {
+                if (!body_) {
+                    state_ = State::ReadingHead;
+                } else if (!nextBodyPiece()) {
+                    return Status::WantData; // the session calls again once the client sent more
+                }
+                continue;
+            }
+            ssize_t n = ::send(fd_, request_data_.data() + sent_, request_data_.size() - sent_, MSG_NOSIGNAL);
+            if (n > 0) {
+                sent_ += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && wouldBlock()) {
+                return await(EPOLLOUT);
+            }
+            if (sent_ == 0 && retryStale()) {
+                continue;
+            }
+            fail("Failed to send request to backend");
+            continue;
+        }
+
+        case State::ReadingHead: {
+            size_t head_end = in_.find("\r\n\r\n");
+            if (head_end == std::string::npos) {
+                if (in_.size() > kMaxResponseHead) {
+                    fail("Backend response head too large");
+                    continue;
+                }
+                ssize_t n = recv(fd_, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    in_.append(buffer, n);
+                    continue;
+                }
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (n == -1 && wouldBlock()) {
+                    return await(EPOLLIN);
+                }
+                if (in_.empty() && retryStale()) {
+                    continue;
+                }
+                fail("Backend closed the connection without responding");
+                continue;
+            }
+
+            Response head;
+            UpstreamFraming framing;
+            parseUpstreamHead(std::string_view(in_).substr(0, head_end + 2), head, framing);
+            std::string rest = in_.substr(head_end + 4);
+            in_.clear();
+            // Interim responses (100 Continue and friends) precede the real one.
+            if (head.status_code < 200 && head.status_code != 101) {
+                in_ = std::move(rest);
+                continue;
+            }
+            head_latency_ = UpstreamGroup::Clock::now() - attempt_start_;
+            head_ok_ = head.status_code != 502 && head.status_code != 503 && head.status_code != 504;
+            state_ = State::Body;
+            beginBody(head, framing);
+            if (!rest.empty()) {
+                relay(rest.data(), rest.size());
+            }
+            // A plaintext client can take the rest of a known-length body straight from the socket.
+            if (framing_ == Framing::Length && remaining_ > 0 && !tee_ && sink.spliceFd() != -1 &&
+                pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) != 0) {
+                pipe_[0] = pipe_[1] = -1;
+            }
+            continue;
+        }
+
+        case State::Body: {
+            if (out_pos_ < out_.size()) {
+                ssize_t n = sink.write(out_.data() + out_pos_, out_.size() - out_pos_);
+                if (n > 0) {
+                    out_pos_ += n;
+                    if (out_pos_ == out_.size()) {
+                        out_.clear();
+                        out_pos_ = 0;
+                    }
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return n < 0 && wouldBlock() ? Status::WantWrite : Status::Failed;
+            }
+            if (piped_ > 0) {
+                ssize_t n = splice(pipe_[0], nullptr, sink.spliceFd(), nullptr, piped_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0) {
+                    piped_ -= n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return n < 0 && wouldBlock() ? Status::WantWrite : Status::Failed;
+            }
+            if (body_done_) {
+                state_ = State::Done;
+                continue;
+            }
+
+            // Out of output: read the next piece of the body from the backend.
+            ssize_t n;
+            if (pipe_[0] != -1) {
+                n = splice(fd_, nullptr, pipe_[1], nullptr, std::min<uint64_t>(remaining_, kReadChunk),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0) {
+                    piped_ += n;
+                    remaining_ -= n;
+                    if (remaining_ == 0) {
+                        finishBody();
+                    }
+                    continue;
+                }
+            } else {
+                n = recv(fd_, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    relay(buffer, n);
+                    continue;
+                }
+            }
+            if (n == 0 && framing_ == Framing::UntilClose) {
+                keep_alive_ = false;
+                finishBody();
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && wouldBlock()) {
+                return await(EPOLLIN);
+            }
+            LOG_WARN("Backend closed the connection mid-response");
+            releaseUpstream(false);
+            endAttempt(false);
+            return Status::Failed;
+        }
+
+        case State::Done:
+            return Status::Done;
+        }
+    }
+}
+
+// Waits for the backend socket; the loop calls wake_ once it is ready. The fd is
+// registered one-shot, so every wait re-arms it.
+ResponseStream::Status ProxyStream::await(uint32_t events) {
+    EventLoop* loop = loop_;
+    int fd = fd_;
+    if (!registered_) {
+        registered_ = true;
+        std::weak_ptr<ProxyStream> weak = shared_from_this();
+        loop->post([loop, fd, events, weak] {
+            loop->addFd(fd, events | EPOLLONESHOT, [weak](int, uint32_t) {
+                if (auto self = weak.lock()) {
+                    self->wake_();
+                }
+            });
+        });
+    } else {
+        loop->post([loop, fd, events] { loop->modifyFd(fd, events | EPOLLONESHOT); });
+    }
+    return Status::WantData;
+}
+
+bool ProxyStream::connectUpstream() {
+    try {
+        fd_ = upstreams_.pool(upstream_).acquire(reused_, true);
+        return true;
+    } catch (const std::exception& e) {
+        fail(e.what());
+        return false;
+    }
+}
+
+void ProxyStream::endAttempt(bool ok) {
+    if (upstream_ == UpstreamGroup::kNone) {
+        return;
+    }
+    bool head_seen = state_ == State::Body || state_ == State::Done;
+    upstreams_.finish(upstream_, ok, head_seen ? head_latency_ : UpstreamGroup::Clock::now() - attempt_start_);
+    upstream_ = UpstreamGroup::kNone;
+}
+
+// A reused connection the backend had closed: resend on a new one if that is safe.
+bool ProxyStream::retryStale() {
+    if (!reused_ || !retryable_) {
+        return false;
+    }
+    releaseUpstream(false);
+    sent_ = 0;
+    in_.clear();
+    state_ = State::Connecting;
+    return true;
+}
+
+// Names the attempt's upstream in request_data_, in place of the previous attempt's.
+void ProxyStream::setHost() {
+    std::string line = upstreams_.pool(upstream_).hostLine();
+    request_data_.replace(request_data_.find("\r\n") + 2, host_line_, line);
+    host_line_ = line.size();
+}
+
+// Replaces the sent request_data_ with the next piece of the streamed body, as a chunk
+// if its length is unknown; body_ is let go with the last one. False if the client has
+// not sent more yet.
+bool ProxyStream::nextBodyPiece() {
+    std::string_view piece = body_->data().substr(0, kReadChunk);
+    bool last = body_->finished() && piece.size() == body_->data().size();
+    if (piece.empty() && !last) {
+        return false;
+    }
+    request_data_.clear();
+    sent_ = 0;
+    if (!body_chunked_) {
+        request_data_.append(piece);
+    } else if (!piece.empty()) {
+        char size_line[24];
+        std::snprintf(size_line, sizeof(size_line), "%zx\r\n", piece.size());
+        request_data_.append(size_line).append(piece).append("\r\n");
+    }
+    if (body_chunked_ && last) {
+        request_data_ += "0\r\n\r\n";
+    }
+    body_->consume(piece.size());
+    if (last) {
+        body_.reset();
+    }
+    return true;
+}
+
+// The current attempt failed before anything reached the client.
+void ProxyStream::fail(const char* reason) {
+    LOG_WARN("Proxy request failed: {}", reason);
+    releaseUpstream(false);
+    endAttempt(false);
+    if (retryable_ && tried_.size() < upstreams_.maxAttempts()) {
+        LOG_WARN("Trying another upstream");
+        sent_ = 0;
+        in_.clear();
+        state_ = State::Connecting;
+        return;
+    }
+    tee_.reset();
+    out_ = kBadGateway;
+    if (head_request_) {
+        out_.resize(out_.find("\r\n\r\n") + 4);
+    }
+    out_pos_ = 0;
+    framing_ = Framing::None;
+    body_done_ = true;
+    state_ = State::Body;
+}
+
+void ProxyStream::beginBody(const Response& head, const UpstreamFraming& framing) {
+    keep_alive_ = framing.keep_alive;
+    int status = head.status_code;
+    if (head_request_ || status == 204 || status == 304 || status < 200) {
+        framing_ = Framing::None;
+    } else if (framing.chunked) {
+        framing_ = Framing::Chunked;
+    } else if (framing.content_length >= 0) {
+        framing_ = Framing::Length;
+        remaining_ = framing.content_length;
+    } else {
+        framing_ = Framing::UntilClose;
+    }
+    // Without a length, HTTP/1.1 clients get chunks; HTTP/1.0 clients read until the close.
+    client_chunked_ = client_http11_ && (framing_ == Framing::Chunked || framing_ == Framing::UntilClose);
+
+    out_ = "HTTP/1.1 " + std::to_string(status) + " " + head.status_message + "\r\n";
+    for (const auto& header : head.headers) {
+        out_.append(header.name).append(": ").append(header.value).append("\r\n");
+    }
+    if (framing_ == Framing::Length || (framing_ == Framing::None && framing.content_length >= 0)) {
+        out_ += "Content-Length: " + std::to_string(framing.content_length) + "\r\n";
+    } else if (client_chunked_) {
+        out_ += "Transfer-Encoding: chunked\r\n";
+    }
+    out_ += "\r\n";
+    out_pos_ = 0;
+
+    if (tee_) {
+        tee_limit_ = tee_->begin(head);
+        if (tee_limit_ == 0 || (framing_ == Framing::Length && remaining_ > tee_limit_)) {
+            tee_.reset(); // let go early: whoever waits on the tee need not wait for the body
+        } else {
+            tee_response_ = head;
+        }
+    }
+    if (framing_ == Framing::None) {
+        finishBody();
+    }
+}
+
+// Takes bytes read from the backend: decodes the body framing, re-frames it for the
+// client into out_ and copies it for the tee.
+void ProxyStream::relay(const char* data, size_t len) {
+    std::string decoded;
+    const char* body = data;
+    size_t body_len = len;
+    size_t consumed = len;
+    if (framing_ == Framing::Length) {
+        body_len = consumed = static_cast<size_t>(std::min<uint64_t>(len, remaining_));
+        remaining_ -= body_len;
+    } else if (framing_ == Framing::Chunked) {
+        consumed = decoder_.decode(data, len, decoded);
+        body = decoded.data();
+        body_len = decoded.size();
+    } else if (framing_ == Framing::None) {
+        body_len = consumed = 0;
+    }
+    if (consumed < len) {
+        extra_bytes_ = true;
+    }
+
+    if (body_len > 0) {
+        if (client_chunked_) {
+            char size_line[24];
+            std::snprintf(size_line, sizeof(size_line), "%zx\r\n", body_len);
+            out_ += size_line;
+            out_.append(body, body_len);
+            out_ += "\r\n";
+        } else {
+            out_.append(body, body_len);
+        }
+        if (tee_) {
+            if (tee_response_.body.size() + body_len > tee_limit_) {
+                tee_.reset();
+                tee_response_ = Response();
+            } else {
+                tee_response_.body.append(body, body_len);
+            }
+        }
+    }
+
+    if ((framing_ == Framing::Length && remaining_ == 0) || (framing_ == Framing::Chunked && decoder_.done())) {
+        finishBody();
+    }
+}
+
+void ProxyStream::finishBody() {
+    if (body_done_) {
+        return;
+    }
+    body_done_ = true;
+    if (client_chunked_) {
+        out_ += "0\r\n\r\n";
+    }
+    if (tee_) {
+        tee_->complete(tee_response_);
+        tee_.reset();
+        tee_response_ = Response();
+    }
+    releaseUpstream(keep_alive_ && !extra_bytes_);
+    endAttempt(head_ok_);
+    Metrics::record(Stage::Proxy, UpstreamGroup::Clock::now() - started_);
+}
+
+// Gives the backend connection back to the pool (or closes it). If the loop watches
+// it, that happens on the loop thread after the fd was removed there, so that it can
+// neither fire for this stream again nor be closed under the loop.
+void ProxyStream::releaseUpstream(bool reusable) {
+    if (fd_ == -1) {
+        return;
+    }
+    int fd = fd_;
+    fd_ = -1;
+    UpstreamPool* pool = &upstreams_.pool(upstream_);
+    if (registered_) {
+        registered_ = false;
+        EventLoop* loop = loop_;
+        loop->post([loop, pool, fd, reusable] {
+            loop->removeFd(fd);
+            if (reusable) {
+                pool->release(fd);
+            } else {
+                close(fd);
+            }
+        });
+    } else if (reusable) {
+        pool->release(fd);
+    } else {
+        close(fd);
+    }
+}
@@ -0,0 +1,346 @@
+#include "proxy/upstream_group.hpp"
+#include "core/logger.hpp"
+#include "http/request_parser.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <random>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Ring points per unit of weight; enough for an even spread over a handful of upstreams.
+const unsigned kPointsPerWeight = 160;
+
+uint64_t hashKey(const std::string& key) {
+    // FNV-1a, then a mixing step so that similar keys land far apart on the ring.
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+std::mt19937_64& rng() {
+    thread_local std::mt19937_64 engine(std::random_device{}());
+    return engine;
+}
+
+int64_t ticks(UpstreamGroup::Clock::time_point t) {
+    return t.time_since_epoch().count();
+}
+
+std::string cookieValue(std::string_view header, const std::string& name) {
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(';', pos);
+        if (end == std::string_view::npos) {
+            end = header.size();
+        }
+        size_t begin = header.find_first_not_of(' ', pos);
+        size_t eq = header.find('=', begin);
+        if (begin < end && eq < end && header.compare(begin, eq - begin, name) == 0) {
+            return std::string(header.substr(eq + 1, end - eq - 1));
+        }
+        pos = end + 1;
+    }
+    return "";
+}
+
+// Waits until fd is ready for events or the deadline passes.
+bool waitFor(int fd, short events, UpstreamGroup::Clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - UpstreamGroup::Clock::now());
+    if (left.count() <= 0) {
+        return false;
+    }
+    struct pollfd p = {fd, events, 0};
+    int n;
+    do {
+        n = poll(&p, 1, static_cast<int>(left.count()));
+    } while (n == -1 && errno == EINTR);
+    return n == 1;
+}
+
+} // namespace
+
+UpstreamGroup::UpstreamGroup(const std::vector<UpstreamConfig>& upstreams, const LoadBalancerConfig& config)
+    : config_(config) {
+    if (upstreams.empty()) {
+        throw std::invalid_argument("Upstream group needs at least one upstream");
+    }
+    for (const UpstreamConfig& upstream : upstreams) {
+        if (upstream.weight == 0) {
+            throw std::invalid_argument("Upstream weight must be positive");
+        }
+        upstreams_.push_back(std::make_unique<Upstream>(upstream, config_.pool));
+    }
+    if (config_.policy == BalancePolicy::ConsistentHash) {
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            const UpstreamConfig& upstream = upstreams_[i]->config;
+            std::string name = upstream.host + ":" + std::to_string(upstream.port) + "#";
+            for (unsigned v = 0; v < upstream.weight * kPointsPerWeight; ++v) {
+                ring_.emplace_back(hashKey(name + std::to_string(v)), i);
+            }
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+    if (!config_.health_path.empty()) {
+        health_thread_ = std::thread([this] { healthLoop(); });
+    }
+}
+
+UpstreamGroup::~UpstreamGroup() {
+    {
+        std::lock_guard<std::mutex> lock(health_mutex_);
+        stop_ = true;
+    }
+    health_cv_.notify_all();
+    if (health_thread_.joinable()) {
+        health_thread_.join();
+    }
+}
+
+std::string UpstreamGroup::affinityKey(const Request& request) const {
+    if (config_.policy != BalancePolicy::ConsistentHash) {
+        return "";
+    }
+    if (!config_.hash_header.empty()) {
+        if (const std::string_view* value = request.headers.get(config_.hash_header)) {
+            return std::string(*value);
+        }
+    }
+    if (!config_.hash_cookie.empty()) {
+        for (const HeaderField& header : request.headers) {
+            if (header.id == HeaderId::Cookie) {
+                std::string value = cookieValue(header.value, config_.hash_cookie);
+                if (!value.empty()) {
+                    return value;
+                }
+            }
+        }
+    }
+    return std::string(request.path);
+}
+
+unsigned UpstreamGroup::maxAttempts() const {
+    return static_cast<unsigned>(std::min<size_t>(std::max(config_.max_attempts, 1u), upstreams_.size()));
+}
+
+size_t UpstreamGroup::pick(const std::string& affinity_key, const std::vector<size_t>& tried) {
+    Clock::time_point now = Clock::now();
+    std::vector<size_t> candidates;
+    // Available and not tried yet; else any not tried yet; else any at all.
+    for (int pass = 0; pass < 3 && candidates.empty(); ++pass) {
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            bool fresh = std::find(tried.begin(), tried.end(), i) == tried.end();
+            if ((pass == 0 && fresh && available(*upstreams_[i], now)) || (pass == 1 && fresh) || pass == 2) {
+                candidates.push_back(i);
+            }
+        }
+    }
+
+    size_t index;
+    switch (config_.policy) {
+    case BalancePolicy::RoundRobin:
+        index = pickRoundRobin(candidates);
+        break;
+    case BalancePolicy::ConsistentHash:
+        index = pickHashed(affinity_key, candidates);
+        break;
+    default:
+        index = pickLeastOutstanding(candidates);
+        break;
+    }
+    Upstream& upstream = *upstreams_[index];
+    ++upstream.outstanding;
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++upstream.requests;
+    return index;
+}
+
+void UpstreamGroup::finish(size_t index, bool ok, Clock::duration latency) {
+    Upstream& upstream = *upstreams_[index];
+    --upstream.outstanding;
+    if (ok && config_.slow_response.count() > 0 && latency > config_.slow_response) {
+        ok = false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ok) {
+        upstream.failures_in_row = 0;
+        return;
+    }
+    ++upstream.failures;
+    ++upstream.failures_in_row;
+    maybeEjectLocked(upstream, Clock::now());
+}
+
+std::vector<UpstreamGroup::Stats> UpstreamGroup::stats() const {
+    Clock::time_point now = Clock::now();
+    std::vector<Stats> stats;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& upstream : upstreams_) {
+        stats.push_back(Stats{upstream->config.host, upstream->config.port, upstream->config.weight,
+                              upstream->requests, upstream->failures, upstream->ejections,
+                              upstream->outstanding.load(), upstream->healthy.load(),
+                              upstream->ejected_until.load() > ticks(now), upstream->pool.stats()});
+    }
+    return stats;
+}
+
+bool UpstreamGroup::available(const Upstream& upstream, Clock::time_point now) const {
+    return upstream.healthy.load(std::memory_order_relaxed) &&
+           upstream.ejected_until.load(std::memory_order_relaxed) <= ticks(now);
+}
+
+size_t UpstreamGroup::pickRoundRobin(const std::vector<size_t>& candidates) {
+    // nginx's smooth weighted round robin: a 5:1:1 split goes a a b a c a a, not a a a a a b c.
+    std::lock_guard<std::mutex> lock(mutex_);
+    int total = 0;
+    Upstream* best = nullptr;
+    size_t best_index = candidates.front();
+    for (size_t i : candidates) {
+        Upstream& upstream = *upstreams_[i];
+        upstream.current_weight += upstream.config.weight;
+        total += upstream.config.weight;
+        if (!best || upstream.current_weight > best->current_weight) {
+            best = &upstream;
+            best_index = i;
+        }
+    }
+    best->current_weight -= total;
+    return best_index;
+}
+
+size_t UpstreamGroup::pickLeastOutstanding(const std::vector<size_t>& candidates) {
+    if (candidates.size() == 1) {
+        return candidates.front();
+    }
+    // Two distinct candidates drawn by weight; the one with fewer requests in flight per
+    // unit of weight wins. Cheaper than scanning all, and it avoids the herding onto one
+    // upstream that always taking the global minimum causes.
+    auto draw = [&](size_t skip) {
+        unsigned total = 0;
+        for (size_t i : candidates) {
+            total += i == skip ? 0 : upstreams_[i]->config.weight;
+        }
+        unsigned r = std::uniform_int_distribution<unsigned>(0, total - 1)(rng());
+        for (size_t i : candidates) {
+            unsigned weight = i == skip ? 0 : upstreams_[i]->config.weight;
+            if (r < weight) {
+                return i;
+            }
+            r -= weight;
+        }
+        return candidates.back();
+    };
+    size_t a = draw(kNone);
+    size_t b = draw(a);
+    const Upstream& ua = *upstreams_[a];
+    const Upstream& ub = *upstreams_[b];
+    int64_t load_a = static_cast<int64_t>(ua.outstanding.load()) * ub.config.weight;
+    int64_t load_b = static_cast<int64_t>(ub.outstanding.load()) * ua.config.weight;
+    return load_b < load_a ? b : a;
+}
+
+size_t UpstreamGroup::pickHashed(const std::string& key, const std::vector<size_t>& candidates) const {
+    // The first ring point at or after the key's hash that belongs to a candidate, so a
+    // key moves only when its upstream drops out.
+    auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(hashKey(key), size_t(0)));
+    for (size_t n = 0; n < ring_.size(); ++n, ++it) {
+        if (it == ring_.end()) {
+            it = ring_.begin();
+        }
+        if (std::find(candidates.begin(), candidates.end(), it->second) != candidates.end()) {
+            return it->second;
+        }
+    }
+    return candidates.front();
+}
+
+void UpstreamGroup::maybeEjectLocked(Upstream& upstream, Clock::time_point now) {
+    if (config_.consecutive_failures == 0 || upstream.failures_in_row < config_.consecutive_failures ||
+        upstream.ejected_until.load() > ticks(now)) {
+        return;
+    }
+    size_t ejected = 0;
+    for (const auto& other : upstreams_) {
+        ejected += other->ejected_until.load() > ticks(now) ? 1 : 0;
+    }
+    if ((ejected + 1) * 100 > config_.max_ejection_percent * upstreams_.size()) {
+        return;
+    }
+    ++upstream.ejections;
+    upstream.failures_in_row = 0;
+    std::chrono::milliseconds duration =
+        std::min<std::chrono::milliseconds>(config_.base_ejection * static_cast<int>(upstream.ejections),
+                                            config_.max_ejection);
+    upstream.ejected_until = ticks(now + duration);
+    LOG_WARN("Ejecting upstream {}:{} for {} ms", upstream.config.host, upstream.config.port, duration.count());
+}
+
+void UpstreamGroup::healthLoop() {
+    while (true) {
+        for (const auto& upstream : upstreams_) {
+            bool ok = checkHealth(*upstream);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (ok == upstream->healthy.load()) {
+                upstream->checks_in_row = 0;
+                continue;
+            }
+            unsigned threshold = ok ? config_.healthy_threshold : config_.unhealthy_threshold;
+            if (++upstream->checks_in_row >= threshold) {
+                upstream->checks_in_row = 0;
+                upstream->healthy = ok;
+                LOG_WARN("Upstream {}:{} is {}", upstream->config.host, upstream->config.port, ok ? "healthy" : "unhealthy");
+            }
+        }
+        std::unique_lock<std::mutex> lock(health_mutex_);
+        if (health_cv_.wait_for(lock, config_.health_interval, [this] { return stop_; })) {
+            return;
+        }
+    }
+}
+
+// One GET of health_path on a fresh connection, bounded by health_timeout as a whole.
+bool UpstreamGroup::checkHealth(const Upstream& upstream) const {
+    Clock::time_point deadline = Clock::now() + config_.health_timeout;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return false;
+    }
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(upstream.config.port);
+    bool ok = inet_pton(AF_INET, upstream.config.host.c_str(), &addr.sin_addr) == 1 &&
+              (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 || errno == EINPROGRESS) &&
+              waitFor(fd, POLLOUT, deadline);
+    int err = 0;
+    socklen_t len = sizeof(err);
+    ok = ok && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+
+    std::string request = "GET " + config_.health_path + " HTTP/1.1\r\nHost: " + upstream.config.host + ":" +
+                          std::to_string(upstream.config.port) + "\r\nConnection: close\r\n\r\n";
+    ok = ok && send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size());
+
+    // "HTTP/1.1 200" is all we need.
+    std::string status;
+    char buffer[256];
+    while (ok && status.size() < 12) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            status.append(buffer, n);
+        } else if (n == 0 || !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ||
+                   !waitFor(fd, POLLIN, deadline)) {
+            ok = false;
+        }
+    }
+    close(fd);
+    return ok && status.compare(0, 5, "HTTP/") == 0 && (status[9] == '2' || status[9] == '3');
+}
@@ -0,0 +1,119 @@
+#include "proxy/upstream_pool.hpp"
+#include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+UpstreamPool::UpstreamPool(const std::string& host, int port, const UpstreamPoolConfig& config)
+    : host_(host), port_(port), config_(config) {}
+
+UpstreamPool::~UpstreamPool() {
+    for (const Idle& idle : idle_) {
+        close(idle.fd);
+    }
+}
+
+int UpstreamPool::acquire(bool& reused, bool nonblocking) {
+    std::deque<int> dead;
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pruneLocked(Clock::now());
+        while (!idle_.empty()) {
+            int candidate = idle_.back().fd;
+            idle_.pop_back();
+            if (stillIdle(candidate)) {
+                fd = candidate;
+                ++stats_.reuses;
+                break;
+            }
+            dead.push_back(candidate);
+            ++stats_.dropped;
+        }
+    }
+    for (int d : dead) {
+        close(d);
+    }
+    reused = fd != -1;
+    if (!reused) {
+        return connectBackend(nonblocking);
+    }
+    // Connections are shared by the blocking and the streaming proxy paths.
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    return fd;
+}
+
+void UpstreamPool::release(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Clock::time_point now = Clock::now();
+        pruneLocked(now);
+        if (idle_.size() < config_.max_idle) {
+            idle_.push_back(Idle{fd, now});
+            return;
+        }
+        ++stats_.dropped;
+    }
+    close(fd);
+}
+
+UpstreamPool::Stats UpstreamPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.idle = idle_.size();
+    return stats;
+}
+
+int UpstreamPool::connectBackend(bool nonblocking) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (sock == -1) {
+        throw std::runtime_error("Failed to create socket for proxy");
+    }
+
+    struct timeval tv;
+    tv.tv_sec = config_.io_timeout.count() / 1000;
+    tv.tv_usec = (config_.io_timeout.count() % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in backend_addr {};
+    backend_addr.sin_family = AF_INET;
+    backend_addr.sin_port = htons(port_);
+    if (inet_pton(AF_INET, host_.c_str(), &backend_addr.sin_addr) != 1) {
+        close(sock);
+        throw std::runtime_error("Invalid backend address " + host_);
+    }
+
+    if (connect(sock, (struct sockaddr*)&backend_addr, sizeof(backend_addr)) == -1 &&
+        !(nonblocking && errno == EINPROGRESS)) {
+        close(sock);
+        throw std::runtime_error("Failed to connect to backend");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.connects;
+    return sock;
+}
+
+// An idle HTTP/1.1 connection has nothing to read. EOF means the backend closed it, and
+// unsolicited bytes mean it cannot be trusted to frame the next response.
+bool UpstreamPool::stillIdle(int fd) {
+    char byte;
+    ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void UpstreamPool::pruneLocked(Clock::time_point now) {
+    while (!idle_.empty() && now - idle_.front().since >= config_.idle_timeout) {
+        close(idle_.front().fd);
+        idle_.pop_front();
+        ++stats_.dropped;
+    }
+}
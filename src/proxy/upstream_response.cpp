@@ -0,0 +1,160 @@
+#include "proxy/upstream_response.hpp"
+#include "http/request_parser.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Longer chunk-size or trailer lines are rejected rather than buffered without bound.
+const size_t kMaxChunkLine = 4096;
+
+bool hasToken(std::string_view value, const char* token) {
+    while (true) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        size_t b = item.find_first_not_of(" \t");
+        if (b != std::string_view::npos && equalsIgnoreCase(item.substr(b, item.find_last_not_of(" \t") - b + 1), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            return false;
+        }
+        value.remove_prefix(comma + 1);
+    }
+}
+
+} // namespace
+
+bool isHopByHopHeader(std::string_view name) {
+    static const char* const names[] = {
+        "connection", "keep-alive", "proxy-connection", "te", "trailer", "transfer-encoding", "upgrade",
+    };
+    for (const char* n : names) {
+        if (equalsIgnoreCase(name, n)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void parseUpstreamHead(std::string_view head, Response& response, UpstreamFraming& framing) {
+    size_t line_end = head.find("\r\n");
+    if (head.compare(0, 5, "HTTP/") != 0 || line_end == std::string_view::npos || line_end < 12 || head[8] != ' ') {
+        throw std::runtime_error("Malformed response from backend");
+    }
+    bool http10 = head.compare(0, 8, "HTTP/1.0") == 0;
+    response.version = "HTTP/1.1";
+    response.status_code = 0;
+    for (size_t i = 9; i < 12; ++i) {
+        if (head[i] < '0' || head[i] > '9') {
+            throw std::runtime_error("Malformed response from backend");
+        }
+        response.status_code = response.status_code * 10 + (head[i] - '0');
+    }
+    response.status_message = line_end > 13 ? std::string(head.substr(13, line_end - 13)) : "";
+    response.headers.clear();
+
+    framing = UpstreamFraming();
+    framing.keep_alive = !http10;
+    size_t pos = line_end + 2;
+    while (pos < head.size()) {
+        size_t eol = head.find("\r\n", pos);
+        size_t colon = head.find(':', pos);
+        if (eol == std::string_view::npos || colon == std::string_view::npos || colon > eol) {
+            throw std::runtime_error("Malformed response from backend");
+        }
+        std::string_view name = head.substr(pos, colon - pos);
+        std::string_view value = head.substr(colon + 1, eol - colon - 1);
+        size_t b = value.find_first_not_of(" \t");
+        value = b == std::string_view::npos ? std::string_view() : value.substr(b, value.find_last_not_of(" \t") - b + 1);
+        pos = eol + 2;
+
+        if (equalsIgnoreCase(name, "Connection")) {
+            if (hasToken(value, "close")) {
+                framing.keep_alive = false;
+            } else if (hasToken(value, "keep-alive")) {
+                framing.keep_alive = true;
+            }
+            continue;
+        }
+        if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            if (!hasToken(value, "chunked")) {
+                throw std::runtime_error("Unsupported transfer coding from backend: " + std::string(value));
+            }
+            framing.chunked = true;
+            continue;
+        }
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            std::string digits(value);
+            char* end;
+            long long length = std::strtoll(digits.c_str(), &end, 10);
+            if (digits.empty() || *end != '\0' || length < 0 ||
+                (framing.content_length >= 0 && framing.content_length != length)) {
+                throw std::runtime_error("Invalid Content-Length from backend");
+            }
+            framing.content_length = length;
+            continue;
+        }
+        if (isHopByHopHeader(name)) {
+            continue;
+        }
+        response.headers.add(name, value);
+    }
+    if (framing.chunked) {
+        framing.content_length = -1;
+    }
+}
+
+size_t ChunkedDecoder::decode(const char* data, size_t len, std::string& out) {
+    size_t i = 0;
+    while (i < len && state_ != State::Done) {
+        if (state_ == State::Data) {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, len - i));
+            out.append(data + i, take);
+            i += take;
+            remaining_ -= take;
+            if (remaining_ == 0) {
+                state_ = State::DataEnd;
+            }
+            continue;
+        }
+
+        const char* nl = static_cast<const char*>(memchr(data + i, '\n', len - i));
+        size_t take = nl ? nl - (data + i) + 1 : len - i;
+        line_.append(data + i, take);
+        i += take;
+        if (line_.size() > kMaxChunkLine) {
+            throw std::runtime_error("Malformed chunked response from backend");
+        }
+        if (!nl) {
+            break;
+        }
+        if (line_.size() < 2 || line_[line_.size() - 2] != '\r') {
+            throw std::runtime_error("Malformed chunked response from backend");
+        }
+        line_.resize(line_.size() - 2);
+
+        if (state_ == State::DataEnd) {
+            if (!line_.empty()) {
+                throw std::runtime_error("Malformed chunked response from backend");
+            }
+            state_ = State::Size;
+        } else if (state_ == State::Size) {
+            char* end;
+            unsigned long long size = std::strtoull(line_.c_str(), &end, 16);
+            if (line_.empty() || !isxdigit(static_cast<unsigned char>(line_[0])) ||
+                (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t') || size > (1ULL << 40)) {
+                throw std::runtime_error("Malformed chunked response from backend");
+            }
+            remaining_ = size;
+            state_ = size == 0 ? State::Trailer : State::Data;
+        } else if (line_.empty()) {
+            state_ = State::Done; // the blank line after the trailer fields
+        }
+        line_.clear();
+    }
+    return i;
+}